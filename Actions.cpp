@@ -1,38 +1,56 @@
 #include "Actions.hpp"
 
+// Integer math only, so every build computes the same damage; matches
+// std::round(damage * (100 - defense) / 100.), rounding halves away from zero
 int calc_damage(int damage, Object* target) {
-	return (int)std::round(damage * (100 - target->property("DEFENSE")) / 100.);
+	int scaled = damage * (100 - target->property(PROPERTY_DEFENSE));
+	return scaled >= 0 ? (scaled + 50) / 100 : -((-scaled + 50) / 100);
 }
 
-void attack(int damage, Object* target) {
-	target->property("HEALTH") -= calc_damage(damage, target);
-	if (target->property("HEALTH") <= 0) {
-		target->property("ALIVE") = 0;
-		add_animation(new DeathAnimation(target));
+// Damage the target, reporting the hit and any resulting death
+void attack(Compiler* compiler, Object* user, Object* target, int damage, DamageKind kind, float duration) {
+	int dealt = calc_damage(damage, target);
+	target->property(PROPERTY_HEALTH) -= dealt;
+	bool lethal = target->property(PROPERTY_HEALTH) <= 0;
+	compiler->emit({EVENT_DAMAGE, kind, lethal, user, target, dealt, duration});
+	if (lethal) {
+		target->property(PROPERTY_ALIVE) = 0;
+		compiler->emit({EVENT_DEATH, kind, true, user, target, 0, duration});
 	}
 }
 
-bool check_burn(Object* user, float duration) {
-	if (user->property("BURNED") == 1) {
-		user->property("HEALTH") -= 10;
-		user->updateHealth();
-		if (user->property("HEALTH") <= 0) {
-			user->property("ALIVE") = 0;
-			add_animation(new DeathAnimation(user));
+// Set the target's health outright, reporting the change as damage of the given kind
+void set_health(Compiler* compiler, Object* user, Object* target, int health, DamageKind kind, float duration) {
+	int dealt = target->property(PROPERTY_HEALTH) - health;
+	target->property(PROPERTY_HEALTH) = health;
+	bool lethal = health <= 0;
+	compiler->emit({EVENT_DAMAGE, kind, lethal, user, target, dealt, duration});
+	if (lethal) {
+		target->property(PROPERTY_ALIVE) = 0;
+		compiler->emit({EVENT_DEATH, kind, true, user, target, 0, duration});
+	}
+}
+
+bool check_burn(Compiler* compiler, Object* user, float duration) {
+	if (user->property(PROPERTY_BURNED) == 1) {
+		user->property(PROPERTY_HEALTH) -= 10;
+		bool lethal = user->property(PROPERTY_HEALTH) <= 0;
+		compiler->emit({EVENT_DAMAGE, DAMAGE_BURN, lethal, nullptr, user, 10, duration});
+		if (lethal) {
+			user->property(PROPERTY_ALIVE) = 0;
+			compiler->emit({EVENT_DEATH, DAMAGE_BURN, true, nullptr, user, 0, duration});
 			return true;
-		} else {
-			add_animation(new EnergyAnimation(EnergyType::BURN, user, duration));
 		}
 	}
 	return false;
 }
 
-bool check_freeze(Object* user, float duration) {
-	if (user->property("FROZEN") == 1) {
-		user->property("FREEZE_COUNTDOWN")--;
-		if (user->property("FREEZE_COUNTDOWN") == 0 && user->property("ALIVE") != 0) {
-			user->property("FREEZE_COUNTDOWN") = 3;
-			add_animation(new EnergyAnimation(EnergyType::FREEZE, user, duration));
+bool check_freeze(Compiler* compiler, Object* user, float duration) {
+	if (user->property(PROPERTY_FROZEN) == 1) {
+		user->property(PROPERTY_FREEZE_COUNTDOWN)--;
+		if (user->property(PROPERTY_FREEZE_COUNTDOWN) == 0 && user->property(PROPERTY_ALIVE) != 0) {
+			user->property(PROPERTY_FREEZE_COUNTDOWN) = 3;
+			compiler->emit({EVENT_STATUS, STATUS_FROZEN_SKIP, false, nullptr, user, 0, duration});
 			return true;
 		}
 	}
@@ -40,48 +58,45 @@ bool check_freeze(Object* user, float duration) {
 }
 
 void attack_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0 || target->property("ALIVE") == 0 || user == target) {
+	if (user->property(PROPERTY_ALIVE) == 0 || target->property(PROPERTY_ALIVE) == 0 || user == target) {
 		*result = false;
 		return;
 	}
-	int damage = user->property("POWER");
-	add_animation(new MoveAnimation(user, target, duration));
-	attack(damage, target);
+	attack(compiler, user, target, user->property(PROPERTY_POWER), DAMAGE_MELEE, duration);
 	*result = true;
 }
 
 void gunner_attack_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0 || target->property("ALIVE") == 0 || user == target) {
+	if (user->property(PROPERTY_ALIVE) == 0 || target->property(PROPERTY_ALIVE) == 0 || user == target) {
 		*result = false;
 		return;
 	}
-	int damage = user->property("POWER");
-	add_animation(new BoltAnimation(user, target, duration));
-	attack(damage, target);
+	compiler->emit({EVENT_PROJECTILE, PROJECTILE_BOLT, false, user, target, 0, duration});
+	attack(compiler, user, target, user->property(PROPERTY_POWER), DAMAGE_PROJECTILE, duration);
 	*result = true;
 }
 
 void freeze_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0 || target->property("ALIVE") == 0 || user == target) {
+	if (user->property(PROPERTY_ALIVE) == 0 || target->property(PROPERTY_ALIVE) == 0 || user == target) {
 		*result = false;
 		return;
 	}
-	if (target->property("FROZEN") == 0) {
-		add_animation(new EnergyAnimation(EnergyType::FREEZE, target, duration));
-		target->property("FROZEN") = 1;
-		target->property("FREEZE_COUNTDOWN") = 3;
+	if (target->property(PROPERTY_FROZEN) == 0) {
+		compiler->emit({EVENT_STATUS, STATUS_FREEZE, false, user, target, 0, duration});
+		target->property(PROPERTY_FROZEN) = 1;
+		target->property(PROPERTY_FREEZE_COUNTDOWN) = 3;
 		*result = true;
 	} else {
 		*result = false;
@@ -89,11 +104,11 @@ void freeze_function(Compiler* compiler, Object* user, Object* target, bool* res
 }
 
 void burn_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0 || target->property("ALIVE") == 0 || user == target) {
+	if (user->property(PROPERTY_ALIVE) == 0 || target->property(PROPERTY_ALIVE) == 0 || user == target) {
 		*result = false;
 		return;
 	}
@@ -101,9 +116,9 @@ void burn_function(Compiler* compiler, Object* user, Object* target, bool* resul
 		*result = false;
 		return;
 	}
-	if (target->property("BURNED") == 0) {
-		add_animation(new EnergyAnimation(EnergyType::BURN, target, duration));
-		target->property("BURNED") = 1;
+	if (target->property(PROPERTY_BURNED) == 0) {
+		compiler->emit({EVENT_STATUS, STATUS_BURN, false, user, target, 0, duration});
+		target->property(PROPERTY_BURNED) = 1;
 		*result = true;
 	} else {
 		*result = false;
@@ -111,49 +126,52 @@ void burn_function(Compiler* compiler, Object* user, Object* target, bool* resul
 }
 
 void heal_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0 || target->property("ALIVE") == 0) {
+	if (user->property(PROPERTY_ALIVE) == 0 || target->property(PROPERTY_ALIVE) == 0) {
 		*result = false;
 		return;
 	}
-	add_animation(new EnergyAnimation(EnergyType::HEAL, target, duration));
-	if (target->property("HEALTH_MAX") - target->property("HEALTH") < 20) {
-		target->property("HEALTH") = target->property("HEALTH_MAX");
+	int healed = std::min(20, target->property(PROPERTY_HEALTH_MAX) - target->property(PROPERTY_HEALTH));
+	if (target->property(PROPERTY_HEALTH_MAX) - target->property(PROPERTY_HEALTH) < 20) {
+		target->property(PROPERTY_HEALTH) = target->property(PROPERTY_HEALTH_MAX);
 	} else {
-		target->property("HEALTH") += 20;
+		target->property(PROPERTY_HEALTH) += 20;
 	}
+	compiler->emit({EVENT_HEAL, 0, false, user, target, healed, duration});
 	*result = true;
 }
 
 void full_heal_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0 || target->property("ALIVE") == 0) {
+	if (user->property(PROPERTY_ALIVE) == 0 || target->property(PROPERTY_ALIVE) == 0) {
 		*result = false;
 		return;
 	}
-	add_animation(new EnergyAnimation(EnergyType::HEAL, target, duration));
-	target->property("HEALTH") = target->property("HEALTH_MAX");
+	int healed = target->property(PROPERTY_HEALTH_MAX) - target->property(PROPERTY_HEALTH);
+	target->property(PROPERTY_HEALTH) = target->property(PROPERTY_HEALTH_MAX);
+	compiler->emit({EVENT_HEAL, 0, false, user, target, healed, duration});
 	*result = true;
 }
 
 void burn_heal_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0 || target->property("ALIVE") == 0) {
+	if (user->property(PROPERTY_ALIVE) == 0 || target->property(PROPERTY_ALIVE) == 0) {
 		*result = false;
 		return;
 	}
-	add_animation(new EnergyAnimation(EnergyType::HEAL, target, duration));
-	if (target->property("BURNED")) {
-		target->property("BURNED") = 0;
+	compiler->emit({EVENT_HEAL, 0, false, user, target, 0, duration});
+	if (target->property(PROPERTY_BURNED)) {
+		target->property(PROPERTY_BURNED) = 0;
+		compiler->emit({EVENT_STATUS, STATUS_CURE_BURN, false, user, target, 0, duration});
 		*result = true;
 	} else {
 		*result = false;
@@ -161,19 +179,19 @@ void burn_heal_function(Compiler* compiler, Object* user, Object* target, bool*
 }
 
 void shoot_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0 || target->property("ALIVE") == 0 || user == target) {
+	if (user->property(PROPERTY_ALIVE) == 0 || target->property(PROPERTY_ALIVE) == 0 || user == target) {
 		*result = false;
 		return;
 	}
 	
-	if (user->property("ARROWS") > 0) {
-		add_animation(new ShootAnimation(target, duration));
-		attack(user->property("POWER"), target);
-		user->property("ARROWS")--;
+	if (user->property(PROPERTY_ARROWS) > 0) {
+		compiler->emit({EVENT_PROJECTILE, PROJECTILE_ARROW, false, user, target, 0, duration});
+		attack(compiler, user, target, user->property(PROPERTY_POWER), DAMAGE_PROJECTILE, duration);
+		user->property(PROPERTY_ARROWS)--;
 		*result = true;
 	} else {
 		*result = false;
@@ -181,87 +199,99 @@ void shoot_function(Compiler* compiler, Object* user, Object* target, bool* resu
 }
 
 void shockwave_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0) {
+	if (user->property(PROPERTY_ALIVE) == 0) {
 		*result = false;
 		return;
 	}
-	add_animation(new WaveAnimation(user, compiler, duration));
+	compiler->emit({EVENT_WAVE, 0, false, user, nullptr, 0, duration});
 	if (user->team == Team::TEAM_PLAYER) {
 		for (size_t i = 0; i < compiler->enemies.size(); i++) {
-			compiler->enemies[i]->property("HEALTH") = 10;
+			set_health(compiler, user, compiler->enemies[i], 10, DAMAGE_WAVE, duration);
 		}
 	} else if (user->team == Team::TEAM_ENEMY) {
 		for (size_t i = 0; i < compiler->players.size(); i++) {
-			compiler->players[i]->property("HEALTH") = 10;
+			set_health(compiler, user, compiler->players[i], 10, DAMAGE_WAVE, duration);
 		}
 	}
 	*result = true;
 }
 
 void kill_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0 || target->property("ALIVE") == 0 || user == target) {
+	if (user->property(PROPERTY_ALIVE) == 0 || target->property(PROPERTY_ALIVE) == 0 || user == target) {
 		*result = false;
 		return;
 	}
-	target->property("HEALTH") = 0;
-	target->property("ALIVE") = 0;
-	add_animation(new MoveAnimation(user, target, duration));
-	add_animation(new DeathAnimation(target));
+	set_health(compiler, user, target, 0, DAMAGE_MELEE, duration);
 	*result = true;
 }
 
 void annihilate_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0) {
+	if (user->property(PROPERTY_ALIVE) == 0) {
 		*result = false;
 		return;
 	}
-	add_animation(new WaveAnimation(user, compiler, duration));
+	compiler->emit({EVENT_WAVE, 0, false, user, nullptr, 0, duration});
 	if (user->team == Team::TEAM_PLAYER) {
 		for (size_t i = 0; i < compiler->enemies.size(); i++) {
-			compiler->enemies[i]->property("HEALTH") = 0;
-			compiler->enemies[i]->property("ALIVE") = 0;
-			add_animation(new DeathAnimation(compiler->enemies[i]));
+			set_health(compiler, user, compiler->enemies[i], 0, DAMAGE_WAVE, duration);
 		}
 	} else if (user->team == Team::TEAM_ENEMY) {
 		for (size_t i = 0; i < compiler->players.size(); i++) {
-			compiler->players[i]->property("HEALTH") = 0;
-			compiler->players[i]->property("ALIVE") = 0;
-			add_animation(new DeathAnimation(compiler->players[i]));
+			set_health(compiler, user, compiler->players[i], 0, DAMAGE_WAVE, duration);
 		}
 	}
 	*result = true;
 }
 
 void destroy_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration) {
-	if (check_burn(user, duration) || check_freeze(user, duration)) {
+	if (check_burn(compiler, user, duration) || check_freeze(compiler, user, duration)) {
 		*result = false;
 		return;
 	}
-	if (user->property("ALIVE") == 0) {
+	if (user->property(PROPERTY_ALIVE) == 0) {
 		*result = false;
 		return;
 	}
-	add_animation(new WaveAnimation(user, compiler, duration));
+	compiler->emit({EVENT_WAVE, 0, false, user, nullptr, 0, duration});
 	if (user->team == Team::TEAM_PLAYER) {
 		for (size_t i = 0; i < compiler->enemies.size(); i++) {
-			attack(50, compiler->enemies[i]);
+			attack(compiler, user, compiler->enemies[i], 50, DAMAGE_WAVE, duration);
 		}
 	} else if (user->team == Team::TEAM_ENEMY) {
 		for (size_t i = 0; i < compiler->players.size(); i++) {
-			attack(50, compiler->players[i]);
+			attack(compiler, user, compiler->players[i], 50, DAMAGE_WAVE, duration);
 		}
 	}
 	*result = true;
-}
\ No newline at end of file
+}
+
+ActionFunction action_function_named(std::string const& name) {
+	static std::unordered_map<std::string, ActionFunction> const functions = {
+		{"attack", attack_function},
+		{"gunner_attack", gunner_attack_function},
+		{"freeze", freeze_function},
+		{"burn", burn_function},
+		{"heal", heal_function},
+		{"full_heal", full_heal_function},
+		{"burn_heal", burn_heal_function},
+		{"shoot", shoot_function},
+		{"shockwave", shockwave_function},
+		{"kill", kill_function},
+		{"destroy", destroy_function},
+		{"annihilate", annihilate_function}
+	};
+	auto found = functions.find(name);
+	return found != functions.end() ? found->second : nullptr;
+}
@@ -1,7 +1,9 @@
 #pragma once
 
-#include "Animation.hpp"
 #include "Compiler.hpp"
+#include "CombatEvent.hpp"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <random>
 #include <string>
@@ -22,4 +24,7 @@ void kill_function(Compiler* compiler, Object* user, Object* target, bool* resul
 void destroy_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration);
 void annihilate_function(Compiler* compiler, Object* user, Object* target, bool* result, float duration);
 
+// The action function level packs refer to by name (e.g. "attack" for attack_function); nullptr if there is none
+ActionFunction action_function_named(std::string const& name);
+
 #endif
\ No newline at end of file
@@ -14,7 +14,17 @@ std::vector<Animation*> active_animations;
 
 size_t animation_id = 0;
 
-float turn_length = 2.0f;
+// Final rotation of the death animation for each character model
+std::unordered_map<std::string, glm::quat> death_rotations = {
+	{"caster", glm::quat(0.0f, sqrt(0.5f), 0.0f, -sqrt(0.5f))},
+	{"warrior", glm::quat(0.5f, -0.5f, -0.5f, 0.5f)},
+	{"healer", glm::quat(0.5f, -0.5f, -0.5f, 0.5f)},
+	{"ranger", glm::quat(0.5f, -0.5f, -0.5f, 0.5f)},
+	{"monster", glm::quat(0.5f, 0.5f, 0.5f, 0.5f)},
+	{"gunner", glm::quat(0.0f, -sqrt(0.5f), 0.0f, -sqrt(0.5f))},
+	{"speedster", glm::quat(0.0f, -sqrt(0.5f), 0.0f, -sqrt(0.5f))},
+	{"tank", glm::quat(0.5f, -0.5f, 0.5f, -0.5f)}
+};
 
 Sound::Sample *attack_sample;
 Sound::Sample *freeze_sample;
@@ -34,10 +44,6 @@ void init_sounds() {
 	bolt_sample = new Sound::Sample(data_path("Sounds/Bolt.wav"));
 }
 
-float turn_duration() {
-	return turn_length;
-}
-
 glm::vec3 offscreen_position() {
 	return glm::vec3(0.0f, 0.0f, 100.0f);
 }
@@ -46,6 +52,54 @@ void add_animation(Animation* animation) {
 	active_animations.push_back(animation);
 }
 
+// Drain the combat event stream, starting the animations and sounds that show each event
+void present_combat_events(CombatEventBuffer* events) {
+	WaveAnimation* wave = nullptr;
+	CombatEvent event;
+	while (events->pop(&event)) {
+		switch (event.type) {
+		case EVENT_DAMAGE:
+			if (event.kind == DAMAGE_MELEE) {
+				add_animation(new MoveAnimation(event.source, event.target, event.duration));
+			} else if (event.kind == DAMAGE_BURN) {
+				event.target->updateHealth();
+				if (!event.lethal) {
+					add_animation(new EnergyAnimation(EnergyType::BURN, event.target, event.duration));
+				}
+			} else if (event.kind == DAMAGE_WAVE && wave != nullptr) {
+				wave->hit_targets.push_back(event.target);
+			}
+			break;
+		case EVENT_HEAL:
+			add_animation(new EnergyAnimation(EnergyType::HEAL, event.target, event.duration));
+			break;
+		case EVENT_STATUS:
+			if (event.kind == STATUS_FREEZE || event.kind == STATUS_FROZEN_SKIP) {
+				add_animation(new EnergyAnimation(EnergyType::FREEZE, event.target, event.duration));
+			} else if (event.kind == STATUS_BURN) {
+				add_animation(new EnergyAnimation(EnergyType::BURN, event.target, event.duration));
+			}
+			break;
+		case EVENT_DEATH:
+			add_animation(new DeathAnimation(event.target));
+			break;
+		case EVENT_PROJECTILE:
+			if (event.kind == PROJECTILE_ARROW) {
+				add_animation(new ShootAnimation(event.source, event.target, event.duration));
+			} else {
+				add_animation(new BoltAnimation(event.source, event.target, event.duration));
+			}
+			break;
+		case EVENT_WAVE:
+			wave = new WaveAnimation(event.source, event.duration);
+			add_animation(wave);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
 void update_animations(float time) {
 	auto iter = active_animations.begin();
 	while (iter != active_animations.end()) {
@@ -112,10 +166,76 @@ void update_animations(float time) {
 	}
 }
 
+// Apply the end state of each event without animating it, for turns that pass in less than a frame
+void skip_combat_events(CombatEventBuffer* events) {
+	CombatEvent event;
+	while (events->pop(&event)) {
+		if (event.type == EVENT_DEATH) {
+			event.target->transform->position = offscreen_position();
+			auto rotation = death_rotations.find(event.target->model_name);
+			if (rotation != death_rotations.end()) {
+				event.target->transform->rotation = rotation->second;
+			}
+			if (event.target == ranger_object) {
+				arrow_transform->position = offscreen_position();
+			}
+		} else if (event.target != nullptr) {
+			event.target->updateHealth();
+		}
+	}
+}
+
+// Jump every active animation to its final state, skipping any sounds it has not played yet
+void finish_animations() {
+	for (Animation* animation : active_animations) {
+		MoveAnimation* move;
+		DeathAnimation* death;
+		EnergyAnimation* energy;
+		WaveAnimation* wave;
+		switch (animation->type) {
+		case MOVE:
+		case SHOOT:
+			move = (MoveAnimation*)animation;
+			move->transform->position = move->start_position;
+			move->health_target->updateHealth();
+			break;
+		case BOLT:
+			move = (MoveAnimation*)animation;
+			move->transform->position = offscreen_position();
+			move->health_target->updateHealth();
+			break;
+		case DEATH:
+			death = (DeathAnimation*)animation;
+			death->transform->position = offscreen_position();
+			death->transform->rotation = death->target->start_rotation + death->delta;
+			break;
+		case ENERGY:
+			energy = (EnergyAnimation*)animation;
+			energy->transform->position = offscreen_position();
+			energy->energy_target->updateHealth();
+			break;
+		case WAVE:
+			wave = (WaveAnimation*)animation;
+			wave->transform->position = offscreen_position();
+			for (Object* hit : wave->hit_targets) {
+				hit->updateHealth();
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	active_animations.clear();
+}
+
 void clear_animations() {
 	active_animations.clear();
 }
 
+bool animations_active() {
+	return !active_animations.empty();
+}
+
 void register_heal_transform(Scene::Transform *t) {
 	heal_transform = t;
 }
@@ -159,7 +279,7 @@ bool Animation::update(float update_time) {
 }
 
 Animation::Animation(float duration) {
-	this->duration = std::min(duration, turn_length);
+	this->duration = std::min(duration, turn_duration());
 }
 
 MoveAnimation::MoveAnimation(Object* source, Object* target, float duration) : Animation(duration) {
@@ -173,7 +293,7 @@ MoveAnimation::MoveAnimation(Object* source, Object* target, float duration) : A
 	health_target = target;
 }
 
-ShootAnimation::ShootAnimation(Object* target, float duration) : MoveAnimation(ranger_object, target, duration) {
+ShootAnimation::ShootAnimation(Object* source, Object* target, float duration) : MoveAnimation(source, target, duration) {
 	start_position += arrow_offset;
 	transform = arrow_transform;
 	// TODO: Some trig magic to rotate the arrow to face the enemy.
@@ -199,21 +319,12 @@ DeathAnimation::DeathAnimation(Object* victim) : Animation(turn_duration()) {
 	target = victim;
 	glm::quat start_quat = target->start_rotation;
 	glm::quat end_quat = start_quat;
-	if (transform->name.find("caster") != std::string::npos) {
-		end_quat = glm::quat(0.0f, sqrt(0.5f), 0.0f, -sqrt(0.5f));
-	} else if (transform->name.find("warrior") != std::string::npos || transform->name.find("healer") != std::string::npos || transform->name.find("ranger") != std::string::npos) {
-		if (transform->name.find("ranger") != std::string::npos) {
-			arrow_transform->position = offscreen_position();
-		}
-		end_quat = glm::quat(0.5f, -0.5f, -0.5f, 0.5f);
-	} else if (transform->name.find("monster") != std::string::npos) {
-		end_quat = glm::quat(0.5f, 0.5f, 0.5f, 0.5f);
-	} else if (transform->name.find("gunner") != std::string::npos) {
-		end_quat = glm::quat(0.0f, -sqrt(0.5f), 0.0f, -sqrt(0.5f));
-	} else if (transform->name.find("speedster") != std::string::npos) {
-		end_quat = glm::quat(0.0f, -sqrt(0.5f), 0.0f, -sqrt(0.5f));
-	} else if (transform->name.find("tank") != std::string::npos) {
-		end_quat = glm::quat(0.5f, -0.5f, 0.5f, -0.5f);
+	auto rotation = death_rotations.find(target->model_name);
+	if (rotation != death_rotations.end()) {
+		end_quat = rotation->second;
+	}
+	if (target == ranger_object) {
+		arrow_transform->position = offscreen_position();
 	}
 	delta = end_quat - start_quat;
 }
@@ -244,12 +355,11 @@ EnergyAnimation::EnergyAnimation(EnergyType nrg, Object* target, float duration)
 	elapsed_time = 0.0f;
 }
 
-WaveAnimation::WaveAnimation(Object* target, Compiler *input_compiler, float duration) : Animation(duration) {
+WaveAnimation::WaveAnimation(Object* target, float duration) : Animation(duration) {
 	start_position = target->getStartPosition();
 	wave_target = target;
 	type = AnimationType::WAVE;
 	id = animation_id++;
-	compiler = input_compiler;
 	sound_playing = true;
 	wave_hit = false;
 	play(*wave_sample);
@@ -365,14 +475,8 @@ bool WaveAnimation::update(float update_time) {
 		transform->scale = glm::vec3(25.0f, 25.0f, 10.0f) * (elapsed_time / duration);
 		if (elapsed_time >= duration / 2.0f && !wave_hit) {
 			wave_hit = true;
-			if (wave_target->team == Team::TEAM_PLAYER) {
-				for (size_t i = 0; i < compiler->enemies.size(); i++) {
-					compiler->enemies[i]->updateHealth();
-				}
-			} else if (wave_target->team == Team::TEAM_ENEMY) {
-				for (size_t i = 0; i < compiler->players.size(); i++) {
-					compiler->players[i]->updateHealth();
-				}
+			for (Object* hit : hit_targets) {
+				hit->updateHealth();
 			}
 		}
 		return true;
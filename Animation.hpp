@@ -2,6 +2,8 @@
 
 #include "Object.hpp"
 #include "Compiler.hpp"
+#include "CombatEvent.hpp"
+#include "Battle.hpp"
 #include "Scene.hpp"
 #include <iostream>
 #include <random>
@@ -73,15 +75,15 @@ struct EnergyAnimation : Animation {
 };
 
 struct ShootAnimation : MoveAnimation {
-	ShootAnimation(Object* target, float duration);
+	ShootAnimation(Object* source, Object* target, float duration);
 	bool update(float update_time);
 };
 
 struct WaveAnimation : Animation {
-	WaveAnimation(Object* target, Compiler* input_compiler, float duration);
+	WaveAnimation(Object* target, float duration);
 	Object* wave_target;
 	bool wave_hit;
-	Compiler* compiler;
+	std::vector<Object*> hit_targets;
 	bool update(float update_time);
 };
 
@@ -94,9 +96,16 @@ void update_animations(float time);
 
 void add_animation(Animation* animation);
 
+void present_combat_events(CombatEventBuffer* events);
+
+void skip_combat_events(CombatEventBuffer* events);
+
+void finish_animations();
+
 void clear_animations();
 
-float turn_duration();
+// Whether any animation is still playing
+bool animations_active();
 
 glm::vec3 offscreen_position();
 
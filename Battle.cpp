@@ -0,0 +1,605 @@
+#include "Battle.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+static float default_turn_length = 2.0f;
+
+float turn_duration() {
+    return default_turn_length;
+}
+
+void Battle::start(Compiler::Executable* player_exe_, Compiler::Executable* enemy_exe_) {
+    player_exe = player_exe_;
+    enemy_exe = enemy_exe_;
+    // Controlled sides choose their first action when they first move
+    player_statement = player_controller == nullptr ? player_exe->next() : nullptr;
+    enemy_statement = enemy_controller == nullptr ? enemy_exe->next() : nullptr;
+    turn = PLAYER;
+    player_done = false;
+    enemy_done = false;
+    won = false;
+    lost = false;
+    player_time = turn_length;
+    enemy_time = turn_length;
+    player_line = -1;
+    enemy_line = -1;
+    result = NONE;
+    ending = UNDECIDED;
+    waiting = false;
+    game_time = 0.f;
+    forgetStates();
+}
+
+// End the battle without a winner
+void Battle::stop() {
+    player_done = true;
+    enemy_done = true;
+    won = false;
+    lost = false;
+    ending = UNDECIDED;
+    waiting = false;
+    turn = PLAYER;
+    player_line = -1;
+    enemy_line = -1;
+    result = NONE;
+}
+
+// How long the next turn should be shown for.
+// A controller has to choose its action first, since the pace depends on it; while it is still thinking,
+// waiting is set and the pace means nothing.
+float Battle::pace() {
+    prepareTurn();
+    if (waiting) {
+        return 0.f;
+    }
+    if (turn == PLAYER && player_statement != nullptr) {
+        if (player_time >= player_statement->duration) {
+            return std::min(player_statement->base_duration, turn_length);
+        }
+        return 0.5f;
+    } else if (turn == ENEMY && enemy_statement != nullptr) {
+        if (enemy_time >= enemy_statement->duration) {
+            return std::min(enemy_statement->base_duration, turn_length);
+        }
+        return 0.5f;
+    }
+    return default_turn_length;
+}
+
+// If the side about to move is controlled and has no action pending, let its controller choose one.
+// Safe to call early (e.g. right after a turn), so a controller that thinks in the background can start sooner.
+void Battle::prepareTurn() {
+    waiting = false;
+    // Twice, since a controlled side with nothing left to do hands the turn to the other side
+    for (int i = 0; i < 2; i++) {
+        if (turn == PLAYER && player_controller != nullptr && player_statement == nullptr && !player_done) {
+            player_statement = player_controller->next(*this);
+            if (player_statement == nullptr && player_controller->thinking()) {
+                waiting = true;
+                return;
+            }
+            if (player_statement == nullptr) {
+                player_done = true;
+                if (!enemy_done) {
+                    turn = ENEMY;
+                    enemy_time = turn_length;
+                }
+            }
+        } else if (turn == ENEMY && enemy_controller != nullptr && enemy_statement == nullptr && !enemy_done) {
+            enemy_statement = enemy_controller->next(*this);
+            if (enemy_statement == nullptr && enemy_controller->thinking()) {
+                waiting = true;
+                return;
+            }
+            if (enemy_statement == nullptr) {
+                enemy_done = true;
+                turn = PLAYER;
+                player_time = turn_length;
+            }
+        }
+    }
+}
+
+void Battle::takeTurn() {
+    // Also lets a controlled side choose its action
+    float turn_pace = pace();
+    if (finished() || waiting) {
+        player_line = -1;
+        enemy_line = -1;
+        result = NONE;
+        return;
+    }
+    game_time += turn_pace;
+    if (turn == PLAYER) {
+        executePlayerStatement();
+    } else {
+        executeEnemyStatement();
+    }
+    if (!finished()) {
+        checkStalemate();
+    }
+}
+
+static size_t const RepeatCheckInterval = 8;
+
+// End the battle as a draw once it runs out of time or comes back to a state it has been in,
+// since the programs would then go round the same loop forever
+void Battle::checkStalemate() {
+    if (max_game_time > 0.f && game_time >= max_game_time) {
+        player_done = true;
+        enemy_done = true;
+        ending = TIME_LIMIT;
+        return;
+    }
+    if (history.empty() || player_controller != nullptr || enemy_controller != nullptr) {
+        return;
+    }
+    // A cycle repeats at every turn within it, so looking at every few turns still finds it
+    if (++unchecked_turns < RepeatCheckInterval) {
+        return;
+    }
+    unchecked_turns = 0;
+    uint64_t hash = stateHash();
+    bool repeated = history_count > 0 && hash == anchor;
+    size_t count = std::min(history_count, history.size());
+    for (size_t i = 0; i < count && !repeated; i++) {
+        repeated = history[i] == hash;
+    }
+    if (repeated) {
+        player_done = true;
+        enemy_done = true;
+        ending = REPEATED_STATE;
+        return;
+    }
+    history[history_count % history.size()] = hash;
+    history_count++;
+    if (history_count >= anchor_span) {
+        anchor = hash;
+        anchor_span = std::max(history_count * 2, history.size());
+    }
+}
+
+// Start the state history over, e.g. after start() or a jump to another point of the battle
+void Battle::forgetStates() {
+    history_count = 0;
+    unchecked_turns = 0;
+    anchor_span = 0;
+    history.assign(repeat_history, 0);
+    hashed_property_count = (size_t)-1;
+    player_flat.clear();
+    enemy_flat.clear();
+    // Battles with a controller are not checked
+    if (player_controller == nullptr && enemy_controller == nullptr) {
+        if (player_exe != nullptr) {
+            player_flat = player_exe->flatten();
+        }
+        if (enemy_exe != nullptr) {
+            enemy_flat = enemy_exe->flatten();
+        }
+    }
+}
+
+static uint64_t splitmix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// A property at 0 hashes like a missing one
+static uint64_t zobrist(uint64_t key, int value) {
+    return value == 0 ? 0 : splitmix(key ^ ((uint64_t)(uint32_t)value * 0x9e3779b97f4a7c15ull));
+}
+
+static uint64_t floatBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Hash of everything that decides how the battle goes on: unit properties, where each program is,
+// and the scheduler. Properties are hashed Zobrist-style, so only the ones that changed cost anything.
+uint64_t Battle::stateHash() {
+    size_t count = 0;
+    for (Object* unit : player_units) {
+        count += unit->propertyCount();
+    }
+    for (Object* unit : enemy_units) {
+        count += unit->propertyCount();
+    }
+    if (count != hashed_property_count) {
+        std::vector<Object*> all = units();
+        hashed_properties.clear();
+        hashed_keys.clear();
+        hashed_values.clear();
+        property_hash = 0;
+        for (size_t u = 0; u < all.size(); u++) {
+            for (size_t p = 0; p < all[u]->propertyCount(); p++) {
+                uint64_t key = splitmix(std::hash<std::string>()(all[u]->propertyNameAt(p)) ^ splitmix(u));
+                int* value = &all[u]->propertyAt(p);
+                hashed_properties.push_back(value);
+                hashed_keys.push_back(key);
+                hashed_values.push_back(*value);
+                property_hash ^= zobrist(key, *value);
+            }
+        }
+        hashed_property_count = count;
+    } else {
+        for (size_t i = 0; i < hashed_properties.size(); i++) {
+            int value = *hashed_properties[i];
+            if (value != hashed_values[i]) {
+                property_hash ^= zobrist(hashed_keys[i], hashed_values[i]) ^ zobrist(hashed_keys[i], value);
+                hashed_values[i] = value;
+            }
+        }
+    }
+
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&](uint64_t value) {
+        hash = (hash ^ value) * 1099511628211ull;
+    };
+    auto mix_side = [&](Compiler::Executable* exe, std::vector<Compiler::Statement*> const& flat, Compiler::Statement* statement) {
+        mix(exe != nullptr ? exe->current_line : 0);
+        // One word per statement: line within it, remaining duration, and condition
+        for (Compiler::Statement* each : flat) {
+            uint64_t truth = 0;
+            if (each->type == Compiler::IF_STATEMENT) {
+                truth = static_cast<Compiler::IfStatement*>(each)->truth;
+            } else if (each->type == Compiler::WHILE_STATEMENT) {
+                truth = static_cast<Compiler::WhileStatement*>(each)->truth;
+            }
+            mix(((uint64_t)each->current_line << 33) ^ (floatBits(each->duration) << 1) ^ truth);
+        }
+        mix((uint64_t)(uintptr_t)statement);
+    };
+    mix_side(player_exe, player_flat, player_statement);
+    mix_side(enemy_exe, enemy_flat, enemy_statement);
+    mix((floatBits(player_time) << 32) ^ floatBits(enemy_time));
+    mix((uint64_t)turn | (player_done ? 2 : 0) | (enemy_done ? 4 : 0));
+    return property_hash ^ splitmix(hash);
+}
+
+char const* Battle::endingName(Ending ending) {
+    switch (ending) {
+    case PLAYER_WON:
+        return "player won";
+    case ENEMY_WON:
+        return "enemy won";
+    case REPEATED_STATE:
+        return "draw, the battle came back to an earlier state";
+    case TIME_LIMIT:
+        return "draw, out of time";
+    default:
+        return "undecided";
+    }
+}
+
+// Resolve the rest of the battle immediately, recording every turn if a replay is given.
+// Events (if any) are cleared after each turn. Returns the number of turns taken.
+// A controller that thinks in the background is waited for, so this is only quick with ones that do not.
+size_t Battle::run(Replay* replay, CombatEventBuffer* events, size_t max_turns) {
+    size_t turns = 0;
+    while (!finished() && turns < max_turns) {
+        float turn_pace = pace();
+        if (waiting) {
+            std::this_thread::yield();
+            continue;
+        }
+        Side side = turn;
+        takeTurn();
+        if (replay != nullptr) {
+            replay->record(side, side == PLAYER ? player_line : enemy_line, result, turn_pace, *events);
+        }
+        if (events != nullptr) {
+            events->clear();
+        }
+        turns++;
+    }
+    return turns;
+}
+
+// Returns true if either side has been wiped out
+bool Battle::checkOutcome() {
+    bool enemies_alive = false;
+    bool players_alive = false;
+    for (auto& enemy : enemy_units) {
+        if (enemy->property(PROPERTY_ALIVE)) {
+            enemies_alive = true;
+            break;
+        }
+    }
+    for (auto& player : player_units) {
+        if (player->property(PROPERTY_ALIVE)) {
+            players_alive = true;
+            break;
+        }
+    }
+    if (!players_alive) {
+        player_done = true;
+        enemy_done = true;
+        lost = true;
+        ending = ENEMY_WON;
+        return true;
+    }
+    if (!enemies_alive) {
+        player_done = true;
+        enemy_done = true;
+        won = true;
+        ending = PLAYER_WON;
+        return true;
+    }
+    return false;
+}
+
+void Battle::executePlayerStatement() {
+    float time = player_statement->duration;
+    player_line = (int)player_statement->line_num;
+    enemy_line = -1;
+    result = NONE;
+    if (player_time >= time) {
+        auto obj = player_units.begin();
+        if (player_statement->type == Compiler::ACTION_STATEMENT) {
+            Compiler::ActionStatement *action_statement = dynamic_cast<Compiler::ActionStatement *>(player_statement);
+            obj = std::find(player_units.begin(), player_units.end(), action_statement->object);
+        }
+        result = FAILURE;
+        if (obj != player_units.end() && player_statement->execute()) {
+            result = SUCCESS;
+        }
+        if (checkOutcome()) {
+            return;
+        }
+        // A controller chooses the next action once this side moves again
+        player_statement = player_controller == nullptr ? player_exe->next() : nullptr;
+        if (player_statement == nullptr && player_controller == nullptr) {
+            player_done = true;
+            if (!enemy_done) {
+                turn = ENEMY;
+                enemy_time = turn_length;
+            }
+        } else {
+            player_time -= time;
+            if (player_time <= 0.0f) {
+                if (!enemy_done) {
+                    turn = ENEMY;
+                    enemy_time = turn_length;
+                } else {
+                    player_time = turn_length;
+                }
+            }
+        }
+    } else {
+        player_statement->duration -= player_time;
+        if (!enemy_done) {
+            turn = ENEMY;
+            enemy_time = turn_length;
+        } else {
+            player_time = turn_length;
+        }
+    }
+}
+
+void Battle::executeEnemyStatement() {
+    float time = enemy_statement->duration;
+    player_line = -1;
+    enemy_line = (int)enemy_statement->line_num;
+    result = NONE;
+    if (enemy_time >= time) {
+        // As for the player, a side may only command its own units
+        auto obj = enemy_units.begin();
+        if (enemy_statement->type == Compiler::ACTION_STATEMENT) {
+            Compiler::ActionStatement *action_statement = dynamic_cast<Compiler::ActionStatement *>(enemy_statement);
+            obj = std::find(enemy_units.begin(), enemy_units.end(), action_statement->object);
+        }
+        result = FAILURE;
+        if (obj != enemy_units.end() && enemy_statement->execute()) {
+            result = SUCCESS;
+        }
+        if (checkOutcome()) {
+            return;
+        }
+        enemy_statement = enemy_controller == nullptr ? enemy_exe->next() : nullptr;
+        if (enemy_statement == nullptr && enemy_controller == nullptr) {
+            enemy_done = true;
+            turn = PLAYER;
+            player_time = turn_length;
+        } else {
+            enemy_time -= time;
+            if (enemy_time <= 0.0f) {
+                if (!player_done) {
+                    turn = PLAYER;
+                    player_time = turn_length;
+                } else {
+                    enemy_time = turn_length;
+                }
+            }
+        }
+    } else {
+        enemy_statement->duration -= enemy_time;
+        // If both are done, we want to switch control to the player for the next turn
+        if (enemy_done || !player_done) {
+            turn = PLAYER;
+            player_time = turn_length;
+        } else {
+            enemy_time = turn_length;
+        }
+    }
+}
+
+Battle::Controller::Controller(Compiler* compiler) : compiler(compiler), statement(compiler) {
+    // Chosen actions do not come from a program line
+    statement.line_num = (size_t)-1;
+}
+
+Battle::Controller::~Controller() {
+}
+
+// Ask for a decision and turn it into a statement the scheduler can run
+Compiler::Statement* Battle::Controller::next(Battle& battle) {
+    Decision chosen;
+    if (!decide(battle, &chosen) || chosen.object == nullptr) {
+        return nullptr;
+    }
+    prepare(chosen);
+    return &statement;
+}
+
+void Battle::Controller::prepare(Decision const& chosen) {
+    decision = chosen;
+    Action const& action = decision.object->actions().at(decision.object->actionNames()[decision.action]);
+    statement.object = decision.object;
+    statement.action_name = decision.object->actionNames()[decision.action];
+    statement.func = action.func;
+    statement.has_target = action.has_target;
+    statement.target = action.has_target ? decision.target : nullptr;
+    statement.base_duration = action.duration;
+    statement.duration = action.duration;
+    statement.current_line = 1;
+}
+
+// Player units followed by enemy units; snapshots index units in this order
+std::vector<Object*> Battle::units() const {
+    std::vector<Object*> all = player_units;
+    all.insert(all.end(), enemy_units.begin(), enemy_units.end());
+    return all;
+}
+
+// FNV-1a over the integer game state: each unit's core properties and where both sides are.
+// Two machines running the same battle agree on it turn by turn.
+uint32_t Battle::checksum() const {
+    uint32_t hash = 2166136261u;
+    auto mix = [&](int32_t value) {
+        for (int i = 0; i < 4; i++) {
+            hash ^= (uint8_t)(value >> (i * 8));
+            hash *= 16777619u;
+        }
+    };
+    for (auto const* side : {&player_units, &enemy_units}) {
+        for (Object* unit : *side) {
+            for (int id = 0; id < PROPERTY_COUNT; id++) {
+                int* value = unit->findProperty((PropertyId)id);
+                mix(value != nullptr ? *value : 0);
+            }
+        }
+    }
+    mix(turn);
+    mix((player_done ? 1 : 0) | (enemy_done ? 2 : 0) | (won ? 4 : 0) | (lost ? 8 : 0));
+    mix(player_line);
+    mix(enemy_line);
+    mix(result);
+    return hash;
+}
+
+void Battle::save(Snapshot* out) {
+    std::vector<Object*> all = units();
+    out->units.resize(all.size());
+    for (size_t i = 0; i < all.size(); i++) {
+        Snapshot::UnitState& state = out->units[i];
+        if (state.archetype != all[i]->archetype) {
+            state.archetype = all[i]->archetype;
+        }
+        std::copy(all[i]->values, all[i]->values + Archetype::MAX_PROPERTIES, state.values);
+        state.present = all[i]->present;
+        std::copy(all[i]->order, all[i]->order + all[i]->property_count, state.order);
+        state.property_count = all[i]->property_count;
+    }
+
+    auto index_of = [&](Object* obj) {
+        auto it = std::find(all.begin(), all.end(), obj);
+        return it != all.end() ? (int)(it - all.begin()) : -1;
+    };
+    auto save_side = [&](Compiler::Executable* exe, Controller* controller, Compiler::Statement* statement,
+                         std::vector<Compiler::StatementState>* state, size_t* exe_line, int* statement_index, int* decision, float* duration) {
+        *statement_index = -1;
+        decision[0] = -1;
+        if (controller != nullptr) {
+            if (statement != nullptr) {
+                decision[0] = index_of(controller->decision.object);
+                decision[1] = (int)controller->decision.action;
+                decision[2] = index_of(controller->decision.target);
+                *duration = statement->duration;
+            }
+        } else if (exe != nullptr) {
+            exe->getState(state);
+            *exe_line = exe->current_line;
+            std::vector<Compiler::Statement*> flat = exe->flatten();
+            auto it = std::find(flat.begin(), flat.end(), statement);
+            if (it != flat.end()) {
+                *statement_index = (int)(it - flat.begin());
+            }
+        }
+    };
+    save_side(player_exe, player_controller, player_statement, &out->player_state, &out->player_exe_line, &out->player_statement, out->player_decision, &out->player_duration);
+    save_side(enemy_exe, enemy_controller, enemy_statement, &out->enemy_state, &out->enemy_exe_line, &out->enemy_statement, out->enemy_decision, &out->enemy_duration);
+
+    out->turn = turn;
+    out->player_time = player_time;
+    out->enemy_time = enemy_time;
+    out->player_done = player_done;
+    out->enemy_done = enemy_done;
+    out->won = won;
+    out->lost = lost;
+    out->game_time = game_time;
+    out->ending = ending;
+}
+
+// Restore a snapshot taken from this battle, or from one with the same units and programs.
+// Units get back exactly the properties they had, including dropping ones added since.
+void Battle::load(Snapshot const& snapshot) {
+    std::vector<Object*> all = units();
+    assert(all.size() == snapshot.units.size());
+    for (size_t i = 0; i < all.size(); i++) {
+        Snapshot::UnitState const& state = snapshot.units[i];
+        // Compiled conditions point into the values, so they are copied in place
+        if (all[i]->archetype != state.archetype) {
+            all[i]->archetype = state.archetype;
+        }
+        std::copy(state.values, state.values + Archetype::MAX_PROPERTIES, all[i]->values);
+        all[i]->present = state.present;
+        std::copy(state.order, state.order + state.property_count, all[i]->order);
+        all[i]->property_count = state.property_count;
+    }
+
+    auto unit = [&](int index) {
+        return index >= 0 ? all[index] : nullptr;
+    };
+    auto load_side = [&](Compiler::Executable* exe, Controller* controller, std::vector<Compiler::StatementState> const& state,
+                         size_t exe_line, int statement_index, int const* decision, float duration) -> Compiler::Statement* {
+        if (controller != nullptr) {
+            if (decision[0] < 0) {
+                return nullptr;
+            }
+            Decision pending;
+            pending.object = unit(decision[0]);
+            pending.action = (size_t)decision[1];
+            pending.target = unit(decision[2]);
+            controller->prepare(pending);
+            controller->statement.duration = duration;
+            return &controller->statement;
+        } else if (exe != nullptr) {
+            exe->setState(state);
+            exe->current_line = exe_line;
+            if (statement_index >= 0) {
+                return exe->flatten()[statement_index];
+            }
+        }
+        return nullptr;
+    };
+    player_statement = load_side(player_exe, player_controller, snapshot.player_state, snapshot.player_exe_line, snapshot.player_statement, snapshot.player_decision, snapshot.player_duration);
+    enemy_statement = load_side(enemy_exe, enemy_controller, snapshot.enemy_state, snapshot.enemy_exe_line, snapshot.enemy_statement, snapshot.enemy_decision, snapshot.enemy_duration);
+
+    turn = snapshot.turn;
+    player_time = snapshot.player_time;
+    enemy_time = snapshot.enemy_time;
+    player_done = snapshot.player_done;
+    enemy_done = snapshot.enemy_done;
+    won = snapshot.won;
+    lost = snapshot.lost;
+    game_time = snapshot.game_time;
+    ending = snapshot.ending;
+    waiting = false;
+    forgetStates();
+}
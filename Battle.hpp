@@ -0,0 +1,177 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <memory>
+#include "Object.hpp"
+#include "Compiler.hpp"
+#include "CombatEvent.hpp"
+#include "Replay.hpp"
+
+#ifndef _BATTLE_H_
+#define _BATTLE_H_
+
+// Seconds of action time each side gets per turn
+float turn_duration();
+
+// The turn scheduler: statements of the player and enemy programs alternate,
+// each side spending up to turn_length seconds of action time per turn.
+// Battle only touches game logic, so a whole battle can also be resolved at once with run().
+struct Battle {
+    enum Side : uint8_t {
+        PLAYER,
+        ENEMY
+    };
+
+    enum Result : uint8_t {
+        NONE,
+        SUCCESS,
+        FAILURE
+    };
+
+    // Why a finished battle ended
+    enum Ending : uint8_t {
+        UNDECIDED, // still going, or stopped from outside
+        PLAYER_WON,
+        ENEMY_WON,
+        REPEATED_STATE, // a draw: the battle came back to a state it had been in
+        TIME_LIMIT // a draw: max_game_time ran out
+    };
+
+    // One action chosen by a Controller
+    struct Decision {
+        Object* object = nullptr;
+        size_t action = 0; // index into object->actionNames()
+        Object* target = nullptr;
+    };
+
+    // Chooses the actions of one side instead of a compiled program
+    struct Controller {
+        Compiler* compiler;
+        Compiler::ActionStatement statement;
+        Decision decision;
+
+        Controller(Compiler* compiler);
+        virtual ~Controller();
+        // Fill in the next action; return false if the side has nothing left to do, or if it is still thinking
+        virtual bool decide(Battle& battle, Decision* out) = 0;
+        // Whether the last decide() came back without an answer yet (e.g. a search still running in the
+        // background); the battle then waits, and asks again the next time the side is about to move
+        virtual bool thinking() { return false; }
+        // The statement to run next: by default the action decide() chooses
+        virtual Compiler::Statement* next(Battle& battle);
+        void prepare(Decision const& decision);
+    };
+
+    // Everything needed to continue a battle from a given point, on these units or on clones of them
+    struct Snapshot {
+        // A unit's properties as the unit stores them, so restoring them is a copy
+        struct UnitState {
+            std::shared_ptr<Archetype> archetype; // which may have slots the unit added during the battle
+            int values[Archetype::MAX_PROPERTIES] = {};
+            uint32_t present = 0;
+            uint8_t order[Archetype::MAX_PROPERTIES] = {};
+            uint8_t property_count = 0;
+        };
+        std::vector<UnitState> units;
+        std::vector<Compiler::StatementState> player_state;
+        std::vector<Compiler::StatementState> enemy_state;
+        size_t player_exe_line = 0;
+        size_t enemy_exe_line = 0;
+        int player_statement = -1; // index in flatten() order, or -1 for none
+        int enemy_statement = -1;
+        // Pending controller actions, as unit indices
+        int player_decision[3] = {-1, 0, -1};
+        int enemy_decision[3] = {-1, 0, -1};
+        float player_duration = 0.f;
+        float enemy_duration = 0.f;
+        Side turn = PLAYER;
+        float player_time = 0.f;
+        float enemy_time = 0.f;
+        bool player_done = true;
+        bool enemy_done = true;
+        bool won = false;
+        bool lost = false;
+        float game_time = 0.f;
+        Ending ending = UNDECIDED;
+    };
+
+    float turn_length = turn_duration();
+    std::vector<Object*> player_units;
+    std::vector<Object*> enemy_units;
+
+    Compiler::Executable* player_exe = nullptr;
+    Compiler::Statement* player_statement = nullptr;
+    Compiler::Executable* enemy_exe = nullptr;
+    Compiler::Statement* enemy_statement = nullptr;
+
+    // When set, these choose the side's actions and its executable is not used.
+    // A controlled side with no statement pending asks its controller when it next moves.
+    Controller* player_controller = nullptr;
+    Controller* enemy_controller = nullptr;
+
+    Side turn = PLAYER;
+    float player_time = 0.f;
+    float enemy_time = 0.f;
+    bool player_done = true;
+    bool enemy_done = true;
+    bool won = false;
+    bool lost = false;
+    Ending ending = UNDECIDED;
+    // The side about to move is a controller still thinking, so the turn cannot be taken yet
+    bool waiting = false;
+
+    // Game time played so far, and how much a battle may take before it is a draw (0 for no limit)
+    float game_time = 0.f;
+    float max_game_time = 0.f;
+    // How many recent states to compare against (0 turns repeat checks off; takes effect at start()). States are
+    // hashed every few turns, and longer cycles are caught by also comparing against one saved state, which moves
+    // ahead at doubling intervals (Brent's method).
+    // Only sides run by programs are checked, since what a controller does next may depend on more than the
+    // battle state. Where RANDOM_PLAYER/RANDOM_ENEMY would land is not part of the state, so a cycle that
+    // random targets might eventually break counts as a stalemate too.
+    size_t repeat_history = 16;
+
+    // What the last call to takeTurn did
+    int player_line = -1;
+    int enemy_line = -1;
+    Result result = NONE;
+
+    void start(Compiler::Executable* player_exe, Compiler::Executable* enemy_exe);
+    void stop();
+    bool finished() const { return player_done && enemy_done; }
+    float pace();
+    void takeTurn();
+    size_t run(Replay* replay, CombatEventBuffer* events, size_t max_turns);
+
+    void save(Snapshot* out);
+    void load(Snapshot const& snapshot);
+    std::vector<Object*> units() const;
+    uint32_t checksum() const;
+
+    void prepareTurn();
+    void executePlayerStatement();
+    void executeEnemyStatement();
+    bool checkOutcome();
+    void checkStalemate();
+    void forgetStates();
+    uint64_t stateHash();
+    static char const* endingName(Ending ending);
+
+    // Zobrist hash of every unit property, updated from the values that changed since the last turn
+    std::vector<int*> hashed_properties;
+    std::vector<uint64_t> hashed_keys; // from the unit and the property name
+    std::vector<int> hashed_values;
+    size_t hashed_property_count = 0;
+    uint64_t property_hash = 0;
+    std::vector<Compiler::Statement*> player_flat;
+    std::vector<Compiler::Statement*> enemy_flat;
+    std::vector<uint64_t> history; // ring of recent state hashes
+    size_t history_count = 0;
+    size_t unchecked_turns = 0;
+    uint64_t anchor = 0;
+    size_t anchor_span = 0; // turns until the anchor moves ahead
+};
+
+#endif
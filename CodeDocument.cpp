@@ -0,0 +1,156 @@
+#include "CodeDocument.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+//shared by all documents, so versions are never reused:
+static uint64_t last_version = 0;
+
+CodeDocument::CodeDocument() {
+	assign({});
+}
+
+std::vector< std::string > CodeDocument::lines() const {
+	std::vector< std::string > ret;
+	ret.reserve(size());
+	ret.insert(ret.end(), slots.begin(), slots.begin() + gap_begin);
+	ret.insert(ret.end(), slots.begin() + gap_end, slots.end());
+	return ret;
+}
+
+void CodeDocument::assign(std::vector< std::string > const &lines) {
+	slots = lines;
+	if (slots.empty()) {
+		slots.emplace_back("");
+	}
+	gap_begin = gap_end = slots.size();
+	history.clear();
+	undone.clear();
+	version_ = ++last_version;
+}
+
+void CodeDocument::replace(size_t index, size_t column, size_t count, std::string const &text) {
+	Edit edit;
+	edit.kind = Edit::Replace;
+	edit.index = index;
+	edit.column = column;
+	edit.removed = line(index).substr(column, count);
+	edit.inserted = text;
+	apply(edit, false);
+	record(std::move(edit));
+}
+
+void CodeDocument::split(size_t index, size_t column) {
+	Edit edit;
+	edit.kind = Edit::Split;
+	edit.index = index;
+	edit.column = column;
+	apply(edit, false);
+	record(std::move(edit));
+}
+
+void CodeDocument::join(size_t index) {
+	Edit edit;
+	edit.kind = Edit::Join;
+	edit.index = index;
+	edit.column = line(index).size();
+	apply(edit, false);
+	record(std::move(edit));
+}
+
+bool CodeDocument::undo(size_t *cursor_line, size_t *cursor_column) {
+	if (history.empty()) return false;
+	Edit edit = std::move(history.back());
+	history.pop_back();
+	apply(edit, true);
+	if (edit.kind == Edit::Join) {
+		*cursor_line = edit.index + 1;
+		*cursor_column = 0;
+	} else {
+		*cursor_line = edit.index;
+		*cursor_column = edit.column + (edit.kind == Edit::Replace ? edit.removed.size() : 0);
+	}
+	undone.emplace_back(std::move(edit));
+	return true;
+}
+
+bool CodeDocument::redo(size_t *cursor_line, size_t *cursor_column) {
+	if (undone.empty()) return false;
+	Edit edit = std::move(undone.back());
+	undone.pop_back();
+	apply(edit, false);
+	if (edit.kind == Edit::Split) {
+		*cursor_line = edit.index + 1;
+		*cursor_column = 0;
+	} else {
+		*cursor_line = edit.index;
+		*cursor_column = edit.column + (edit.kind == Edit::Replace ? edit.inserted.size() : 0);
+	}
+	history.emplace_back(std::move(edit));
+	return true;
+}
+
+void CodeDocument::apply(Edit const &edit, bool inverse) {
+	Edit::Kind kind = edit.kind;
+	if (inverse && kind != Edit::Replace) {
+		kind = (kind == Edit::Split ? Edit::Join : Edit::Split);
+	}
+	if (kind == Edit::Replace) {
+		std::string const &removed = inverse ? edit.inserted : edit.removed;
+		std::string const &inserted = inverse ? edit.removed : edit.inserted;
+		line_slot(edit.index).replace(edit.column, removed.size(), inserted);
+	} else if (kind == Edit::Split) {
+		std::string &first = line_slot(edit.index);
+		std::string second = first.substr(edit.column);
+		first.erase(edit.column);
+		insert_line(edit.index + 1, std::move(second));
+	} else {
+		std::string second = std::move(line_slot(edit.index + 1));
+		erase_line(edit.index + 1);
+		line_slot(edit.index) += second;
+	}
+	version_ = ++last_version;
+}
+
+void CodeDocument::record(Edit &&edit) {
+	undone.clear();
+	//typing on from where the last typing ended extends it:
+	if (!history.empty() && edit.kind == Edit::Replace && edit.removed.empty()) {
+		Edit &last = history.back();
+		if (last.kind == Edit::Replace && last.index == edit.index && last.column + last.inserted.size() == edit.column) {
+			last.inserted += edit.inserted;
+			return;
+		}
+	}
+	if (history.size() == MaxHistory) {
+		history.pop_front();
+	}
+	history.emplace_back(std::move(edit));
+}
+
+void CodeDocument::move_gap(size_t index) {
+	assert(index <= size());
+	if (gap_begin == gap_end) {
+		//grow by as many slots as there are lines, so growing is O(1) amortised:
+		size_t grow = std::max< size_t >(16, slots.size());
+		slots.insert(slots.begin() + gap_begin, grow, std::string());
+		gap_end += grow;
+	}
+	while (index < gap_begin) {
+		slots[--gap_end] = std::move(slots[--gap_begin]);
+	}
+	while (index > gap_begin) {
+		slots[gap_begin++] = std::move(slots[gap_end++]);
+	}
+}
+
+void CodeDocument::insert_line(size_t index, std::string &&text) {
+	move_gap(index);
+	slots[gap_begin++] = std::move(text);
+}
+
+void CodeDocument::erase_line(size_t index) {
+	move_gap(index);
+	slots[gap_end++].clear();
+}
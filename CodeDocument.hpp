@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+ * "CodeDocument" holds the lines of the program being typed in a gap buffer:
+ *  one vector of lines with a run of unused slots (the gap) kept where the last
+ *  line was added or removed, so adding and removing lines there is O(1)
+ *  amortised no matter how long the program is.
+ * Every edit can be undone and redone, and bumps version(), so views of the
+ *  document can tell when to lay it out again without comparing text.
+ *
+ */
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct CodeDocument {
+	CodeDocument(); //one empty line
+
+	size_t size() const { return slots.size() - (gap_end - gap_begin); }
+	std::string const &line(size_t index) const { return slots[index < gap_begin ? index : index + (gap_end - gap_begin)]; }
+	//a copy of every line, in order:
+	std::vector< std::string > lines() const;
+	//changed by every edit, to a value no other document state has had, so a copy put back
+	// (e.g. a draft kept aside during a replay) never looks like text it is not:
+	uint64_t version() const { return version_; }
+
+	//replace every line (with one empty line if there are none), forgetting the undo history:
+	void assign(std::vector< std::string > const &lines);
+
+	//edits, each undoable; cursor positions are (line, column):
+	//replace count characters of a line from column on with text (which has no line breaks):
+	void replace(size_t index, size_t column, size_t count, std::string const &text);
+	//break a line in two at column:
+	void split(size_t index, size_t column);
+	//append the next line to a line:
+	void join(size_t index);
+
+	//undo or redo the last edit, moving the cursor to where it happened; false if there was none:
+	bool undo(size_t *cursor_line, size_t *cursor_column);
+	bool redo(size_t *cursor_line, size_t *cursor_column);
+
+	//an edit, as needed to undo and redo it:
+	struct Edit {
+		enum Kind : uint8_t { Replace, Split, Join } kind = Replace;
+		size_t index = 0;
+		size_t column = 0; //for Join, the length of the first line before joining
+		std::string removed; //for Replace
+		std::string inserted; //for Replace
+	};
+	//edits to undo, oldest first (consecutive typing on a line is one edit), and edits undone, to redo:
+	enum : size_t { MaxHistory = 1024 };
+	std::deque< Edit > history;
+	std::vector< Edit > undone;
+
+	//the lines, with slots [gap_begin, gap_end) unused:
+	std::vector< std::string > slots;
+	size_t gap_begin = 0;
+	size_t gap_end = 0;
+	uint64_t version_ = 0;
+
+	void apply(Edit const &edit, bool inverse);
+	void record(Edit &&edit);
+	std::string &line_slot(size_t index) { return slots[index < gap_begin ? index : index + (gap_end - gap_begin)]; }
+	//move the gap to index, growing it if it is empty:
+	void move_gap(size_t index);
+	void insert_line(size_t index, std::string &&text);
+	void erase_line(size_t index);
+};
@@ -0,0 +1,40 @@
+#include "CombatEvent.hpp"
+
+// Round capacity up to a power of two so indices can wrap with a mask
+CombatEventBuffer::CombatEventBuffer(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    ring.resize(size);
+}
+
+// Append an event, doubling the ring if it is full so nothing is ever dropped
+void CombatEventBuffer::push(CombatEvent const& event) {
+    if (size() == ring.size()) {
+        std::vector<CombatEvent> bigger(ring.size() * 2);
+        for (size_t i = 0; i < size(); i++) {
+            bigger[i] = (*this)[i];
+        }
+        tail = size();
+        head = 0;
+        ring.swap(bigger);
+    }
+    ring[tail & (ring.size() - 1)] = event;
+    tail++;
+}
+
+// Remove the oldest event, returning false if there are none
+bool CombatEventBuffer::pop(CombatEvent* out) {
+    if (empty()) {
+        return false;
+    }
+    *out = ring[head & (ring.size() - 1)];
+    head++;
+    return true;
+}
+
+void CombatEventBuffer::clear() {
+    head = 0;
+    tail = 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#ifndef _COMBAT_EVENT_H_
+#define _COMBAT_EVENT_H_
+
+struct Object;
+
+// Everything an action can do to the battle, in the order it happened.
+// Actions only emit these; the presentation layer (see present_combat_events) turns them into animations and sounds.
+enum CombatEventType : uint8_t {
+    EVENT_DAMAGE,
+    EVENT_HEAL,
+    EVENT_STATUS,
+    EVENT_DEATH,
+    EVENT_PROJECTILE,
+    EVENT_WAVE
+};
+
+// Value of CombatEvent::kind for EVENT_DAMAGE
+enum DamageKind : uint8_t {
+    DAMAGE_MELEE,
+    DAMAGE_PROJECTILE,
+    DAMAGE_BURN,
+    DAMAGE_WAVE
+};
+
+// Value of CombatEvent::kind for EVENT_STATUS
+enum StatusKind : uint8_t {
+    STATUS_FREEZE,
+    STATUS_BURN,
+    STATUS_CURE_BURN,
+    STATUS_FROZEN_SKIP
+};
+
+// Value of CombatEvent::kind for EVENT_PROJECTILE
+enum ProjectileKind : uint8_t {
+    PROJECTILE_ARROW,
+    PROJECTILE_BOLT
+};
+
+// Plain data, so events can be copied around and written to disk freely
+struct CombatEvent {
+    CombatEventType type;
+    uint8_t kind = 0;
+    bool lethal = false;
+    Object* source = nullptr;
+    Object* target = nullptr;
+    int amount = 0;
+    float duration = 0.f;
+};
+
+// Growable ring buffer of events, consumed in order
+struct CombatEventBuffer {
+    std::vector<CombatEvent> ring;
+    size_t head = 0;
+    size_t tail = 0;
+
+    CombatEventBuffer(size_t capacity = 64);
+    void push(CombatEvent const& event);
+    bool pop(CombatEvent* out);
+    void clear();
+    size_t size() const { return tail - head; }
+    bool empty() const { return head == tail; }
+    CombatEvent const& operator[](size_t i) const { return ring[(head + i) & (ring.size() - 1)]; }
+};
+
+#endif
@@ -183,7 +183,9 @@ Compiler::ActionStatement* Compiler::parseActionStatement(Program& program, Prog
     std::string obj = *word_it;
     if (parseObject(line_it, word_it, &out->object)) {
         if (parseWord(line_it, word_it, ".")) {
+            Line::iterator action_it = word_it;
             if (parseAction(line_it, word_it, out->object, &out->func, &out->base_duration, &out->has_target)) {
+                out->action_name = *action_it;
                 if (parseWord(line_it, word_it, "(")) {
                     out->target = nullptr;
                     if (!out->has_target || parseObject(line_it, word_it, &out->target)) {
@@ -392,6 +394,9 @@ bool Compiler::parseStatementBlock(Program& program, Program::iterator& line_it,
                 set_error(line_num, "Could not parse '" + *line_it->begin() + "' as an IF, WHILE, or object name");
             }
             line_it = old_it;
+            for (Statement* statement : *out) {
+                delete statement;
+            }
             out->clear();
             return false;
         }
@@ -432,8 +437,8 @@ bool Compiler::parseAction(Program::iterator& line_it, Line::iterator& word_it,
         return false;
     }
 
-    auto act = obj->actions.find(*word_it);
-    if (act != obj->actions.end()) {
+    auto act = obj->actions().find(*word_it);
+    if (act != obj->actions().end()) {
         *out_func = act->second.func;
         if (out_dur != nullptr) {
             *out_dur = act->second.duration;
@@ -618,9 +623,9 @@ bool Compiler::parseProperty(Program::iterator& line_it, Line::iterator& word_it
         return false;
     }
     
-    auto prop = obj->properties.find(*word_it);
-    if (prop != obj->properties.end()) {
-        *out = prop->second;
+    int* prop = obj->findProperty(*word_it);
+    if (prop != nullptr) {
+        *out = prop;
         word_it++;
         return true;
     }
@@ -666,6 +671,25 @@ Compiler::WhileStatement::WhileStatement(Compiler* compiler) : Statement(compile
     duration = 0.25f;
 }
 
+// Nested statements and compound conditions belong to the statement that holds them
+Compiler::IfStatement::~IfStatement() {
+    for (Statement* statement : statements) {
+        delete statement;
+    }
+    for (CompoundStatement* compound : compounds) {
+        delete compound;
+    }
+}
+
+Compiler::WhileStatement::~WhileStatement() {
+    for (Statement* statement : statements) {
+        delete statement;
+    }
+    for (CompoundStatement* compound : compounds) {
+        delete compound;
+    }
+}
+
 // Compound statement constructor
 Compiler::CompoundStatement::CompoundStatement(Compiler* compiler) : Statement(compiler) {
     type = COMPOUND_STATEMENT;
@@ -691,6 +715,11 @@ void Compiler::Statement::reset() {
     current_line = 0;
 }
 
+// Append this statement and everything nested in it, in program order
+void Compiler::Statement::flatten(std::vector<Statement*>* out) {
+    out->push_back(this);
+}
+
 // Action statement only returns itself
 Compiler::Statement* Compiler::ActionStatement::next() {
     if (current_line == 0) {
@@ -711,26 +740,26 @@ Object* Compiler::ActionStatement::getRealTarget() {
     if (target == compiler->random_player) {
         std::vector<Object*> living_players;
         for (size_t i = 0; i < compiler->players.size(); i++) {
-            if (compiler->players[i]->property("ALIVE")) {
+            if (compiler->players[i]->property(PROPERTY_ALIVE)) {
                 living_players.push_back(compiler->players[i]);
             }
         }
         if (living_players.size() > 0) {
-            return living_players[rand() % living_players.size()];
+            return living_players[compiler->rng() % living_players.size()];
         } else {
-            return compiler->players[rand() % compiler->players.size()];
+            return compiler->players[compiler->rng() % compiler->players.size()];
         }
     } else if (target == compiler->random_enemy) {
         std::vector<Object*> living_enemies;
         for (size_t i = 0; i < compiler->enemies.size(); i++) {
-            if (compiler->enemies[i]->property("ALIVE")) {
+            if (compiler->enemies[i]->property(PROPERTY_ALIVE)) {
                 living_enemies.push_back(compiler->enemies[i]);
             }
         }
         if (living_enemies.size() > 0) {
-            return living_enemies[rand() % living_enemies.size()];
+            return living_enemies[compiler->rng() % living_enemies.size()];
         } else {
-            return compiler->enemies[rand() % compiler->enemies.size()];
+            return compiler->enemies[compiler->rng() % compiler->enemies.size()];
         }
     }
 
@@ -797,6 +826,13 @@ void Compiler::IfStatement::reset() {
     }
 }
 
+void Compiler::IfStatement::flatten(std::vector<Statement*>* out) {
+    out->push_back(this);
+    for (size_t i = 0; i < statements.size(); i++) {
+        statements[i]->flatten(out);
+    }
+}
+
 // First call returns the if line itself.
 // If true, subsequent calls return statements in order
 Compiler::Statement* Compiler::WhileStatement::next() {
@@ -866,6 +902,13 @@ void Compiler::WhileStatement::reset() {
     }
 }
 
+void Compiler::WhileStatement::flatten(std::vector<Statement*>* out) {
+    out->push_back(this);
+    for (size_t i = 0; i < statements.size(); i++) {
+        statements[i]->flatten(out);
+    }
+}
+
 // Execute an executable by executing all of its statements
 void Compiler::Executable::execute() {
     Statement* statement;
@@ -914,12 +957,62 @@ Compiler::Statement* Compiler::Executable::next() {
     return statement;
 }
 
+// All statements of the executable, nested ones included, in program order
+Compiler::Executable::~Executable() {
+    for (Statement* statement : statements) {
+        delete statement;
+    }
+}
+
+std::vector<Compiler::Statement*> Compiler::Executable::flatten() {
+    std::vector<Statement*> out;
+    for (size_t i = 0; i < statements.size(); i++) {
+        statements[i]->flatten(&out);
+    }
+    return out;
+}
+
+// Execution state of every statement, in flatten() order
+void Compiler::Executable::getState(std::vector<StatementState>* out) {
+    out->clear();
+    for (Statement* statement : flatten()) {
+        bool truth = false;
+        if (statement->type == IF_STATEMENT) {
+            truth = static_cast<IfStatement*>(statement)->truth;
+        } else if (statement->type == WHILE_STATEMENT) {
+            truth = static_cast<WhileStatement*>(statement)->truth;
+        }
+        out->push_back({statement->current_line, statement->duration, truth});
+    }
+}
+
+// Restore state from getState() of an executable compiled from the same program
+void Compiler::Executable::setState(std::vector<StatementState> const& state) {
+    std::vector<Statement*> all = flatten();
+    assert(all.size() == state.size());
+    for (size_t i = 0; i < all.size(); i++) {
+        all[i]->current_line = state[i].current_line;
+        all[i]->duration = state[i].duration;
+        if (all[i]->type == IF_STATEMENT) {
+            static_cast<IfStatement*>(all[i])->truth = state[i].truth;
+        } else if (all[i]->type == WHILE_STATEMENT) {
+            static_cast<WhileStatement*>(all[i])->truth = state[i].truth;
+        }
+    }
+}
+
 // Add object to compiler's object map
 void Compiler::addObject(Object* obj) {
-    objects.emplace(obj->name, obj);
-    if (obj->team == Team::TEAM_PLAYER) {
+    addObject(obj, obj->name, obj->team);
+}
+
+// Add object under another name, on the side the program sees it on (for RANDOM_PLAYER/RANDOM_ENEMY).
+// Lets a program written for the player's units drive a mirrored copy of them.
+void Compiler::addObject(Object* obj, std::string const& name, Team team) {
+    objects.emplace(name, obj);
+    if (team == Team::TEAM_PLAYER) {
         players.push_back(obj);
-    } else if (obj->team == Team::TEAM_ENEMY) {
+    } else if (team == Team::TEAM_ENEMY) {
         enemies.push_back(obj);
     }
 }
@@ -4,7 +4,9 @@
 #include <vector>
 #include <list>
 #include <string>
+#include <random>
 #include "Object.hpp"
+#include "CombatEvent.hpp"
 
 #ifndef _COMPILER_H_
 #define _COMPILER_H_
@@ -41,6 +43,13 @@ struct Compiler {
         COMPOUND_STATEMENT
     };
 
+    // Execution state of one statement, for copying a running program into another compiled copy of it
+    struct StatementState {
+        size_t current_line;
+        float duration;
+        bool truth;
+    };
+
     struct Statement {
         StatementType type;
         size_t current_line = 0;
@@ -54,10 +63,12 @@ struct Compiler {
         virtual Statement* next();
         virtual bool execute();
         virtual void reset();
+        virtual void flatten(std::vector<Statement*>* out);
     };
 
     struct ActionStatement : Statement {
         Object* object;
+        std::string action_name;
         ActionFunction func;
         Object* target;
         bool has_target;
@@ -82,9 +93,11 @@ struct Compiler {
         bool truth = false;
 
         IfStatement(Compiler* compiler);
+        ~IfStatement();
         Statement* next();
         bool execute();
         void reset();
+        void flatten(std::vector<Statement*>* out);
     };
 
     struct WhileStatement : Statement {
@@ -94,16 +107,25 @@ struct Compiler {
         bool truth = false;
 
         WhileStatement(Compiler* compiler);
+        ~WhileStatement();
         Statement* next();
         bool execute();
         void reset();
+        void flatten(std::vector<Statement*>* out);
     };
 
     struct Executable {
         std::vector<Statement*> statements;
         size_t current_line = 0;
+
+        Executable() = default;
+        Executable(Executable const&) = delete;
+        ~Executable();
         void execute();
         Statement* next();
+        std::vector<Statement*> flatten();
+        void getState(std::vector<StatementState>* out);
+        void setState(std::vector<StatementState> const& state);
     };
 
     std::string error_message = "";
@@ -111,6 +133,17 @@ struct Compiler {
     Object* random_player;
     Object* random_enemy;
 
+    // Source of randomness for RANDOM_PLAYER/RANDOM_ENEMY targets; seed it to make a battle reproducible
+    std::mt19937 rng;
+
+    // Where actions report what they did; nullptr when nobody is watching (e.g. headless runs)
+    CombatEventBuffer* events = nullptr;
+    void emit(CombatEvent const& event) {
+        if (events != nullptr) {
+            events->push(event);
+        }
+    }
+
     Compiler();
     Statement* parseStatement(Program& program, Program::iterator& line_it);
     ActionStatement* parseActionStatement(Program& program, Program::iterator& line_it);
@@ -133,8 +166,9 @@ struct Compiler {
     Executable* compile(std::string filename);
     Executable* compile(std::vector<std::string> lines);
     void addObject(Object* obj);
+    void addObject(Object* obj, std::string const& name, Team team);
     Program readProgram(std::string filename);
-    Program readProgram(std::vector<std::string> lines);
+    static Program readProgram(std::vector<std::string> lines);
     static Line readLine(std::string text, std::vector<int>* offsets = nullptr);
     void set_error(size_t line_num, std::string message);
     void initSpecialObjects();
@@ -0,0 +1,222 @@
+#include "Connection.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#undef NOMINMAX
+typedef int socklen_t;
+static int const SendFlags = 0;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#ifdef MSG_NOSIGNAL
+static int const SendFlags = MSG_NOSIGNAL;
+#else
+static int const SendFlags = 0;
+#endif
+#endif
+
+#ifdef _WIN32
+Socket const Connection::InvalidSocket = INVALID_SOCKET;
+#else
+Socket const Connection::InvalidSocket = -1;
+#endif
+
+namespace {
+
+#ifdef _WIN32
+void init_sockets() {
+	static bool initialized = false;
+	if (!initialized) {
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+			throw std::runtime_error("WSAStartup failed.");
+		}
+		initialized = true;
+	}
+}
+bool would_block() {
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+void close_socket(Socket s) {
+	closesocket(s);
+}
+#else
+void init_sockets() {
+}
+bool would_block() {
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+void close_socket(Socket s) {
+	::close(s);
+}
+#endif
+
+void set_nonblocking(Socket s) {
+#ifdef _WIN32
+	u_long mode = 1;
+	ioctlsocket(s, FIONBIO, &mode);
+#else
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+	//small messages should go out right away:
+	int one = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast< char const * >(&one), sizeof(one));
+#ifdef SO_NOSIGPIPE
+	setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+timeval to_timeval(double timeout) {
+	timeval tv;
+	timeout = std::max(0.0, timeout);
+	tv.tv_sec = long(timeout);
+	tv.tv_usec = long((timeout - double(tv.tv_sec)) * 1e6);
+	return tv;
+}
+
+}
+
+Connection::~Connection() {
+	close();
+}
+
+Connection *Connection::connect(std::string const &host, std::string const &port) {
+	init_sockets();
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *res = nullptr;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || res == nullptr) {
+		std::cerr << "Failed to look up '" << host << ":" << port << "'." << std::endl;
+		return nullptr;
+	}
+	Socket s = InvalidSocket;
+	for (addrinfo *info = res; info != nullptr; info = info->ai_next) {
+		s = ::socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if (s == InvalidSocket) continue;
+		if (::connect(s, info->ai_addr, socklen_t(info->ai_addrlen)) == 0) break;
+		close_socket(s);
+		s = InvalidSocket;
+	}
+	freeaddrinfo(res);
+	if (s == InvalidSocket) {
+		std::cerr << "Failed to connect to '" << host << ":" << port << "'." << std::endl;
+		return nullptr;
+	}
+	set_nonblocking(s);
+	return new Connection(s);
+}
+
+void Connection::send(void const *data, size_t size) {
+	char const *bytes = reinterpret_cast< char const * >(data);
+	send_buffer.insert(send_buffer.end(), bytes, bytes + size);
+}
+
+void Connection::poll(double timeout) {
+	if (socket == InvalidSocket) return;
+
+	fd_set read_fds, write_fds;
+	FD_ZERO(&read_fds);
+	FD_ZERO(&write_fds);
+	FD_SET(socket, &read_fds);
+	if (!send_buffer.empty()) {
+		FD_SET(socket, &write_fds);
+	}
+	timeval tv = to_timeval(timeout);
+	int ready = select(int(socket + 1), &read_fds, &write_fds, nullptr, &tv);
+	if (ready <= 0) return;
+
+	if (FD_ISSET(socket, &write_fds)) {
+		auto sent = ::send(socket, send_buffer.data(), int(send_buffer.size()), SendFlags);
+		if (sent > 0) {
+			send_buffer.erase(send_buffer.begin(), send_buffer.begin() + sent);
+			bytes_sent += size_t(sent);
+		} else if (sent < 0 && !would_block()) {
+			close();
+			return;
+		}
+	}
+
+	if (FD_ISSET(socket, &read_fds)) {
+		char buffer[4096];
+		while (true) {
+			auto got = ::recv(socket, buffer, int(sizeof(buffer)), 0);
+			if (got > 0) {
+				recv_buffer.insert(recv_buffer.end(), buffer, buffer + got);
+				bytes_received += size_t(got);
+			} else if (got < 0 && would_block()) {
+				break;
+			} else {
+				//closed by the other end (got == 0) or failed:
+				close();
+				return;
+			}
+		}
+	}
+}
+
+void Connection::close() {
+	if (socket != InvalidSocket) {
+		close_socket(socket);
+		socket = InvalidSocket;
+	}
+}
+
+Server::Server(std::string const &port) {
+	init_sockets();
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo *res = nullptr;
+	if (getaddrinfo(nullptr, port.c_str(), &hints, &res) != 0 || res == nullptr) {
+		throw std::runtime_error("Failed to look up port '" + port + "'.");
+	}
+	socket = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (socket != Connection::InvalidSocket) {
+		int one = 1;
+		setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast< char const * >(&one), sizeof(one));
+		if (bind(socket, res->ai_addr, socklen_t(res->ai_addrlen)) != 0 || listen(socket, 4) != 0) {
+			close_socket(socket);
+			socket = Connection::InvalidSocket;
+		}
+	}
+	freeaddrinfo(res);
+	if (socket == Connection::InvalidSocket) {
+		throw std::runtime_error("Failed to listen on port '" + port + "'.");
+	}
+}
+
+Server::~Server() {
+	if (socket != Connection::InvalidSocket) {
+		close_socket(socket);
+	}
+}
+
+Connection *Server::accept(double timeout) {
+	fd_set read_fds;
+	FD_ZERO(&read_fds);
+	FD_SET(socket, &read_fds);
+	timeval tv = to_timeval(timeout);
+	if (select(int(socket + 1), &read_fds, nullptr, nullptr, &tv) <= 0) return nullptr;
+	Socket s = ::accept(socket, nullptr, nullptr);
+	if (s == Connection::InvalidSocket) return nullptr;
+	set_nonblocking(s);
+	return new Connection(s);
+}
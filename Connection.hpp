@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#ifndef _CONNECTION_H_
+#define _CONNECTION_H_
+
+//Minimal non-blocking TCP streams for two-player modes.
+//Data is queued with send() and moved to/from the socket by poll();
+// whatever has arrived waits in recv_buffer until the caller consumes it.
+
+#ifdef _WIN32
+typedef uintptr_t Socket;
+#else
+typedef int Socket;
+#endif
+
+struct Connection {
+	static Socket const InvalidSocket;
+
+	explicit Connection(Socket socket = InvalidSocket) : socket(socket) { }
+	Connection(Connection const &) = delete;
+	~Connection();
+
+	//connect to host:port; returns nullptr (and prints why) on failure:
+	static Connection *connect(std::string const &host, std::string const &port);
+
+	void send(void const *data, size_t size);
+	//send whatever is queued and read whatever has arrived, waiting up to timeout seconds for either:
+	void poll(double timeout = 0.0);
+	void close();
+
+	explicit operator bool() const { return socket != InvalidSocket; }
+
+	Socket socket = InvalidSocket;
+	std::vector< char > send_buffer;
+	std::vector< char > recv_buffer;
+	size_t bytes_sent = 0;
+	size_t bytes_received = 0;
+};
+
+//Listens on a port and hands out incoming connections:
+struct Server {
+	explicit Server(std::string const &port); //throws std::runtime_error if the port can't be opened
+	Server(Server const &) = delete;
+	~Server();
+
+	//wait up to timeout seconds for a client; returns nullptr if none arrived:
+	Connection *accept(double timeout = 0.0);
+
+	Socket socket = Connection::InvalidSocket;
+};
+
+#endif
@@ -0,0 +1,328 @@
+#include "EnemyAI.hpp"
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+
+typedef std::chrono::steady_clock Clock;
+
+// A decision as (unit index, action index, target index + 1), with units indexed as in Battle::units()
+static uint32_t encode(size_t unit, size_t action, int target) {
+    return (uint32_t)((unit << 16) | (action << 8) | (size_t)(target + 1));
+}
+
+static Battle::Decision decode(uint32_t code, std::vector<Object*> const& units) {
+    Battle::Decision decision;
+    decision.object = units[code >> 16];
+    decision.action = (code >> 8) & 0xff;
+    int target = (int)(code & 0xff) - 1;
+    decision.target = target >= 0 ? units[target] : nullptr;
+    return decision;
+}
+
+struct Node {
+    uint32_t code = 0;
+    uint32_t visits = 0;
+    float value = 0.f;
+    std::vector<uint32_t> children;
+};
+
+// Chooses actions for a worker's forked battle: down the tree while it can, then at random
+struct Policy : Battle::Controller {
+    EnemyAI::Worker* worker;
+    Policy(Compiler* compiler, EnemyAI::Worker* worker) : Controller(compiler), worker(worker) {}
+    bool decide(Battle& battle, Battle::Decision* out) override;
+};
+
+struct EnemyAI::Worker {
+    std::vector<Object*> units;
+    std::vector<bool> present; // whether the unit takes part in this level
+    size_t first_enemy = 0;
+    Compiler player_compiler;
+    Compiler enemy_compiler;
+    Battle battle;
+    Policy policy;
+    std::mt19937 rng;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> path;
+    std::vector<uint32_t> options;
+    bool in_tree = false;
+    size_t max_nodes = 0;
+    float exploration = 0.f;
+
+    Worker() : policy(&enemy_compiler, this) {}
+    ~Worker() {
+        for (Object* unit : units) {
+            delete unit;
+        }
+    }
+
+    bool alive(size_t unit) {
+        return present[unit] && units[unit]->property(PROPERTY_ALIVE) != 0;
+    }
+
+    // Every action any living enemy can take against any living unit
+    void legalOptions() {
+        options.clear();
+        for (size_t u = first_enemy; u < units.size(); u++) {
+            if (!alive(u)) {
+                continue;
+            }
+            for (size_t a = 0; a < units[u]->actionNames().size(); a++) {
+                if (units[u]->actions().at(units[u]->actionNames()[a]).has_target) {
+                    for (size_t t = 0; t < units.size(); t++) {
+                        if (alive(t)) {
+                            options.push_back(encode(u, a, (int)t));
+                        }
+                    }
+                } else {
+                    options.push_back(encode(u, a, -1));
+                }
+            }
+        }
+    }
+
+    // Expand an untried option if there is one, otherwise follow the best UCT child
+    uint32_t select() {
+        uint32_t parent = path.back();
+        std::vector<uint32_t> untried;
+        for (uint32_t code : options) {
+            auto const& children = nodes[parent].children;
+            if (std::none_of(children.begin(), children.end(), [&](uint32_t child) { return nodes[child].code == code; })) {
+                untried.push_back(code);
+            }
+        }
+        if (!untried.empty()) {
+            uint32_t code = untried[rng() % untried.size()];
+            in_tree = false;
+            if (nodes.size() < max_nodes) {
+                Node node;
+                node.code = code;
+                nodes.push_back(node);
+                nodes[parent].children.push_back((uint32_t)nodes.size() - 1);
+                path.push_back((uint32_t)nodes.size() - 1);
+            }
+            return code;
+        }
+
+        float log_visits = std::log((float)std::max(nodes[parent].visits, 1u));
+        uint32_t best = 0;
+        float best_score = -1.f;
+        for (uint32_t child : nodes[parent].children) {
+            Node const& node = nodes[child];
+            if (std::find(options.begin(), options.end(), node.code) == options.end()) {
+                continue;
+            }
+            float score = node.value / node.visits + exploration * std::sqrt(log_visits / node.visits);
+            if (score > best_score) {
+                best_score = score;
+                best = child;
+            }
+        }
+        path.push_back(best);
+        return nodes[best].code;
+    }
+
+    bool choose(Battle::Decision* out) {
+        legalOptions();
+        if (options.empty()) {
+            return false;
+        }
+        uint32_t code = in_tree ? select() : options[rng() % options.size()];
+        *out = decode(code, units);
+        return true;
+    }
+
+    // 1 for an enemy win, 0 for a player win, otherwise by remaining health
+    float score() {
+        if (battle.lost) {
+            return 1.f;
+        } else if (battle.won) {
+            return 0.f;
+        }
+        float health[2] = {0.f, 0.f};
+        float health_max[2] = {0.f, 0.f};
+        for (size_t u = 0; u < units.size(); u++) {
+            if (!present[u]) {
+                continue;
+            }
+            int side = u < first_enemy ? 0 : 1;
+            if (alive(u)) {
+                health[side] += (float)std::max(0, units[u]->property(PROPERTY_HEALTH));
+            }
+            health_max[side] += (float)std::max(1, units[u]->property(PROPERTY_HEALTH_MAX));
+        }
+        return 0.5f + 0.5f * (health[1] / health_max[1] - health[0] / health_max[0]);
+    }
+
+    void search(Battle::Snapshot const& root, Clock::time_point deadline, size_t horizon, size_t* iterations) {
+        nodes.clear();
+        nodes.emplace_back();
+        size_t count = 0;
+        while (Clock::now() < deadline) {
+            battle.load(root);
+            path.clear();
+            path.push_back(0);
+            in_tree = true;
+            battle.run(nullptr, nullptr, horizon);
+            float value = score();
+            for (uint32_t index : path) {
+                nodes[index].visits++;
+                nodes[index].value += value;
+            }
+            count++;
+        }
+        *iterations = count;
+    }
+};
+
+bool Policy::decide(Battle& battle, Battle::Decision* out) {
+    return worker->choose(out);
+}
+
+// The pool gets at least one thread besides the caller's, since only its own threads search
+EnemyAI::EnemyAI(Compiler* compiler, size_t threads)
+    : Controller(compiler), pool(std::max<size_t>(threads != 0 ? threads : std::thread::hardware_concurrency(), 2)) {
+}
+
+EnemyAI::~EnemyAI() {
+    // The workers may still be searching
+    pool.wait();
+    for (Worker* worker : workers) {
+        delete worker;
+    }
+}
+
+void EnemyAI::setDifficulty(Difficulty difficulty_) {
+    difficulty = difficulty_;
+    if (difficulty == EASY) {
+        budget = 0.005f;
+    } else if (difficulty == NORMAL || difficulty == ADAPTIVE) {
+        budget = 0.02f;
+    } else if (difficulty == HARD) {
+        budget = 0.06f;
+    }
+}
+
+std::string EnemyAI::difficultyName(Difficulty difficulty) {
+    switch (difficulty) {
+    case EASY:
+        return "EASY";
+    case NORMAL:
+        return "NORMAL";
+    case HARD:
+        return "HARD";
+    case ADAPTIVE:
+        return "ADAPTIVE";
+    default:
+        return "";
+    }
+}
+
+void EnemyAI::adapt(bool player_won) {
+    if (difficulty != ADAPTIVE) {
+        return;
+    }
+    if (player_won) {
+        budget = std::min(budget * 1.5f, 0.1f);
+    } else {
+        budget = std::max(budget / 1.5f, 0.002f);
+    }
+}
+
+void EnemyAI::begin(Battle const& battle, Compiler const& player_compiler, std::vector<std::string> const& player_program) {
+    cancel();
+    for (Worker* worker : workers) {
+        delete worker;
+    }
+    workers.clear();
+
+    std::random_device random;
+    std::vector<Object*> units = battle.units();
+    // The calling thread carries on with the game, so only the pool's own threads search
+    for (size_t w = 0; w < pool.threads.size(); w++) {
+        Worker* worker = new Worker();
+        worker->rng.seed(random());
+        worker->player_compiler.rng.seed(random());
+        worker->enemy_compiler.rng.seed(random());
+        worker->max_nodes = max_nodes;
+        worker->exploration = exploration;
+        worker->first_enemy = battle.player_units.size();
+        for (Object* unit : units) {
+            Object* clone = unit->clone();
+            worker->units.push_back(clone);
+            worker->present.push_back(compiler->objects.count(unit->name) > 0);
+            if (player_compiler.objects.count(unit->name) > 0) {
+                worker->player_compiler.addObject(clone);
+            }
+            if (compiler->objects.count(unit->name) > 0) {
+                worker->enemy_compiler.addObject(clone);
+            }
+        }
+
+        Battle& fork = worker->battle;
+        fork.turn_length = battle.turn_length;
+        fork.player_units.assign(worker->units.begin(), worker->units.begin() + worker->first_enemy);
+        fork.enemy_units.assign(worker->units.begin() + worker->first_enemy, worker->units.end());
+        fork.player_exe = worker->player_compiler.compile(player_program);
+        fork.enemy_controller = &worker->policy;
+        workers.push_back(worker);
+    }
+}
+
+void EnemyAI::cancel() {
+    pool.wait();
+    searching = false;
+}
+
+bool EnemyAI::decide(Battle& battle, Battle::Decision* out) {
+    if (workers.empty()) {
+        return false;
+    }
+    // Nothing changes the battle while the enemy is next to move, so the state searched from is still current
+    if (!searching) {
+        battle.save(&root);
+        deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(budget));
+        counts.assign(workers.size(), 0);
+        searching = true;
+        pool.start(workers.size(), [this](size_t job, size_t) {
+            workers[job]->search(root, deadline, horizon, &counts[job]);
+        });
+    }
+    if (!pool.done()) {
+        return false;
+    }
+    pool.wait();
+    searching = false;
+
+    // Sum root visits over all trees and play the most visited action
+    iterations = 0;
+    std::unordered_map<uint32_t, uint32_t> visits;
+    for (size_t w = 0; w < workers.size(); w++) {
+        iterations += counts[w];
+        for (uint32_t child : workers[w]->nodes[0].children) {
+            visits[workers[w]->nodes[child].code] += workers[w]->nodes[child].visits;
+        }
+    }
+
+    // Without any search (or if the tree never branched), fall back to a random legal action
+    Worker* first = workers[0];
+    first->battle.load(root);
+    first->legalOptions();
+    if (first->options.empty()) {
+        return false;
+    }
+    uint32_t best = first->options[first->rng() % first->options.size()];
+    uint32_t best_visits = 0;
+    for (auto const& entry : visits) {
+        if (entry.second > best_visits && std::find(first->options.begin(), first->options.end(), entry.first) != first->options.end()) {
+            best = entry.first;
+            best_visits = entry.second;
+        }
+    }
+    *out = decode(best, battle.units());
+    return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include "Battle.hpp"
+#include "ThreadPool.hpp"
+
+#ifndef _ENEMY_AI_H_
+#define _ENEMY_AI_H_
+
+// Monte-Carlo tree search controller for the enemy side, used instead of the level's enemy script.
+// Every worker thread keeps its own forked copy of the battle (cloned units, the player's program
+// compiled against them) and grows its own search tree from the current state until the time
+// budget runs out; the root visit counts of all trees are then summed (root parallelization).
+// The search runs on the pool's threads while the game goes on: it starts as soon as the enemy is next to
+// move (Battle::prepareTurn() right after the player's turn), and the battle waits until it is done.
+struct EnemyAI : Battle::Controller {
+    enum Difficulty {
+        EASY,
+        NORMAL,
+        HARD,
+        ADAPTIVE
+    };
+
+    Difficulty difficulty = NORMAL;
+    float budget = 0.02f; // seconds of search per decision
+    float exploration = 1.41f;
+    size_t horizon = 200; // turns per rollout before the position is scored
+    size_t max_nodes = 1 << 16;
+
+    ThreadPool pool;
+    struct Worker;
+    std::vector<Worker*> workers;
+    Battle::Snapshot root;
+    // The search in progress, if any
+    bool searching = false;
+    std::chrono::steady_clock::time_point deadline;
+    std::vector<size_t> counts; // iterations per worker
+
+    // Statistics of the last decision
+    size_t iterations = 0;
+
+    EnemyAI(Compiler* compiler, size_t threads = 0);
+    ~EnemyAI();
+
+    void setDifficulty(Difficulty difficulty);
+    static std::string difficultyName(Difficulty difficulty);
+    // Adaptive difficulty: think longer after the player wins, shorter after the player loses
+    void adapt(bool player_won);
+
+    // Fork the battle for every worker; call after setting up the battle's units and before start()
+    void begin(Battle const& battle, Compiler const& player_compiler, std::vector<std::string> const& player_program);
+    // Starts a search from the battle's state the first time it is asked, then chooses once the search is done
+    bool decide(Battle& battle, Battle::Decision* out) override;
+    bool thinking() override { return searching; }
+    // Wait out the search in progress, if any, and forget it
+    void cancel();
+};
+
+#endif
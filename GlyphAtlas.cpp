@@ -0,0 +1,137 @@
+#include "GlyphAtlas.hpp"
+
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+GlyphAtlas::GlyphAtlas(FT_Library library, std::string const &fontfile) {
+	if (FT_New_Face(library, fontfile.c_str(), 0, &face)) {
+		throw std::runtime_error("Failed to load font '" + fontfile + "' for the glyph atlas.");
+	}
+	if (FT_Set_Pixel_Sizes(face, 0, BaseSize)) {
+		throw std::runtime_error("Failed to size font '" + fontfile + "' for the glyph atlas.");
+	}
+
+	//start out empty (all "far outside"), so filtering at the edge of a glyph never reads garbage:
+	std::vector< uint8_t > empty(TextureSize * TextureSize, 0);
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, TextureSize, TextureSize, 0, GL_RED, GL_UNSIGNED_BYTE, empty.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	//distance fields are meant to be filtered:
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	//metrics are looked up with texelFetch, so are never filtered:
+	glGenTextures(1, &table);
+	glBindTexture(GL_TEXTURE_2D, table);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16I, 2, MaxGlyphs, 0, GL_RGBA_INTEGER, GL_SHORT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	GL_ERRORS();
+}
+
+GlyphAtlas::~GlyphAtlas() {
+	if (texture != 0) {
+		glDeleteTextures(1, &texture);
+		texture = 0;
+	}
+	if (table != 0) {
+		glDeleteTextures(1, &table);
+		table = 0;
+	}
+}
+
+GlyphAtlas::Glyph const &GlyphAtlas::glyph(uint32_t character) {
+	auto f = glyphs.find(character);
+	if (f != glyphs.end()) return f->second;
+
+	Glyph &glyph = glyphs[character];
+	FT_UInt glyph_index = FT_Get_Char_Index(face, character);
+	if (FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT) || FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL)) {
+		std::cout << "Warning: could not render character " << character << " into the glyph atlas." << std::endl;
+		return glyph;
+	}
+	FT_Bitmap const &bitmap = face->glyph->bitmap;
+	if (bitmap.width == 0 || bitmap.rows == 0) return glyph;
+
+	glm::ivec2 size = glm::ivec2(bitmap.width + 2 * Spread, bitmap.rows + 2 * Spread);
+	//one texel of gutter keeps filtering from bleeding between neighbours:
+	if (cursor.x + size.x + 1 > TextureSize) {
+		cursor = glm::ivec2(1, cursor.y + shelf_height + 1);
+		shelf_height = 0;
+	}
+	if (cursor.y + size.y + 1 > TextureSize || table_rows == MaxGlyphs) {
+		std::cout << "Warning: the glyph atlas is full, so character " << character << " will not be drawn." << std::endl;
+		return glyph;
+	}
+
+	std::vector< uint8_t > field = distance_field(bitmap.buffer, bitmap.width, bitmap.rows, bitmap.pitch);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, cursor.x, cursor.y, size.x, size.y, GL_RED, GL_UNSIGNED_BYTE, field.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	GL_ERRORS();
+
+	glyph.atlas_min = cursor;
+	glyph.atlas_size = size;
+	glyph.bearing = glm::ivec2(face->glyph->bitmap_left - Spread, face->glyph->bitmap_top - int(bitmap.rows) - Spread);
+	glyph.index = table_rows++;
+
+	int16_t row[8] = {
+		int16_t(glyph.atlas_min.x), int16_t(glyph.atlas_min.y), int16_t(glyph.atlas_size.x), int16_t(glyph.atlas_size.y),
+		int16_t(glyph.bearing.x), int16_t(glyph.bearing.y), 0, 0
+	};
+	glBindTexture(GL_TEXTURE_2D, table);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, glyph.index, 2, 1, GL_RGBA_INTEGER, GL_SHORT, row);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	GL_ERRORS();
+
+	cursor.x += size.x + 1;
+	shelf_height = std::max(shelf_height, size.y);
+	return glyph;
+}
+
+std::vector< uint8_t > GlyphAtlas::distance_field(uint8_t const *coverage, int width, int rows, int pitch) {
+	auto inside = [&](int x, int y) {
+		if (x < 0 || x >= width || y < 0 || y >= rows) return false;
+		return coverage[y * pitch + x] >= 128;
+	};
+
+	int out_width = width + 2 * Spread;
+	int out_rows = rows + 2 * Spread;
+	std::vector< uint8_t > field(out_width * out_rows);
+	for (int oy = 0; oy < out_rows; ++oy) {
+		for (int ox = 0; ox < out_width; ++ox) {
+			int x = ox - Spread;
+			int y = (out_rows - 1 - oy) - Spread; //the field is stored bottom row first
+			bool in = inside(x, y);
+
+			//nearest pixel on the other side of the outline, looking no further than Spread:
+			int best = (Spread + 1) * (Spread + 1);
+			for (int dy = -Spread; dy <= Spread; ++dy) {
+				for (int dx = -Spread; dx <= Spread; ++dx) {
+					int d2 = dx * dx + dy * dy;
+					if (d2 < best && inside(x + dx, y + dy) != in) {
+						best = d2;
+					}
+				}
+			}
+			//the outline runs about halfway between the two pixels:
+			float distance = std::min(std::sqrt(float(best)) - 0.5f, float(Spread));
+			float value = 127.5f + (in ? distance : -distance) * (127.5f / Spread);
+			field[oy * out_width + ox] = uint8_t(std::clamp(value, 0.0f, 255.0f));
+		}
+	}
+	return field;
+}
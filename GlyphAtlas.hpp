@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+ * "GlyphAtlas" keeps signed distance fields of the glyphs drawn so far in one
+ *  texture, so text of any size can be drawn from it (and in one batch).
+ * Glyphs are rendered the first time they are asked for, packed into rows
+ *  ("shelves") and uploaded on their own with glTexSubImage2D.
+ * Each glyph also gets an index into a small table texture of its metrics, so a
+ *  shader can build its quad from just (pen, index, size).
+ *
+ */
+
+#include "GL.hpp"
+
+#include <freetype/freetype.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct GlyphAtlas {
+	//opens its own face of fontfile, since it changes the face's size; needs a GL context:
+	GlyphAtlas(FT_Library library, std::string const &fontfile);
+	~GlyphAtlas();
+	GlyphAtlas(GlyphAtlas const &) = delete;
+
+	struct Glyph {
+		glm::ivec2 atlas_min = glm::ivec2(0); //lower left texel of the distance field
+		glm::ivec2 atlas_size = glm::ivec2(0); //(0,0) for glyphs with nothing to draw, like ' '
+		glm::ivec2 bearing = glm::ivec2(0); //from the pen position to atlas_min's corner, in BaseSize pixels
+		uint16_t index = 0; //row of table holding the above
+	};
+
+	//the glyph of a character, rendered into the atlas the first time it is asked for:
+	Glyph const &glyph(uint32_t character);
+
+	//distance field of a coverage bitmap (rows top to bottom), Spread texels larger on each side
+	// and stored bottom to top; 128 is on the outline, larger values inside:
+	static std::vector< uint8_t > distance_field(uint8_t const *coverage, int width, int rows, int pitch);
+
+	enum : int {
+		BaseSize = 48, //pixel size the distance fields are rendered at
+		Spread = 6, //distance, in texels, at which the field saturates
+		TextureSize = 1024,
+		MaxGlyphs = 1024 //rows of table
+	};
+
+	FT_Face face = nullptr;
+	GLuint texture = 0; //GL_R8, TextureSize x TextureSize
+	//GL_RGBA16I, 2 x MaxGlyphs; row i is (atlas_min, atlas_size), (bearing, 0, 0) of the glyph with index i:
+	GLuint table = 0;
+	uint16_t table_rows = 0;
+	std::unordered_map< uint32_t, Glyph > glyphs;
+
+	//shelf packing: glyphs fill the current row left to right, and the next row starts above its tallest glyph:
+	glm::ivec2 cursor = glm::ivec2(1, 1);
+	int shelf_height = 0;
+};
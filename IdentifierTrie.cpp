@@ -0,0 +1,134 @@
+#include "IdentifierTrie.hpp"
+
+#include <algorithm>
+
+IdentifierTrie::IdentifierTrie() {
+	clear();
+}
+
+bool IdentifierTrie::better(Candidate const &a, Candidate const &b) {
+	if (a.tier != b.tier) return a.tier < b.tier;
+	if (a.word->size() != b.word->size()) return a.word->size() < b.word->size();
+	return *a.word < *b.word;
+}
+
+void IdentifierTrie::clear() {
+	entries.clear();
+	nodes.clear();
+	nodes.emplace_back();
+}
+
+void IdentifierTrie::insert(std::string const &word, uint32_t tier) {
+	//the entry is made up front so a new leaf can point its edge into it:
+	uint32_t entry = uint32_t(entries.size());
+	entries.emplace_back();
+	entries.back().word = word;
+	entries.back().tier = tier;
+
+	std::vector< uint32_t > path{0};
+	uint32_t node = 0;
+	size_t i = 0;
+	while (i < word.size()) {
+		uint32_t next = child(node, word[i]);
+		if (next == 0) {
+			//nothing shares the rest of the word, so it is one new leaf:
+			Node leaf;
+			leaf.word = entry;
+			leaf.begin = uint32_t(i);
+			leaf.end = uint32_t(word.size());
+			next = uint32_t(nodes.size());
+			nodes.emplace_back(std::move(leaf));
+			std::vector< uint32_t > &children = nodes[node].children;
+			children.insert(std::upper_bound(children.begin(), children.end(), word[i], [this](char c, uint32_t n) {
+				return c < entries[nodes[n].word].word[nodes[n].begin];
+			}), next);
+			node = next;
+			path.emplace_back(node);
+			break;
+		}
+
+		std::string const &edge = entries[nodes[next].word].word;
+		uint32_t k = nodes[next].begin;
+		while (k < nodes[next].end && i < word.size() && edge[k] == word[i]) {
+			++k;
+			++i;
+		}
+		if (k < nodes[next].end) {
+			//the word leaves (or ends inside) the edge, so split it where they differ:
+			Node middle;
+			middle.word = nodes[next].word;
+			middle.begin = nodes[next].begin;
+			middle.end = k;
+			middle.children.emplace_back(next);
+			middle.ranked = nodes[next].ranked;
+			nodes[next].begin = k;
+			uint32_t split = uint32_t(nodes.size());
+			nodes.emplace_back(std::move(middle));
+			std::replace(nodes[node].children.begin(), nodes[node].children.end(), next, split);
+			next = split;
+		}
+		node = next;
+		path.emplace_back(node);
+	}
+
+	if (nodes[node].entry >= 0) {
+		//already indexed; only a better tier changes anything:
+		entries.pop_back();
+		entry = uint32_t(nodes[node].entry);
+		if (tier >= entries[entry].tier) return;
+		entries[entry].tier = tier;
+	} else {
+		nodes[node].entry = int32_t(entry);
+	}
+	for (uint32_t n : path) {
+		rank(n, entry);
+	}
+}
+
+void IdentifierTrie::complete(std::string const &prefix, size_t limit, std::vector< Candidate > *out) const {
+	uint32_t node = 0;
+	size_t i = 0;
+	while (i < prefix.size()) {
+		node = child(node, prefix[i]);
+		if (node == 0) return;
+		std::string const &edge = entries[nodes[node].word].word;
+		for (uint32_t k = nodes[node].begin; k < nodes[node].end && i < prefix.size(); ++k, ++i) {
+			if (edge[k] != prefix[i]) return;
+		}
+	}
+
+	for (uint32_t entry : nodes[node].ranked) {
+		Candidate candidate;
+		candidate.word = &entries[entry].word;
+		candidate.tier = entries[entry].tier;
+		auto same = [&](Candidate const &c) { return *c.word == *candidate.word; };
+		if (std::find_if(out->begin(), out->end(), same) != out->end()) continue;
+		out->insert(std::upper_bound(out->begin(), out->end(), candidate, better), candidate);
+		if (out->size() > limit) out->pop_back();
+	}
+}
+
+bool IdentifierTrie::entry_better(uint32_t a, uint32_t b) const {
+	Candidate ca, cb;
+	ca.word = &entries[a].word;
+	ca.tier = entries[a].tier;
+	cb.word = &entries[b].word;
+	cb.tier = entries[b].tier;
+	return better(ca, cb);
+}
+
+void IdentifierTrie::rank(uint32_t node, uint32_t entry) {
+	std::vector< uint32_t > &ranked = nodes[node].ranked;
+	ranked.erase(std::remove(ranked.begin(), ranked.end(), entry), ranked.end());
+	ranked.insert(std::upper_bound(ranked.begin(), ranked.end(), entry, [this](uint32_t a, uint32_t b) {
+		return entry_better(a, b);
+	}), entry);
+	if (ranked.size() > MaxRanked) ranked.pop_back();
+}
+
+uint32_t IdentifierTrie::child(uint32_t node, char c) const {
+	for (uint32_t n : nodes[node].children) {
+		if (entries[nodes[n].word].word[nodes[n].begin] == c) return n;
+	}
+	return 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+/*
+ * "IdentifierTrie" indexes the names autofill can complete as a radix trie:
+ *  each edge is a run of characters, stored as a slice of one of the words,
+ *  and each node keeps its best few completions, ranked, so looking up a
+ *  prefix walks the prefix once and never visits the words below it.
+ * Words rank by tier (lower first), then by length, then alphabetically.
+ *
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct IdentifierTrie {
+	IdentifierTrie(); //empty
+
+	//completions kept per node, so the most complete() can return:
+	enum : size_t { MaxRanked = 8 };
+
+	struct Candidate {
+		std::string const *word = nullptr; //valid until the trie is changed
+		uint32_t tier = 0;
+	};
+	//whether a ranks before b:
+	static bool better(Candidate const &a, Candidate const &b);
+
+	void clear();
+	//add word (again, with the lower tier, if it is already here):
+	void insert(std::string const &word, uint32_t tier = 0);
+
+	//merge the best completions of prefix (including prefix itself) into out, which stays ranked
+	// and at most limit long, so several tries can be asked in turn:
+	void complete(std::string const &prefix, size_t limit, std::vector< Candidate > *out) const;
+
+	struct Entry {
+		std::string word;
+		uint32_t tier = 0;
+	};
+	std::vector< Entry > entries;
+
+	//the edge into a node is entries[word].word[begin, end):
+	struct Node {
+		uint32_t word = 0;
+		uint32_t begin = 0, end = 0;
+		int32_t entry = -1; //the word ending here, if any
+		std::vector< uint32_t > children; //sorted by first character of their edges
+		std::vector< uint32_t > ranked; //best entries ending at or below this node, best first
+	};
+	std::vector< Node > nodes; //nodes[0] is the root, with an empty edge
+
+	bool entry_better(uint32_t a, uint32_t b) const;
+	//put entry in the ranked list of node, if it is among the best:
+	void rank(uint32_t node, uint32_t entry);
+	//the child of node whose edge starts with c, or 0:
+	uint32_t child(uint32_t node, char c) const;
+};
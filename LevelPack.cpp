@@ -0,0 +1,332 @@
+#include "LevelPack.hpp"
+#include "Actions.hpp"
+#include "Battle.hpp"
+#include "read_write_chunk.hpp"
+#include <fstream>
+#include <stdexcept>
+
+struct UnitEntry {
+    uint32_t name_begin, name_end;
+    uint32_t model_begin, model_end;
+    uint32_t team;
+    int32_t first_level;
+    glm::vec2 start_position;
+    uint32_t actions_begin, actions_end;
+    uint32_t properties_begin, properties_end;
+};
+static_assert(sizeof(UnitEntry) == 4 * 4 + 4 + 4 + 4 * 2 + 4 * 4, "UnitEntry is packed");
+
+struct ActionEntry {
+    uint32_t name_begin, name_end;
+    uint32_t function_begin, function_end;
+    float turns;
+    uint32_t has_target;
+};
+static_assert(sizeof(ActionEntry) == 4 * 4 + 4 + 4, "ActionEntry is packed");
+
+struct PropertyEntry {
+    uint32_t name_begin, name_end;
+    int32_t value;
+};
+static_assert(sizeof(PropertyEntry) == 4 * 2 + 4, "PropertyEntry is packed");
+
+struct LevelEntry {
+    uint32_t guidance_begin, guidance_end;
+    uint32_t scene_begin, scene_end;
+    uint32_t enemies_begin, enemies_end;
+    uint32_t script_begin, script_end; // within the code chunk
+};
+static_assert(sizeof(LevelEntry) == 4 * 8, "LevelEntry is packed");
+
+void LevelPack::load(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open level pack '" + path + "'");
+    }
+
+    std::vector<Header> headers;
+    read_chunk(in, "lvpk", &headers);
+    if (headers.size() != 1 || headers[0].version != VERSION) {
+        throw std::runtime_error("Unsupported level pack version in '" + path + "'");
+    }
+    std::vector<char> strings;
+    read_chunk(in, "str0", &strings);
+    std::vector<UnitEntry> unit_entries;
+    read_chunk(in, "unit", &unit_entries);
+    std::vector<ActionEntry> action_entries;
+    read_chunk(in, "actn", &action_entries);
+    std::vector<PropertyEntry> property_entries;
+    read_chunk(in, "prop", &property_entries);
+    std::vector<LevelEntry> level_entries;
+    read_chunk(in, "levl", &level_entries);
+    std::vector<uint32_t> rosters;
+    read_chunk(in, "rost", &rosters);
+
+    // Leave the scripts on disk, only noting where the code chunk is
+    char magic[4];
+    uint32_t code_size = 0;
+    if (!in.read(magic, 4) || !in.read(reinterpret_cast<char*>(&code_size), 4) || std::string(magic, 4) != "code") {
+        throw std::runtime_error("Level pack '" + path + "' has no scripts");
+    }
+    uint64_t code_begin = (uint64_t)in.tellg();
+
+    auto string = [&](uint32_t begin, uint32_t end) {
+        if (!(begin <= end && end <= strings.size())) {
+            throw std::runtime_error("Level pack '" + path + "' contains invalid string indices");
+        }
+        return std::string(strings.begin() + begin, strings.begin() + end);
+    };
+    auto check_range = [&](uint32_t begin, uint32_t end, size_t size, char const* what) {
+        if (!(begin <= end && end <= size)) {
+            throw std::runtime_error("Level pack '" + path + "' contains invalid " + what + " indices");
+        }
+    };
+
+    units.clear();
+    for (UnitEntry const& entry : unit_entries) {
+        Unit unit;
+        unit.name = string(entry.name_begin, entry.name_end);
+        unit.model = string(entry.model_begin, entry.model_end);
+        if (entry.team != TEAM_PLAYER && entry.team != TEAM_ENEMY) {
+            throw std::runtime_error("Level pack '" + path + "' gives " + unit.name + " no team");
+        }
+        unit.team = (Team)entry.team;
+        unit.start_position = entry.start_position;
+        unit.first_level = entry.first_level;
+        check_range(entry.actions_begin, entry.actions_end, action_entries.size(), "action");
+        for (uint32_t a = entry.actions_begin; a < entry.actions_end; a++) {
+            ActionEntry const& action = action_entries[a];
+            unit.actions.push_back(ActionInfo{
+                string(action.name_begin, action.name_end),
+                string(action.function_begin, action.function_end),
+                action.turns,
+                action.has_target != 0
+            });
+        }
+        check_range(entry.properties_begin, entry.properties_end, property_entries.size(), "property");
+        for (uint32_t p = entry.properties_begin; p < entry.properties_end; p++) {
+            PropertyEntry const& property = property_entries[p];
+            unit.properties.push_back(Property{string(property.name_begin, property.name_end), property.value});
+        }
+        units.push_back(unit);
+    }
+
+    levels.clear();
+    script_ranges.clear();
+    for (LevelEntry const& entry : level_entries) {
+        Level level;
+        level.guidance = string(entry.guidance_begin, entry.guidance_end);
+        level.scene = string(entry.scene_begin, entry.scene_end);
+        check_range(entry.enemies_begin, entry.enemies_end, rosters.size(), "roster");
+        for (uint32_t r = entry.enemies_begin; r < entry.enemies_end; r++) {
+            if (rosters[r] >= units.size() || units[rosters[r]].team != TEAM_ENEMY) {
+                throw std::runtime_error("Level pack '" + path + "' lists a unit that is not an enemy in level " + std::to_string(levels.size() + 1));
+            }
+            level.enemies.push_back(rosters[r]);
+        }
+        check_range(entry.script_begin, entry.script_end, code_size, "script");
+        script_ranges.emplace_back(code_begin + entry.script_begin, code_begin + entry.script_end);
+        levels.push_back(level);
+    }
+    filename = path;
+    buildArchetypes();
+}
+
+void LevelPack::buildArchetypes() {
+    for (Unit& unit : units) {
+        if (unit.archetype != nullptr) {
+            continue;
+        }
+        auto archetype = std::make_shared<Archetype>();
+        for (ActionInfo const& action : unit.actions) {
+            ActionFunction func = action_function_named(action.function);
+            if (func == nullptr) {
+                throw std::runtime_error("Level pack '" + filename + "' gives " + unit.name + " unknown action function '" + action.function + "'");
+            }
+            archetype->addAction(action.name, func, turn_duration() * action.turns, action.has_target);
+        }
+        for (Property const& property : unit.properties) {
+            archetype->addProperty(property.name, property.value);
+        }
+        unit.archetype = archetype;
+    }
+}
+
+void LevelPack::save(std::string const& path) const {
+    std::vector<char> strings;
+    auto add_string = [&](std::string const& str, uint32_t* begin, uint32_t* end) {
+        *begin = (uint32_t)strings.size();
+        strings.insert(strings.end(), str.begin(), str.end());
+        *end = (uint32_t)strings.size();
+    };
+
+    std::vector<UnitEntry> unit_entries;
+    std::vector<ActionEntry> action_entries;
+    std::vector<PropertyEntry> property_entries;
+    for (Unit const& unit : units) {
+        UnitEntry entry;
+        add_string(unit.name, &entry.name_begin, &entry.name_end);
+        add_string(unit.model, &entry.model_begin, &entry.model_end);
+        entry.team = (uint32_t)unit.team;
+        entry.first_level = unit.first_level;
+        entry.start_position = unit.start_position;
+        entry.actions_begin = (uint32_t)action_entries.size();
+        for (ActionInfo const& action : unit.actions) {
+            ActionEntry action_entry;
+            add_string(action.name, &action_entry.name_begin, &action_entry.name_end);
+            add_string(action.function, &action_entry.function_begin, &action_entry.function_end);
+            action_entry.turns = action.turns;
+            action_entry.has_target = action.has_target ? 1 : 0;
+            action_entries.push_back(action_entry);
+        }
+        entry.actions_end = (uint32_t)action_entries.size();
+        entry.properties_begin = (uint32_t)property_entries.size();
+        for (Property const& property : unit.properties) {
+            PropertyEntry property_entry;
+            add_string(property.name, &property_entry.name_begin, &property_entry.name_end);
+            property_entry.value = property.value;
+            property_entries.push_back(property_entry);
+        }
+        entry.properties_end = (uint32_t)property_entries.size();
+        unit_entries.push_back(entry);
+    }
+
+    std::vector<LevelEntry> level_entries;
+    std::vector<uint32_t> rosters;
+    std::vector<char> code;
+    for (Level const& level : levels) {
+        LevelEntry entry;
+        add_string(level.guidance, &entry.guidance_begin, &entry.guidance_end);
+        add_string(level.scene, &entry.scene_begin, &entry.scene_end);
+        entry.enemies_begin = (uint32_t)rosters.size();
+        rosters.insert(rosters.end(), level.enemies.begin(), level.enemies.end());
+        entry.enemies_end = (uint32_t)rosters.size();
+        entry.script_begin = (uint32_t)code.size();
+        for (std::string const& line : level.script) {
+            code.insert(code.end(), line.begin(), line.end());
+            code.push_back('\n');
+        }
+        entry.script_end = (uint32_t)code.size();
+        level_entries.push_back(entry);
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        throw std::runtime_error("Failed to open level pack '" + path + "' for writing");
+    }
+    write_chunk("lvpk", std::vector<Header>{Header()}, &out);
+    write_chunk("str0", strings, &out);
+    write_chunk("unit", unit_entries, &out);
+    write_chunk("actn", action_entries, &out);
+    write_chunk("prop", property_entries, &out);
+    write_chunk("levl", level_entries, &out);
+    write_chunk("rost", rosters, &out);
+    write_chunk("code", code, &out);
+    if (!out) {
+        throw std::runtime_error("Failed to write level pack '" + path + "'");
+    }
+}
+
+std::vector<std::string> LevelPack::script(size_t level) const {
+    if (level >= script_ranges.size()) {
+        throw std::runtime_error("There is no level " + std::to_string(level + 1) + " in level pack '" + filename + "'");
+    }
+    std::ifstream in(filename, std::ios::binary);
+    std::string text(script_ranges[level].second - script_ranges[level].first, '\0');
+    if (!in.seekg((std::streamoff)script_ranges[level].first) || !in.read(&text[0], (std::streamsize)text.size())) {
+        throw std::runtime_error("Failed to read the script of level " + std::to_string(level + 1) + " from '" + filename + "'");
+    }
+
+    std::vector<std::string> lines;
+    size_t begin = 0;
+    while (begin < text.size()) {
+        size_t end = text.find('\n', begin);
+        if (end == std::string::npos) {
+            end = text.size(); // an unterminated last line
+        }
+        lines.push_back(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return lines;
+}
+
+LevelPrefetch::LevelPrefetch() {
+    thread = std::thread(&LevelPrefetch::work, this);
+}
+
+LevelPrefetch::~LevelPrefetch() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    thread.join();
+}
+
+void LevelPrefetch::request(LevelPack const* pack, int level) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pack == requested_pack && level == requested_level) {
+            return;
+        }
+        requested_pack = pack;
+        requested_level = level;
+        pending = true;
+        ready = false;
+    }
+    wake.notify_all();
+}
+
+LevelPrefetch::Script LevelPrefetch::take(LevelPack const* pack, int level) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (pack == requested_pack && level == requested_level) {
+            wake.wait(lock, [&]() { return ready; });
+            Script script = std::move(prepared);
+            requested_pack = nullptr;
+            requested_level = -1;
+            ready = false;
+            // The worker gives up on reading errors; reading again here reports them
+            if (script.level == level) {
+                return script;
+            }
+        }
+    }
+    return read(pack, level);
+}
+
+void LevelPrefetch::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [&]() { return quit || pending; });
+        if (quit) {
+            return;
+        }
+        LevelPack const* pack = requested_pack;
+        int level = requested_level;
+        pending = false;
+
+        lock.unlock();
+        Script script;
+        try {
+            script = read(pack, level);
+        } catch (std::exception&) {
+            script.level = -1;
+        }
+        lock.lock();
+
+        if (!pending && pack == requested_pack && level == requested_level) {
+            prepared = std::move(script);
+            ready = true;
+            wake.notify_all();
+        }
+    }
+}
+
+LevelPrefetch::Script LevelPrefetch::read(LevelPack const* pack, int level) {
+    Script script;
+    script.lines = pack->script((size_t)level);
+    script.program = Compiler::readProgram(script.lines);
+    script.level = level;
+    return script;
+}
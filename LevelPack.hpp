@@ -0,0 +1,114 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Object.hpp"
+#include "Compiler.hpp"
+
+#ifndef _LEVEL_PACK_H_
+#define _LEVEL_PACK_H_
+
+// Every unit and level of the game in one file, built from levels.txt by pack-levels.
+// Saved in the read_write_chunk.hpp chunk format:
+//  lvpk <Header>
+//  str0 <char>        names, models, scenes and guidance, referenced as [begin, end)
+//  unit <UnitEntry>   with their actions and properties in actn and prop
+//  actn <ActionEntry>
+//  prop <PropertyEntry>
+//  levl <LevelEntry>  with their enemies as unit indices in rost
+//  rost <uint32_t>
+//  code <char>        the enemy scripts; load() only notes where they are, script() reads one on demand
+struct LevelPack {
+    static const uint32_t VERSION = 1;
+
+    struct Header {
+        uint32_t version = VERSION;
+    };
+    static_assert(sizeof(Header) == 4, "Level pack header is packed");
+
+    struct Property {
+        std::string name;
+        int value = 0;
+    };
+
+    struct ActionInfo {
+        std::string name;
+        std::string function; // as named by action_function_named()
+        float turns = 1.f; // duration, in multiples of turn_duration()
+        bool has_target = true;
+    };
+
+    struct Unit {
+        std::string name;
+        std::string model;
+        Team team = TEAM_NONE;
+        glm::vec2 start_position = glm::vec2(0.f);
+        int first_level = 0; // player units sit out earlier levels
+        std::vector<ActionInfo> actions;
+        std::vector<Property> properties;
+        std::shared_ptr<Archetype> archetype; // the actions and properties above, shared by every object made from the unit
+    };
+
+    struct Level {
+        std::string guidance;
+        std::string scene; // the backdrop model
+        std::vector<uint32_t> enemies; // indices into units
+        std::vector<std::string> script; // only filled by whoever builds a pack; use script() to read one
+    };
+
+    std::vector<Unit> units;
+    std::vector<Level> levels;
+
+    // Throws std::runtime_error if the file is missing or malformed
+    void load(std::string const& filename);
+    void save(std::string const& filename) const;
+    // Fills in the archetype of every unit that has none; load() already does.
+    // Throws std::runtime_error if a unit names an unknown action function
+    void buildArchetypes();
+    // The level's enemy script, read from the file load() was given; safe to call from several threads
+    std::vector<std::string> script(size_t level) const;
+
+    std::string filename;
+    std::vector<std::pair<uint64_t, uint64_t>> script_ranges; // [begin, end) file offsets
+};
+
+// Reads and tokenizes the enemy script of the level about to be played on a worker thread,
+// so moving on to it never waits for the disk. Only the most recent request is kept.
+struct LevelPrefetch {
+    struct Script {
+        int level = -1;
+        std::vector<std::string> lines;
+        Compiler::Program program;
+    };
+
+    LevelPrefetch();
+    ~LevelPrefetch();
+    LevelPrefetch(LevelPrefetch const&) = delete;
+
+    // The pack must stay alive and unchanged until the request is taken or replaced
+    void request(LevelPack const* pack, int level);
+    // The level's script: waits if the worker is still on it, and reads it right here if it was never requested
+    Script take(LevelPack const* pack, int level);
+
+    // Worker side
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    LevelPack const* requested_pack = nullptr;
+    int requested_level = -1;
+    bool pending = false; // requested but not picked up by the worker yet
+    bool ready = false; // prepared holds the requested level
+    Script prepared;
+    bool quit = false;
+
+    void work();
+    static Script read(LevelPack const* pack, int level);
+};
+
+#endif
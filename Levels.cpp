@@ -0,0 +1,94 @@
+#include "Levels.hpp"
+#include "data_path.hpp"
+
+// An object without a model, for running levels without the game
+static Object* makeHeadless(std::string const& name, std::string const& model_name, Team team) {
+	Object* obj = new Object(name, team);
+	obj->model_name = model_name;
+	obj->transform = new Scene::Transform();
+	return obj;
+}
+
+Levels::~Levels() {
+	if (!headless) {
+		return;
+	}
+	for (Object* unit : units) {
+		delete unit->transform;
+		delete unit;
+	}
+}
+
+// Marked headless first, so units made before a failure are freed too
+void Levels::createHeadless() {
+	headless = true;
+	create(makeHeadless);
+}
+
+void Levels::createHeadless(LevelPack const& from) {
+	headless = true;
+	create(makeHeadless, from);
+}
+
+void Levels::create(MakeObject const& make) {
+	LevelPack loaded;
+	loaded.load(data_path("levels.pack"));
+	create(make, loaded);
+}
+
+void Levels::create(MakeObject const& make, LevelPack const& from) {
+	pack = from;
+	pack.buildArchetypes();
+	for (LevelPack::Unit const& unit : pack.units) {
+		Object* obj = make(unit.name, unit.model, unit.team);
+		units.push_back(obj);
+		obj->start_position = unit.start_position;
+		obj->setArchetype(unit.archetype);
+
+		if (unit.team == Team::TEAM_PLAYER) {
+			player_units.push_back(obj);
+			first_levels.push_back(unit.first_level);
+			player_positions.push_back(unit.start_position);
+			if (unit.name == "BRAWLER") {
+				brawler = obj;
+			} else if (unit.name == "CASTER") {
+				caster = obj;
+			} else if (unit.name == "RANGER") {
+				ranger = obj;
+			} else if (unit.name == "HEALER") {
+				healer = obj;
+			}
+		}
+	}
+
+	for (LevelPack::Level const& level : pack.levels) {
+		std::vector<Object*> enemies;
+		for (uint32_t unit : level.enemies) {
+			enemies.push_back(units[unit]);
+		}
+		enemy_units.push_back(enemies);
+		guidance.push_back(level.guidance);
+		scenes.push_back(level.scene);
+	}
+}
+
+// Only the units taking part in the level are known to the compilers; the others are moved offscreen
+void Levels::setup(int level, Compiler* player_compiler, Compiler* enemy_compiler) {
+	player_compiler->clearObjects();
+	enemy_compiler->clearObjects();
+	for (size_t i = 0; i < player_units.size(); i++) {
+		Object* unit = player_units[i];
+		if (level >= first_levels[i]) {
+			player_compiler->addObject(unit);
+			enemy_compiler->addObject(unit);
+			unit->start_position = player_positions[i];
+		} else {
+			unit->start_position = glm::vec2(100.f, 0.f);
+		}
+	}
+
+	for (Object* u : enemy_units[level]) {
+		player_compiler->addObject(u);
+		enemy_compiler->addObject(u);
+	}
+}
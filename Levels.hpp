@@ -0,0 +1,51 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "Object.hpp"
+#include "Compiler.hpp"
+#include "LevelPack.hpp"
+
+#ifndef _LEVELS_H_
+#define _LEVELS_H_
+
+// The player's units, each level's enemies and enemy program, and the tutorial text, as defined by a LevelPack.
+// Units are created through a callback so the game can give them models while tools run headless;
+// headless units belong to the Levels that made them, which is why it cannot be copied.
+struct Levels {
+	typedef std::function<Object*(std::string const& name, std::string const& model_name, Team team)> MakeObject;
+
+	Levels() = default;
+	Levels(Levels const&) = delete;
+	Levels& operator=(Levels const&) = delete;
+	~Levels(); // frees the units, if they are headless
+
+	// The game's own player units, found by name; nullptr if the pack has no such unit
+	Object* brawler = nullptr;
+	Object* caster = nullptr;
+	Object* ranger = nullptr;
+	Object* healer = nullptr;
+	std::vector<Object*> player_units;
+	std::vector<int> first_levels; // of each player unit
+	std::vector<glm::vec2> player_positions; // of each player unit, in the levels it takes part in
+	std::vector<std::vector<Object*>> enemy_units;
+	std::vector<Object*> units; // every unit made, each once, in pack order
+	bool headless = false;
+	std::vector<std::string> guidance;
+	std::vector<std::string> scenes;
+	LevelPack pack;
+
+	// Both throw std::runtime_error if the pack is missing, malformed or names an unknown action
+	void create(MakeObject const& make); // from dist/levels.pack
+	void create(MakeObject const& make, LevelPack const& from);
+	// Units without models, for running levels without the game
+	void createHeadless();
+	void createHeadless(LevelPack const& from);
+	void setup(int level, Compiler* player_compiler, Compiler* enemy_compiler);
+	size_t size() const { return enemy_units.size(); }
+	// The level's enemy program, read from the pack
+	std::vector<std::string> script(int level) const { return pack.script((size_t)level); }
+};
+
+#endif
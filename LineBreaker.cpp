@@ -0,0 +1,74 @@
+#include "LineBreaker.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+LineBreaker::LineBreaker(TextShaper *shaper_) : shaper(shaper_) {
+}
+
+std::vector< LineBreaker::Line > const &LineBreaker::wrap(std::string const &text, double width, double margin, double scale) {
+	size_t key = std::hash< std::string >()(text);
+	for (double value : {width, margin, scale}) {
+		key = (key ^ std::hash< double >()(value)) * 0x100000001b3ULL;
+	}
+
+	auto f = layout_of.find(key);
+	if (f != layout_of.end()) {
+		layouts.splice(layouts.begin(), layouts, f->second);
+		Layout &layout = layouts.front();
+		if (layout.text == text && layout.width == width && layout.margin == margin && layout.scale == scale) return layout.lines;
+		//a different layout with the same hash; wrap it into this one instead
+	} else {
+		if (layouts.size() == MaxLayouts) {
+			layout_of.erase(layouts.back().key);
+			layouts.splice(layouts.begin(), layouts, std::prev(layouts.end()));
+		} else {
+			layouts.emplace_front();
+		}
+		layouts.front().key = key;
+		layout_of.emplace(key, layouts.begin());
+	}
+
+	Layout &layout = layouts.front();
+	layout.text = text;
+	layout.width = width;
+	layout.margin = margin;
+	layout.scale = scale;
+	break_lines(text, shaper->shape(text), width, margin, scale, &layout.lines);
+	return layout.lines;
+}
+
+void LineBreaker::break_lines(std::string const &text, std::vector< hb_glyph_position_t > const &positions, double width, double margin, double scale, std::vector< Line > *lines) {
+	lines->clear();
+	size_t count = std::min(text.size(), positions.size());
+
+	//pen position before each glyph, from the start of the text:
+	std::vector< double > pen(count + 1, 0.0);
+	for (size_t i = 0; i < count; ++i) {
+		pen[i + 1] = pen[i] + positions[i].x_advance * scale / 64.;
+	}
+	//where the word after each space ends (at the next space, or the end of the text):
+	std::vector< size_t > word_end(count, count);
+	for (size_t i = count; i-- > 1; ) {
+		word_end[i - 1] = (text[i] == ' ' ? i : word_end[i]);
+	}
+
+	Line line;
+	for (size_t i = 0; i < count; ++i) {
+		//break at a space if the word after it would run past the width:
+		if (text[i] == ' ' && word_end[i] > i + 1 && pen[word_end[i]] - pen[line.begin] + margin > width) {
+			line.end = i;
+			line.next = i + 1;
+			lines->emplace_back(line);
+			line.begin = i + 1;
+			continue;
+		}
+		//...or after a glyph that leaves no room for another:
+		if (pen[i + 1] - pen[line.begin] + margin > width || i + 1 == count) {
+			line.end = i + 1;
+			line.next = i + 1;
+			lines->emplace_back(line);
+			line.begin = i + 1;
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * "LineBreaker" wraps text to a width greedily, in one pass over the text:
+ *  a line breaks at a space when the word after it would not fit, or after
+ *  any glyph that leaves no room for another one.
+ * Wrapped lines are remembered per (text, width), so the guidance and error
+ *  messages drawn every frame are only laid out when they change.
+ *
+ */
+
+#include "TextShaper.hpp"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct LineBreaker {
+	//shapes with shaper, which must outlive this:
+	LineBreaker(TextShaper *shaper);
+	LineBreaker(LineBreaker const &) = delete;
+
+	struct Line {
+		size_t begin = 0; //first glyph drawn on the line
+		size_t end = 0; //one past the last glyph drawn on the line
+		size_t next = 0; //where the next line begins; end + 1 when the line was broken at a space
+	};
+
+	//lines of text wrapped to width pixels, keeping margin pixels clear after the last glyph,
+	// with the shaped advances scaled by scale; the reference stays valid until MaxLayouts other layouts are made:
+	std::vector< Line > const &wrap(std::string const &text, double width, double margin, double scale = 1.0);
+
+	//the same, uncached, for one glyph per character of text:
+	static void break_lines(std::string const &text, std::vector< hb_glyph_position_t > const &positions, double width, double margin, double scale, std::vector< Line > *lines);
+
+	TextShaper *shaper;
+
+	//recently wrapped texts, most recently used first, found by hash of (text, width, margin, scale):
+	enum : size_t { MaxLayouts = 256 };
+	struct Layout {
+		size_t key = 0;
+		std::string text; //to tell apart layouts whose hashes collide
+		double width = 0.0, margin = 0.0, scale = 0.0;
+		std::vector< Line > lines;
+	};
+	std::list< Layout > layouts;
+	std::unordered_map< size_t, std::list< Layout >::iterator > layout_of;
+};
@@ -0,0 +1,181 @@
+#include "Lockstep.hpp"
+#include "Replay.hpp"
+#include "read_write_chunk.hpp"
+
+#include <cstring>
+#include <random>
+#include <sstream>
+
+// Larger messages than this are not trusted
+static size_t const MaxMessage = 1 << 20;
+
+static uint32_t mix(uint32_t hash, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        hash ^= (uint8_t)(value >> (i * 8));
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+Lockstep::Lockstep(Connection* connection, bool host, std::vector<std::string> const& program, float max_game_time)
+    : connection(connection), host(host), program(program) {
+    std::random_device random;
+    hello.nonce = random();
+    hello.program_hash = Replay::hashProgram(program);
+    hello.max_game_time = max_game_time;
+
+    std::string text;
+    for (auto const& line : program) {
+        text += line + "\n";
+    }
+    std::ostringstream out;
+    write_chunk("helo", std::vector<Hello>{hello}, &out);
+    write_chunk("prog", std::vector<char>(text.begin(), text.end()), &out);
+    std::string bytes = out.str();
+    connection->send(bytes.data(), bytes.size());
+}
+
+void Lockstep::update(double timeout) {
+    connection->poll(timeout);
+    if (state != WAITING) {
+        return;
+    }
+    receive();
+    if (state == WAITING && have_peer_program && checks.empty()) {
+        simulate();
+    }
+    if (state == WAITING && have_peer_checks && !checks.empty()) {
+        compare();
+    }
+    if (state == WAITING && !*connection) {
+        fail("Connection closed");
+    }
+}
+
+int Lockstep::result(size_t game) const {
+    if (outcomes[game] == Mirror::DRAW) {
+        return -1;
+    }
+    bool party = (game == 0) == host;
+    return (outcomes[game] == Mirror::PARTY_WON) == party ? 1 : 0;
+}
+
+// Take every complete message out of the receive buffer
+void Lockstep::receive() {
+    auto& buffer = connection->recv_buffer;
+    while (state == WAITING && buffer.size() >= 8) {
+        uint32_t size;
+        std::memcpy(&size, buffer.data() + 4, 4);
+        if (size > MaxMessage) {
+            fail("Message too large");
+            return;
+        }
+        if (buffer.size() < 8 + size) {
+            return;
+        }
+        std::string magic(buffer.data(), 4);
+        std::istringstream in(std::string(buffer.data(), 8 + size));
+        buffer.erase(buffer.begin(), buffer.begin() + 8 + size);
+        try {
+            if (magic == "helo") {
+                std::vector<Hello> hellos;
+                read_chunk(in, "helo", &hellos);
+                if (hellos.size() != 1 || hellos[0].version != VERSION) {
+                    fail("The other side runs an incompatible version");
+                } else if (hellos[0].check_interval != hello.check_interval || hellos[0].max_game_time != hello.max_game_time) {
+                    fail("The other side uses different match settings");
+                } else {
+                    peer_hello = hellos[0];
+                    have_peer_hello = true;
+                }
+            } else if (magic == "prog") {
+                std::vector<char> chars;
+                read_chunk(in, "prog", &chars);
+                peer_program.clear();
+                std::istringstream lines(std::string(chars.begin(), chars.end()));
+                std::string line;
+                while (std::getline(lines, line)) {
+                    peer_program.push_back(line);
+                }
+                if (!have_peer_hello || Replay::hashProgram(peer_program) != peer_hello.program_hash) {
+                    fail("The other side's program does not match its hash");
+                } else {
+                    have_peer_program = true;
+                }
+            } else if (magic == "sums") {
+                read_chunk(in, "sums", &peer_checks);
+                have_peer_checks = true;
+            } else {
+                fail("Unexpected message '" + magic + "'");
+            }
+        } catch (std::exception& e) {
+            fail(e.what());
+        }
+    }
+}
+
+// Play both games of the match and send the checksums
+void Lockstep::simulate() {
+    uint32_t host_nonce = host ? hello.nonce : peer_hello.nonce;
+    uint32_t join_nonce = host ? peer_hello.nonce : hello.nonce;
+    seed = mix(mix(2166136261u, host_nonce), join_nonce);
+
+    std::vector<std::string> const& host_program = host ? program : peer_program;
+    std::vector<std::string> const& join_program = host ? peer_program : program;
+    for (uint32_t game = 0; game < 2; game++) {
+        std::vector<std::string> const& party_program = game == 0 ? host_program : join_program;
+        std::vector<std::string> const& foe_program = game == 0 ? join_program : host_program;
+        Compiler::Executable* party_exe = mirror.party_compiler.compile(party_program);
+        Compiler::Executable* foe_exe = mirror.foe_compiler.compile(foe_program);
+        // Both sides compile both programs, so they fail together
+        if (party_exe == nullptr || foe_exe == nullptr) {
+            bool ours = (party_exe == nullptr && &party_program == &program) || (foe_exe == nullptr && &foe_program == &program);
+            std::string message = party_exe == nullptr ? mirror.party_compiler.error_message : mirror.foe_compiler.error_message;
+            fail(std::string(ours ? "This side's" : "The other side's") + " program does not compile: " + message);
+            return;
+        }
+
+        mirror.battle.max_game_time = hello.max_game_time;
+        mirror.start(party_exe, foe_exe, seed + game);
+        uint32_t running = 2166136261u;
+        uint32_t turn = 0;
+        while (mirror.step()) {
+            running = mix(running, mirror.battle.checksum());
+            turn++;
+            if (turn % hello.check_interval == 0) {
+                checks.push_back(Check{game, turn, running});
+            }
+        }
+        if (turn % hello.check_interval != 0 || turn == 0) {
+            checks.push_back(Check{game, turn, running});
+        }
+        outcomes[game] = mirror.outcome();
+    }
+
+    std::ostringstream out;
+    write_chunk("sums", checks, &out);
+    std::string bytes = out.str();
+    connection->send(bytes.data(), bytes.size());
+}
+
+void Lockstep::compare() {
+    uint32_t last_turn[2] = {0, 0};
+    for (size_t i = 0; i < checks.size(); i++) {
+        Check const& check = checks[i];
+        if (i >= peer_checks.size() || peer_checks[i].game != check.game || peer_checks[i].turn != check.turn || peer_checks[i].checksum != check.checksum) {
+            fail("Desync in game " + std::to_string(check.game + 1) + " between turns " + std::to_string(last_turn[check.game]) + " and " + std::to_string(check.turn));
+            return;
+        }
+        last_turn[check.game] = check.turn;
+    }
+    if (peer_checks.size() != checks.size()) {
+        fail("Desync: the other side's games ran longer");
+        return;
+    }
+    state = DONE;
+}
+
+void Lockstep::fail(std::string const& message) {
+    state = FAILED;
+    error = message;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Mirror.hpp"
+#include "Connection.hpp"
+
+#ifndef _LOCKSTEP_H_
+#define _LOCKSTEP_H_
+
+// A player-vs-player match between two instances over a Connection (see Mirror.hpp for the setup).
+// Only the programs, their hashes and a seed are exchanged: each side simulates both games of the
+// match itself, and the two compare running checksums of the battle state every check_interval turns.
+// Messages are read_write_chunk chunks, so a match costs a few kilobytes however long it runs.
+// Game 0 has the host's program on the party side, game 1 the joining side's.
+struct Lockstep {
+    enum : uint32_t { VERSION = 1 };
+
+    enum State {
+        WAITING,
+        DONE,
+        FAILED
+    };
+
+    struct Hello {
+        uint32_t version = VERSION;
+        uint32_t nonce = 0; // both nonces together make the seed
+        uint32_t program_hash = 0;
+        uint32_t check_interval = 16;
+        float max_game_time = 600.f;
+    };
+    static_assert(sizeof(Hello) == 20, "Hello is packed");
+
+    // Running checksum of a game after the given number of turns
+    struct Check {
+        uint32_t game = 0;
+        uint32_t turn = 0;
+        uint32_t checksum = 0;
+    };
+    static_assert(sizeof(Check) == 12, "Check is packed");
+
+    Connection* connection;
+    bool host;
+    std::vector<std::string> program;
+    std::vector<std::string> peer_program;
+    Hello hello;
+    Hello peer_hello;
+    bool have_peer_hello = false;
+    bool have_peer_program = false;
+    bool have_peer_checks = false;
+    std::vector<Check> checks;
+    std::vector<Check> peer_checks;
+    Mirror mirror;
+    Mirror::Outcome outcomes[2] = {Mirror::DRAW, Mirror::DRAW};
+    uint32_t seed = 0;
+    State state = WAITING;
+    std::string error;
+
+    // Sends this side's hello and program right away
+    Lockstep(Connection* connection, bool host, std::vector<std::string> const& program, float max_game_time = 600.f);
+    Lockstep(Lockstep const&) = delete;
+
+    // Move data, and simulate once both programs are here; call until state is no longer WAITING
+    void update(double timeout = 0.0);
+    // From this side's point of view: 1 for a win, 0 for a loss, -1 for a draw
+    int result(size_t game) const;
+
+    void receive();
+    void simulate();
+    void compare();
+    void fail(std::string const& message);
+};
+
+#endif
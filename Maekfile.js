@@ -44,6 +44,7 @@ if (maek.OS === "windows") {
 	);
 	maek.options.LINKLibs.push(
 		`/LIBPATH:${NEST_LIBS}/SDL2/lib`, `SDL2main.lib`, `SDL2.lib`, `OpenGL32.lib`, `Shell32.lib`,
+		`Ws2_32.lib`, //sockets, for Connection.cpp
 		`/LIBPATH:${NEST_LIBS}/libpng/lib`, `libpng.lib`,
 		`/LIBPATH:${NEST_LIBS}/zlib/lib`, `zlib.lib`,
 		`/LIBPATH:${NEST_LIBS}/opusfile/lib`, `opusfile.lib`,
@@ -138,6 +139,12 @@ if (maek.OS === 'windows') {
 const game_names = [
 	maek.CPP('GP22IntroMode.cpp'),
 	maek.CPP('PlayMode.cpp'),
+	maek.CPP('Prefabs.cpp'),
+	maek.CPP('TextShaper.cpp'),
+	maek.CPP('LineBreaker.cpp'),
+	maek.CPP('CodeDocument.cpp'),
+	maek.CPP('IdentifierTrie.cpp'),
+	maek.CPP('GlyphAtlas.cpp'),
 	maek.CPP('main.cpp'),
 	maek.CPP('LitColorTextureProgram.cpp'),
 	//maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
@@ -155,6 +162,15 @@ const common_names = [
 	maek.CPP('Animation.cpp'),
 	maek.CPP('Compiler.cpp'),
 	maek.CPP('Actions.cpp'),
+	maek.CPP('Levels.cpp'),
+	maek.CPP('LevelPack.cpp'),
+	maek.CPP('Mirror.cpp'),
+	maek.CPP('CombatEvent.cpp'),
+	maek.CPP('Replay.cpp'),
+	maek.CPP('Battle.cpp'),
+	maek.CPP('ThreadPool.cpp'),
+	maek.CPP('EnemyAI.cpp'),
+	maek.CPP('Preview.cpp'),
 	maek.CPP('load_save_png.cpp'),
 	maek.CPP('gl_compile_program.cpp'),
 	maek.CPP('Mode.cpp'),
@@ -177,10 +193,50 @@ const show_scene_names = [
 	maek.CPP('ShowSceneMode.cpp')
 ];
 
+const solve_level_names = [
+	maek.CPP('solve-level.cpp')
+];
+
+const balance_sweep_names = [
+	maek.CPP('balance-sweep.cpp')
+];
+
+const tournament_names = [
+	maek.CPP('tournament.cpp')
+];
+
+const pvp_names = [
+	maek.CPP('pvp.cpp'),
+	maek.CPP('Lockstep.cpp'),
+	maek.CPP('Connection.cpp')
+];
+
+const pack_levels_names = [
+	maek.CPP('pack-levels.cpp')
+];
+
 const freetype_test_names = [
 	maek.CPP('freetype-test.cpp')
 ];
 
+//the headless battle simulation, for embedding in other programs through clockwork.h and for checking levels:
+const simulation_names = [
+	maek.CPP('Levels.cpp'),
+	maek.CPP('LevelPack.cpp'),
+	maek.CPP('Object.cpp'),
+	maek.CPP('Compiler.cpp'),
+	maek.CPP('Actions.cpp'),
+	maek.CPP('CombatEvent.cpp'),
+	maek.CPP('Replay.cpp'),
+	maek.CPP('Battle.cpp'),
+	maek.CPP('ThreadPool.cpp'),
+	maek.CPP('data_path.cpp')
+];
+
+const clockwork_names = [
+	maek.CPP('clockwork.cpp')
+];
+
 //the '[exeFile =] LINK(objFiles, exeFileBase, [, options])' links an array of objects into an executable:
 // objFiles: array of objects to link
 // exeFileBase: name of executable file to produce
@@ -188,11 +244,28 @@ const freetype_test_names = [
 const game_exe = maek.LINK([...game_names, ...common_names], 'dist/game');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
+//tools that live next to the game so data_path() finds the level data:
+const solve_level_exe = maek.LINK([...solve_level_names, ...common_names], 'dist/solve-level');
+const balance_sweep_exe = maek.LINK([...balance_sweep_names, ...common_names], 'dist/balance-sweep');
+const tournament_exe = maek.LINK([...tournament_names, ...common_names], 'dist/tournament');
+const pvp_exe = maek.LINK([...pvp_names, ...common_names], 'dist/pvp');
+const pack_levels_exe = maek.LINK([...pack_levels_names, ...simulation_names], 'dist/pack-levels');
 
 const freetype_test_exe = maek.LINK([...freetype_test_names], 'freetype-test');
 
+//the '[libFile =] LIB(objFiles, libFileBase [, options])' archives objects into a static library:
+// libFileBase: name of the library to produce, without platform-dependant prefix and suffix (e.g., 'lib' and '.a')
+const clockwork_lib = maek.LIB([...clockwork_names, ...simulation_names], 'dist/clockwork');
+
+//the game and tools load their levels from a pack of levels.txt and the enemy scripts it names:
+const enemy_scripts = require('fs').readdirSync('dist/EnemyCode').map(name => `dist/EnemyCode/${name}`);
+const level_pack = 'dist/levels.pack';
+maek.RULE([level_pack], [pack_levels_exe, 'levels.txt', ...enemy_scripts], [
+	[pack_levels_exe, 'levels.txt', level_pack]
+]);
+
 //set the default target to the game (and copy the readme files):
-maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, freetype_test_exe, ...copies];
+maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, solve_level_exe, balance_sweep_exe, tournament_exe, pvp_exe, clockwork_lib, level_pack, freetype_test_exe, ...copies];
 
 //the '[targets =] RULE(targets, prerequisites[, recipe])' rule defines a Makefile-style task
 // targets: array of targets the task produces (can include both files and ':abstract targets')
@@ -267,22 +340,28 @@ function init_maek() {
 		objPrefix: 'objs/', //prefix for object file paths (if not explicitly specified)
 		objSuffix: (OS === 'windows' ? '.obj' : '.o'), //suffix for object files
 		exeSuffix: (OS === 'windows' ? '.exe' : ''), //suffix for executable files
+		libPrefix: (OS === 'windows' ? '' : 'lib'), //prefix for static library files
+		libSuffix: (OS === 'windows' ? '.lib' : '.a'), //suffix for static library files
 		depends: [], //extra dependencies; generally only set locally
 		CPP: [], //the c++ compiler and any flags to start with (set below, per-OS)
 		CPPFlags: [], //extra flags for c++ compiler
 		LINK: [], //the linker and any flags to start with (set below, per-OS)
 		LINKLibs: [], //extra -L and -l flags for linker
+		LIB: [], //the static library archiver and any flags to start with (set below, per-OS)
 	}
 
 	if (OS === 'windows') {
 		DEFAULT_OPTIONS.CPP = ['cl.exe', '/nologo', '/EHsc', '/Z7', '/std:c++17', '/W4', '/WX', '/MD'];
 		DEFAULT_OPTIONS.LINK = ['link.exe', '/nologo', '/SUBSYSTEM:CONSOLE', '/DEBUG:FASTLINK', '/INCREMENTAL:NO'];
+		DEFAULT_OPTIONS.LIB = ['lib.exe', '/nologo'];
 	} else if (OS === 'linux') {
 		DEFAULT_OPTIONS.CPP = ['g++', '-std=c++17', '-Wall', '-Werror', '-g'];
 		DEFAULT_OPTIONS.LINK = ['g++', '-std=c++17', '-Wall', '-Werror', '-g'];
+		DEFAULT_OPTIONS.LIB = ['ar', 'rcs'];
 	} else if (OS === 'macos') {
 		DEFAULT_OPTIONS.CPP = ['clang++', '-std=c++17', '-Wall', '-Werror', '-Wshadow', '-g'];
 		DEFAULT_OPTIONS.LINK = ['clang++', '-std=c++17', '-Wall', '-Werror', '-Wshadow', '-g'];
+		DEFAULT_OPTIONS.LIB = ['ar', 'rcs'];
 	}
 
 	//any settings here override 'DEFAULT_OPTIONS':
@@ -577,6 +656,48 @@ function init_maek() {
 		return exeFile;
 	};
 
+	//maek.LIB archives a collection of object files into a static library:
+	// objFiles is an array of object file names
+	// libFileBase is the library path without prefix or suffix ('dist/name' becomes 'dist/libname.a' or 'dist/name.lib')
+	maek.LIB = (objFiles, libFileBase, localOptions = {}) => {
+		const options = combineOptions(localOptions);
+
+		const libFile = path.join(path.dirname(libFileBase), options.libPrefix + path.basename(libFileBase) + options.libSuffix);
+
+		let libCommand;
+		if (OS === 'windows') {
+			libCommand = [...options.LIB, `/OUT:${libFile}`, ...objFiles];
+		} else {
+			libCommand = [...options.LIB, libFile, ...objFiles];
+		}
+		const depends = [...objFiles, ...options.depends];
+
+		const task = async () => {
+			//first, wait for all requested object files to build:
+			await updateTargets(depends, `${task.label}`);
+
+			//then archive (from scratch, since 'ar' would keep members that are no longer listed):
+			delete hashCache[libFile];
+			await fsPromises.mkdir(path.dirname(libFile), { recursive: true });
+			await fsPromises.rm(libFile, { force: true });
+			await runCommand(libCommand, `${task.label}: archive`);
+		};
+
+		task.keyFn = async () => {
+			await updateTargets(depends, `${task.label} (keyFn)`);
+			return [
+				libCommand,
+				...(await hashFiles([await findExe(libCommand), libFile, ...depends]))
+			];
+		};
+
+		task.label = `LIB ${libFile}`;
+
+		maek.tasks[libFile] = task;
+
+		return libFile;
+	};
+
 	//---------------------------------
 	//helper functions used by the build rules:
 
@@ -0,0 +1,68 @@
+#include "Mirror.hpp"
+
+Mirror::Mirror() {
+    party.createHeadless();
+    foes.createHeadless();
+    for (size_t i = 0; i < party.player_units.size(); i++) {
+        Object* own = party.player_units[i];
+        Object* foe = foes.player_units[i];
+        std::string name = own->name;
+        foe->name = "FOE_" + name;
+        foe->team = TEAM_ENEMY;
+        party_compiler.addObject(own, name, TEAM_PLAYER);
+        party_compiler.addObject(foe, "FOE_" + name, TEAM_ENEMY);
+        foe_compiler.addObject(foe, name, TEAM_PLAYER);
+        foe_compiler.addObject(own, "FOE_" + name, TEAM_ENEMY);
+    }
+    battle.player_units = party.player_units;
+    battle.enemy_units = foes.player_units;
+    // Programs may refer to properties reset() creates, like BURNED
+    for (Object* unit : battle.units()) {
+        unit->reset();
+    }
+}
+
+void Mirror::start(Compiler::Executable* party_exe, Compiler::Executable* foe_exe, uint32_t seed) {
+    for (Object* unit : battle.units()) {
+        unit->reset();
+    }
+    party_compiler.rng.seed(seed);
+    foe_compiler.rng.seed(seed ^ 0x9e3779b9u);
+    battle.start(party_exe, foe_exe);
+}
+
+bool Mirror::step() {
+    if (battle.finished()) {
+        return false;
+    }
+    battle.takeTurn();
+    return true;
+}
+
+Mirror::Outcome Mirror::finish() {
+    while (step()) {
+    }
+    return outcome();
+}
+
+Mirror::Outcome Mirror::outcome() const {
+    if (battle.won) {
+        return PARTY_WON;
+    } else if (battle.lost) {
+        return FOE_WON;
+    }
+    return DRAW;
+}
+
+std::string Mirror::outcomeName(Outcome outcome) {
+    switch (outcome) {
+    case PARTY_WON:
+        return "PARTY_WON";
+    case FOE_WON:
+        return "FOE_WON";
+    case DRAW:
+        return "DRAW";
+    default:
+        return "";
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Levels.hpp"
+#include "Battle.hpp"
+
+#ifndef _MIRROR_H_
+#define _MIRROR_H_
+
+// Player program against player program: the player's units face a mirrored copy of them on the enemy side.
+// Every program is written from the party's side: its own units are BRAWLER, CASTER, HEALER and RANGER,
+// the opponent's are FOE_BRAWLER, FOE_CASTER, and so on, and RANDOM_PLAYER/RANDOM_ENEMY pick from
+// its own/the opponent's units. Programs for the party compile with party_compiler, those for the
+// mirrored side with foe_compiler.
+struct Mirror {
+    enum Outcome : uint8_t {
+        PARTY_WON,
+        FOE_WON,
+        DRAW
+    };
+
+    Levels party;
+    Levels foes;
+    Compiler party_compiler;
+    Compiler foe_compiler;
+    Battle battle; // set battle.max_game_time to cap games
+
+    Mirror();
+    Mirror(Mirror const&) = delete;
+
+    // Reset the units and start a battle; the executables must be at their first statement
+    void start(Compiler::Executable* party_exe, Compiler::Executable* foe_exe, uint32_t seed);
+    // Play one turn; returns false once the battle is over
+    bool step();
+    // Battles that run out of game time, go round in circles, or where both programs end are draws
+    Outcome outcome() const;
+    Outcome finish();
+
+    static std::string outcomeName(Outcome outcome);
+};
+
+#endif
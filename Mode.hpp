@@ -20,6 +20,11 @@ struct Mode : std::enable_shared_from_this< Mode > {
 	//draw is called after update:
 	virtual void draw(glm::uvec2 const &drawable_size) = 0;
 
+	//needs_redraw is called after update, to ask whether anything changes on its own (animations, background work):
+	// the main loop draws after every event anyway, and while this returns false it sleeps until the next event
+	// instead of drawing (waking now and then to call update again):
+	virtual bool needs_redraw() { return true; }
+
 	//Mode::current is the Mode to which events are dispatched.
 	// use 'set_current' to change the current Mode (e.g., to switch to a menu)
 	static std::shared_ptr< Mode > current;
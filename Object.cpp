@@ -1,5 +1,6 @@
 #include "Object.hpp"
 #include <algorithm>
+#include <stdexcept>
 
 std::string formatCase(std::string str) {
     auto upperChar = [](char c) {
@@ -9,47 +10,166 @@ std::string formatCase(std::string str) {
     return str;
 }
 
+static char const* property_id_names[PROPERTY_COUNT] = {
+    "ALIVE",
+    "HEALTH",
+    "HEALTH_MAX",
+    "DEFENSE",
+    "POWER",
+    "ARROWS",
+    "BURNED",
+    "FROZEN",
+    "FREEZE_COUNTDOWN"
+};
+
+char const* Object::propertyName(PropertyId id) {
+    return property_id_names[id];
+}
+
 // Construct action with function and duration
 Action::Action(ActionFunction func, float duration, bool has_target) : func(func), duration(duration), has_target(has_target) {}
 
-// Construct object with name
-Object::Object(std::string name, Team team) : name(formatCase(name)), team(team) {}
+Archetype::Archetype() {
+    for (size_t id = 0; id < PROPERTY_COUNT; id++) {
+        addSlot(property_id_names[id]);
+    }
+}
 
-// Add action to object's map of valid actions
-void Object::addAction(std::string action_name, ActionFunction func, float duration, bool has_target) {
+// Add action to the archetype's map of valid actions
+void Archetype::addAction(std::string action_name, ActionFunction func, float duration, bool has_target) {
     action_name = formatCase(action_name);
     actions.emplace(action_name, Action(func, duration, has_target));
     action_names.push_back(action_name);
 }
 
-// Add property to object's map of properties
+// Add a property that objects of this archetype start with
+void Archetype::addProperty(std::string property_name, int default_value) {
+    uint8_t added = (uint8_t)addSlot(formatCase(property_name));
+    for (auto& start : initial) {
+        if (start.first == added) {
+            start.second = default_value;
+            return;
+        }
+    }
+    initial.emplace_back(added, default_value);
+}
+
+size_t Archetype::addSlot(std::string const& property_name) {
+    auto found = slot_of.find(property_name);
+    if (found != slot_of.end()) {
+        return found->second;
+    }
+    if (slot_names.size() == MAX_PROPERTIES) {
+        throw std::runtime_error("Objects cannot have more than " + std::to_string(MAX_PROPERTIES) + " properties, so there is no room for " + property_name);
+    }
+    slot_of.emplace(property_name, slot_names.size());
+    slot_names.push_back(property_name);
+    return slot_names.size() - 1;
+}
+
+size_t Archetype::slot(std::string const& property_name) const {
+    auto found = slot_of.find(property_name);
+    return found != slot_of.end() ? found->second : MAX_PROPERTIES;
+}
+
+// Objects start out sharing one archetype without actions or properties
+static std::shared_ptr<Archetype> const& emptyArchetype() {
+    static std::shared_ptr<Archetype> empty = std::make_shared<Archetype>();
+    return empty;
+}
+
+// Construct object with name
+Object::Object(std::string name, Team team) : name(formatCase(name)), archetype(emptyArchetype()), team(team) {}
+
+// Copy the game state of the object (name, actions, properties) for simulation.
+// The copy has no transform or drawables, so it must never be reset() or drawn.
+Object* Object::clone() const {
+    Object* copy = new Object(name, team);
+    copy->model_name = model_name;
+    copy->archetype = archetype;
+    std::copy(values, values + Archetype::MAX_PROPERTIES, copy->values);
+    copy->present = present;
+    std::copy(order, order + property_count, copy->order);
+    copy->property_count = property_count;
+    copy->transform = nullptr;
+    copy->start_position = start_position;
+    copy->start_rotation = start_rotation;
+    copy->health_level = health_level;
+    copy->floor_height = floor_height;
+    return copy;
+}
+
+void Object::setArchetype(std::shared_ptr<Archetype> const& shared) {
+    archetype = shared;
+    present = 0;
+    property_count = 0;
+    for (auto const& start : archetype->initial) {
+        values[start.first] = start.second;
+        present |= 1u << start.first;
+        order[property_count++] = start.first;
+    }
+}
+
+Archetype& Object::ownArchetype() {
+    if (archetype.use_count() > 1) {
+        archetype = std::make_shared<Archetype>(*archetype);
+    }
+    return *archetype;
+}
+
+Action* Object::editAction(std::string const& action_name) {
+    if (archetype->actions.count(action_name) == 0) {
+        return nullptr;
+    }
+    return &ownArchetype().actions.at(action_name);
+}
+
+// Add action to object's map of valid actions
+void Object::addAction(std::string action_name, ActionFunction func, float duration, bool has_target) {
+    ownArchetype().addAction(action_name, func, duration, has_target);
+}
+
+// Add property to object's properties
 void Object::addProperty(std::string property_name, int default_value) {
     property_name = formatCase(property_name);
-    properties.emplace(property_name, new int(default_value));
-    property_names.push_back(property_name);
+    size_t slot = archetype->slot(property_name);
+    if (slot == Archetype::MAX_PROPERTIES) {
+        slot = ownArchetype().addSlot(property_name);
+    }
+    values[slot] = default_value;
+    if ((present >> slot) & 1) {
+        return;
+    }
+    present |= 1u << slot;
+    order[property_count++] = (uint8_t)slot;
+}
+
+// Remove a property, as if it had never been added
+void Object::removeProperty(std::string property_name) {
+    property_name = formatCase(property_name);
+    size_t slot = archetype->slot(property_name);
+    if (slot == Archetype::MAX_PROPERTIES || !((present >> slot) & 1)) {
+        return;
+    }
+    // The value stays in its slot, since compiled conditions may still point at it
+    present &= ~(1u << slot);
+    uint8_t* end = std::remove(order, order + property_count, (uint8_t)slot);
+    property_count = (uint8_t)(end - order);
 }
 
 void Object::updateHealth() {
-    health_level = std::max(0.0f, (float)property("HEALTH") / (float)property("HEALTH_MAX"));
+    health_level = std::max(0.0f, (float)property(PROPERTY_HEALTH) / (float)property(PROPERTY_HEALTH_MAX));
 }
 
 // Reset an object
 void Object::reset() {
-    property("ALIVE") = 1;
-    property("BURNED") = 0;
-    property("FROZEN") = 0;
-    if (properties.find("FREEZE_COUNTDOWN") != properties.end()) {
-        properties.erase("FREEZE_COUNTDOWN");
-        for (size_t i = 0; i < property_names.size(); i++) {
-            if (property_names[i] == "FREEZE_COUNTDOWN") {
-                property_names.erase(property_names.begin() + i);
-                break;
-            }
-        }
-    }
-    property("HEALTH") = property("HEALTH_MAX");
-    if (name == "RANGER") {
-        property("ARROWS") = 8;
+    property(PROPERTY_ALIVE) = 1;
+    property(PROPERTY_BURNED) = 0;
+    property(PROPERTY_FROZEN) = 0;
+    removeProperty("FREEZE_COUNTDOWN");
+    property(PROPERTY_HEALTH) = property(PROPERTY_HEALTH_MAX);
+    if (model_name == "ranger") {
+        property(PROPERTY_ARROWS) = 8;
     }
     updateHealth();
     transform->position = getStartPosition();
@@ -64,10 +184,26 @@ glm::vec3 Object::getStartPosition() {
 // If the object has no such property, create one with default value 0
 int& Object::property(std::string property_name) {
     property_name = formatCase(property_name);
-    auto prop = properties.find(property_name);
-    if (prop == properties.end()) {
+    int* value = findProperty(property_name);
+    if (value == nullptr) {
         addProperty(property_name, 0);
-        prop = properties.find(property_name);
+        value = findProperty(property_name);
+    }
+    return *value;
+}
+
+// Same as property(name), without looking the name up
+int& Object::property(PropertyId id) {
+    if (!((present >> id) & 1)) {
+        addProperty(property_id_names[id], 0);
+    }
+    return values[id];
+}
+
+int* Object::findProperty(std::string const& property_name) {
+    size_t slot = archetype->slot(property_name);
+    if (slot == Archetype::MAX_PROPERTIES || !((present >> slot) & 1)) {
+        return nullptr;
     }
-    return *prop->second;
+    return &values[slot];
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 #include <list>
@@ -23,20 +25,57 @@ struct Action {
     Action(ActionFunction func, float duration, bool has_target = true);
 };
 
+// Properties the game logic touches on every action; every archetype keeps them in the
+// first slots, so actions and the scheduler can read them without hashing the name
+enum PropertyId {
+    PROPERTY_ALIVE,
+    PROPERTY_HEALTH,
+    PROPERTY_HEALTH_MAX,
+    PROPERTY_DEFENSE,
+    PROPERTY_POWER,
+    PROPERTY_ARROWS,
+    PROPERTY_BURNED,
+    PROPERTY_FROZEN,
+    PROPERTY_FREEZE_COUNTDOWN,
+    PROPERTY_COUNT
+};
+
 enum Team {
     TEAM_NONE,
     TEAM_PLAYER,
     TEAM_ENEMY
 };
 
-struct Object {
-    std::string name = "";
+// What every object made from one unit definition shares: its actions, and the slots and starting
+// values of its properties. Objects only store their property values, and copy the archetype
+// before changing it, so clones and the units of other simulations never see the change.
+struct Archetype {
+    static const size_t MAX_PROPERTIES = 32;
+
     std::unordered_map<std::string, Action> actions;
     std::vector<std::string> action_names;
-    std::unordered_map<std::string, int*> properties;
-    std::vector<std::string> property_names;
+    std::vector<std::string> slot_names; // slot i of every object holds the property slot_names[i]
+    std::unordered_map<std::string, size_t> slot_of;
+    std::vector<std::pair<uint8_t, int>> initial; // the properties objects start with: slot and value, in order
+
+    Archetype(); // with the PropertyId slots, but no properties yet
+    void addAction(std::string action_name, ActionFunction func, float duration, bool has_target = true);
+    void addProperty(std::string property_name, int default_value);
+    size_t addSlot(std::string const& property_name);
+    // MAX_PROPERTIES if no object of this archetype can have the property
+    size_t slot(std::string const& property_name) const;
+};
+
+struct Object {
+    std::string name = "";
+    std::string model_name = "";
+    std::shared_ptr<Archetype> archetype;
+    int values[Archetype::MAX_PROPERTIES] = {}; // by slot; compiled conditions point into it
+    uint32_t present = 0; // bit per slot the object has a property in
+    uint8_t order[Archetype::MAX_PROPERTIES] = {}; // slots of its properties, in the order they were added
+    uint8_t property_count = 0;
     std::unordered_map<std::string, Scene::Drawable*> drawables;
-    Scene::Transform* transform;
+    Scene::Transform* transform = nullptr;
     glm::vec2 start_position;
     glm::quat start_rotation;
     float health_level = 1.0f;
@@ -44,10 +83,30 @@ struct Object {
     Team team;
 
     Object(std::string name, Team team);
+    Object(Object const&) = delete;
+    Object* clone() const;
+    // Share the archetype, starting over with its initial properties
+    void setArchetype(std::shared_ptr<Archetype> const& shared);
+    std::unordered_map<std::string, Action> const& actions() const { return archetype->actions; }
+    std::vector<std::string> const& actionNames() const { return archetype->action_names; }
+    // The action, changed for this object only from now on; nullptr if it has no such action
+    Action* editAction(std::string const& action_name);
     void addAction(std::string action_name, ActionFunction func, float duration, bool has_target = true);
     void addProperty(std::string property_name, int default_value);
     void reset();
     int& property(std::string property_name);
+    int& property(PropertyId id);
+    // nullptr if the object has no such property; the name must already be upper case
+    int* findProperty(std::string const& property_name);
+    int* findProperty(PropertyId id) { return (present >> id) & 1 ? &values[id] : nullptr; }
+    // The object's properties, in the order they were added
+    size_t propertyCount() const { return property_count; }
+    std::string const& propertyNameAt(size_t index) const { return archetype->slot_names[order[index]]; }
+    int& propertyAt(size_t index) { return values[order[index]]; }
+    void removeProperty(std::string property_name);
+    // The archetype, copied first if anything else shares it
+    Archetype& ownArchetype();
+    static char const* propertyName(PropertyId id);
     void updateHealth();
     glm::vec3 getStartPosition();
 };
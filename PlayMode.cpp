@@ -15,7 +15,10 @@
 #include <freetype/freetype.h>
 #include <freetype/fttypes.h>
 
+#include <cmath>
+#include <cstring>
 #include <random>
+#include <chrono>
 #include <sstream>
 #include <iomanip>
 
@@ -33,7 +36,7 @@ Load< Scene > character_scene(LoadTagDefault, []() -> Scene const * {
 	return new Scene(data_path("characters.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){});
 });
 
-PlayMode::PlayMode() : scene(*character_scene) {
+PlayMode::PlayMode() : scene(*character_scene), prefabs(scene) {
 	//get pointer to camera for convenience:
 	if (scene.cameras.size() != 1) throw std::runtime_error("Expecting scene to have exactly one camera, but it has " + std::to_string(scene.cameras.size()));
 	camera = &scene.cameras.front();
@@ -67,81 +70,55 @@ PlayMode::PlayMode() : scene(*character_scene) {
 
 	// Create hb-ft font.
 	hb_font = hb_ft_font_create(ft_face, NULL);
+	text_shaper.reset(new TextShaper(hb_font, font_size));
+	line_breaker.reset(new LineBreaker(text_shaper.get()));
 
-	// Determine a fixed size and baseline for all character tiles
+	// Glyphs of every size are drawn from distance fields, rendered as they are first needed
+	glyph_atlas.reset(new GlyphAtlas(ft_library, fontfilestring));
+
+	// The widest glyph, which keeps wrapped lines clear of the edge
 	for (size_t i = min_char; i <= max_char; i++) {
 		FT_UInt glyph_index = FT_Get_Char_Index(ft_face, (char)i);
 		FT_Load_Glyph(ft_face, glyph_index, FT_LOAD_DEFAULT);
 		FT_Render_Glyph(ft_face->glyph, FT_RENDER_MODE_NORMAL);
 
 		uint32_t w = ft_face->glyph->bitmap.width + ft_face->glyph->bitmap_left;
-
-		int top = ft_face->glyph->bitmap_top;
-		int bottom = ft_face->glyph->bitmap.rows - top;
-
 		if (w > char_width) {
 			char_width = w;
 		}
-		if (top > (int)char_top) {
-			char_top = top;
-		}
-		if (bottom > (int)char_bottom) {
-			char_bottom = bottom;
-		}
 	}
-	char_height = char_top + char_bottom;
-
-	//interpret tiles and build a 1 x num_chars color texture (adapated from PPU466)
-	std::vector<glm::u8vec4> data;
-	data.resize(num_chars * char_width * char_height);
-	for (uint32_t i = 0; i < num_chars; i++) {
-		FT_UInt glyph_index = FT_Get_Char_Index(ft_face, (char)(min_char + i));
-		FT_Load_Glyph(ft_face, glyph_index, FT_LOAD_DEFAULT);
-		FT_Render_Glyph(ft_face->glyph, FT_RENDER_MODE_NORMAL);
-
-		//location of tile in the texture:
-		uint32_t ox = i * char_width;
-
-		//copy tile indices into texture:
-		for (int y = 0; y < (int)char_height; y++) {
-			for (int x = 0; x < (int)char_width; x++) {
-				int bitmap_x = x - ft_face->glyph->bitmap_left;
-				int bitmap_baseline = ft_face->glyph->bitmap_top;
-				int from_baseline = y - char_bottom;
-				int bitmap_y = bitmap_baseline - from_baseline;
-
-				if (bitmap_x >= 0 && bitmap_x < (int)ft_face->glyph->bitmap.width && bitmap_y >= 0 && bitmap_y < (int)ft_face->glyph->bitmap.rows) {
-					data[ox + x + (char_width * num_chars) * y] = glm::u8vec4(0xff, 0xff, 0xff, ft_face->glyph->bitmap.buffer[bitmap_x + ft_face->glyph->bitmap.width * bitmap_y]);
-				}
-				else {
-					data[ox + x + (char_width * num_chars) * y] = glm::u8vec4(0, 0, 0, 0);
-				}
-			}
-		}
-	}
-	glBindTexture(GL_TEXTURE_2D, data_stream->tile_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, char_width * num_chars, char_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
-	glBindTexture(GL_TEXTURE_2D, 0);
 
 	turn_time = 0.0f;
-	player_done = true;
-	enemy_done = true;
 	turn_done = true;
-	level_won = false;
-	level_lost = false;
-	turn = Turn::PLAYER;
+	battle.turn_length = turn_duration();
 	current_level = -1;
-	player_units.clear();
-	enemy_units.clear();
-	create_levels();
-	init_compiler();
+	player_compiler.events = &combat_events;
+	enemy_compiler.events = &combat_events;
+	levels.create([this](std::string const& name, std::string const& model_name, Team team) {
+		return makeObject(name, model_name, team);
+	});
+	register_ranger_object(levels.ranger);
+	battle.player_units = levels.player_units;
 	energyTransforms();
 	init_sounds();
-	dungeon_scene = makeObject("DUNGEON", "dungeon");
-	cave_scene = makeObject("CAVE", "cave");
-	forest_scene = makeObject("FOREST", "forest");
-	scene_position = dungeon_scene->transform->position;
-	offscreen_scene_position = cave_scene->transform->position;
+	for (std::string const& name : levels.scenes) {
+		if (backdrops.count(name) == 0) {
+			Object* backdrop = makeObject(name, name);
+			if (backdrop->transform == nullptr) {
+				throw std::runtime_error("There is no model for scene '" + name + "'");
+			}
+			backdrops.emplace(name, backdrop);
+		}
+	}
+	// The scene file places the first level's backdrop onscreen and the others out of sight
+	scene_position = backdrops[levels.scenes[0]]->transform->position;
+	offscreen_scene_position = scene_position;
+	for (auto const& backdrop : backdrops) {
+		if (backdrop.second->transform->position != scene_position) {
+			offscreen_scene_position = backdrop.second->transform->position;
+			break;
+		}
+	}
 	next_level();
 	compile_failed = false;
 	execution_result = ExecutionResult::NONE;
@@ -154,39 +131,21 @@ PlayMode::PlayMode() : scene(*character_scene) {
 
 Object* PlayMode::makeObject(std::string name, std::string model_name, Team team) {
 	Object* obj = new Object(name, team);
+	obj->model_name = model_name;
 	
-	if (!model_name.empty()) {
-		for (auto& transform : scene.transforms) {
-			Scene::Transform* new_transform = new Scene::Transform();
-			new_transform->name = name + ":" + transform.name;
-			new_transform->position = transform.position;
-			new_transform->rotation = transform.rotation;
-			new_transform->scale = transform.scale;
-			new_transform->parent = transform.parent;
-
-			if (transform.name == model_name) {
-				obj->transform = new_transform;
+	Prefabs::Prefab const* prefab = model_name.empty() ? nullptr : prefabs.find(model_name);
+	if (prefab != nullptr) {
+		std::vector<Scene::Transform*> copies = prefabs.instantiate(*prefab, name);
+		for (size_t i = 0; i < copies.size(); i++) {
+			Scene::Transform const* original = prefab->members[i];
+			if (original == prefab->root) {
+				obj->transform = copies[i];
 				obj->floor_height = obj->transform->position.z;
-				obj->start_rotation = new_transform->rotation;
-			}
-			
-			if (transform.name == model_name || transform.name.rfind(model_name + "-", 0) == 0) {
-				scene.drawables.emplace_back(new_transform);
-				setMesh(&scene.drawables.back(), transform.name);
-				obj->drawables.emplace(transform.name, &scene.drawables.back());
-			}
-		}
-		
-		for (auto& drawable : obj->drawables) {
-			Scene::Transform* transform = drawable.second->transform;
-			
-			if (transform->name != name + ":" + model_name) {
-				if (transform->parent != nullptr && obj->drawables.find(transform->parent->name) != obj->drawables.end()) {
-					transform->parent = obj->drawables[transform->parent->name]->transform;
-				} else {
-					std::cout << "Warning: " << transform->name << " is not a child of " << model_name << std::endl;
-				}
+				obj->start_rotation = copies[i]->rotation;
 			}
+			scene.drawables.emplace_back(copies[i]);
+			setMesh(&scene.drawables.back(), original->name);
+			obj->drawables.emplace(original->name, &scene.drawables.back());
 		}
 	}
 	return obj;
@@ -203,7 +162,7 @@ void PlayMode::energyTransforms() {
 			register_arrow_transform(&transform);
 			scene.drawables.emplace_back(&transform);
 			setMesh(&scene.drawables.back(), transform.name);
-			transform.position = ranger->transform->position + arrow_offset;
+			transform.position = levels.ranger->transform->position + arrow_offset;
 		} else if (transform.name == "fire") {
 			register_burn_transform(&transform);
 			scene.drawables.emplace_back(&transform);
@@ -241,606 +200,6 @@ void PlayMode::setMesh(Scene::Drawable* drawable, std::string mesh_name) {
 	drawable->pipeline.count = mesh.count;
 }
 
-void PlayMode::create_levels() {
-	level_guidance.push_back("An enemy approaches! Use \"brawler.attack(enemy1)\" to attack him with the brawler! Press shift + enter to submit your code.");
-	level_guidance.push_back("Another enemy! This one can't be hurt by the brawler...but you also have a caster. With the same syntax, tell the \"caster\" to \"burn\" \"enemy2\". It will take damage whenever it moves.");
-	level_guidance.push_back("Uh oh, enemy3 will survive a hit... After typing the line to have the brawler attack, press enter to move to the next line. Then have the brawler attack enemy3 again. Press shift + enter to submit both lines.");
-	level_guidance.push_back("Enemy4 has a powerful attack coming up! The caster can also \"freeze\" enemies, making them unable to move every third turn. Freeze enemy4 and then attack him five times with the brawler. If you get tired of typing, just enter the first few letters of a word and let autocompletion take care of the rest!");
-	level_guidance.push_back("Enemy5 will take three hits, and he does a lot of damage! If you just attack him, you'll lose. After the brawler attacks once, use the \"healer\" to \"heal\" the \"brawler\". Then have the brawler finish him off.");
-	level_guidance.push_back("Your last unit is a ranger, who can attack faster than the brawler but has limited ammo! Try having the \"ranger\" \"shoot\" enemy6 twice before he has a chance to attack!");
-	level_guidance.push_back("Enemy7 has a lot of health. It would take a lot of lines to beat him... You can use loops! Type \"while (true)\" and hit enter, have the brawler attack enemy7, and then type \"end\" below the last line to end the loop. While loops are extremely useful, but be careful: all condition checks, like the one on the WHILE line, take 1/8 of a turn to execute. You can hold CTRL to speed up the fight, or press ESC to end it.");
-	level_guidance.push_back("You can also check properties. Try shooting enemy8 \"while (ranger.arrows > 0)\", and then use the brawler afterwards. Try typing just 'RANGER.' (or 'ENEMY8.', 'BRAWLER.', etc.) and check out the full property list in the info box; see if you can guess how many arrows and attacks it will take to score a kill!");
-	level_guidance.push_back("If statements work the same way. Try checking \"if (brawler.health < 100)\" before healing him, then repeatedly attack enemy9 (100 is the brawler's maximum health, but this is not true of all units; have a look at the property window). Remember the \"end\"! You can also chain conditions with \"IF (this)\" \"AND (that)\", with the AND on a new line. OR works too.");
-	level_guidance.push_back("Alright, time to test everything you've learned! Enemy10 is tough, but you can do it!");
-	level_guidance.push_back("Gunners are very powerful! Be careful of Vrop's attacks.");
-	level_guidance.push_back("Speedsters like Grum can attack multiple times in a row! Make sure your code is efficient. If you want to know just how fast Grum's attacks are, type 'GRUM.' to check his action info!");
-	level_guidance.push_back("Tanks take a lot of damage. Be patient and make sure your code is robust enough to last a while against Yormun.");
-	level_guidance.push_back("Not all monsters are the same. Gunner VropVrop is even more powerful!");
-	level_guidance.push_back("You can face multiple enemies at once! Make sure your code handles both Fargoth and Rupol.");
-	level_guidance.push_back("Great job. Now how about a different pair of enemies?");
-	level_guidance.push_back("You're doing great! Keep it up!");
-	level_guidance.push_back("You can also face multiple enemies of the same type. You may need a nap in a war against two tanks... Or you can use the ctrl skip. If that's still too slow for you, hold both left and right control for super speed!");
-	level_guidance.push_back("If two tanks was too easy for you, how about three speedsters?");
-	level_guidance.push_back("To finish off this set of 10 levels, beat one of each enemy!");
-	level_guidance.push_back("The scientist has gotten smarter, so the next ten levels are puzzles! You'll have to think carefully about your solution... Shockwave will bring your whole team down to 10 health.");
-	level_guidance.push_back("The scientist has developed an enemy with the capability to strike a critical point and kill a robot in one hit! Get rid of it quickly.");
-	level_guidance.push_back("Now he's learned from you, and the units can heal each other. Don't let them stay at full health, or destroy_all will deal massive damage to all your units!");
-	level_guidance.push_back("He's combined his kill and destroy ideas, and Garthon can defeat everybody with a single attack!");
-	level_guidance.push_back("The sceintist has determined that the ranger and healer are your most valuable units. What will you do without them?");
-	level_guidance.push_back("It has been discovered that the tanks are vulernable to a burn strategy. Not this one!");
-	level_guidance.push_back("He's figured out that you like to deal a lot of damage early and has deployed some countermeasures...");
-	level_guidance.push_back("Uh oh, they've figured out how to heal burns!");
-	level_guidance.push_back("The enemies can burn you now! You're really getting a taste of your own medicine.");
-	level_guidance.push_back("You'll need to use all of your units wisely to beat this last one...");
-
-	level_enemy_code.push_back("EnemyCode/enemy1.txt");
-	level_enemy_code.push_back("EnemyCode/enemy2.txt");
-	level_enemy_code.push_back("EnemyCode/enemy3.txt");
-	level_enemy_code.push_back("EnemyCode/enemy4.txt");
-	level_enemy_code.push_back("EnemyCode/enemy5.txt");
-	level_enemy_code.push_back("EnemyCode/enemy6.txt");
-	level_enemy_code.push_back("EnemyCode/enemy7.txt");
-	level_enemy_code.push_back("EnemyCode/enemy8.txt");
-	level_enemy_code.push_back("EnemyCode/enemy9.txt");
-	level_enemy_code.push_back("EnemyCode/enemy10.txt");
-	level_enemy_code.push_back("EnemyCode/enemy11.txt");
-	level_enemy_code.push_back("EnemyCode/enemy12.txt");
-	level_enemy_code.push_back("EnemyCode/enemy13.txt");
-	level_enemy_code.push_back("EnemyCode/enemy14.txt");
-	level_enemy_code.push_back("EnemyCode/enemy15.txt");
-	level_enemy_code.push_back("EnemyCode/enemy16.txt");
-	level_enemy_code.push_back("EnemyCode/enemy17.txt");
-	level_enemy_code.push_back("EnemyCode/enemy18.txt");
-	level_enemy_code.push_back("EnemyCode/enemy19.txt");
-	level_enemy_code.push_back("EnemyCode/enemy20.txt");
-	level_enemy_code.push_back("EnemyCode/enemy21.txt");
-	level_enemy_code.push_back("EnemyCode/enemy22.txt");
-	level_enemy_code.push_back("EnemyCode/enemy23.txt");
-	level_enemy_code.push_back("EnemyCode/enemy24.txt");
-	level_enemy_code.push_back("EnemyCode/enemy25.txt");
-	level_enemy_code.push_back("EnemyCode/enemy26.txt");
-	level_enemy_code.push_back("EnemyCode/enemy27.txt");
-	level_enemy_code.push_back("EnemyCode/enemy28.txt");
-	level_enemy_code.push_back("EnemyCode/enemy29.txt");
-	level_enemy_code.push_back("EnemyCode/enemy30.txt");
-}
-
-void PlayMode::init_compiler() {
-	brawler = makeObject("BRAWLER", "warrior", Team::TEAM_PLAYER);
-	brawler->start_position = glm::vec2(-6.f, -6.f);
-	brawler->addAction("ATTACK", attack_function, turn_duration());
-	brawler->addProperty("HEALTH_MAX", 100);
-	brawler->addProperty("HEALTH", 100);
-	brawler->addProperty("DEFENSE", 0);
-	brawler->addProperty("ALIVE", 1);
-	brawler->addProperty("POWER", 15);
-
-	caster = makeObject("CASTER", "caster", Team::TEAM_PLAYER);
-	caster->start_position = glm::vec2(-6.f, 6.f);
-	caster->addAction("FREEZE", freeze_function, turn_duration() * 1.5f);
-	caster->addAction("BURN", burn_function, turn_duration() * 1.5f);
-	caster->addProperty("HEALTH_MAX", 60);
-	caster->addProperty("HEALTH", 60);
-	caster->addProperty("DEFENSE", 0);
-	caster->addProperty("ALIVE", 1);
-
-	ranger = makeObject("RANGER", "ranger", Team::TEAM_PLAYER);
-	ranger->start_position = glm::vec2(-6.f, 2.f);
-	register_ranger_object(ranger);
-	ranger->addAction("SHOOT", shoot_function, turn_duration() * 0.5f);
-	ranger->addProperty("HEALTH_MAX", 60);
-	ranger->addProperty("HEALTH", 60);
-	ranger->addProperty("DEFENSE", 0);
-	ranger->addProperty("ALIVE", 1);
-	ranger->addProperty("ARROWS", 8);
-	ranger->addProperty("POWER", 20);
-
-	healer = makeObject("HEALER", "healer", Team::TEAM_PLAYER);
-	healer->start_position = glm::vec2(-6.f, -2.f);
-	healer->addAction("HEAL", heal_function, turn_duration());
-	healer->addProperty("HEALTH_MAX", 80);
-	healer->addProperty("HEALTH", 80);
-	healer->addProperty("DEFENSE", 0);
-	healer->addProperty("ALIVE", 1);
-
-	Object* enemy1 = makeObject("ENEMY1", "monster", Team::TEAM_ENEMY);
-	enemy1->start_position = glm::vec2(6.f, 0.f);
-	enemy1->addAction("ATTACK", attack_function, turn_duration());
-	enemy1->addProperty("HEALTH_MAX", 15);
-	enemy1->addProperty("HEALTH", 15);
-	enemy1->addProperty("DEFENSE", 0);
-	enemy1->addProperty("ALIVE", 1);
-	enemy1->addProperty("POWER", 0);
-
-	Object* enemy2 = makeObject("ENEMY2", "monster", Team::TEAM_ENEMY);
-	enemy2->start_position = enemy1->start_position;
-	enemy2->addAction("ATTACK", attack_function, turn_duration());
-	enemy2->addProperty("HEALTH_MAX", 10);
-	enemy2->addProperty("HEALTH", 10);
-	enemy2->addProperty("DEFENSE", 100);
-	enemy2->addProperty("ALIVE", 1);
-	enemy2->addProperty("POWER", 10);
-
-	Object* enemy3 = makeObject("ENEMY3", "monster", Team::TEAM_ENEMY);
-	enemy3->start_position = enemy1->start_position;
-	enemy3->addAction("ATTACK", attack_function, turn_duration());
-	enemy3->addProperty("HEALTH_MAX", 30);
-	enemy3->addProperty("HEALTH", 30);
-	enemy3->addProperty("DEFENSE", 0);
-	enemy3->addProperty("ALIVE", 1);
-	enemy3->addProperty("POWER", 10);
-
-	Object* enemy4 = makeObject("ENEMY4", "monster", Team::TEAM_ENEMY);
-	enemy4->start_position = enemy1->start_position;
-	enemy4->addAction("ATTACK", attack_function, turn_duration());
-	enemy4->addProperty("HEALTH_MAX", 75);
-	enemy4->addProperty("HEALTH", 75);
-	enemy4->addProperty("DEFENSE", 0);
-	enemy4->addProperty("ALIVE", 1);
-	enemy4->addProperty("POWER", 200);
-
-	Object* enemy5 = makeObject("ENEMY5", "monster", Team::TEAM_ENEMY);
-	enemy5->start_position = enemy1->start_position;
-	enemy5->addAction("ATTACK", attack_function, turn_duration());
-	enemy5->addProperty("HEALTH_MAX", 45);
-	enemy5->addProperty("HEALTH", 45);
-	enemy5->addProperty("DEFENSE", 0);
-	enemy5->addProperty("ALIVE", 1);
-	enemy5->addProperty("POWER", 50);
-
-	Object* enemy6 = makeObject("ENEMY6", "monster", Team::TEAM_ENEMY);
-	enemy6->start_position = enemy1->start_position;
-	enemy6->addAction("ATTACK", attack_function, turn_duration());
-	enemy6->addProperty("HEALTH_MAX", 40);
-	enemy6->addProperty("HEALTH", 40);
-	enemy6->addProperty("DEFENSE", 0);
-	enemy6->addProperty("ALIVE", 1);
-	enemy6->addProperty("POWER", 100);
-
-	Object* enemy7 = makeObject("ENEMY7", "monster", Team::TEAM_ENEMY);
-	enemy7->start_position = enemy1->start_position;
-	enemy7->addAction("ATTACK", attack_function, turn_duration());
-	enemy7->addProperty("HEALTH_MAX", 200);
-	enemy7->addProperty("HEALTH", 200);
-	enemy7->addProperty("DEFENSE", 0);
-	enemy7->addProperty("ALIVE", 1);
-	enemy7->addProperty("POWER", 10);
-
-	Object* enemy8 = makeObject("ENEMY8", "monster", Team::TEAM_ENEMY);
-	enemy8->start_position = enemy1->start_position;
-	enemy8->addAction("ATTACK", attack_function, turn_duration());
-	enemy8->addProperty("HEALTH_MAX", 220);
-	enemy8->addProperty("HEALTH", 175);
-	enemy8->addProperty("DEFENSE", 0);
-	enemy8->addProperty("ALIVE", 1);
-	enemy8->addProperty("POWER", 10);
-
-	Object* enemy9 = makeObject("ENEMY9", "monster", Team::TEAM_ENEMY);
-	enemy9->start_position = enemy1->start_position;
-	enemy9->addAction("ATTACK", attack_function, turn_duration());
-	enemy9->addProperty("HEALTH_MAX", 90);
-	enemy9->addProperty("HEALTH", 90);
-	enemy9->addProperty("DEFENSE", 0);
-	enemy9->addProperty("ALIVE", 1);
-	enemy9->addProperty("POWER", 50);
-
-	Object* enemy10 = makeObject("ENEMY10", "monster", Team::TEAM_ENEMY);
-	enemy10->start_position = enemy1->start_position;
-	enemy10->addAction("ATTACK", attack_function, turn_duration());
-	enemy10->addProperty("HEALTH_MAX", 100);
-	enemy10->addProperty("HEALTH", 100);
-	enemy10->addProperty("DEFENSE", 0);
-	enemy10->addProperty("ALIVE", 1);
-	enemy10->addProperty("POWER", 30);
-
-	Object* vrop = makeObject("VROP", "gunner", Team::TEAM_ENEMY);
-	vrop->start_position = enemy1->start_position;
-	vrop->addAction("ATTACK", gunner_attack_function, turn_duration());
-	vrop->addProperty("HEALTH_MAX", 100);
-	vrop->addProperty("HEALTH", 100);
-	vrop->addProperty("DEFENSE", 0);
-	vrop->addProperty("ALIVE", 1);
-	vrop->addProperty("POWER", 50);
-
-	Object* grum = makeObject("GRUM", "speedster", Team::TEAM_ENEMY);
-	grum->start_position = enemy1->start_position;
-	grum->addAction("ATTACK", attack_function, 0.25f * turn_duration());
-	grum->addProperty("HEALTH_MAX", 80);
-	grum->addProperty("HEALTH", 80);
-	grum->addProperty("DEFENSE", 0);
-	grum->addProperty("ALIVE", 1);
-	grum->addProperty("POWER", 20);
-
-	Object* yormun = makeObject("YORMUN", "tank", Team::TEAM_ENEMY);
-	yormun->start_position = enemy1->start_position;
-	yormun->addAction("ATTACK", attack_function, 1.5f * turn_duration());
-	yormun->addProperty("HEALTH_MAX", 200);
-	yormun->addProperty("HEALTH", 200);
-	yormun->addProperty("DEFENSE", 0);
-	yormun->addProperty("ALIVE", 1);
-	yormun->addProperty("POWER", 30);
-
-	Object* vropvrop = makeObject("VROPVROP", "gunner", Team::TEAM_ENEMY);
-	vropvrop->start_position = enemy1->start_position;
-	vropvrop->addAction("ATTACK", gunner_attack_function, turn_duration());
-	vropvrop->addProperty("HEALTH_MAX", 100);
-	vropvrop->addProperty("HEALTH", 100);
-	vropvrop->addProperty("DEFENSE", 0);
-	vropvrop->addProperty("ALIVE", 1);
-	vropvrop->addProperty("POWER", 60);
-
-	Object *fargoth = makeObject("FARGOTH", "tank", Team::TEAM_ENEMY);
-	fargoth->start_position = glm::vec2(6.f, -3.f);
-	fargoth->addAction("ATTACK", attack_function, turn_duration());
-	fargoth->addProperty("HEALTH_MAX", 225);
-	fargoth->addProperty("HEALTH", 225);
-	fargoth->addProperty("DEFENSE", 0);
-	fargoth->addProperty("ALIVE", 1);
-	fargoth->addProperty("POWER", 20);
-
-	Object *rupol = makeObject("RUPOL", "gunner", Team::TEAM_ENEMY);
-	rupol->start_position = glm::vec2(6.f, 3.f);
-	rupol->addAction("ATTACK", gunner_attack_function, turn_duration());
-	rupol->addProperty("HEALTH_MAX", 150);
-	rupol->addProperty("HEALTH", 150);
-	rupol->addProperty("DEFENSE", 0);
-	rupol->addProperty("ALIVE", 1);
-	rupol->addProperty("POWER", 30);
-
-	Object* blurok = makeObject("BLUROK", "speedster", Team::TEAM_ENEMY);
-	blurok->start_position = fargoth->start_position;
-	blurok->addAction("ATTACK", attack_function, 0.25f * turn_duration());
-	blurok->addProperty("HEALTH_MAX", 100);
-	blurok->addProperty("HEALTH", 100);
-	blurok->addProperty("DEFENSE", 0);
-	blurok->addProperty("ALIVE", 1);
-	blurok->addProperty("POWER", 10);
-
-	Object* qerbi = makeObject("QERBI", "tank", Team::TEAM_ENEMY);
-	qerbi->start_position = rupol->start_position;
-	qerbi->addAction("ATTACK", attack_function, turn_duration());
-	qerbi->addProperty("HEALTH_MAX", 200);
-	qerbi->addProperty("HEALTH", 200);
-	qerbi->addProperty("DEFENSE", 0);
-	qerbi->addProperty("ALIVE", 1);
-	qerbi->addProperty("POWER", 30);
-
-	Object* norver = makeObject("NORVER", "speedster", Team::TEAM_ENEMY);
-	norver->start_position = fargoth->start_position;
-	norver->addAction("ATTACK", attack_function, 0.5f * turn_duration());
-	norver->addProperty("HEALTH_MAX", 120);
-	norver->addProperty("HEALTH", 120);
-	norver->addProperty("DEFENSE", 0);
-	norver->addProperty("ALIVE", 1);
-	norver->addProperty("POWER", 15);
-
-	Object* almo = makeObject("ALMO", "gunner", Team::TEAM_ENEMY);
-	almo->start_position = rupol->start_position;
-	almo->addAction("ATTACK", gunner_attack_function, turn_duration());
-	almo->addProperty("HEALTH_MAX", 130);
-	almo->addProperty("HEALTH", 130);
-	almo->addProperty("DEFENSE", 0);
-	almo->addProperty("ALIVE", 1);
-	almo->addProperty("POWER", 40);
-
-	Object* harky = makeObject("HARKY", "tank", Team::TEAM_ENEMY);
-	harky->start_position = fargoth->start_position;
-	harky->addAction("ATTACK", attack_function, turn_duration());
-	harky->addProperty("HEALTH_MAX", 250);
-	harky->addProperty("HEALTH", 250);
-	harky->addProperty("DEFENSE", 0);
-	harky->addProperty("ALIVE", 1);
-	harky->addProperty("POWER", 15);
-
-	Object* marky = makeObject("MARKY", "tank", Team::TEAM_ENEMY);
-	marky->start_position = rupol->start_position;
-	marky->addAction("ATTACK", attack_function, turn_duration());
-	marky->addProperty("HEALTH_MAX", 250);
-	marky->addProperty("HEALTH", 250);
-	marky->addProperty("DEFENSE", 0);
-	marky->addProperty("ALIVE", 1);
-	marky->addProperty("POWER", 15);
-
-	Object* boro = makeObject("BORO", "speedster", Team::TEAM_ENEMY);
-	boro->start_position = glm::vec2(6.f, -5.f);
-	boro->addAction("ATTACK", attack_function, 0.5f * turn_duration());
-	boro->addProperty("HEALTH_MAX", 100);
-	boro->addProperty("HEALTH", 100);
-	boro->addProperty("DEFENSE", 0);
-	boro->addProperty("ALIVE", 1);
-	boro->addProperty("POWER", 10);
-
-	Object* coro = makeObject("CORO", "speedster", Team::TEAM_ENEMY);
-	coro->start_position = glm::vec2(6.f, 0.f);
-	coro->addAction("ATTACK", attack_function, 0.5f * turn_duration());
-	coro->addProperty("HEALTH_MAX", 100);
-	coro->addProperty("HEALTH", 100);
-	coro->addProperty("DEFENSE", 0);
-	coro->addProperty("ALIVE", 1);
-	coro->addProperty("POWER", 10);
-
-	Object* zoro = makeObject("ZORO", "speedster", Team::TEAM_ENEMY);
-	zoro->start_position = glm::vec2(6.f, 5.f);
-	zoro->addAction("ATTACK", attack_function, 0.5f * turn_duration());
-	zoro->addProperty("HEALTH_MAX", 100);
-	zoro->addProperty("HEALTH", 100);
-	zoro->addProperty("DEFENSE", 0);
-	zoro->addProperty("ALIVE", 1);
-	zoro->addProperty("POWER", 10);
-
-	Object* poryo = makeObject("PORYO", "speedster", Team::TEAM_ENEMY);
-	poryo->start_position = glm::vec2(6.f, -5.f);
-	poryo->addAction("ATTACK", attack_function, 0.5f * turn_duration());
-	poryo->addProperty("HEALTH_MAX", 100);
-	poryo->addProperty("HEALTH", 100);
-	poryo->addProperty("DEFENSE", 0);
-	poryo->addProperty("ALIVE", 1);
-	poryo->addProperty("POWER", 10);
-
-	Object* therfu = makeObject("THERFU", "gunner", Team::TEAM_ENEMY);
-	therfu->start_position = glm::vec2(6.f, -2.f);
-	therfu->addAction("ATTACK", gunner_attack_function, turn_duration());
-	therfu->addProperty("HEALTH_MAX", 120);
-	therfu->addProperty("HEALTH", 120);
-	therfu->addProperty("DEFENSE", 0);
-	therfu->addProperty("ALIVE", 1);
-	therfu->addProperty("POWER", 30);
-
-	Object* wurmp = makeObject("WURMP", "tank", Team::TEAM_ENEMY);
-	wurmp->start_position = glm::vec2(6.f, 5.f);
-	wurmp->addAction("ATTACK", attack_function, 1.5f * turn_duration());
-	wurmp->addProperty("HEALTH_MAX", 200);
-	wurmp->addProperty("HEALTH", 200);
-	wurmp->addProperty("DEFENSE", 0);
-	wurmp->addProperty("ALIVE", 1);
-	wurmp->addProperty("POWER", 20);
-
-	Object* bardor = makeObject("BARDOR", "tank", Team::TEAM_ENEMY);
-	bardor->start_position = enemy1->start_position;
-	bardor->addAction("ATTACK", attack_function, turn_duration());
-	bardor->addAction("SHOCKWAVE", shockwave_function, turn_duration(), false);
-	bardor->addProperty("HEALTH_MAX", 200);
-	bardor->addProperty("HEALTH", 200);
-	bardor->addProperty("DEFENSE", 90);
-	bardor->addProperty("ALIVE", 1);
-	bardor->addProperty("POWER", 20);
-
-	Object* girof = makeObject("GIROF", "gunner", Team::TEAM_ENEMY);
-	girof->start_position = enemy1->start_position;
-	girof->addAction("KILL", kill_function, turn_duration());
-	girof->addProperty("HEALTH_MAX", 80);
-	girof->addProperty("HEALTH", 80);
-	girof->addProperty("DEFENSE", 0);
-	girof->addProperty("ALIVE", 1);
-	girof->addProperty("POWER", 1000000);
-
-	Object* vernie = makeObject("VERNIE", "speedster", Team::TEAM_ENEMY);
-	vernie->start_position = fargoth->start_position;
-	vernie->addAction("HEAL", heal_function, turn_duration());
-	vernie->addAction("DESTROY_ALL", destroy_function, turn_duration(), false);
-	vernie->addProperty("HEALTH_MAX", 180);
-	vernie->addProperty("HEALTH", 180);
-	vernie->addProperty("DEFENSE", 0);
-	vernie->addProperty("ALIVE", 1);
-	vernie->addProperty("POWER", 50);
-
-	Object* purgen = makeObject("PURGEN", "speedster", Team::TEAM_ENEMY);
-	purgen->start_position = rupol->start_position;
-	purgen->addAction("HEAL", heal_function, turn_duration());
-	purgen->addAction("DESTROY_ALL", destroy_function, turn_duration(), false);
-	purgen->addProperty("HEALTH_MAX", 180);
-	purgen->addProperty("HEALTH", 180);
-	purgen->addProperty("DEFENSE", 0);
-	purgen->addProperty("ALIVE", 1);
-	purgen->addProperty("POWER", 50);
-
-	Object* vurly = makeObject("VURLY", "speedster", Team::TEAM_ENEMY);
-	vurly->start_position = fargoth->start_position;
-	vurly->addAction("ATTACK", attack_function, turn_duration());
-	vurly->addProperty("HEALTH_MAX", 200);
-	vurly->addProperty("HEALTH", 200);
-	vurly->addProperty("DEFENSE", 0);
-	vurly->addProperty("ALIVE", 1);
-	vurly->addProperty("POWER", 35);
-
-	Object* garthon = makeObject("GARTHON", "gunner", Team::TEAM_ENEMY);
-	garthon->start_position = rupol->start_position;
-	garthon->addAction("ANNIHILATE", annihilate_function, 2.0f * turn_duration(), false);
-	garthon->addProperty("HEALTH_MAX", 150);
-	garthon->addProperty("HEALTH", 150);
-	garthon->addProperty("DEFENSE", 0);
-	garthon->addProperty("ALIVE", 1);
-	garthon->addProperty("POWER", 1000000);
-
-	Object* kerqul = makeObject("KERQUL", "gunner", Team::TEAM_ENEMY);
-	kerqul->start_position = enemy1->start_position;
-	kerqul->addAction("KILL", kill_function, turn_duration());
-	kerqul->addProperty("HEALTH_MAX", 100);
-	kerqul->addProperty("HEALTH", 100);
-	kerqul->addProperty("DEFENSE", 0);
-	kerqul->addProperty("ALIVE", 1);
-	kerqul->addProperty("POWER", 1000000);
-
-	Object* flammy = makeObject("FLAMMY", "tank", Team::TEAM_ENEMY);
-	flammy->start_position = enemy1->start_position;
-	flammy->addAction("ATTACK", attack_function, 0.75f * turn_duration());
-	flammy->addProperty("HEALTH_MAX", 50);
-	flammy->addProperty("HEALTH", 50);
-	flammy->addProperty("DEFENSE", 90);
-	flammy->addProperty("ALIVE", 1);
-	flammy->addProperty("POWER", 10);
-
-	Object* turpin = makeObject("TURPIN", "speedster", Team::TEAM_ENEMY);
-	turpin->start_position = enemy1->start_position;
-	turpin->addAction("ATTACK", attack_function, turn_duration());
-	turpin->addAction("KILL", kill_function, turn_duration());
-	turpin->addAction("FULL_HEAL", full_heal_function, turn_duration());
-	turpin->addProperty("HEALTH_MAX", 160);
-	turpin->addProperty("HEALTH", 160);
-	turpin->addProperty("DEFENSE", 0);
-	turpin->addProperty("ALIVE", 1);
-	turpin->addProperty("POWER", 20);
-
-	Object* rentol = makeObject("RENTOL", "tank", Team::TEAM_ENEMY);
-	rentol->start_position = enemy1->start_position;
-	rentol->addAction("ATTACK", attack_function, turn_duration());
-	rentol->addAction("BURN_HEAL", burn_heal_function, turn_duration());
-	rentol->addProperty("HEALTH_MAX", 200);
-	rentol->addProperty("HEALTH", 200);
-	rentol->addProperty("DEFENSE", 100);
-	rentol->addProperty("ALIVE", 1);
-	rentol->addProperty("POWER", 20);
-
-	Object* dingo = makeObject("DINGO", "speedster", Team::TEAM_ENEMY);
-	dingo->start_position = fargoth->start_position;
-	dingo->addAction("ATTACK", attack_function, turn_duration());
-	dingo->addAction("BURN", burn_function, turn_duration());
-	dingo->addAction("HEAL", heal_function, turn_duration());
-	dingo->addProperty("HEALTH_MAX", 100);
-	dingo->addProperty("HEALTH", 100);
-	dingo->addProperty("DEFENSE", 50);
-	dingo->addProperty("ALIVE", 1);
-	dingo->addProperty("POWER", 20);
-
-	Object* wingo = makeObject("WINGO", "speedster", Team::TEAM_ENEMY);
-	wingo->start_position = rupol->start_position;
-	wingo->addAction("ATTACK", attack_function, turn_duration());
-	wingo->addAction("BURN", burn_function, turn_duration());
-	wingo->addAction("HEAL", heal_function, turn_duration());
-	wingo->addProperty("HEALTH_MAX", 100);
-	wingo->addProperty("HEALTH", 100);
-	wingo->addProperty("DEFENSE", 50);
-	wingo->addProperty("ALIVE", 1);
-	wingo->addProperty("POWER", 20);
-
-	Object* shrolin = makeObject("SHROLIN", "gunner", Team::TEAM_ENEMY);
-	shrolin->start_position = fargoth->start_position;
-	shrolin->addAction("ATTACK", gunner_attack_function, turn_duration());
-	shrolin->addProperty("HEALTH_MAX", 100);
-	shrolin->addProperty("HEALTH", 100);
-	shrolin->addProperty("DEFENSE", 0);
-	shrolin->addProperty("ALIVE", 1);
-	shrolin->addProperty("POWER", 40);
-
-	Object* mingar = makeObject("MINGAR", "tank", Team::TEAM_ENEMY);
-	mingar->start_position = rupol->start_position;
-	mingar->addAction("ATTACK", attack_function, turn_duration());
-	mingar->addProperty("HEALTH_MAX", 200);
-	mingar->addProperty("HEALTH", 200);
-	mingar->addProperty("DEFENSE", 0);
-	mingar->addProperty("ALIVE", 1);
-	mingar->addProperty("POWER", 10);
-
-	player_units.push_back(brawler);
-	player_units.push_back(caster);
-	player_units.push_back(healer);
-	player_units.push_back(ranger);
-
-	std::vector<Object *> level1;
-	level1.push_back(enemy1);
-	std::vector<Object*> level2;
-	level2.push_back(enemy2);
-	std::vector<Object*> level3;
-	level3.push_back(enemy3);
-	std::vector<Object*> level4;
-	level4.push_back(enemy4);
-	std::vector<Object*> level5;
-	level5.push_back(enemy5);
-	std::vector<Object*> level6;
-	level6.push_back(enemy6);
-	std::vector<Object*> level7;
-	level7.push_back(enemy7);
-	std::vector<Object*> level8;
-	level8.push_back(enemy8);
-	std::vector<Object*> level9;
-	level9.push_back(enemy9);
-	std::vector<Object*> level10;
-	level10.push_back(enemy10);
-	std::vector<Object*> level11;
-	level11.push_back(vrop);
-	std::vector<Object*> level12;
-	level12.push_back(grum);
-	std::vector<Object*> level13;
-	level13.push_back(yormun);
-	std::vector<Object*> level14;
-	level14.push_back(vropvrop);
-	std::vector<Object*> level15;
-	level15.push_back(fargoth);
-	level15.push_back(rupol);
-	std::vector<Object*> level16;
-	level16.push_back(blurok);
-	level16.push_back(qerbi);
-	std::vector<Object*> level17;
-	level17.push_back(norver);
-	level17.push_back(almo);
-	std::vector<Object*> level18;
-	level18.push_back(harky);
-	level18.push_back(marky);
-	std::vector<Object*> level19;
-	level19.push_back(boro);
-	level19.push_back(coro);
-	level19.push_back(zoro);
-	std::vector<Object*> level20;
-	level20.push_back(poryo);
-	level20.push_back(therfu);
-	level20.push_back(wurmp);
-	std::vector<Object*> level21;
-	level21.push_back(bardor);
-	std::vector<Object*> level22;
-	level22.push_back(girof);
-	std::vector<Object*> level23;
-	level23.push_back(vernie);
-	level23.push_back(purgen);
-	std::vector<Object*> level24;
-	level24.push_back(vurly);
-	level24.push_back(garthon);
-	std::vector<Object*> level25;
-	level25.push_back(kerqul);
-	std::vector<Object*> level26;
-	level26.push_back(flammy);
-	std::vector<Object*> level27;
-	level27.push_back(turpin);
-	std::vector<Object*> level28;
-	level28.push_back(rentol);
-	std::vector<Object*> level29;
-	level29.push_back(dingo);
-	level29.push_back(wingo);
-	std::vector<Object*> level30;
-	level30.push_back(shrolin);
-	level30.push_back(mingar);
-
-	enemy_units.push_back(level1);
-	enemy_units.push_back(level2);
-	enemy_units.push_back(level3);
-	enemy_units.push_back(level4);
-	enemy_units.push_back(level5);
-	enemy_units.push_back(level6);
-	enemy_units.push_back(level7);
-	enemy_units.push_back(level8);
-	enemy_units.push_back(level9);
-	enemy_units.push_back(level10);
-	enemy_units.push_back(level11);
-	enemy_units.push_back(level12);
-	enemy_units.push_back(level13);
-	enemy_units.push_back(level14);
-	enemy_units.push_back(level15);
-	enemy_units.push_back(level16);
-	enemy_units.push_back(level17);
-	enemy_units.push_back(level18);
-	enemy_units.push_back(level19);
-	enemy_units.push_back(level20);
-	enemy_units.push_back(level21);
-	enemy_units.push_back(level22);
-	enemy_units.push_back(level23);
-	enemy_units.push_back(level24);
-	enemy_units.push_back(level25);
-	enemy_units.push_back(level26);
-	enemy_units.push_back(level27);
-	enemy_units.push_back(level28);
-	enemy_units.push_back(level29);
-	enemy_units.push_back(level30);
-}
-
 bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size) {
 	if (evt.type == SDL_KEYDOWN) {
 		if (evt.key.keysym.sym == SDLK_LCTRL) {
@@ -895,12 +254,52 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 		return false;
 	}
 
+	// The wheel scrolls the code, a line per notch
+	if (evt.type == SDL_MOUSEWHEEL) {
+		scroll_y -= evt.wheel.y * font_size;
+		return true;
+	}
+
+	if (replay_active) {
+		if (evt.type == SDL_KEYDOWN) {
+			if (evt.key.keysym.sym == SDLK_ESCAPE) {
+				stop_replay();
+			} else if (evt.key.keysym.sym == SDLK_SPACE) {
+				replay_playing = !replay_playing;
+				replay_clock = 0.f;
+			} else if (evt.key.keysym.sym == SDLK_RIGHT) {
+				replay_playing = false;
+				step_replay();
+			} else if (evt.key.keysym.sym == SDLK_LEFT) {
+				replay_playing = false;
+				if (replay_turn > 0) {
+					seek_replay(replay_turn - 1);
+				}
+			} else if (evt.key.keysym.sym == SDLK_UP) {
+				replay_speed = std::min(replay_speed * 2.f, 1024.f);
+				replay_speed = std::max(replay_speed, -1024.f);
+			} else if (evt.key.keysym.sym == SDLK_DOWN) {
+				replay_speed = replay_speed / 2.f;
+				if (std::abs(replay_speed) < 0.25f) {
+					replay_speed = replay_speed < 0.f ? -0.25f : 0.25f;
+				}
+			} else if (evt.key.keysym.sym == SDLK_r) {
+				// Play backwards
+				replay_speed = -replay_speed;
+			} else if (evt.key.keysym.sym == SDLK_HOME) {
+				seek_replay(0);
+			} else if (evt.key.keysym.sym == SDLK_END) {
+				seek_replay(replay.turns.size());
+			}
+			return true;
+		}
+		return false;
+	}
+
 	if (!turn_done) {
 		if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_ESCAPE) {
-			player_done = true;
-			enemy_done = true;
-			level_won = false;
-			level_lost = false;
+			save_replay();
+			battle.stop();
 			turn_done = true;
 			reset_level();
 			clear_animations();
@@ -909,23 +308,41 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 		return false;
 	}
 
+	if (evt.type == SDL_KEYDOWN && (lctrl.pressed || rctrl.pressed) && evt.key.keysym.sym == SDLK_r) {
+		start_replay();
+		return true;
+	}
+
+	if (evt.type == SDL_KEYDOWN && (lctrl.pressed || rctrl.pressed) && evt.key.keysym.sym == SDLK_e) {
+		cycle_enemy_ai();
+		return true;
+	}
+
+	// ctrl+Z undoes, and ctrl+Y or ctrl+shift+Z redoes
+	if (evt.type == SDL_KEYDOWN && (lctrl.pressed || rctrl.pressed) && evt.key.keysym.sym == SDLK_z) {
+		if (lshift.pressed || rshift.pressed) {
+			redo();
+		} else {
+			undo();
+		}
+		return true;
+	}
+	if (evt.type == SDL_KEYDOWN && (lctrl.pressed || rctrl.pressed) && evt.key.keysym.sym == SDLK_y) {
+		redo();
+		return true;
+	}
+
 	if (evt.type == SDL_KEYDOWN) {
 		if(evt.key.keysym.sym == SDLK_RETURN) {
-			if (lshift.pressed || rshift.pressed) {
-				player_exe = player_compiler.compile(text_buffer);
-				if (player_exe == nullptr) {
-					compile_failed = true;
-					return true;
+			if ((lshift.pressed || rshift.pressed) && (lctrl.pressed || rctrl.pressed)) {
+				// Every AI move searches for a while, so a whole battle of them cannot be resolved at once
+				if (enemy_ai_enabled) {
+					draw_message = "Instant resolve needs the scripted enemies: ctrl+E to turn the AI off";
+				} else if (submit()) {
+					resolve_instantly();
 				}
-				compile_failed = false;
-				player_statement = player_exe->next();
-				enemy_exe = enemy_compiler.compile(level_enemy_code[current_level]);
-				enemy_statement = enemy_exe->next();
-				player_done = false;
-				enemy_done = false;
-				turn_done = false;
-				player_time = turn_duration();
-				enemy_time = turn_duration();
+			} else if (lshift.pressed || rshift.pressed) {
+				submit();
 			} else {
 				if (!autofill()) {
 					line_break();
@@ -938,6 +355,15 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 		} else if(evt.key.keysym.sym == SDLK_UP) {
 			move_up();
 			return true;
+		} else if (evt.key.keysym.sym == SDLK_PAGEUP || evt.key.keysym.sym == SDLK_PAGEDOWN) {
+			for (size_t i = 0; i < codeRows(); i++) {
+				if (evt.key.keysym.sym == SDLK_PAGEUP) {
+					move_up();
+				} else {
+					move_down();
+				}
+			}
+			return true;
 		} else if(evt.key.keysym.sym == SDLK_LEFT) {
 			if ((lshift.pressed || rshift.pressed) && (lctrl.pressed || rctrl.pressed)) {
 				current_level -= 2;
@@ -1116,156 +542,85 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 	return false;
 }
 
-void PlayMode::execute_player_statement() {
-	float time = player_statement->duration;
-	execution_line_index = (int)player_statement->line_num;
-	enemy_execution_line_index = -1;
-	execution_result = ExecutionResult::NONE;
-	if (player_time >= time) {
-		auto obj = player_units.begin();
-		if (player_statement->type == Compiler::ACTION_STATEMENT) {
-			Compiler::ActionStatement *action_statement = dynamic_cast<Compiler::ActionStatement *>(player_statement);
-			obj = std::find(player_units.begin(), player_units.end(), action_statement->object);
-		}
-		execution_result = ExecutionResult::FAILURE;
-		if (obj != player_units.end() && player_statement->execute()) {
-			execution_result = ExecutionResult::SUCCESS;
-		}
-		bool enemies_alive = false;
-		bool players_alive = false;
-		for (auto& enemy : enemy_units[current_level]) {
-			if (enemy->property("ALIVE")) {
-				enemies_alive = true;
-				break;
-			}
-		}
-		for (auto& player : player_units) {
-			if (player->property("ALIVE")) {
-				players_alive = true;
-				break;
-			}
-		}
-		if (!players_alive) {
-			player_done = true;
-			enemy_done = true;
-			level_lost = true;
-			return;
-		}
-		if (!enemies_alive) {
-			player_done = true;
-			enemy_done = true;
-			level_won = true;
-			return;
-		}
-		player_statement = player_exe->next();
-		if (player_statement == nullptr) {
-			player_done = true;
-			if (!enemy_done) {
-				turn = Turn::ENEMY;
-				enemy_time = turn_duration();
-			}
-		} else {
-			player_time -= time;
-			if (player_time <= 0.0f) {
-				if (!enemy_done) {
-					turn = Turn::ENEMY;
-					enemy_time = turn_duration();
-				} else {
-					player_time = turn_duration();
-				}
-			}
-		}
+// Compile the program and start a live battle, recording it; returns false on a compile error
+bool PlayMode::submit() {
+	std::vector<std::string> program = text_buffer.lines();
+	Compiler::Executable* player_exe = player_compiler.compile(program);
+	if (player_exe == nullptr) {
+		compile_failed = true;
+		return false;
+	}
+	compile_failed = false;
+	draw_message.clear();
+	if (enemy_ai_enabled) {
+		battle.enemy_controller = &enemy_ai;
+		enemy_ai.begin(battle, player_compiler, program);
+		battle.start(player_exe, nullptr);
 	} else {
-		player_statement->duration -= player_time;
-		if (!enemy_done) {
-			turn = Turn::ENEMY;
-			enemy_time = turn_duration();
-		} else {
-			player_time = turn_duration();
-		}
+		battle.enemy_controller = nullptr;
+		battle.start(player_exe, enemy_compiler.compile(enemy_program));
 	}
+	turn_done = false;
+
+	// Seed both sides so the battle can be reproduced from the replay
+	uint32_t seed = std::random_device()();
+	player_compiler.rng.seed(seed);
+	enemy_compiler.rng.seed(seed + 1);
+	std::vector<Object*> units = levels.player_units;
+	units.insert(units.end(), levels.enemy_units[current_level].begin(), levels.enemy_units[current_level].end());
+	replay.begin(current_level, program, seed, units);
+	recording = true;
+	return true;
 }
 
-void PlayMode::execute_enemy_statement() {
-	float time = enemy_statement->duration;
-	execution_line_index = -1;
-	enemy_execution_line_index = (int)enemy_statement->line_num;
-	execution_result = ExecutionResult::NONE;
-	if (enemy_time >= time) {
-		if (enemy_statement->execute()) {
-			execution_result = ExecutionResult::SUCCESS;
-		} else {
-			execution_result = ExecutionResult::FAILURE;
-		}
-		bool enemies_alive = false;
-		bool players_alive = false;
-		for (auto& enemy : enemy_units[current_level]) {
-			if (enemy->property("ALIVE")) {
-				enemies_alive = true;
-				break;
-			}
-		}
-		for (auto& player : player_units) {
-			if (player->property("ALIVE")) {
-				players_alive = true;
-				break;
-			}
-		}
-		if (!players_alive) {
-			player_done = true;
-			enemy_done = true;
-			level_lost = true;
-			return;
-		}
-		if (!enemies_alive) {
-			player_done = true;
-			enemy_done = true;
-			level_won = true;
-			return;
-		}
-		enemy_statement = enemy_exe->next();
-		if (enemy_statement == nullptr) {
-			enemy_done = true;
-			turn = Turn::PLAYER;
-			player_time = turn_duration();
-		} else {
-			enemy_time -= time;
-			if (enemy_time <= 0.0f) {
-				if (!player_done) {
-					turn = Turn::PLAYER;
-					player_time = turn_duration();
-				} else {
-					enemy_time = turn_duration();
-				}
-			}
-		}
-	} else {
-		enemy_statement->duration -= enemy_time;
-		// If both are done, we want to switch control to the player for the next turn
-		if (enemy_done || !player_done) {
-			turn = Turn::PLAYER;
-			player_time = turn_duration();
-		} else {
-			enemy_time = turn_duration();
-		}
+// Run the battle that submit() just started to completion, then play it back from the replay
+// (only against the scripted enemies: handle_event refuses it while the enemy AI is on)
+void PlayMode::resolve_instantly() {
+	assert(battle.enemy_controller == nullptr);
+	size_t turns = battle.run(&replay, &combat_events, max_instant_turns);
+	if (!battle.finished()) {
+		std::cout << "Warning: battle did not finish within " << turns << " turns" << std::endl;
+		battle.stop();
+	} else if (!battle.won && !battle.lost && battle.ending != Battle::UNDECIDED) {
+		draw_message = std::string("Battle over: ") + Battle::endingName(battle.ending);
 	}
+	save_replay();
+	turn_done = true;
+
+	replay_active = true;
+	replay_resolves_level = true;
+	replay_playing = true;
+	replay_speed = 1.f;
+	replay_clock = 0.f;
+	seek_replay(0);
 }
 
-void PlayMode::take_turn() {
-	if (turn == Turn::PLAYER) {
-		execute_player_statement();
+// Scripted enemies -> AI at each difficulty -> scripted enemies
+void PlayMode::cycle_enemy_ai() {
+	draw_message.clear();
+	if (!enemy_ai_enabled) {
+		enemy_ai_enabled = true;
+		enemy_ai.setDifficulty(EnemyAI::EASY);
+	} else if (enemy_ai.difficulty == EnemyAI::ADAPTIVE) {
+		enemy_ai_enabled = false;
 	} else {
-		execute_enemy_statement();
+		enemy_ai.setDifficulty((EnemyAI::Difficulty)(enemy_ai.difficulty + 1));
 	}
 }
 
+void PlayMode::take_turn() {
+	battle.takeTurn();
+	execution_line_index = battle.player_line;
+	enemy_execution_line_index = battle.enemy_line;
+	execution_result = (ExecutionResult)battle.result;
+}
+
 void PlayMode::reset_level() {
-	turn = Turn::PLAYER;
-	for (Object* p : player_units) {
+	for (Object* p : levels.player_units) {
 		p->reset();
 	}
-	for (size_t i = 0; i < enemy_units.size(); i++) {
-		for (Object* e : enemy_units[i]) {
+	for (size_t i = 0; i < levels.enemy_units.size(); i++) {
+		for (Object* e : levels.enemy_units[i]) {
 			if ((int)i == current_level) {
 				e->reset();
 			} else {
@@ -1275,80 +630,170 @@ void PlayMode::reset_level() {
 	}
 	reset_energy();
 	clear_animations();
+	combat_events.clear();
 	turn_time = 0.f;
 	execution_line_index = -1;
 	enemy_execution_line_index = -1;
 }
 
-void PlayMode::next_level() {
-	current_level++;
-	if (current_level < 0) {
-		current_level = 0;
-	} else if (current_level < 10) {
-		dungeon_scene->transform->position = scene_position;
-		cave_scene->transform->position = offscreen_scene_position;
-		forest_scene->transform->position = offscreen_scene_position;
-	} else if (current_level < 20) {
-		dungeon_scene->transform->position = offscreen_scene_position;
-		cave_scene->transform->position = scene_position;
-		forest_scene->transform->position = offscreen_scene_position;
-	} else if (current_level < 30) {
-		dungeon_scene->transform->position = offscreen_scene_position;
-		cave_scene->transform->position = offscreen_scene_position;
-		forest_scene->transform->position = scene_position;
-	} else if (current_level >= 30) {
-		game_end = true;
-		current_level = (int)level_guidance.size() - 1;
+void PlayMode::save_replay() {
+	if (!recording) {
+		return;
 	}
+	recording = false;
+	try {
+		replay.save(data_path("last.replay"));
+	} catch (std::exception const& e) {
+		std::cout << "Warning: could not save replay: " << e.what() << std::endl;
+	}
+}
 
-	// Compiler should recognize only those objects that exist in this level
-	player_compiler.clearObjects();
-	enemy_compiler.clearObjects();
-	/*
-	for (Object *u : player_units) {
-		player_compiler.addObject(u);
-		enemy_compiler.addObject(u);
-	}
-	*/
-	if (current_level >= first_brawler_level) {
-		player_compiler.addObject(brawler);
-		enemy_compiler.addObject(brawler);
-		brawler->start_position = glm::vec2(-6.f, -6.f);
+void PlayMode::start_replay() {
+	try {
+		replay.load(data_path("last.replay"));
+	} catch (std::exception const& e) {
+		std::cout << "Warning: could not load replay: " << e.what() << std::endl;
+		return;
+	}
+	if (replay.header.level < 0 || replay.header.level >= (int)levels.enemy_units.size()) {
+		std::cout << "Warning: replay is for unknown level " << replay.header.level << std::endl;
+		return;
+	}
+
+	// Keep the level and the draft to come back to, since showing the replay replaces both
+	replay_return_level = current_level;
+	replay_draft = text_buffer;
+	replay_draft_line = line_index;
+	replay_draft_column = cur_cursor_pos;
+	if (replay.header.level != current_level) {
+		current_level = replay.header.level - 1;
+		next_level();
+	}
+
+	std::vector<Object*> units = levels.player_units;
+	units.insert(units.end(), levels.enemy_units[current_level].begin(), levels.enemy_units[current_level].end());
+	if (!replay.bind(units)) {
+		std::cout << "Warning: replay units do not match level " << current_level << std::endl;
+		return_from_replay();
+		return;
+	}
+
+	text_buffer.assign(replay.program);
+	line_index = 0;
+	cur_cursor_pos = 0;
+	compile_failed = false;
+
+	replay_active = true;
+	replay_resolves_level = false;
+	replay_playing = true;
+	replay_speed = 1.f;
+	replay_clock = 0.f;
+	seek_replay(0);
+}
+
+void PlayMode::stop_replay() {
+	replay_active = false;
+	replay_playing = false;
+	if (!replay_resolves_level) {
+		return_from_replay();
+	} else if (battle.won) {
+		next_level();
 	} else {
-		brawler->start_position = glm::vec2(100.f, 0.f);
+		reset_level();
 	}
-	if (current_level >= first_caster_level) {
-		player_compiler.addObject(caster);
-		enemy_compiler.addObject(caster);
-		caster->start_position = glm::vec2(-6.f, 6.f);
+	replay_resolves_level = false;
+	battle.won = false;
+	battle.lost = false;
+}
+
+// Go back to the level and the draft start_replay() put aside
+void PlayMode::return_from_replay() {
+	if (current_level != replay_return_level) {
+		current_level = replay_return_level - 1;
+		next_level();
 	} else {
-		caster->start_position = glm::vec2(100.f, 0.f);
+		reset_level();
+	}
+	text_buffer = replay_draft;
+	line_index = replay_draft_line;
+	cur_cursor_pos = replay_draft_column;
+	compile_failed = false;
+}
+
+// Jump straight to the state before the given turn, without animating
+void PlayMode::seek_replay(size_t turn) {
+	reset_level();
+	replay.seek(turn);
+	for (Object* unit : replay.units) {
+		if (!unit->property("ALIVE")) {
+			unit->transform->position = offscreen_position();
+		}
+		unit->updateHealth();
+	}
+	replay_turn = std::min(turn, replay.turns.size());
+	show_replay_line();
+}
+
+// Play the next turn forward, with its animations unless animate is false
+void PlayMode::step_replay(bool animate) {
+	if (replay_turn >= replay.turns.size()) {
+		return;
 	}
-	if (current_level >= first_healer_level) {
-		player_compiler.addObject(healer);
-		enemy_compiler.addObject(healer);
-		healer->start_position = glm::vec2(-6.f, -2.f);
+	replay.seek(replay_turn + 1);
+	replay.turnEvents(replay_turn, &combat_events);
+	if (animate) {
+		present_combat_events(&combat_events);
 	} else {
-		healer->start_position = glm::vec2(100.f, 0.f);
+		finish_animations();
+		skip_combat_events(&combat_events);
 	}
-	if (current_level >= first_ranger_level) {
-		player_compiler.addObject(ranger);
-		enemy_compiler.addObject(ranger);
-		ranger->start_position = glm::vec2(-6.f, 2.f);
+	replay_turn++;
+	show_replay_line();
+}
+
+// Highlight the statement of the most recently played turn
+void PlayMode::show_replay_line() {
+	execution_line_index = -1;
+	enemy_execution_line_index = -1;
+	execution_result = ExecutionResult::NONE;
+	if (replay_turn == 0) {
+		return;
+	}
+	Replay::Turn const& last = replay.turns[replay_turn - 1];
+	if (last.side == Battle::PLAYER) {
+		execution_line_index = last.line;
 	} else {
-		ranger->start_position = glm::vec2(100.f, 0.f);
+		enemy_execution_line_index = last.line;
 	}
+	execution_result = (ExecutionResult)last.result;
+}
 
-	for (Object* u : enemy_units[current_level]) {
-		player_compiler.addObject(u);
-		enemy_compiler.addObject(u);
+void PlayMode::next_level() {
+	current_level++;
+	if (current_level < 0) {
+		current_level = 0;
+	} else if (current_level >= (int)levels.size()) {
+		game_end = true;
+		current_level = (int)levels.size() - 1;
+	}
+	for (auto const& backdrop : backdrops) {
+		backdrop.second->transform->position = backdrop.first == levels.scenes[current_level] ? scene_position : offscreen_scene_position;
 	}
 
-	enemy_text_buffer = Compiler::readFile(level_enemy_code[current_level]);
+	// Compiler should recognize only those objects that exist in this level
+	levels.setup(current_level, &player_compiler, &enemy_compiler);
+	battle.enemy_units = levels.enemy_units[current_level];
+
+	LevelPrefetch::Script script = level_prefetch.take(&levels.pack, current_level);
+	enemy_text_buffer = std::move(script.lines);
+	enemy_program = std::move(script.program);
+	if (current_level + 1 < (int)levels.size()) {
+		level_prefetch.request(&levels.pack, current_level + 1);
+	}
 
 	reset_level();
-	text_buffer.clear();
-	text_buffer.push_back("");
+	indexIdentifiers();
+	text_buffer.assign({});
 	line_index = 0;
 	cur_cursor_pos = 0;
 }
@@ -1356,15 +801,15 @@ void PlayMode::next_level() {
 
 void PlayMode::update(float elapsed) {
 	if (game_end) {
-		brawler->transform->rotation = glm::quat(0.0f, 0.0f, 0.0f, 0.0f);
-		brawler->transform->position = glm::vec3(-6.0f, -3.0f, brawler->floor_height);
-		caster->transform->rotation = glm::quat(sqrt(0.5f), 0.0f, 0.0f, sqrt(0.5f));
-		caster->transform->position = glm::vec3(-2.0f, -3.0f, caster->floor_height);
-		ranger->transform->rotation = glm::quat(0.0f, 0.0f, 0.0f, 0.0f);
-		ranger->transform->position = glm::vec3(2.0f, -3.0f, ranger->floor_height);
-		healer->transform->rotation = glm::quat(0.0f, 0.0f, 0.0f, 0.0f);
-		healer->transform->position = glm::vec3(6.0f, -3.0f, healer->floor_height);
-		for (Object* u : enemy_units[current_level]) {
+		levels.brawler->transform->rotation = glm::quat(0.0f, 0.0f, 0.0f, 0.0f);
+		levels.brawler->transform->position = glm::vec3(-6.0f, -3.0f, levels.brawler->floor_height);
+		levels.caster->transform->rotation = glm::quat(sqrt(0.5f), 0.0f, 0.0f, sqrt(0.5f));
+		levels.caster->transform->position = glm::vec3(-2.0f, -3.0f, levels.caster->floor_height);
+		levels.ranger->transform->rotation = glm::quat(0.0f, 0.0f, 0.0f, 0.0f);
+		levels.ranger->transform->position = glm::vec3(2.0f, -3.0f, levels.ranger->floor_height);
+		levels.healer->transform->rotation = glm::quat(0.0f, 0.0f, 0.0f, 0.0f);
+		levels.healer->transform->position = glm::vec3(6.0f, -3.0f, levels.healer->floor_height);
+		for (Object* u : levels.enemy_units[current_level]) {
 			u->transform->position = offscreen_position();
 		}
 		for (auto& transform : scene.transforms) {
@@ -1373,202 +818,205 @@ void PlayMode::update(float elapsed) {
 			}
 		}
 	}
-	if (lctrl.pressed || rctrl.pressed) {
-		update_animations(10.0f * elapsed);
-	} else {
-		update_animations(elapsed);
-	}
-
-	if (!turn_done) {
-		if (!player_done || !enemy_done) {
-			if (turn_time <= 0.0f) {
-				turn_time = turn_duration();
-				if (turn == Turn::PLAYER && player_statement != nullptr) {
-					if (player_time >= player_statement->duration) {
-						turn_time = std::min(player_statement->base_duration, turn_duration());
-					} else {
-						turn_time = 0.5f;
-					}
-				} else if (turn == Turn::ENEMY && enemy_statement != nullptr) {
-					if (enemy_time >= enemy_statement->duration) {
-						turn_time = std::min(enemy_statement->base_duration, turn_duration());
-					} else {
-						turn_time = 0.5f;
-					}
-				}
-				take_turn();
-			} else {
-				if (lctrl.pressed && rctrl.pressed) {
-					turn_time -= elapsed * 100.f;
-				} else if (lctrl.pressed || rctrl.pressed) {
-					turn_time -= elapsed * 10.f;
+	if (replay_active) {
+		float speed = std::abs(replay_speed);
+		advance_animations(elapsed, speed);
+		if (replay_playing) {
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<float>(max_logic_time);
+			replay_clock -= speed * elapsed;
+			while (replay_playing && replay_clock <= 0.0f) {
+				if (replay_speed > 0.f && replay_turn < replay.turns.size()) {
+					float pace = replay.turns[replay_turn].pace;
+					replay_clock += pace;
+					step_replay(pace / speed >= elapsed);
+				} else if (replay_speed < 0.f && replay_turn > 0) {
+					replay_clock += replay.turns[replay_turn - 1].pace;
+					seek_replay(replay_turn - 1);
 				} else {
-					turn_time -= elapsed;
+					replay_playing = false;
+				}
+				if (std::chrono::steady_clock::now() > deadline) {
+					replay_clock = std::max(replay_clock, 0.0f);
+					break;
 				}
 			}
-		} else {
-			if (turn_time <= 0.0f) {
-				turn_done = true;
-				execution_line_index = -1;
-				enemy_execution_line_index = -1;
-				if (!level_lost && !level_won) {
-					reset_level();
-				} else {
-					if (level_won) {
-						next_level();
-						level_won = false;
-					} else if (level_lost) {
-						reset_level();
-						level_lost = false;
-					}
+		}
+		return;
+	}
+
+	// The preview plays the scripted enemies, so it says nothing about the AI
+	if (turn_done && !enemy_ai_enabled && (text_buffer.version() != previewed_version || current_level != previewed_level)) {
+		preview.request(current_level, text_buffer.lines());
+		previewed_version = text_buffer.version();
+		previewed_level = current_level;
+	}
+
+	float warp = time_warp();
+	advance_animations(elapsed, warp);
+
+	// Take every turn that falls within this frame's warped time, but stop once the CPU budget is spent
+	// so a slow frame does not make the next one slower.
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<float>(max_logic_time);
+	float remaining = elapsed * warp;
+	while (!turn_done) {
+		if (turn_time > remaining) {
+			turn_time -= remaining;
+			break;
+		}
+		remaining -= turn_time;
+		turn_time = 0.0f;
+
+		if (battle.finished()) {
+			save_replay();
+			if (battle.enemy_controller != nullptr && (battle.won || battle.lost)) {
+				enemy_ai.adapt(battle.won);
+			}
+			turn_done = true;
+			execution_line_index = -1;
+			enemy_execution_line_index = -1;
+			if (!battle.lost && !battle.won) {
+				if (battle.ending != Battle::UNDECIDED) {
+					draw_message = std::string("Battle over: ") + Battle::endingName(battle.ending);
 				}
+				reset_level();
 			} else {
-				if (lctrl.pressed && rctrl.pressed) {
-					turn_time -= elapsed * 100.f;
-				} else if (lctrl.pressed || rctrl.pressed) {
-					turn_time -= elapsed * 10.f;
-				} else {
-					turn_time -= elapsed;
+				if (battle.won) {
+					next_level();
+					battle.won = false;
+				} else if (battle.lost) {
+					reset_level();
+					battle.lost = false;
 				}
 			}
+			break;
 		}
+
+		turn_time = battle.pace();
+		// The enemy AI is still searching for its move; ask again next frame
+		if (battle.waiting) {
+			turn_time = 0.0f;
+			break;
+		}
+		Battle::Side side = battle.turn;
+		take_turn();
+		if (recording) {
+			int line = side == Battle::PLAYER ? execution_line_index : enemy_execution_line_index;
+			replay.record((uint8_t)side, line, (uint8_t)execution_result, turn_time, combat_events);
+		}
+		// If the enemy AI moves next, let it start searching while this turn plays out
+		battle.prepareTurn();
+		// Turns that last less than a frame are not worth animating
+		if (turn_time / warp < elapsed) {
+			finish_animations();
+			skip_combat_events(&combat_events);
+		} else {
+			present_combat_events(&combat_events);
+		}
+
+		if (std::chrono::steady_clock::now() > deadline) {
+			break;
+		}
+	}
+}
+
+// 1x normally, 10x with ctrl, 100x with both ctrl keys, 1000x with both ctrl keys and shift
+float PlayMode::time_warp() {
+	if (lctrl.pressed && rctrl.pressed) {
+		if (lshift.pressed || rshift.pressed) {
+			return 1000.f;
+		}
+		return 100.f;
+	} else if (lctrl.pressed || rctrl.pressed) {
+		return 10.f;
+	}
+	return 1.f;
+}
+
+// Battles, replays and animations move on their own; otherwise only input, and the preview coming back, change the screen
+bool PlayMode::needs_redraw() {
+	return !turn_done || replay_playing || animations_active() || preview.pending() || preview_shown_stale;
+}
+
+// Animations never outlast a turn, so at warps where a whole turn fits in one frame they are just completed
+void PlayMode::advance_animations(float elapsed, float warp) {
+	if (elapsed * warp >= turn_duration()) {
+		finish_animations();
+	} else {
+		update_animations(elapsed * warp);
 	}
 }
 
 glm::ivec2 PlayMode::drawTextLarge(std::string text, glm::vec2 position, size_t width, int large_font_size, glm::u8vec4 color_large, bool cursor_line_large){
-		std::vector< PPUDataStream::Vertex > triangle_strip;
-
-	//helper to put a single tile somewhere on the screen:
-	auto draw_tile = [&](glm::ivec2 const& lower_left, uint8_t tile_index, glm::u8vec4 tile_color) {
-		//convert tile index to lower-left pixel coordinate in tile image:
-		glm::ivec2 tile_coord = glm::ivec2(tile_index * char_width, 0);
-
-		//build a quad as a (very short) triangle strip that starts and ends with degenerate triangles:
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x + 0, lower_left.y - char_bottom), glm::ivec2(tile_coord.x + 0, tile_coord.y + 0), tile_color);
-		triangle_strip.emplace_back(triangle_strip.back());
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x + 0, lower_left.y + char_top), glm::ivec2(tile_coord.x + 0, tile_coord.y + char_height), tile_color);
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x + char_width, lower_left.y - char_bottom), glm::ivec2(tile_coord.x + char_width, tile_coord.y + 0), tile_color);
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x + char_width, lower_left.y + char_top), glm::ivec2(tile_coord.x + char_width, tile_coord.y + char_height), tile_color);
-		triangle_strip.emplace_back(triangle_strip.back());
-	};
+	std::vector< PPUDataStream::GlyphInstance > glyphs;
 
-	const char* text_c_str = text.c_str();
-	size_t start_line = 0;
-	size_t line_num = 0;
+	//helper to put a single glyph, at the given size, with its pen at a point on the screen:
+	auto draw_glyph = [&](glm::vec2 const& pen, char character, glm::u8vec4 glyph_color) {
+		GlyphAtlas::Glyph const& glyph = glyph_atlas->glyph((uint8_t)character);
+		if (glyph.atlas_size.x == 0) {
+			return;
+		}
+		glyphs.emplace_back(pen, glyph.index, (uint16_t)large_font_size, glyph_color);
+	};
 
-	if (start_line == text.size() && cursor_line_large) {
+	if (text.empty() && cursor_line_large) {
 		drawText("|", position, width);
 	}
 
 	glm::ivec2 ret(0, 0);
 
-	while (start_line < text.size()) {
-		line_num++;
+	// Positions are shaped at font_size; monospace text scales evenly to the large size
+	double scale = (double)large_font_size / font_size;
 
-		// Create hb-buffer and populate.
-		hb_buffer_t* hb_buffer;
-		hb_buffer = hb_buffer_create();
-		hb_buffer_add_utf8(hb_buffer, text_c_str + start_line, -1, 0, -1);
-		hb_buffer_guess_segment_properties(hb_buffer);
-
-		// Shape it!
-		hb_feature_t feature;
-		hb_feature_from_string("-liga", -1, &feature);
-		hb_shape(hb_font, hb_buffer, &feature, 1);
-
-		// Get glyph information and positions out of the buffer.
-		unsigned int len = hb_buffer_get_length(hb_buffer);
-		hb_glyph_position_t* pos = hb_buffer_get_glyph_positions(hb_buffer, NULL);
+	std::vector<hb_glyph_position_t> const& pos = getGlyphPositions(text);
+	std::vector<LineBreaker::Line> const& lines = line_breaker->wrap(text, (double)width, char_width * scale, scale);
+	for (size_t line_num = 1; line_num <= lines.size(); line_num++) {
+		LineBreaker::Line const& line = lines[line_num - 1];
 
 		// Draw text
 		double current_x = position.x;
 		double current_y = position.y - line_num * large_font_size;
 
-		for (size_t i = 0; i < len; i++)
+		for (size_t i = 0; line.begin + i < line.next; i++)
 		{
 			if (cursor_line_large && i == cur_cursor_pos) {
 				drawText("|", glm::vec2(current_x - 5., current_y + large_font_size), width);
 			}
-			// Line break if next word would overflow
-			if (text[start_line + i] == ' ') {
-				double cx = current_x + pos[i].x_advance / 64.;
-				bool line_break = false;
-				for (size_t j = i + 1; j < len; j++) {
-					if (text[start_line + j] == ' ') {
-						break;
-					}
-					cx += pos[j].x_advance / 64.;
-					if (cx + char_width > position.x + width) {
-						line_break = true;
-						break;
-					}
-				}
-				if (line_break) {
-					start_line = start_line + i + 1;
-					break;
-				}
+			// The space the line was broken at is not drawn
+			if (line.begin + i == line.end) {
+				break;
 			}
 
 			// Draw character
-			draw_tile(glm::ivec2((int)(current_x + pos[i].x_offset / 64.), (int)(current_y + pos[i].y_offset / 64.)), (uint8_t)text[start_line + i] - (uint8_t)min_char, color_large);
+			hb_glyph_position_t const& glyph_pos = pos[line.begin + i];
+			draw_glyph(glm::vec2(current_x + glyph_pos.x_offset * scale / 64., current_y + glyph_pos.y_offset * scale / 64.), text[line.begin + i], color_large);
 			
 			// Advance position
-			current_x += pos[i].x_advance / 64.;
-			current_y += pos[i].y_advance / 64.;
+			current_x += glyph_pos.x_advance * scale / 64.;
+			current_y += glyph_pos.y_advance * scale / 64.;
 
 			ret.x = std::max(ret.x, (int)(current_x - position.x));
 			ret.y = std::max(ret.y, (int)current_y);
-			
-			// Line break on overflow (may be necessary if there are no spaces)
-			if (current_x + char_width > position.x + width || i == len - 1) {
-				start_line = start_line + i + 1;
-				break;
-			}
-			
 		}
 		if (cursor_line_large && cur_cursor_pos == text.size()) {
 			drawText("|", glm::vec2(current_x - 5., current_y + large_font_size), width);
 		}
 	}
 
-	drawVertexArray(GL_TRIANGLE_STRIP, triangle_strip, true);
+	drawGlyphs(glyphs);
 	
 	//return (int)(line_num * font_size);
 	return ret;
 }
 
-std::vector<hb_glyph_position_t> PlayMode::getGlyphPositions(std::string text, size_t offset) {
-	// Create hb-buffer and populate.
-	hb_buffer_t* hb_buffer;
-	hb_buffer = hb_buffer_create();
-	hb_buffer_add_utf8(hb_buffer, text.c_str() + offset, -1, 0, -1);
-	hb_buffer_guess_segment_properties(hb_buffer);
-
-	// Shape it!
-	hb_feature_t feature;
-	hb_feature_from_string("-liga", -1, &feature);
-	hb_shape(hb_font, hb_buffer, &feature, 1);
-
-	// Get glyph information and positions out of the buffer.
-	unsigned int len = hb_buffer_get_length(hb_buffer);
-	hb_glyph_position_t* pos = hb_buffer_get_glyph_positions(hb_buffer, NULL);
-
-	// Copy the glyph positions into a vector
-	std::vector<hb_glyph_position_t> ret;
-	for (size_t i = 0; i < len; i++) {
-		ret.push_back(pos[i]);
-	}
-
-	// Deallocate the harfbuzz buffer now that it is safely copied
-	hb_buffer_destroy(hb_buffer);
-
-	return ret;
+// Positions of the glyphs of text from offset on; valid until TextShaper::MaxRuns more runs are shaped
+std::vector<hb_glyph_position_t> const& PlayMode::getGlyphPositions(std::string const& text, size_t offset) {
+	return text_shaper->shape(text, offset);
 }
 
 
 glm::ivec2 PlayMode::getPositionInText(std::string text, glm::vec2 position, size_t index, size_t offset) {
 	// Get glyph positions for the given text string
-	std::vector<hb_glyph_position_t> pos = getGlyphPositions(text, offset);
+	std::vector<hb_glyph_position_t> const& pos = getGlyphPositions(text, offset);
 
 	// Increment position until we reach the end of the string, or the given end index
 	glm::dvec2 ret = position;
@@ -1587,26 +1035,18 @@ glm::ivec2 PlayMode::drawText(std::string text, glm::vec2 position, size_t width
 	if (width == 0) {
 		width = (size_t)1e6;
 	}
-	std::vector< PPUDataStream::Vertex > triangle_strip;
+	std::vector< PPUDataStream::GlyphInstance > glyphs;
 
-	//helper to put a single tile somewhere on the screen:
-	auto draw_tile = [&](glm::ivec2 const& lower_left, uint8_t tile_index, glm::u8vec4 tile_color) {
-		//convert tile index to lower-left pixel coordinate in tile image:
-		glm::ivec2 tile_coord = glm::ivec2(tile_index * char_width, 0);
-
-		//build a quad as a (very short) triangle strip that starts and ends with degenerate triangles:
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x + 0, lower_left.y - char_bottom), glm::ivec2(tile_coord.x + 0, tile_coord.y + 0), tile_color);
-		triangle_strip.emplace_back(triangle_strip.back());
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x + 0, lower_left.y + char_top), glm::ivec2(tile_coord.x + 0, tile_coord.y + char_height), tile_color);
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x + char_width, lower_left.y - char_bottom), glm::ivec2(tile_coord.x + char_width, tile_coord.y + 0), tile_color);
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x + char_width, lower_left.y + char_top), glm::ivec2(tile_coord.x + char_width, tile_coord.y + char_height), tile_color);
-		triangle_strip.emplace_back(triangle_strip.back());
+	//helper to put a single glyph, at the given size, with its pen at a point on the screen:
+	auto draw_glyph = [&](glm::vec2 const& pen, char character, glm::u8vec4 glyph_color) {
+		GlyphAtlas::Glyph const& glyph = glyph_atlas->glyph((uint8_t)character);
+		if (glyph.atlas_size.x == 0) {
+			return;
+		}
+		glyphs.emplace_back(pen, glyph.index, (uint16_t)font_size, glyph_color);
 	};
 
-	size_t start_line = 0;
-	size_t line_num = 0;
-
-	if (start_line == text.size() && cursor_line) {
+	if (text.empty() && cursor_line) {
 		drawText("|", position, width);
 	}
 
@@ -1619,38 +1059,23 @@ glm::ivec2 PlayMode::drawText(std::string text, glm::vec2 position, size_t width
 
 	glm::ivec2 ret(0, 0);
 
-	while (start_line < text.size()) {
-		line_num++;
-
-		std::vector<hb_glyph_position_t> pos = getGlyphPositions(text, start_line);
+	std::vector<hb_glyph_position_t> const& pos = getGlyphPositions(text);
+	std::vector<LineBreaker::Line> const& lines = line_breaker->wrap(text, (double)width, char_width);
+	for (size_t line_num = 1; line_num <= lines.size(); line_num++) {
+		LineBreaker::Line const& line = lines[line_num - 1];
 
 		// Draw text
 		double current_x = position.x;
 		double current_y = position.y - line_num * font_size;
 
-		for (size_t i = 0; i < pos.size(); i++)
+		for (size_t i = 0; line.begin + i < line.next; i++)
 		{
 			if (cursor_line && i == cur_cursor_pos) {
 				drawText("|", glm::vec2(current_x - 5., current_y + font_size), width);
 			}
-			// Line break if next word would overflow
-			if (text[start_line + i] == ' ') {
-				double cx = current_x + pos[i].x_advance / 64.;
-				bool line_break = false;
-				for (size_t j = i + 1; j < pos.size(); j++) {
-					cx += pos[j].x_advance / 64.;
-					if (cx > position.x + width) {
-						line_break = true;
-						break;
-					}
-					if (text[start_line + j] == ' ') {
-						break;
-					}
-				}
-				if (line_break) {
-					start_line = start_line + i + 1;
-					break;
-				}
+			// The space the line was broken at is not drawn
+			if (line.begin + i == line.end) {
+				break;
 			}
 
 			// Draw character
@@ -1658,27 +1083,22 @@ glm::ivec2 PlayMode::drawText(std::string text, glm::vec2 position, size_t width
 			if (do_autofill && (int)i >= autofill_word_end && (int)i < autofill_word_offset + (int)autofill_suggestion.size()) {
 				glyph_color = glm::u8vec4(glyph_color.r / 2, glyph_color.g / 2, glyph_color.b / 2, glyph_color.a);
 			}
-			draw_tile(glm::ivec2((int)(current_x + pos[i].x_offset / 64.), (int)(current_y + pos[i].y_offset / 64.)), (uint8_t)text[start_line + i] - (uint8_t)min_char, glyph_color);
+			hb_glyph_position_t const& glyph_pos = pos[line.begin + i];
+			draw_glyph(glm::vec2(current_x + glyph_pos.x_offset / 64., current_y + glyph_pos.y_offset / 64.), text[line.begin + i], glyph_color);
 			
 			// Advance position
-			current_x += pos[i].x_advance / 64.;
-			current_y += pos[i].y_advance / 64.;
+			current_x += glyph_pos.x_advance / 64.;
+			current_y += glyph_pos.y_advance / 64.;
 
 			ret.x = std::max(ret.x, (int)(current_x - position.x));
 			ret.y = std::max(ret.y, -(int)(current_y - position.y));
-			
-			// Line break on overflow (may be necessary if there are no spaces)
-			if (current_x + char_width > position.x + width || i == pos.size() - 1) {
-				start_line = start_line + i + 1;
-				break;
-			}
 		}
 		if (cursor_line && cur_cursor_pos == text.size()) {
 			drawText("|", glm::vec2(current_x - 5., current_y + font_size), width);
 		}
 	}
 
-	drawVertexArray(GL_TRIANGLE_STRIP, triangle_strip, true);
+	drawGlyphs(glyphs);
 	
 	return ret;
 }
@@ -1686,8 +1106,8 @@ glm::ivec2 PlayMode::drawText(std::string text, glm::vec2 position, size_t width
 void PlayMode::move_up(){
 	if (line_index > 0) {
 		line_index--;
-		if (cur_cursor_pos > text_buffer[line_index].size()) {
-			cur_cursor_pos = text_buffer[line_index].size();
+		if (cur_cursor_pos > text_buffer.line(line_index).size()) {
+			cur_cursor_pos = text_buffer.line(line_index).size();
 		}
 	}
 }
@@ -1695,14 +1115,14 @@ void PlayMode::move_up(){
 void PlayMode::move_down(){
 	if(line_index < text_buffer.size() - 1){
 		line_index++;
-		if (cur_cursor_pos > text_buffer[line_index].size()) {
-			cur_cursor_pos = text_buffer[line_index].size();
+		if (cur_cursor_pos > text_buffer.line(line_index).size()) {
+			cur_cursor_pos = text_buffer.line(line_index).size();
 		}
 	}
 }
 
 void PlayMode::move_right(){
-	if(cur_cursor_pos < text_buffer[line_index].size()){
+	if(cur_cursor_pos < text_buffer.line(line_index).size()){
 		cur_cursor_pos++;
 	}
 }
@@ -1715,8 +1135,7 @@ void PlayMode::move_left(){
 
 void PlayMode::line_break(){
 	if (text_buffer.size() < max_lines) {
-		text_buffer.insert(text_buffer.begin() + line_index + 1, text_buffer[line_index].substr(cur_cursor_pos, text_buffer[line_index].size() - cur_cursor_pos));
-		text_buffer[line_index] = text_buffer[line_index].substr(0, cur_cursor_pos);
+		text_buffer.split(line_index, cur_cursor_pos);
 		line_index++;
 		cur_cursor_pos = 0;
 	}
@@ -1724,63 +1143,216 @@ void PlayMode::line_break(){
 
 void PlayMode::delete_text(){
 	if (cur_cursor_pos > 0){
-		text_buffer[line_index].erase(cur_cursor_pos - 1, 1);
+		text_buffer.replace(line_index, cur_cursor_pos - 1, 1, "");
 		cur_cursor_pos = cur_cursor_pos - 1;
-	} else if (line_index > 0 && text_buffer[line_index - 1].size() + text_buffer[line_index].size() <= max_line_chars) {
-		cur_cursor_pos = text_buffer[line_index - 1].size();
-		text_buffer[line_index - 1] += text_buffer[line_index];
-		text_buffer.erase(text_buffer.begin() + line_index);
+	} else if (line_index > 0 && text_buffer.line(line_index - 1).size() + text_buffer.line(line_index).size() <= max_line_chars) {
+		cur_cursor_pos = text_buffer.line(line_index - 1).size();
+		text_buffer.join(line_index - 1);
 		line_index--;
 	}
 }
 
 void PlayMode::insert(std::string cur_letter){
-	if (text_buffer[line_index].size() < max_line_chars) {
-		text_buffer[line_index].insert(cur_cursor_pos, cur_letter);
+	if (text_buffer.line(line_index).size() < max_line_chars) {
+		text_buffer.replace(line_index, cur_cursor_pos, 0, cur_letter);
 		cur_cursor_pos++;
 	}
 }
 
+// Lines of code that fit in the box under its header
+size_t PlayMode::codeRows() {
+	return (size_t)std::max(1, (input_size.y + 2 * text_margin.y - font_size) / font_size);
+}
+
+void PlayMode::undo(){
+	text_buffer.undo(&line_index, &cur_cursor_pos);
+}
+
+void PlayMode::redo(){
+	text_buffer.redo(&line_index, &cur_cursor_pos);
+}
+
 void PlayMode::render(){
-	int x = input_pos.x + text_margin.x;
-	int y = input_pos.y + input_size.y + text_margin.y;
-
-	drawText("Your Code", glm::vec2(x, y), 0, glm::u8vec4(0x80, 0x80, 0x80, 0xff));
-	y -= font_size;
-
-	glm::u8vec4 pen_color = default_line_color;
-	for(size_t i = 0; i < text_buffer.size(); i++){
-		if (!turn_done && (int)i == execution_line_index) {
-			switch (execution_result) {
-			case ExecutionResult::SUCCESS:
-				pen_color = execute_success_color;
-				break;
-			case ExecutionResult::FAILURE:
-				pen_color = execute_failure_color;
-				break;
-			default:
-				pen_color = execute_normal_color;
-				break;
+	// Each box is its own panel, redrawn only when something it shows changes
+	// Only the lines in view are laid out; the view follows the line being typed or run when that changes
+	size_t rows = codeRows();
+	bool executing = (!turn_done || replay_active) && execution_line_index >= 0;
+	size_t follow = executing ? (size_t)execution_line_index : line_index;
+	if (follow != followed_line) {
+		followed_line = follow;
+		size_t top = scroll_y / font_size;
+		if (follow < top) {
+			top = follow;
+		} else if (follow >= top + rows) {
+			top = follow - rows + 1;
+		}
+		scroll_y = (int)top * font_size;
+	}
+	size_t max_top = text_buffer.size() > rows ? text_buffer.size() - rows : 0;
+	scroll_y = std::max(0, std::min(scroll_y, (int)max_top * font_size));
+	size_t first = scroll_y / font_size;
+	size_t last = std::min(text_buffer.size(), first + rows);
+
+	std::ostringstream code_inputs;
+	code_inputs << text_buffer.version() << ' ' << first << ' ' << scroll_x << ' ' << line_index << ' ' << cur_cursor_pos << ' ' << execution_line_index << ' ' << execution_result
+		<< ' ' << turn_done << ' ' << replay_active << ' ' << autofill_suggestion << ' ' << autofill_word_offset << ' ' << autofill_word_end;
+	drawPanel(code_panel, input_pos, input_size, code_inputs.str(), [&]() {
+		int x = input_pos.x + text_margin.x;
+		int y = input_pos.y + input_size.y + text_margin.y;
+
+		std::string header = "Your Code";
+		if (text_buffer.size() > rows) {
+			header += "  " + std::to_string(first + 1) + "-" + std::to_string(last) + " of " + std::to_string(text_buffer.size());
+		}
+		drawText(header, glm::vec2(x, y), 0, glm::u8vec4(0x80, 0x80, 0x80, 0xff));
+		y -= font_size;
+
+		glm::u8vec4 pen_color = default_line_color;
+		for(size_t i = first; i < last; i++){
+			if ((!turn_done || replay_active) && (int)i == execution_line_index) {
+				switch (execution_result) {
+				case ExecutionResult::SUCCESS:
+					pen_color = execute_success_color;
+					break;
+				case ExecutionResult::FAILURE:
+					pen_color = execute_failure_color;
+					break;
+				default:
+					pen_color = execute_normal_color;
+					break;
+				}
+			} else if (turn_done && i == line_index) {
+				pen_color = cur_line_color;
+			} else {
+				pen_color = default_line_color;
 			}
-		} else if (turn_done && i == line_index) {
-			pen_color = cur_line_color;
-		} else {
-			pen_color = default_line_color;
+			drawText(text_buffer.line(i), glm::vec2(x - scroll_x, y - (i - first) * font_size), 0, pen_color, i == line_index);
+		}
+	});
+
+	std::string status;
+	if (replay_active) {
+		status = "REPLAY turn " + std::to_string(replay_turn) + "/" + std::to_string(replay.turns.size()) + "  speed " + std::to_string(replay_speed).substr(0, 5) + (replay_playing ? "" : "  (paused)");
+	} else if (compile_failed) {
+		status = player_compiler.error_message;
+	} else if (!draw_message.empty()) {
+		status = draw_message;
+	} else if (enemy_ai_enabled) {
+		status = "Enemy AI: " + EnemyAI::difficultyName(enemy_ai.difficulty);
+	}
+	drawPanel(status_panel, error_pos, error_size, status, [&]() {
+		drawText(status, glm::ivec2(error_pos.x + text_margin.x, error_pos.y + error_size.y + text_margin.y), error_size.x - 2 * text_margin.x);
+	});
+
+	std::string preview_line;
+	if (turn_done && !enemy_ai_enabled) {
+		preview_line = preview_message();
+	}
+	drawPanel(prompt_panel, prompt_pos, prompt_size, levels.guidance[current_level] + '\n' + preview_line, [&]() {
+		drawText(levels.guidance[current_level], prompt_pos + glm::ivec2(0, prompt_size.y) + text_margin, prompt_size.x - 2 * text_margin.x);
+		drawText(preview_line, prompt_pos + glm::ivec2(text_margin.x, font_size), prompt_size.x - 2 * text_margin.x, glm::u8vec4(0x80, 0x80, 0x80, 0xff));
+	});
+}
+
+std::string PlayMode::preview_message() {
+	Preview::Result result = preview.result();
+	std::string message;
+	if (result.status == Preview::COMPILE_ERROR) {
+		message = "Preview: does not compile yet";
+	} else if (result.status == Preview::DONE) {
+		std::string turns = std::to_string(result.turns) + " turns";
+		std::string health = "HP " + std::to_string(result.health) + "/" + std::to_string(result.health_max) + " left";
+		switch (result.ending) {
+		case Battle::PLAYER_WON:
+			message = "Preview: win in " + turns + ", " + health;
+			break;
+		case Battle::ENEMY_WON:
+			message = "Preview: loss after " + turns;
+			break;
+		case Battle::UNDECIDED:
+			message = "Preview: no winner after " + turns + ", " + health;
+			break;
+		default:
+			message = std::string("Preview: ") + Battle::endingName(result.ending);
+			break;
 		}
-		drawText(text_buffer[i], glm::vec2(x, y - i * font_size), 0, pen_color, i == line_index);
 	}
-	if (compile_failed) {
-		drawText(player_compiler.error_message, glm::ivec2(error_pos.x + text_margin.x, error_pos.y + error_size.y + text_margin.y), error_size.x - 2 * text_margin.x);
+	if (result.stale && !message.empty()) {
+		message += " ...";
 	}
-	drawText(level_guidance[current_level], prompt_pos + glm::ivec2(0, prompt_size.y) + text_margin, prompt_size.x - 2 * text_margin.x);
+	preview_shown_stale = result.stale;
+	return message;
 }
 
 //TODO: render text end
-void PlayMode::drawVertexArray(GLenum mode, const std::vector<PPUDataStream::Vertex>& vertex_array, bool use_texture) {
-	// Upload vertex buffer
-	glBindBuffer(GL_ARRAY_BUFFER, data_stream->vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(decltype(vertex_array[0])) * vertex_array.size(), vertex_array.data(), GL_STREAM_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+// Queue vertices to be drawn at the end of the frame, after everything queued before them.
+// Textured vertices sample a distance field; texture 0 draws them in solid color.
+void PlayMode::drawVertexArray(GLenum mode, const std::vector<PPUDataStream::Vertex>& vertex_array, GLuint texture) {
+	if (vertex_array.empty()) {
+		return;
+	}
+
+	// Lists of primitives can share a draw call with the batch before them; strips cannot
+	bool is_list = mode == GL_TRIANGLES || mode == GL_LINES || mode == GL_POINTS;
+	VertexBatch* last = queued_batches.empty() ? nullptr : &queued_batches.back();
+	if (is_list && last && last->instances == PPUTileProgram::NoInstances && last->mode == mode && (last->texture == texture || last->texture == 0 || texture == 0)) {
+		last->texture = std::max(last->texture, texture);
+		last->count += GLsizei(vertex_array.size());
+	} else {
+		queued_batches.push_back(VertexBatch{mode, texture, false, PPUTileProgram::NoInstances, GLint(queued_vertices.size()), GLsizei(vertex_array.size())});
+	}
+
+	size_t start = queued_vertices.size();
+	queued_vertices.insert(queued_vertices.end(), vertex_array.begin(), vertex_array.end());
+	if (texture == 0) {
+		// A negative tile coordinate tells the shader to draw a solid color
+		for (size_t i = start; i < queued_vertices.size(); i++) {
+			queued_vertices[i].TileCoord = glm::ivec2(-1, -1);
+		}
+	}
+}
+
+
+// Queue glyph instances to be drawn at the end of the frame, after everything queued before them.
+void PlayMode::drawGlyphs(const std::vector<PPUDataStream::GlyphInstance>& glyphs) {
+	if (glyphs.empty()) {
+		return;
+	}
+
+	VertexBatch* last = queued_batches.empty() ? nullptr : &queued_batches.back();
+	if (last && last->instances == PPUTileProgram::GlyphInstances) {
+		last->count += GLsizei(glyphs.size());
+	} else {
+		queued_batches.push_back(VertexBatch{GL_TRIANGLE_STRIP, glyph_atlas->texture, false, PPUTileProgram::GlyphInstances, GLint(queued_glyphs.size()), GLsizei(glyphs.size())});
+	}
+	queued_glyphs.insert(queued_glyphs.end(), glyphs.begin(), glyphs.end());
+}
+
+// Queue a rectangle drawn entirely by the fragment shader, batched with the rectangles queued just before it.
+void PlayMode::drawRect(PPUDataStream::RectInstance const& rect) {
+	VertexBatch* last = queued_batches.empty() ? nullptr : &queued_batches.back();
+	if (last && last->instances == PPUTileProgram::RectInstances) {
+		last->count++;
+	} else {
+		queued_batches.push_back(VertexBatch{GL_TRIANGLE_STRIP, 0, false, PPUTileProgram::RectInstances, GLint(queued_rects.size()), 1});
+	}
+	queued_rects.push_back(rect);
+}
+
+
+// Draw everything drawVertexArray queued, in as few draw calls as the batches allow
+void PlayMode::flushVertexArrays() {
+	flushVertexArrays(glm::ivec2(0, 0), glm::ivec2(ScreenWidth, ScreenHeight));
+}
+
+// The same, into whatever framebuffer is bound, with [lower_left, lower_left + size] filling the viewport
+void PlayMode::flushVertexArrays(glm::ivec2 lower_left, glm::ivec2 size) {
+	if (queued_batches.empty()) {
+		return;
+	}
+	GLint base = queued_vertices.empty() ? 0 : data_stream->upload(queued_vertices);
+	GLint glyph_base = queued_glyphs.empty() ? 0 : data_stream->upload(queued_glyphs);
+	GLint rect_base = queued_rects.empty() ? 0 : data_stream->upload(queued_rects);
 
 	//set up the pipeline:
 	// set blending function for output fragments:
@@ -1795,75 +1367,190 @@ void PlayMode::drawVertexArray(GLenum mode, const std::vector<PPUDataStream::Ver
 	glBindVertexArray(data_stream->vertex_buffer_for_tile_program);
 
 	// set uniforms for shader programs:
-	{ //set matrix to transform [0,ScreenWidth]x[0,ScreenHeight] -> [-1,1]x[-1,1]:
+	{ //set matrix to transform [lower_left,lower_left+size] -> [-1,1]x[-1,1]:
 		//NOTE: glm uses column-major matrices:
 		glm::mat4 OBJECT_TO_CLIP = glm::mat4(
-			glm::vec4(2.0f / ScreenWidth, 0.0f, 0.0f, 0.0f),
-			glm::vec4(0.0f, 2.0f / ScreenHeight, 0.0f, 0.0f),
+			glm::vec4(2.0f / size.x, 0.0f, 0.0f, 0.0f),
+			glm::vec4(0.0f, 2.0f / size.y, 0.0f, 0.0f),
 			glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
-			glm::vec4(-1.0f - scroll_x * 2.f / ScreenWidth, -1.0f - scroll_y * 2.f / ScreenHeight, 0.0f, 1.0f)
+			glm::vec4(-1.0f - lower_left.x * 2.f / size.x, -1.0f - lower_left.y * 2.f / size.y, 0.0f, 1.0f)
 		);
 		glUniformMatrix4fv(tile_program->OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(OBJECT_TO_CLIP));
-		glUniform1i(tile_program->USE_TEXTURE_bool, (int)use_texture);
 	}
+	glUniform1i(tile_program->IMAGE_bool, GL_FALSE);
+	glUniform1i(tile_program->INSTANCES_int, PPUTileProgram::NoInstances);
 
-	// bind texture units to proper texture objects:
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, data_stream->tile_tex);
+	// glyph metrics, for expanding glyph instances:
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, glyph_atlas->table);
 
-	//now that the pipeline is configured, trigger drawing of triangle strip:
-	glDrawArrays(mode, 0, GLsizei(vertex_array.size()));
+	// draw the batches, binding textures only when they change:
+	glActiveTexture(GL_TEXTURE0);
+	GLuint bound = 0;
+	bool image = false;
+	PPUTileProgram::Instances instances = PPUTileProgram::NoInstances;
+	for (VertexBatch const& batch : queued_batches) {
+		if (batch.texture != 0 && batch.texture != bound) {
+			glBindTexture(GL_TEXTURE_2D, batch.texture);
+			bound = batch.texture;
+			if (batch.image != image) {
+				glUniform1i(tile_program->IMAGE_bool, batch.image ? GL_TRUE : GL_FALSE);
+				image = batch.image;
+			}
+		}
+		if (batch.instances != instances) {
+			glUniform1i(tile_program->INSTANCES_int, batch.instances);
+			if (batch.instances == PPUTileProgram::GlyphInstances) {
+				glBindVertexArray(data_stream->glyph_buffer_for_tile_program);
+			} else if (batch.instances == PPUTileProgram::RectInstances) {
+				glBindVertexArray(data_stream->rect_buffer_for_tile_program);
+			} else {
+				glBindVertexArray(data_stream->vertex_buffer_for_tile_program);
+			}
+			instances = batch.instances;
+		}
+		// instances are one quad each, its corners numbered by gl_VertexID:
+		if (batch.instances == PPUTileProgram::GlyphInstances) {
+			data_stream->point_glyph_attributes(glyph_base + batch.first);
+			glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, batch.count);
+		} else if (batch.instances == PPUTileProgram::RectInstances) {
+			data_stream->point_rect_attributes(rect_base + batch.first);
+			glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, batch.count);
+		} else {
+			glDrawArrays(batch.mode, base + batch.first, batch.count);
+		}
+	}
+	data_stream->fence();
 
 	//return state to default:
+	glBindTexture(GL_TEXTURE_2D, 0);
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
 	glBindVertexArray(0);
 	glUseProgram(0);
 	glDisable(GL_BLEND);
 
+	queued_vertices.clear();
+	queued_glyphs.clear();
+	queued_rects.clear();
+	queued_batches.clear();
+
 	GL_ERRORS();
 }
 
+// Queue a texture of pixels texels to be drawn as it is, filling [pos, pos + size]
+void PlayMode::drawImage(GLuint texture, glm::ivec2 pos, glm::ivec2 size, glm::ivec2 pixels) {
+	glm::u8vec4 white = glm::u8vec4(0xff, 0xff, 0xff, 0xff);
+	PPUDataStream::Vertex bottom_left(pos, glm::ivec2(0, 0), white);
+	PPUDataStream::Vertex top_left(glm::ivec2(pos.x, pos.y + size.y), glm::ivec2(0, pixels.y), white);
+	PPUDataStream::Vertex bottom_right(glm::ivec2(pos.x + size.x, pos.y), glm::ivec2(pixels.x, 0), white);
+	PPUDataStream::Vertex top_right(pos + size, pixels, white);
+
+	// Its own batch, since it samples its texture differently from the glyphs
+	queued_batches.push_back(VertexBatch{GL_TRIANGLES, texture, true, PPUTileProgram::NoInstances, GLint(queued_vertices.size()), 6});
+	queued_vertices.insert(queued_vertices.end(), {bottom_left, top_left, bottom_right, bottom_right, top_left, top_right});
+}
+
+// Draw a black box with a white border at [pos, pos + size], filled in by draw_contents (in screen coordinates).
+// The box is kept in panel's texture, and draw_contents is only called again when inputs differ from last time.
+void PlayMode::drawPanel(Panel& panel, glm::ivec2 pos, glm::ivec2 size, std::string inputs, std::function<void()> const& draw_contents) {
+	glm::ivec2 pixels = glm::ivec2(int(std::ceil(size.x * panel_scale.x)), int(std::ceil(size.y * panel_scale.y)));
+	inputs = std::to_string(size.x) + " " + std::to_string(size.y) + "\n" + inputs;
 
-void PlayMode::drawRectangle(glm::ivec2 pos, glm::ivec2 size, glm::u8vec4 color, bool filled) {
-	// Find corners of rectangle, counter-clockwise from bottom left, first corner repeated at end
-	std::array<glm::ivec2, 5> corners = {
-		glm::ivec2(pos.x, pos.y),
-		glm::ivec2(pos.x, pos.y + size.y),
-		glm::ivec2(pos.x + size.x, pos.y + size.y),
-		glm::ivec2(pos.x + size.x, pos.y),
-		glm::ivec2(pos.x, pos.y)
-	};
+	if (pixels != panel.pixels) {
+		if (panel.texture == 0) {
+			glGenTextures(1, &panel.texture);
+			glGenFramebuffers(1, &panel.framebuffer);
+		}
+		glBindTexture(GL_TEXTURE_2D, panel.texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, pixels.x, pixels.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, panel.framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, panel.texture, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			throw std::runtime_error("Panel framebuffer of " + std::to_string(pixels.x) + "x" + std::to_string(pixels.y) + " pixels is incomplete.");
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	// Switch corners if filled to get it into the format for a triangle strip
-	if (filled) {
-		glm::ivec2 temp = corners[2];
-		corners[2] = corners[3];
-		corners[3] = temp;
+		panel.pixels = pixels;
+		panel.inputs.clear();
 	}
-	
-	// Build vertex array
-	std::vector<PPUDataStream::Vertex> vertex_array;
-	for (size_t i = 0; i < (filled ? 4 : 5); i++) {
-		vertex_array.emplace_back(corners[i], glm::ivec2(0, 0), color);
+
+	if (panel.inputs != inputs) {
+		// Draw the contents on their own, leaving what the frame queued so far for later
+		std::vector<PPUDataStream::Vertex> frame_vertices;
+		std::vector<PPUDataStream::GlyphInstance> frame_glyphs;
+		std::vector<PPUDataStream::RectInstance> frame_rects;
+		std::vector<VertexBatch> frame_batches;
+		std::swap(frame_vertices, queued_vertices);
+		std::swap(frame_glyphs, queued_glyphs);
+		std::swap(frame_rects, queued_rects);
+		std::swap(frame_batches, queued_batches);
+
+		drawRectangle(pos + glm::ivec2(5, 5), size - glm::ivec2(10, 10), glm::u8vec4(255, 255, 255, 255), false);
+		draw_contents();
+
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		glBindFramebuffer(GL_FRAMEBUFFER, panel.framebuffer);
+		glViewport(0, 0, pixels.x, pixels.y);
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		flushVertexArrays(pos, size);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+		std::swap(frame_vertices, queued_vertices);
+		std::swap(frame_glyphs, queued_glyphs);
+		std::swap(frame_rects, queued_rects);
+		std::swap(frame_batches, queued_batches);
+		panel.inputs = std::move(inputs);
+		panel.version++;
 	}
 
-	// Draw vertex array
-	drawVertexArray(filled ? GL_TRIANGLE_STRIP : GL_LINE_STRIP, vertex_array, false);
+	drawImage(panel.texture, pos, size, pixels);
+}
 
-	// Fill in the bottom left corner, which is empty for some reason
-	std::vector<PPUDataStream::Vertex> point;
-	point.emplace_back(corners[0], glm::ivec2(0, 0), color);
-	drawVertexArray(GL_POINTS, point, false);
+PlayMode::Panel::~Panel() {
+	if (framebuffer != 0) {
+		glDeleteFramebuffers(1, &framebuffer);
+		framebuffer = 0;
+	}
+	if (texture != 0) {
+		glDeleteTextures(1, &texture);
+		texture = 0;
+	}
 }
 
-void PlayMode::drawThickRectangleOutline(glm::ivec2 pos, glm::ivec2 size, glm::u8vec4 color, int thickness) {
-	thickness--;
-	for (int i = -thickness; i <= thickness; i++) {
-		drawRectangle(pos + glm::ivec2(i, i), size - 2 * glm::ivec2(i, i), color, false);
+
+void PlayMode::drawRectangle(glm::ivec2 pos, glm::ivec2 size, glm::u8vec4 color, bool filled) {
+	// Rectangles are built from triangles so they batch with everything else
+	std::vector<PPUDataStream::Vertex> triangles;
+	auto add_quad = [&](glm::ivec2 lower_left, glm::ivec2 upper_right) {
+		PPUDataStream::Vertex bottom_left(lower_left, color);
+		PPUDataStream::Vertex top_left(glm::ivec2(lower_left.x, upper_right.y), color);
+		PPUDataStream::Vertex bottom_right(glm::ivec2(upper_right.x, lower_left.y), color);
+		PPUDataStream::Vertex top_right(upper_right, color);
+		triangles.insert(triangles.end(), {bottom_left, top_left, bottom_right, bottom_right, top_left, top_right});
+	};
+
+	if (filled) {
+		add_quad(pos, pos + size);
+	} else {
+		// One pixel wide edges, covering the same pixels as a line loop through the corners
+		add_quad(pos, glm::ivec2(pos.x + 1, pos.y + size.y + 1));
+		add_quad(glm::ivec2(pos.x + size.x, pos.y), pos + size + glm::ivec2(1, 1));
+		add_quad(pos, glm::ivec2(pos.x + size.x + 1, pos.y + 1));
+		add_quad(glm::ivec2(pos.x, pos.y + size.y), pos + size + glm::ivec2(1, 1));
 	}
+
+	drawVertexArray(GL_TRIANGLES, triangles, 0);
 }
 
 
@@ -1877,26 +1564,32 @@ glm::vec2 PlayMode::worldToScreen(glm::vec3 pos) {
 void PlayMode::drawHealthBar(Object* unit) {
 	if (unit->property("health_max") > 0 && unit->health_level > 0) {
 		glm::ivec2 health_bar_pos = worldToScreen(unit->transform->position + glm::vec3(0.f, 0.f, 2.5f)) - glm::vec2(health_bar_size.x / 2.f, 0);
-		
-		int name_width = drawText(unit->name, health_bar_pos + glm::ivec2(0, health_bar_size.y + font_size), health_bar_size.x, glm::u8vec4(0xff, 0xff, 0xff, 0xff)).x;
-		drawRectangle(health_bar_pos - glm::ivec2(2, 1), glm::ivec2(name_width + 2, health_bar_size.y + font_size) + glm::ivec2(3, 3), glm::u8vec4(0, 0, 0, 255), true);
-		drawText(unit->name, health_bar_pos + glm::ivec2(0, health_bar_size.y + font_size + 2), health_bar_size.x, glm::u8vec4(0xff, 0xff, 0xff, 0xff));
-		
-		drawRectangle(health_bar_pos, health_bar_size, glm::u8vec4(0, 0, 0, 255), true);
-		glm::ivec2 filled_size = glm::vec2(health_bar_size.x * unit->health_level, health_bar_size.y);
-		drawRectangle(health_bar_pos, filled_size - glm::ivec2(1, 0), glm::u8vec4(0, 255, 0, 255), true);
-		if (filled_size.x > 0) {
-			drawThickRectangleOutline(health_bar_pos + glm::ivec2(2, 2), filled_size - glm::ivec2(4, 4), glm::u8vec4(0, 128, 0, 255), 2);
-		}
-		drawThickRectangleOutline(health_bar_pos, health_bar_size, glm::u8vec4(0, 0, 0, 255), 2);
-		float segment_width = 10.f / unit->property("health_max") * health_bar_size.x;
-		float segment_start = 0;
-		while (segment_start < health_bar_size.x) {
-			int x1 = (int)segment_start;
-			int x2 = (int)(segment_start + segment_width);
-			drawRectangle(glm::ivec2(health_bar_pos.x + x1, health_bar_pos.y), glm::ivec2(std::min(x2 - x1, health_bar_size.x - x1), health_bar_size.y), glm::u8vec4(0, 0, 0, 255), false);
-			segment_start += segment_width;
+
+		// The name's width, to fit its backing to it
+		double name_width = 0.;
+		for (hb_glyph_position_t const& pos : getGlyphPositions(unit->name)) {
+			name_width += pos.x_advance / 64.;
 		}
+		name_width = std::min(name_width, (double)health_bar_size.x);
+
+		// The name's backing and the bar are one rectangle each, drawn by the tile program's fragment shader
+		PPUDataStream::RectInstance backing;
+		backing.Box = glm::i16vec4(health_bar_pos.x - 2, health_bar_pos.y - 1, (int)name_width + 5, health_bar_size.y + font_size + 3);
+		backing.Color = glm::u8vec4(0, 0, 0, 255);
+		drawRect(backing);
+
+		PPUDataStream::RectInstance bar;
+		bar.Box = glm::i16vec4(health_bar_pos.x, health_bar_pos.y, health_bar_size.x, health_bar_size.y);
+		bar.Color = glm::u8vec4(0, 0, 0, 255);
+		bar.FillColor = glm::u8vec4(0, 255, 0, 255);
+		bar.EdgeColor = glm::u8vec4(0, 0, 0, 255);
+		bar.Fill = (uint16_t)std::lround(glm::clamp(unit->health_level, 0.f, 1.f) * 0xffff);
+		// A tick every 10 HP
+		bar.Segment = (uint16_t)std::min(std::lround(10.f / unit->property("health_max") * health_bar_size.x * 16.f), 0xffffL);
+		bar.Edge = 2;
+		drawRect(bar);
+
+		drawText(unit->name, health_bar_pos + glm::ivec2(0, health_bar_size.y + font_size + 2), health_bar_size.x, glm::u8vec4(0xff, 0xff, 0xff, 0xff));
 	}
 }
 
@@ -1916,7 +1609,7 @@ Object* PlayMode::getObject(std::string name) {
 
 
 bool PlayMode::isPlayer(Object* obj) {
-	return std::find(player_units.begin(), player_units.end(), obj) != player_units.end();
+	return std::find(levels.player_units.begin(), levels.player_units.end(), obj) != levels.player_units.end();
 }
 
 
@@ -1929,7 +1622,7 @@ void PlayMode::updateAutofillSuggestion() {
 
 	// Parse the current line into a vector of words
 	std::vector<int> offsets;
-	Compiler::Line line = Compiler::readLine(text_buffer[line_index], &offsets);
+	Compiler::Line line = Compiler::readLine(text_buffer.line(line_index), &offsets);
 	assert(offsets.size() == line.size());
 
 	// Determine whether this line is a conditional statement (as opposed to an action)
@@ -1952,21 +1645,6 @@ void PlayMode::updateAutofillSuggestion() {
 		autofill_word_offset = offsets[word_index];
 		autofill_word_end = autofill_word_offset + (int)word.size();
 
-		bool suggestion_is_player = false;
-
-		// Update suggestion if new word starts with word and is shorter than the current suggestion
-		auto updateSuggestion = [&](std::string new_word, bool is_player = false) {
-			bool starts_with_word = new_word.size() >= word.size() && new_word.substr(0, word.size()) == word;
-			bool priority = ((autofill_suggestion.empty())
-			              || (new_word.size() < autofill_suggestion.size())
-						  || (is_player && !suggestion_is_player))
-						  && (is_player || !suggestion_is_player);
-			if (starts_with_word && priority) {
-				autofill_suggestion = new_word;
-				suggestion_is_player = is_player;
-			}
-		};
-
 		// Find the object whose name comes before the ".", if applicable
 		if (word_index >= 2 && line[word_index - 1] == ".") {
 			autofill_user = getObject(line[word_index - 2]);
@@ -1974,37 +1652,56 @@ void PlayMode::updateAutofillSuggestion() {
 			autofill_user = getObject(line[word_index - 1]);
 		}
 
-		// Generate the autofill suggestion
+		// Generate the autofill suggestion: the best completion of the word among the names that fit here
+		std::vector<IdentifierTrie::Candidate> candidates;
 		if (autofill_user) {
-			// If we already have an object, attempt to autofill an action or property
-			if (is_condition) {
-				// For a condition line, attempt to autofill a property
-				for (const auto& prop : autofill_user->properties) {
-					updateSuggestion(prop.first);
-				}
-			} else {
-				// For an action line, attempt to autofill an action
-				for (const auto& action : autofill_user->actions) {
-					updateSuggestion(action.first);
-				}
+			// If we already have an object, attempt to autofill a property in a condition, or an action otherwise
+			auto& names = is_condition ? property_names : action_names;
+			auto f = names.find(autofill_user);
+			if (f != names.end()) {
+				f->second.complete(word, 1, &candidates);
 			}
 		} else {
-			// Otherwise, attempt to autofill an object name
-			for (const auto& obj : player_compiler.objects) {
-				updateSuggestion(obj.first, isPlayer(obj.second));
-			}
+			// Otherwise, attempt to autofill an object name, a truth value or a keyword
+			object_names.complete(word, 1, &candidates);
 			if (is_condition) {
-				updateSuggestion("TRUE");
-				updateSuggestion("FALSE");
+				value_names.complete(word, 1, &candidates);
 			}
 			if (word_index == 0) {
-				updateSuggestion("IF");
-				updateSuggestion("WHILE");
-				updateSuggestion("AND");
-				updateSuggestion("OR");
-				updateSuggestion("END");
+				keyword_names.complete(word, 1, &candidates);
 			}
 		}
+		if (!candidates.empty()) {
+			autofill_suggestion = *candidates[0].word;
+		}
+	}
+}
+
+
+// Index the names autofill can complete, for the objects of this level
+void PlayMode::indexIdentifiers() {
+	object_names.clear();
+	property_names.clear();
+	action_names.clear();
+	for (const auto& obj : player_compiler.objects) {
+		// Players come before every other name
+		object_names.insert(obj.first, isPlayer(obj.second) ? 0 : 1);
+		IdentifierTrie& properties = property_names[obj.second];
+		for (size_t p = 0; p < obj.second->propertyCount(); p++) {
+			properties.insert(obj.second->propertyNameAt(p));
+		}
+		IdentifierTrie& actions = action_names[obj.second];
+		for (const auto& action : obj.second->actionNames()) {
+			actions.insert(action);
+		}
+	}
+
+	if (value_names.entries.empty()) {
+		value_names.insert("TRUE", 1);
+		value_names.insert("FALSE", 1);
+		for (char const* keyword : {"IF", "WHILE", "AND", "OR", "END"}) {
+			keyword_names.insert(keyword, 1);
+		}
 	}
 }
 
@@ -2012,12 +1709,13 @@ void PlayMode::updateAutofillSuggestion() {
 // Replace the word at the cursor position with the autofill suggestion
 bool PlayMode::autofill() {
 	if (!autofill_suggestion.empty()) {
-		std::string& line = text_buffer[line_index];
-		std::string old_line = line;
-		line.erase(autofill_word_offset, autofill_word_end - autofill_word_offset);
-		line.insert(autofill_word_offset, autofill_suggestion);
+		std::string const& line = text_buffer.line(line_index);
 		cur_cursor_pos = autofill_word_offset + autofill_suggestion.size();
-		return old_line != line;
+		if (line.compare(autofill_word_offset, autofill_word_end - autofill_word_offset, autofill_suggestion) == 0) {
+			return false;
+		}
+		text_buffer.replace(line_index, autofill_word_offset, autofill_word_end - autofill_word_offset, autofill_suggestion);
+		return true;
 	}
 
 	return false;
@@ -2026,10 +1724,10 @@ bool PlayMode::autofill() {
 
 void PlayMode::drawObjectInfoBox(Object* obj) {
 	// Size of box
-	glm::ivec2 size = glm::ivec2(obj_info_box_width, (obj->properties.size() + obj->actions.size() + 3) * font_size + 2 * abs(text_margin.y));
+	glm::ivec2 size = glm::ivec2(obj_info_box_width, (obj->propertyCount() + obj->actions().size() + 3) * font_size + 2 * abs(text_margin.y));
 
 	// Determine whether the object is a player or an enemy
-	bool is_player = std::find(player_units.begin(), player_units.end(), obj) != player_units.end();
+	bool is_player = std::find(levels.player_units.begin(), levels.player_units.end(), obj) != levels.player_units.end();
 	
 	// Draw box on the right side for players, and the left side for enemies
 	glm::ivec2 offset;
@@ -2042,10 +1740,6 @@ void PlayMode::drawObjectInfoBox(Object* obj) {
 	// Position of lower left corner of box
 	glm::ivec2 pos = (glm::ivec2)worldToScreen(obj->transform->position) + offset;
 	
-	// Draw box
-	drawRectangle(pos, size, glm::u8vec4(0x00, 0x00, 0x00, 0xff), true);
-	drawRectangle(pos + glm::ivec2(5, 5), size - glm::ivec2(10, 10), glm::u8vec4(0xff, 0xff, 0xff, 0xff), false);
-
 	// Draw triangle pointing to the object
 	std::vector<PPUDataStream::Vertex> triangle;
 	glm::ivec2 midpoint;
@@ -2058,23 +1752,21 @@ void PlayMode::drawObjectInfoBox(Object* obj) {
 	}
 	triangle.emplace_back(midpoint + glm::ivec2(0, 10), glm::u8vec4(0x00, 0x00, 0x00, 0xff));
 	triangle.emplace_back(midpoint + glm::ivec2(0, -10), glm::u8vec4(0x00, 0x00, 0x00, 0xff));
-	drawVertexArray(GL_TRIANGLES, triangle, false);
-
-	// Position at which to write new lines of text
-	glm::ivec2 text_pos = pos + glm::ivec2(0, size.y) + text_margin;
+	drawVertexArray(GL_TRIANGLES, triangle, 0);
 
-	// Add a line of text to the box, indented if not a header
+	// Lines of text in the box, indented if not a header
+	std::vector<std::string> lines;
 	auto writeLine = [&](std::string text, bool header = false) {
-		text_pos.y -= drawText((header ? "" : "  ") + text, text_pos, obj_info_box_width - 2 * text_margin.x).y;
+		lines.emplace_back((header ? "" : "  ") + text);
 	};
 
 	// Write actions
 	writeLine("ACTION       TURNS", true);
 	size_t dur_offset = 16;
-	for (auto& action : obj->action_names) {
+	for (auto& action : obj->actionNames()) {
 		std::string action_line = action;
 		std::stringstream dur_ss;
-		dur_ss << std::setprecision(2) << obj->actions.at(action).duration / turn_duration();
+		dur_ss << std::setprecision(2) << obj->actions().at(action).duration / turn_duration();
 		std::string dur_string = dur_ss.str();
 		while(action_line.size() + dur_string.size() < dur_offset) {
 			action_line.append(" ");
@@ -2087,44 +1779,63 @@ void PlayMode::drawObjectInfoBox(Object* obj) {
 	writeLine(" ");
 	writeLine("PROPERTY     VALUE", true);
 	size_t val_offset = 16;
-	for (auto& prop : obj->property_names) {
-		std::string prop_line = prop;
-		std::string val_string = std::to_string(obj->property(prop));
+	for (size_t p = 0; p < obj->propertyCount(); p++) {
+		std::string prop_line = obj->propertyNameAt(p);
+		std::string val_string = std::to_string(obj->propertyAt(p));
 		while(prop_line.size() + val_string.size() < val_offset) {
 			prop_line.append(" ");
 		}
 		prop_line.append(val_string);
 		writeLine(prop_line);
 	}
+
+	// The box is only laid out again when its lines change, not when the object moves
+	std::string inputs;
+	for (std::string const& line : lines) {
+		inputs += line + "\n";
+	}
+	drawPanel(info_panel, pos, size, inputs, [&]() {
+		glm::ivec2 text_pos = pos + glm::ivec2(0, size.y) + text_margin;
+		for (std::string const& line : lines) {
+			text_pos.y -= drawText(line, text_pos, obj_info_box_width - 2 * text_margin.x).y;
+		}
+	});
 }
 
 
 void PlayMode::drawEnemyCode() {
-	int x = enemy_pos.x + text_margin.x;
-	int y = enemy_pos.y + enemy_size.y + text_margin.y;
-
-	drawText("Enemy Code", glm::vec2(x, y), 0, glm::u8vec4(0x80, 0x80, 0x80, 0xff));
-	y -= font_size;
-
-	glm::u8vec4 pen_color = default_line_color;
-	for(size_t i = 0; i < enemy_text_buffer.size(); i++){
-		if (!turn_done && (int)i == enemy_execution_line_index) {
-			switch (execution_result) {
-			case ExecutionResult::SUCCESS:
-				pen_color = execute_success_color;
-				break;
-			case ExecutionResult::FAILURE:
-				pen_color = execute_failure_color;
-				break;
-			default:
-				pen_color = execute_normal_color;
-				break;
+	std::ostringstream inputs;
+	inputs << enemy_execution_line_index << ' ' << execution_result << ' ' << turn_done << ' ' << replay_active << '\n';
+	for (std::string const& line : enemy_text_buffer) {
+		inputs << line << '\n';
+	}
+	drawPanel(enemy_panel, enemy_pos, enemy_size, inputs.str(), [&]() {
+		int x = enemy_pos.x + text_margin.x;
+		int y = enemy_pos.y + enemy_size.y + text_margin.y;
+
+		drawText("Enemy Code", glm::vec2(x, y), 0, glm::u8vec4(0x80, 0x80, 0x80, 0xff));
+		y -= font_size;
+
+		glm::u8vec4 pen_color = default_line_color;
+		for(size_t i = 0; i < enemy_text_buffer.size(); i++){
+			if ((!turn_done || replay_active) && (int)i == enemy_execution_line_index) {
+				switch (execution_result) {
+				case ExecutionResult::SUCCESS:
+					pen_color = execute_success_color;
+					break;
+				case ExecutionResult::FAILURE:
+					pen_color = execute_failure_color;
+					break;
+				default:
+					pen_color = execute_normal_color;
+					break;
+				}
+			} else {
+				pen_color = default_line_color;
 			}
-		} else {
-			pen_color = default_line_color;
+			drawText(enemy_text_buffer[i], glm::vec2(x, y - i * font_size), 0, pen_color);
 		}
-		drawText(enemy_text_buffer[i], glm::vec2(x, y - i * font_size), 0, pen_color);
-	}
+	});
 }
 
 
@@ -2132,6 +1843,8 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	//update camera aspect ratio for drawable:
 	//camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 	
+	// Set again if this frame shows a preview that is still being worked out
+	preview_shown_stale = false;
 
 	//set up light type and position for lit_color_texture_program:
 	// TODO: consider using the Light(s) in the scene to do this
@@ -2168,31 +1881,23 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 
 		drawRectangle(worldbox_pos - glm::ivec2(5, 5), worldbox_size + glm::ivec2(10, 10), glm::u8vec4(255, 255, 255, 255), false);
 
-		for (size_t i = 0; i < player_units.size(); i++) {
-			drawHealthBar(player_units[i]);
+		for (size_t i = 0; i < levels.player_units.size(); i++) {
+			drawHealthBar(levels.player_units[i]);
 		}
-		for (size_t i = 0; i < enemy_units[current_level].size(); i++) {
-			drawHealthBar(enemy_units[current_level][i]);
+		for (size_t i = 0; i < levels.enemy_units[current_level].size(); i++) {
+			drawHealthBar(levels.enemy_units[current_level][i]);
 		}
 
-		drawRectangle(enemy_pos, enemy_size, glm::u8vec4(0, 0, 0, 255), true);
-		drawRectangle(enemy_pos + glm::ivec2(5, 5), enemy_size - glm::ivec2(10, 10), glm::u8vec4(255, 255, 255, 255), false);
-		drawRectangle(input_pos, input_size, glm::u8vec4(0, 0, 0, 255), true);
-		drawRectangle(input_pos + glm::ivec2(5, 5), input_size - glm::ivec2(10, 10), glm::u8vec4(255, 255, 255, 255), false);
-		drawRectangle(prompt_pos, prompt_size, glm::u8vec4(0, 0, 0, 255), true);
-		drawRectangle(prompt_pos + glm::ivec2(5, 5), prompt_size - glm::ivec2(10, 10), glm::u8vec4(255, 255, 255, 255), false);
-		drawRectangle(error_pos, error_size, glm::u8vec4(0, 0, 0, 255), true);
-		drawRectangle(error_pos + glm::ivec2(5, 5), error_size - glm::ivec2(10, 10), glm::u8vec4(255, 255, 255, 255), false);
-
 		updateAutofillSuggestion();
 
+		// The boxes come from their panels' textures, drawn again only when their contents change
+		panel_scale = glm::vec2(drawable_size) / glm::vec2(ScreenWidth, ScreenHeight);
+		drawEnemyCode();
+		render();
+
 		if (autofill_user && turn_done) {
 			drawObjectInfoBox(autofill_user);
 		}
-
-		render();
-
-		drawEnemyCode();
 	}
 	else if(game_end && game_start){
 		//Draw game start here
@@ -2206,11 +1911,13 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 		int x = 600;
 		int y = 450;
 		scene.draw(*camera);
-		//not working cannot set font size
 		glm::ivec2 new_pos = drawTextLarge("Code Quest", glm::ivec2(x,y), 500, 54, default_color, false);
 		drawText("PRESS ENTER", glm::ivec2(new_pos.x + 500, 100), 500);
 	}
 
+	// All of the 2D drawing above happens here, in a few draw calls
+	flushVertexArrays();
+
 	GL_ERRORS();
 }
 
@@ -2222,37 +1929,113 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 // Functions for initializing the rendering structs, adapted from PPU466
 
 PlayMode::PPUTileProgram::PPUTileProgram() {
+	//what INSTANCES can be, for both shaders:
+	std::string instances =
+		"const int GLYPH_INSTANCES = " + std::to_string(GlyphInstances) + ";\n"
+		"const int RECT_INSTANCES = " + std::to_string(RectInstances) + ";\n"
+		"uniform int INSTANCES;\n";
+
 	program = gl_compile_program(
 		//vertex shader:
 		"#version 330\n"
+		+ instances +
 		"uniform mat4 OBJECT_TO_CLIP;\n"
+		"uniform isampler2D GLYPH_TABLE;\n"
 		"in vec4 Position;\n"
 		"in ivec2 TileCoord;\n"
 		"out vec2 tileCoord;\n"
 		"in vec4 Color;\n"
 		"out vec4 color;\n"
+		"in ivec2 GlyphPen;\n"
+		"in uvec2 GlyphId;\n"
+		"in vec4 GlyphColor;\n"
+		"in ivec4 RectBox;\n"
+		"in vec4 RectColor;\n"
+		"in vec4 RectFillColor;\n"
+		"in vec4 RectEdgeColor;\n"
+		"in uvec2 RectFillSegment;\n"
+		"in uvec2 RectEdgeRadius;\n"
+		"out vec2 rectLocal;\n"
+		"flat out vec2 rectSize;\n"
+		"flat out vec4 rectFillColor;\n"
+		"flat out vec4 rectEdgeColor;\n"
+		"flat out vec2 rectFillSegment;\n"
+		"flat out vec2 rectEdgeRadius;\n"
 		"void main() {\n"
-		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
-		"	tileCoord = TileCoord;\n"
-		"	color = Color;\n"
+		"	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+		"	if (INSTANCES == GLYPH_INSTANCES) {\n"
+		"		ivec4 box = texelFetch(GLYPH_TABLE, ivec2(0, GlyphId.x), 0);\n" //atlas_min, atlas_size
+		"		ivec2 bearing = texelFetch(GLYPH_TABLE, ivec2(1, GlyphId.x), 0).xy;\n"
+		"		float scale = float(GlyphId.y) / " + std::to_string(GlyphAtlas::BaseSize) + ".0;\n"
+		"		vec2 pen = vec2(GlyphPen) / 4.0;\n"
+		//rounded to whole pixels, as drawn glyphs always were:
+		"		vec2 lower_left = floor(pen + vec2(bearing) * scale + 0.5);\n"
+		"		vec2 upper_right = floor(pen + vec2(bearing + box.zw) * scale + 0.5);\n"
+		"		gl_Position = OBJECT_TO_CLIP * vec4(mix(lower_left, upper_right, corner), 0.0, 1.0);\n"
+		"		tileCoord = vec2(box.xy) + vec2(box.zw) * corner;\n"
+		"		color = GlyphColor;\n"
+		"	} else if (INSTANCES == RECT_INSTANCES) {\n"
+		"		rectLocal = vec2(RectBox.zw) * corner;\n"
+		"		gl_Position = OBJECT_TO_CLIP * vec4(vec2(RectBox.xy) + rectLocal, 0.0, 1.0);\n"
+		"		tileCoord = vec2(-1.0);\n"
+		"		color = RectColor;\n"
+		"		rectSize = vec2(RectBox.zw);\n"
+		"		rectFillColor = RectFillColor;\n"
+		"		rectEdgeColor = RectEdgeColor;\n"
+		"		rectFillSegment = vec2(float(RectFillSegment.x) / 65535.0, float(RectFillSegment.y) / 16.0);\n"
+		"		rectEdgeRadius = vec2(RectEdgeRadius);\n"
+		"	} else {\n"
+		"		gl_Position = OBJECT_TO_CLIP * Position;\n"
+		"		tileCoord = TileCoord;\n"
+		"		color = Color;\n"
+		"	}\n"
 		"}\n"
 		,
 		//fragment shader:
 		"#version 330\n"
+		+ instances +
 		"uniform sampler2D TILE_TABLE;\n"
-		"uniform bool USE_TEXTURE;\n"
+		"uniform bool IMAGE;\n"
 		"in vec2 tileCoord;\n"
 		"out vec4 fragColor;\n"
 		"in vec4 color;\n"
+		"in vec2 rectLocal;\n"
+		"flat in vec2 rectSize;\n"
+		"flat in vec4 rectFillColor;\n"
+		"flat in vec4 rectEdgeColor;\n"
+		"flat in vec2 rectFillSegment;\n"
+		"flat in vec2 rectEdgeRadius;\n"
 		"void main() {\n"
-		"if (USE_TEXTURE) {\n"
-		"	fragColor = texelFetch(TILE_TABLE, ivec2(tileCoord), 0);\n"
-		"} else {\n"
-		"	fragColor.a = 1.0;\n"
+		"if (INSTANCES == RECT_INSTANCES) {\n"
+		//signed distance to the (rounded) outline, negative inside:
+		"	vec2 half_size = 0.5 * rectSize;\n"
+		"	float radius = rectEdgeRadius.y;\n"
+		"	vec2 q = abs(rectLocal - half_size) - (half_size - radius);\n"
+		"	float outline = length(max(q, 0.0)) + min(max(q.x, q.y), 0.0) - radius;\n"
+		"	fragColor = color;\n"
+		"	float filled = rectSize.x * rectFillSegment.x;\n"
+		"	if (rectLocal.x < filled) {\n"
+		"		fragColor = rectFillColor;\n"
+		//the filled part's border, two pixels wide and two pixels in from its edge:
+		"		vec2 from_edge = min(rectLocal, vec2(filled, rectSize.y) - rectLocal);\n"
+		"		float inset = min(from_edge.x, from_edge.y);\n"
+		"		if (inset >= 2.0 && inset < 4.0) fragColor.rgb *= 0.5;\n"
+		"	}\n"
+		"	if (rectFillSegment.y > 0.0 && mod(rectLocal.x, rectFillSegment.y) < 1.0) fragColor = rectEdgeColor;\n"
+		"	if (outline > -rectEdgeRadius.x) fragColor = rectEdgeColor;\n"
+		"	fragColor.a *= clamp(0.5 - outline, 0.0, 1.0);\n"
+		"	return;\n"
+		"}\n"
+		"fragColor = vec4(color.rgb, 1.0);\n"
+		"if (tileCoord.x >= 0.0) {\n"
+		"	vec4 texel = texture(TILE_TABLE, tileCoord / vec2(textureSize(TILE_TABLE, 0)));\n"
+		"	if (IMAGE) {\n"
+		"		fragColor.rgb *= texel.rgb;\n"
+		"	} else {\n"
+		"		float edge = max(fwidth(texel.r), 1e-4);\n"
+		"		fragColor.a = clamp((texel.r - 0.5) / edge + 0.5, 0.0, 1.0);\n"
+		"	}\n"
 		"}\n"
-		"fragColor.r = color.r;\n"
-		"fragColor.g = color.g;\n"
-		"fragColor.b = color.b;\n"
 		"}\n"
 	);
 
@@ -2260,18 +2043,30 @@ PlayMode::PPUTileProgram::PPUTileProgram() {
 	Position_vec2 = glGetAttribLocation(program, "Position");
 	TileCoord_ivec2 = glGetAttribLocation(program, "TileCoord");
 	Color_vec4 = glGetAttribLocation(program, "Color");
+	GlyphPen_ivec2 = glGetAttribLocation(program, "GlyphPen");
+	GlyphId_uvec2 = glGetAttribLocation(program, "GlyphId");
+	GlyphColor_vec4 = glGetAttribLocation(program, "GlyphColor");
+	RectBox_ivec4 = glGetAttribLocation(program, "RectBox");
+	RectColor_vec4 = glGetAttribLocation(program, "RectColor");
+	RectFillColor_vec4 = glGetAttribLocation(program, "RectFillColor");
+	RectEdgeColor_vec4 = glGetAttribLocation(program, "RectEdgeColor");
+	RectFillSegment_uvec2 = glGetAttribLocation(program, "RectFillSegment");
+	RectEdgeRadius_uvec2 = glGetAttribLocation(program, "RectEdgeRadius");
 	//Palette_int = glGetAttribLocation(program, "Palette");
 
 	//look up the locations of uniforms:
 	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	USE_TEXTURE_bool = glGetUniformLocation(program, "USE_TEXTURE");
+	IMAGE_bool = glGetUniformLocation(program, "IMAGE");
+	INSTANCES_int = glGetUniformLocation(program, "INSTANCES");
 
 	GLuint TILE_TABLE_usampler2D = glGetUniformLocation(program, "TILE_TABLE");
+	GLuint GLYPH_TABLE_isampler2D = glGetUniformLocation(program, "GLYPH_TABLE");
 	//GLuint PALETTE_TABLE_sampler2D = glGetUniformLocation(program, "PALETTE_TABLE");
 
 	//bind texture units indices to samplers:
 	glUseProgram(program);
 	glUniform1i(TILE_TABLE_usampler2D, 0);
+	glUniform1i(GLYPH_TABLE_isampler2D, 1);
 	//glUniform1i(PALETTE_TABLE_sampler2D, 1);
 	glUseProgram(0);
 
@@ -2288,13 +2083,11 @@ PlayMode::PPUTileProgram::~PPUTileProgram() {
 //PPU data is streamed to the GPU (read: uploaded 'just in time') using a few buffers:
 PlayMode::PPUDataStream::PPUDataStream() {
 
-	//vertex_buffer_for_tile_program is a vertex array object that tells the GPU the layout of data in vertex_buffer:
+	//vertex_buffer_for_tile_program is a vertex array object that tells the GPU the layout of data in vertex_ring:
 	glGenVertexArrays(1, &vertex_buffer_for_tile_program);
 	glBindVertexArray(vertex_buffer_for_tile_program);
 
-	//vertex_buffer will (eventually) hold vertex data for drawing:
-	glGenBuffers(1, &vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_ring.buffer);
 
 	//Notice how this binding is attaching an integer input to a floating point attribute:
 	glVertexAttribPointer(
@@ -2331,33 +2124,167 @@ PlayMode::PPUDataStream::PPUDataStream() {
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 
-	glGenTextures(1, &tile_tex);
-	glBindTexture(GL_TEXTURE_2D, tile_tex);
-	//passing 'nullptr' to TexImage says "allocate memory but don't store anything there":
-	// (textures will be uploaded later)
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 26, 26, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-	//make the texture have sharp pixels when magnified:
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	//when access past the edge, clamp to the edge:
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	//glyph_buffer_for_tile_program reads one GlyphInstance per instance from glyph_ring:
+	glGenVertexArrays(1, &glyph_buffer_for_tile_program);
+	glBindVertexArray(glyph_buffer_for_tile_program);
+	point_glyph_attributes(0);
+	glEnableVertexAttribArray(tile_program->GlyphPen_ivec2);
+	glVertexAttribDivisor(tile_program->GlyphPen_ivec2, 1);
+	glEnableVertexAttribArray(tile_program->GlyphId_uvec2);
+	glVertexAttribDivisor(tile_program->GlyphId_uvec2, 1);
+	glEnableVertexAttribArray(tile_program->GlyphColor_vec4);
+	glVertexAttribDivisor(tile_program->GlyphColor_vec4, 1);
+	glBindVertexArray(0);
+
+	//rect_buffer_for_tile_program reads one RectInstance per instance from rect_ring:
+	glGenVertexArrays(1, &rect_buffer_for_tile_program);
+	glBindVertexArray(rect_buffer_for_tile_program);
+	point_rect_attributes(0);
+	for (GLuint attribute : {tile_program->RectBox_ivec4, tile_program->RectColor_vec4, tile_program->RectFillColor_vec4,
+		tile_program->RectEdgeColor_vec4, tile_program->RectFillSegment_uvec2, tile_program->RectEdgeRadius_uvec2}) {
+		glEnableVertexAttribArray(attribute);
+		glVertexAttribDivisor(attribute, 1);
+	}
+	glBindVertexArray(0);
 
 	GL_ERRORS();
 }
 
+//with glyph_buffer_for_tile_program bound, read instances from the first'th GlyphInstance of glyph_ring on:
+// (GL 3.3 has no base instance for glDrawArraysInstanced, so the offset goes here)
+void PlayMode::PPUDataStream::point_glyph_attributes(GLint first) const {
+	GLbyte *start = (GLbyte*)0 + first * sizeof(GlyphInstance);
+	glBindBuffer(GL_ARRAY_BUFFER, glyph_ring.buffer);
+	glVertexAttribIPointer(
+		tile_program->GlyphPen_ivec2, //attribute
+		2, //size
+		GL_SHORT, //type
+		sizeof(GlyphInstance), //stride
+		start + offsetof(GlyphInstance, Pen) //offset
+	);
+	//Glyph and Size together:
+	glVertexAttribIPointer(
+		tile_program->GlyphId_uvec2, //attribute
+		2, //size
+		GL_UNSIGNED_SHORT, //type
+		sizeof(GlyphInstance), //stride
+		start + offsetof(GlyphInstance, Glyph) //offset
+	);
+	glVertexAttribPointer(
+		tile_program->GlyphColor_vec4, //attribute
+		4, //size
+		GL_UNSIGNED_BYTE, //type
+		GL_TRUE, //normalized
+		sizeof(GlyphInstance), //stride
+		start + offsetof(GlyphInstance, Color) //offset
+	);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//with rect_buffer_for_tile_program bound, read instances from the first'th RectInstance of rect_ring on:
+void PlayMode::PPUDataStream::point_rect_attributes(GLint first) const {
+	GLbyte *start = (GLbyte*)0 + first * sizeof(RectInstance);
+	glBindBuffer(GL_ARRAY_BUFFER, rect_ring.buffer);
+	glVertexAttribIPointer(tile_program->RectBox_ivec4, 4, GL_SHORT, sizeof(RectInstance), start + offsetof(RectInstance, Box));
+	glVertexAttribPointer(tile_program->RectColor_vec4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(RectInstance), start + offsetof(RectInstance, Color));
+	glVertexAttribPointer(tile_program->RectFillColor_vec4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(RectInstance), start + offsetof(RectInstance, FillColor));
+	glVertexAttribPointer(tile_program->RectEdgeColor_vec4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(RectInstance), start + offsetof(RectInstance, EdgeColor));
+	//Fill and Segment together, then Edge and Radius together:
+	glVertexAttribIPointer(tile_program->RectFillSegment_uvec2, 2, GL_UNSIGNED_SHORT, sizeof(RectInstance), start + offsetof(RectInstance, Fill));
+	glVertexAttribIPointer(tile_program->RectEdgeRadius_uvec2, 2, GL_UNSIGNED_BYTE, sizeof(RectInstance), start + offsetof(RectInstance, Edge));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 PlayMode::PPUDataStream::~PPUDataStream() {
 	if (vertex_buffer_for_tile_program != 0) {
 		glDeleteVertexArrays(1, &vertex_buffer_for_tile_program);
 		vertex_buffer_for_tile_program = 0;
 	}
-	if (vertex_buffer != 0) {
-		glDeleteBuffers(1, &vertex_buffer);
-		vertex_buffer = 0;
+	if (glyph_buffer_for_tile_program != 0) {
+		glDeleteVertexArrays(1, &glyph_buffer_for_tile_program);
+		glyph_buffer_for_tile_program = 0;
+	}
+	if (rect_buffer_for_tile_program != 0) {
+		glDeleteVertexArrays(1, &rect_buffer_for_tile_program);
+		rect_buffer_for_tile_program = 0;
 	}
-	if (tile_tex != 0) {
-		glDeleteTextures(1, &tile_tex);
-		tile_tex = 0;
+}
+
+GLint PlayMode::PPUDataStream::upload(std::vector< Vertex > const &vertices) const {
+	return GLint(vertex_ring.upload(vertices.data(), GLsizeiptr(sizeof(Vertex) * vertices.size())) / GLsizeiptr(sizeof(Vertex)));
+}
+
+GLint PlayMode::PPUDataStream::upload(std::vector< GlyphInstance > const &glyphs) const {
+	return GLint(glyph_ring.upload(glyphs.data(), GLsizeiptr(sizeof(GlyphInstance) * glyphs.size())) / GLsizeiptr(sizeof(GlyphInstance)));
+}
+
+GLint PlayMode::PPUDataStream::upload(std::vector< RectInstance > const &rects) const {
+	return GLint(rect_ring.upload(rects.data(), GLsizeiptr(sizeof(RectInstance) * rects.size())) / GLsizeiptr(sizeof(RectInstance)));
+}
+
+void PlayMode::PPUDataStream::fence() const {
+	vertex_ring.fence();
+	glyph_ring.fence();
+	rect_ring.fence();
+}
+
+PlayMode::PPUDataStream::Ring::Ring(GLsizeiptr stride_) : stride(stride_) {
+	//buffer will (eventually) hold data for drawing:
+	glGenBuffers(1, &buffer);
+}
+
+PlayMode::PPUDataStream::Ring::~Ring() {
+	if (buffer != 0) {
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+	for (GLsync& fence : fences) {
+		if (fence != 0) {
+			glDeleteSync(fence);
+			fence = 0;
+		}
+	}
+}
+
+GLsizeiptr PlayMode::PPUDataStream::Ring::upload(void const* data, GLsizeiptr bytes) {
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	if (bytes > region_size) {
+		//grow the ring; the driver keeps the old storage alive for any draws still reading it:
+		while (region_size < bytes) {
+			region_size = std::max< GLsizeiptr >(2 * region_size, (1 << 20) / stride * stride);
+		}
+		glBufferData(GL_ARRAY_BUFFER, region_size * Regions, nullptr, GL_STREAM_DRAW);
+		for (GLsync& fence : fences) {
+			if (fence != 0) {
+				glDeleteSync(fence);
+				fence = 0;
+			}
+		}
+		region = 0;
+	} else {
+		region = (region + 1) % Regions;
+	}
+
+	if (fences[region] != 0) {
+		glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(fences[region]);
+		fences[region] = 0;
+	}
+
+	//the fence makes it safe to skip the driver's own synchronization:
+	void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, region * region_size, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (mapped != nullptr) {
+		std::memcpy(mapped, data, bytes);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return region * region_size;
+}
+
+void PlayMode::PPUDataStream::Ring::fence() {
+	if (fences[region] != 0) {
+		glDeleteSync(fences[region]);
 	}
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
@@ -3,6 +3,12 @@
 #include "Mode.hpp"
 
 #include "Scene.hpp"
+#include "Prefabs.hpp"
+#include "TextShaper.hpp"
+#include "LineBreaker.hpp"
+#include "CodeDocument.hpp"
+#include "IdentifierTrie.hpp"
+#include "GlyphAtlas.hpp"
 #include "Sound.hpp"
 
 #include <glm/glm.hpp>
@@ -13,10 +19,20 @@
 #include "Animation.hpp"
 #include "Actions.hpp"
 #include "Compiler.hpp"
+#include "Replay.hpp"
+#include "Battle.hpp"
+#include "EnemyAI.hpp"
+#include "Levels.hpp"
+#include "Preview.hpp"
 
 #include <vector>
 #include <deque>
+#include <functional>
+#include <string>
+#include <memory>
 #include <array>
+#include <cmath>
+#include <unordered_map>
 
 struct PlayMode : Mode {
 	PlayMode();
@@ -25,6 +41,7 @@ struct PlayMode : Mode {
 	//functions called by main loop:
 	virtual bool handle_event(SDL_Event const &, glm::uvec2 const &window_size) override;
 	virtual void update(float elapsed) override;
+	virtual bool needs_redraw() override;
 	virtual void draw(glm::uvec2 const &drawable_size) override;
 
 
@@ -47,13 +64,31 @@ struct PlayMode : Mode {
 		GLuint Position_vec2 = -1U;
 		GLuint TileCoord_ivec2 = -1U;
 		GLuint Color_vec4 = -1U;
+		//(per-instance, when INSTANCES is GlyphInstances; see PPUDataStream::GlyphInstance)
+		GLuint GlyphPen_ivec2 = -1U;
+		GLuint GlyphId_uvec2 = -1U; //(Glyph, Size)
+		GLuint GlyphColor_vec4 = -1U;
+		//(per-instance, when INSTANCES is RectInstances; see PPUDataStream::RectInstance)
+		GLuint RectBox_ivec4 = -1U;
+		GLuint RectColor_vec4 = -1U;
+		GLuint RectFillColor_vec4 = -1U;
+		GLuint RectEdgeColor_vec4 = -1U;
+		GLuint RectFillSegment_uvec2 = -1U; //(Fill, Segment)
+		GLuint RectEdgeRadius_uvec2 = -1U; //(Edge, Radius)
 
 		//Uniform (per-invocation variable) locations:
 		GLuint OBJECT_TO_CLIP_mat4 = -1U;
-		GLuint USE_TEXTURE_bool = -1U;
+		GLuint IMAGE_bool = -1U; //textures are drawn as they are instead of as distance fields
+		GLuint INSTANCES_int = -1U; //what each instance is, if drawing instances; each vertex is then a corner of its quad
+		enum Instances : int {
+			NoInstances = 0,
+			GlyphInstances = 1,
+			RectInstances = 2
+		};
 
 		//Textures bindings:
-		//TEXTURE0 - the tile table (as a 128x128 R8UI texture)
+		//TEXTURE0 - the glyph atlas (GL_R8 distance fields, see GlyphAtlas) or a panel (see Panel)
+		//TEXTURE1 - the glyph atlas's table of glyph metrics
 	};
 
 	//PPU data is streamed to the GPU (read: uploaded 'just in time') using a few buffers:
@@ -74,14 +109,73 @@ struct PlayMode : Mode {
 			glm::vec4 Color;
 		};
 
-		//vertex buffer that will store data stream:
-		GLuint vertex_buffer = 0;
+		//one glyph of text, which the tile program's vertex shader expands into a quad
+		// using the metrics in GlyphAtlas::table (12 bytes, against 6 Vertex's 192):
+		struct GlyphInstance {
+			GlyphInstance(glm::vec2 const& pen, uint16_t glyph, uint16_t size, glm::u8vec4 color)
+				: Pen(int16_t(std::lround(pen.x * 4.f)), int16_t(std::lround(pen.y * 4.f))), Glyph(glyph), Size(size), Color(color) { }
+			glm::i16vec2 Pen; //in quarter pixels
+			uint16_t Glyph; //GlyphAtlas::Glyph::index
+			uint16_t Size; //font size in pixels
+			glm::u8vec4 Color;
+		};
+		static_assert(sizeof(GlyphInstance) == 12, "GlyphInstance should be tightly packed");
+
+		//a rectangle of the UI drawn from one quad by the tile program's fragment shader,
+		// with an outline, rounded corners, a part filled from the left, and ticks between segments:
+		struct RectInstance {
+			glm::i16vec4 Box = glm::i16vec4(0); //lower left corner and size, in pixels
+			glm::u8vec4 Color = glm::u8vec4(0); //inside
+			glm::u8vec4 FillColor = glm::u8vec4(0); //the filled part, whose border is drawn at half brightness
+			glm::u8vec4 EdgeColor = glm::u8vec4(0); //the outline and segment ticks
+			uint16_t Fill = 0; //filled fraction of the width, out of 0xffff
+			uint16_t Segment = 0; //width of the segments, in 1/16 pixels; 0 for none
+			uint8_t Edge = 0; //outline thickness in pixels
+			uint8_t Radius = 0; //corner radius in pixels
+			uint8_t Unused[2] = {0, 0}; //keeps instances 4-byte aligned
+		};
+		static_assert(sizeof(RectInstance) == 28, "RectInstance should be tightly packed");
+
+		//a buffer used as a ring of Regions equal regions; each upload writes the next one, once
+		// the fence set after the last draws from that region says the GPU is done with it:
+		struct Ring {
+			//regions hold whole elements of stride bytes:
+			Ring(GLsizeiptr stride);
+			~Ring();
+			Ring(Ring const&) = delete;
+
+			GLuint buffer = 0;
+			GLsizeiptr stride;
+			enum : uint32_t { Regions = 3 };
+			GLsizeiptr region_size = 0;
+			uint32_t region = 0;
+			GLsync fences[Regions] = {};
+
+			//copy bytes into the next region; returns its offset in buffer:
+			GLsizeiptr upload(void const* data, GLsizeiptr bytes);
+			//call after the draws that use the last upload:
+			void fence();
+		};
+		//(mutable, since the stream is shared through a const Load<>):
+		mutable Ring vertex_ring{sizeof(Vertex)};
+		mutable Ring glyph_ring{sizeof(GlyphInstance)};
+		mutable Ring rect_ring{sizeof(RectInstance)};
+
+		//copy into the next region of their ring; returns the index of the first one in the ring's buffer:
+		GLint upload(std::vector< Vertex > const &vertices) const;
+		GLint upload(std::vector< GlyphInstance > const &glyphs) const;
+		GLint upload(std::vector< RectInstance > const &rects) const;
+		//call after the draws that use the last uploads:
+		void fence() const;
 
 		//vertex array object that maps tile program attributes to vertex storage:
 		GLuint vertex_buffer_for_tile_program = 0;
-
-		//texture object that will store tile table:
-		GLuint tile_tex = 0;
+		//...and one for glyph instances, whose attributes are pointed at each batch's glyphs as it is drawn:
+		GLuint glyph_buffer_for_tile_program = 0;
+		void point_glyph_attributes(GLint first) const;
+		//...and for rect instances, the same way:
+		GLuint rect_buffer_for_tile_program = 0;
+		void point_rect_attributes(GLint first) const;
 	};
 
 
@@ -89,13 +183,12 @@ struct PlayMode : Mode {
 	FT_Library ft_library;
 	FT_Face ft_face;
 	hb_font_t* hb_font;
-	uint32_t char_top = 1;
-	uint32_t char_bottom = 1;
+	std::unique_ptr< TextShaper > text_shaper; // shapes with hb_font, remembering recent text
+	std::unique_ptr< LineBreaker > line_breaker; // wraps text shaped by text_shaper, remembering recent layouts
+	std::unique_ptr< GlyphAtlas > glyph_atlas; // distance fields of the glyphs drawn so far, for any size
 	uint32_t char_width = 1;
-	uint32_t char_height = 1;
 	uint32_t min_char = 32;
 	uint32_t max_char = 126;
-	uint32_t num_chars = max_char - min_char + 1;
 	int font_size = 16;
 	static inline glm::u8vec4 default_color = glm::u8vec4(0xff, 0xff, 0xff, 0xff);
 	static inline glm::u8vec4 alt_color = glm::u8vec4(0xff, 0xff, 0xc0, 0xff);
@@ -104,8 +197,11 @@ struct PlayMode : Mode {
 	static inline glm::u8vec4 execute_success_color = glm::u8vec4(0x80, 0xff, 0x80, 0xff);
 	static inline glm::u8vec4 execute_failure_color = glm::u8vec4(0xff, 0x80, 0x80, 0xff);
 	static inline glm::u8vec4 default_line_color = glm::u8vec4(0xff, 0xff, 0xff, 0xff);
+	// How far the code is scrolled, in pixels; scroll_y moves by whole lines
 	int scroll_x = 0;
 	int scroll_y = 0;
+	// The line the code view last scrolled to show
+	size_t followed_line = -1;
 
 
 	//----- game state -----
@@ -118,52 +214,69 @@ struct PlayMode : Mode {
 
 	//local copy of the game scene (so code can change it during gameplay):
 	Scene scene;
+	//the models in it, which makeObject() instances:
+	Prefabs prefabs;
 	
 	//camera:
 	Scene::Camera *camera = nullptr;
 
 	// David
-	enum Turn {
-		PLAYER,
-		ENEMY
-	} turn;
 	float turn_time;
-	float player_time;
-	float enemy_time;
-	bool player_done;
-	bool enemy_done;
 	bool turn_done;
+	// Real seconds per frame that update() may spend catching up on turns
+	float max_logic_time = 0.008f;
+	float time_warp();
+	void advance_animations(float elapsed, float warp);
 	void take_turn();
-	void init_compiler();
-	void create_levels();
 	void next_level();
 	void reset_level();
-	void execute_player_statement();
-	void execute_enemy_statement();
+	bool submit();
+	void resolve_instantly();
 	Compiler player_compiler;
 	Compiler enemy_compiler;
-	Compiler::Executable *player_exe;
-	Compiler::Statement *player_statement;
-	Compiler::Executable *enemy_exe;
-	Compiler::Statement *enemy_statement;
-	std::vector<Object*> player_units;
-	std::vector<std::vector<Object*>> enemy_units;
-	std::vector<std::string> level_enemy_code;
-	std::vector<std::string> level_guidance;
+	CombatEventBuffer combat_events;
+	Battle battle;
+	// ctrl+E switches the enemies from their scripts to the search AI, cycling through its difficulties
+	EnemyAI enemy_ai{&enemy_compiler};
+	bool enemy_ai_enabled = false;
+	void cycle_enemy_ai();
+	Levels levels;
 	int current_level;
-	bool level_lost;
-	bool level_won;
+	// The next level's enemy script is read while this one is played
+	LevelPrefetch level_prefetch;
+	Compiler::Program enemy_program;
 	bool compile_failed;
-
-	Object* brawler;
-	Object* caster;
-	Object* ranger;
-	Object* healer;
-
-	int first_brawler_level = 0;
-	int first_caster_level = 1;
-	int first_healer_level = 4;
-	int first_ranger_level = 5;
+	// Why the last battle ended without a winner, shown until the next submit
+	std::string draw_message;
+	// How the program being typed would do, simulated in the background after every edit
+	Preview preview;
+	std::string preview_message();
+	bool preview_shown_stale = false; // the last preview drawn was still being worked out
+
+	// Replays: every submitted battle is recorded and saved to last.replay; ctrl+R plays it back
+	Replay replay;
+	bool recording = false;
+	bool replay_active = false;
+	bool replay_playing = false;
+	float replay_speed = 1.f;
+	size_t replay_turn = 0;
+	float replay_clock = 0.f;
+	// Set when the replay is an instantly resolved battle, whose outcome applies once playback ends
+	bool replay_resolves_level = false;
+	// Safety limit for instant resolution, since programs can loop forever
+	size_t max_instant_turns = 100000;
+	void save_replay();
+	void start_replay();
+	void stop_replay();
+	// What a replay of another battle (ctrl+R) put aside: the level and the draft, with its undo history and cursor
+	int replay_return_level = -1;
+	CodeDocument replay_draft;
+	size_t replay_draft_line = 0;
+	size_t replay_draft_column = 0;
+	void return_from_replay();
+	void seek_replay(size_t turn);
+	void step_replay(bool animate = true);
+	void show_replay_line();
 
 	glm::ivec2 error_pos = glm::ivec2(10, 10);
 	glm::ivec2 error_size = glm::ivec2(400, 80);
@@ -187,22 +300,63 @@ struct PlayMode : Mode {
 	int autofill_word_offset = 0;
 	int autofill_word_end = 0;
 	Object* autofill_user;
+	// Names autofill can complete, indexed when a level starts
+	IdentifierTrie object_names; // players rank before every other name
+	IdentifierTrie value_names; // TRUE and FALSE, for conditions
+	IdentifierTrie keyword_names; // words that start a statement
+	std::unordered_map<Object const*, IdentifierTrie> property_names;
+	std::unordered_map<Object const*, IdentifierTrie> action_names;
+
+	// UI geometry queued by drawVertexArray, drawn in order by flushVertexArrays
+	struct VertexBatch {
+		GLenum mode;
+		GLuint texture; // 0 for solid colors, which draw with any texture bound
+		bool image; // texture is a picture (a panel) rather than distance fields
+		PPUTileProgram::Instances instances; // if not NoInstances, first and count are in queued_glyphs or queued_rects
+		GLint first;
+		GLsizei count;
+	};
+	std::vector<PPUDataStream::Vertex> queued_vertices;
+	std::vector<PPUDataStream::GlyphInstance> queued_glyphs;
+	std::vector<PPUDataStream::RectInstance> queued_rects;
+	std::vector<VertexBatch> queued_batches;
+
+	// A box of the UI kept in its own texture, drawn again only when what it shows changes
+	struct Panel {
+		Panel() = default;
+		Panel(Panel const&) = delete;
+		~Panel();
+		GLuint framebuffer = 0;
+		GLuint texture = 0;
+		glm::ivec2 pixels = glm::ivec2(0); // size of texture, which follows the drawable's size
+		std::string inputs; // everything the panel showed when last drawn
+		uint32_t version = 0; // bumped every time the panel is drawn again
+	};
+	Panel code_panel, status_panel, prompt_panel, enemy_panel, info_panel;
+	// Screen pixels per UI unit, for sizing panel textures
+	glm::vec2 panel_scale = glm::vec2(1.f);
 
 	// Helper functions
 	glm::ivec2 drawText(std::string text, glm::vec2 position, size_t width, glm::u8vec4 color = default_color, bool cursor_line = false);
 	glm::ivec2 drawTextLarge(std::string text, glm::vec2 position, size_t width, int large_font_size, glm::u8vec4 color_large = default_color, bool cursor_line_large = false);
-	void drawVertexArray(GLenum mode, const std::vector<PPUDataStream::Vertex>& vertex_array, bool use_texture);
+	void drawVertexArray(GLenum mode, const std::vector<PPUDataStream::Vertex>& vertex_array, GLuint texture);
+	void drawGlyphs(const std::vector<PPUDataStream::GlyphInstance>& glyphs);
+	void drawRect(PPUDataStream::RectInstance const& rect);
+	void flushVertexArrays();
+	void flushVertexArrays(glm::ivec2 lower_left, glm::ivec2 size);
+	void drawImage(GLuint texture, glm::ivec2 pos, glm::ivec2 size, glm::ivec2 pixels);
+	void drawPanel(Panel& panel, glm::ivec2 pos, glm::ivec2 size, std::string inputs, std::function<void()> const& draw_contents);
 	void setMesh(Scene::Drawable* drawable, std::string mesh);
 	Object* makeObject(std::string name, std::string model_name, Team team = Team::TEAM_NONE);
 	void energyTransforms();
 	void drawRectangle(glm::ivec2 pos, glm::ivec2 size, glm::u8vec4 color, bool filled);
-	void drawThickRectangleOutline(glm::ivec2 pos, glm::ivec2 size, glm::u8vec4 color, int thickness);
 	glm::vec2 worldToScreen(glm::vec3 pos);
 	void drawHealthBar(Object* unit);
 	void updateAutofillSuggestion();
+	void indexIdentifiers();
 	bool isObject(std::string name);
 	Object* getObject(std::string name);
-	std::vector<hb_glyph_position_t> getGlyphPositions(std::string text, size_t offset = 0);
+	std::vector<hb_glyph_position_t> const& getGlyphPositions(std::string const& text, size_t offset = 0);
 	glm::ivec2 getPositionInText(std::string text, glm::vec2 position, size_t index, size_t offset = 0);
 	void drawObjectInfoBox(Object* obj);
 	bool autofill();
@@ -212,7 +366,10 @@ struct PlayMode : Mode {
 	//begin of the text rendering
 	size_t line_index = 0;
 	size_t cur_cursor_pos = 0;
-	std::vector< std::string > text_buffer;
+	CodeDocument text_buffer;
+	// The edit and level the preview was last asked about
+	uint64_t previewed_version = 0;
+	int previewed_level = -1;
 	std::vector< std::string > enemy_text_buffer;
 	int execution_line_index = -1;
 	enum ExecutionResult {
@@ -223,7 +380,7 @@ struct PlayMode : Mode {
 	int enemy_execution_line_index = -1;
 	size_t max_line_length = 400;
 	size_t max_line_chars = 40;
-	size_t max_lines = 16;
+	size_t max_lines = 10000;
 	std::string cur_str;
 	void move_up();
 	void move_down();
@@ -232,6 +389,9 @@ struct PlayMode : Mode {
 	void line_break();
 	void delete_text();
 	void insert(std::string cur_letter);
+	void undo();
+	void redo();
+	size_t codeRows();
 	void render();
 	bool game_start = false;
 	bool game_end = false;
@@ -239,9 +399,8 @@ struct PlayMode : Mode {
 	std::shared_ptr<Sound::PlayingSample> bgm_playing_sample;
 	bool music_muted = false;
 	
-	Object* dungeon_scene;
-	Object* cave_scene;
-	Object* forest_scene;
+	// One per scene the levels use, by model name; only the current level's is moved onscreen
+	std::unordered_map< std::string, Object* > backdrops;
 	glm::vec3 scene_position;
 	glm::vec3 offscreen_scene_position;
 };
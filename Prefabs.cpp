@@ -0,0 +1,63 @@
+#include "Prefabs.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+Prefabs::Prefabs(Scene const &scene) {
+	for (auto const &transform : scene.transforms) {
+		Prefab &own = prefabs[transform.name];
+		if (own.root == nullptr) own.root = &transform;
+		own.members.emplace_back(&transform);
+
+		//"a-b-c" is also a part of models "a" and "a-b":
+		for (size_t dash = transform.name.find('-'); dash != std::string::npos; dash = transform.name.find('-', dash + 1)) {
+			prefabs[transform.name.substr(0, dash)].members.emplace_back(&transform);
+		}
+	}
+	for (auto &entry : prefabs) {
+		entry.second.model = entry.first;
+	}
+}
+
+Prefabs::Prefab const *Prefabs::find(std::string const &model) const {
+	auto f = prefabs.find(model);
+	if (f == prefabs.end()) return nullptr;
+	return &f->second;
+}
+
+std::vector< Scene::Transform * > Prefabs::instantiate(Prefab const &prefab, std::string const &name) {
+	size_t count = prefab.members.size();
+	if (block_used + count > block_size) {
+		block_size = std::max< size_t >(BlockSize, count);
+		blocks.emplace_back(new Scene::Transform[block_size]);
+		block_used = 0;
+	}
+	Scene::Transform *run = blocks.back().get() + block_used;
+	block_used += count;
+
+	std::unordered_map< Scene::Transform const *, Scene::Transform * > copy_of;
+	std::vector< Scene::Transform * > copies;
+	copies.reserve(count);
+	for (size_t i = 0; i < count; ++i) {
+		Scene::Transform const &original = *prefab.members[i];
+		Scene::Transform &copy = run[i];
+		copy.name = name + ":" + original.name;
+		copy.position = original.position;
+		copy.rotation = original.rotation;
+		copy.scale = original.scale;
+		copy.parent = original.parent;
+		copy_of.emplace(&original, &copy);
+		copies.emplace_back(&copy);
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (prefab.members[i] == prefab.root) continue;
+		auto f = copy_of.find(prefab.members[i]->parent);
+		if (f != copy_of.end()) {
+			copies[i]->parent = f->second;
+		} else {
+			std::cout << "Warning: " << copies[i]->name << " is not a child of " << prefab.model << std::endl;
+		}
+	}
+	return copies;
+}
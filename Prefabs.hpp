@@ -0,0 +1,43 @@
+#pragma once
+
+/*
+ * "Prefabs" indexes the models in a scene by name, once, so objects can be
+ *  instanced from them without searching the whole scene each time.
+ * A model is the transform with its name plus every transform named "model-part".
+ * Instances copy only the model's transforms, into runs of pooled storage.
+ *
+ */
+
+#include "Scene.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Prefabs {
+	struct Prefab {
+		std::string model;
+		Scene::Transform const *root = nullptr; //the transform named after the model, if there is one
+		std::vector< Scene::Transform const * > members; //root and parts, in scene order
+	};
+
+	//index the models of a scene; the scene's transforms must outlive this:
+	Prefabs(Scene const &scene);
+	Prefabs(Prefabs const &) = delete;
+
+	//nullptr if the scene has no transform named model or "model-..."
+	Prefab const *find(std::string const &model) const;
+
+	//copies of the prefab's members, in the same order, named "name:original" and parented
+	// to each other (the root keeps the original's parent); they live as long as this:
+	std::vector< Scene::Transform * > instantiate(Prefab const &prefab, std::string const &name);
+
+	std::unordered_map< std::string, Prefab > prefabs;
+
+	//transforms are handed out in contiguous runs from blocks that never move:
+	enum : size_t { BlockSize = 256 };
+	std::vector< std::unique_ptr< Scene::Transform[] > > blocks;
+	size_t block_size = 0;
+	size_t block_used = 0;
+};
@@ -0,0 +1,154 @@
+#include "Preview.hpp"
+#include <algorithm>
+
+// How many turns to play between checks for a newer request
+static size_t const CancelCheckInterval = 256;
+
+Preview::Preview() {
+    levels.createHeadless();
+    // Programs may refer to properties reset() creates, like BURNED
+    for (Object* unit : levels.player_units) {
+        unit->reset();
+    }
+    for (auto const& units : levels.enemy_units) {
+        for (Object* unit : units) {
+            unit->reset();
+        }
+    }
+    thread = std::thread(&Preview::work, this);
+}
+
+Preview::~Preview() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+        generation++;
+    }
+    wake.notify_all();
+    thread.join();
+    delete enemy_exe;
+}
+
+void Preview::request(int level, std::vector<std::string> const& program) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (level == requested_level && program == requested_program) {
+            return;
+        }
+        requested_level = level;
+        requested_program = program;
+        generation++;
+    }
+    wake.notify_one();
+}
+
+Preview::Result Preview::result() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Result out = latest;
+    out.stale = latest_generation != generation;
+    return out;
+}
+
+bool Preview::pending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return latest_generation != generation;
+}
+
+void Preview::work() {
+    uint64_t done = 0;
+    while (true) {
+        uint64_t job;
+        int level;
+        std::vector<std::string> program;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return quit || generation != done; });
+            if (quit) {
+                return;
+            }
+            job = generation;
+            level = requested_level;
+            program = requested_program;
+        }
+        done = job;
+
+        Result out;
+        if (!simulate(job, level, program, &out)) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (job == generation) {
+            latest = out;
+            latest_generation = job;
+        }
+    }
+}
+
+// Play the draft from the start of the level; returns false if a newer request came in meanwhile
+bool Preview::simulate(uint64_t job, int level, std::vector<std::string> const& program, Result* out) {
+    if (level < 0 || level >= (int)levels.size()) {
+        return true;
+    }
+    if (std::all_of(program.begin(), program.end(), [](std::string const& line) {
+            return line.find_first_not_of(" \t") == std::string::npos;
+        })) {
+        return true;
+    }
+    if (level != prepared_level) {
+        levels.setup(level, &player_compiler, &enemy_compiler);
+        battle.player_units = levels.player_units;
+        battle.enemy_units = levels.enemy_units[level];
+        delete enemy_exe;
+        enemy_exe = enemy_compiler.compile(levels.script(level));
+        if (enemy_exe != nullptr) {
+            enemy_exe->getState(&enemy_initial);
+        }
+        prepared_level = level;
+    }
+
+    Compiler::Executable* player_exe = player_compiler.compile(program);
+    if (player_exe == nullptr) {
+        out->status = COMPILE_ERROR;
+        out->error = player_compiler.error_message;
+        return true;
+    }
+    if (enemy_exe == nullptr) {
+        delete player_exe;
+        return true;
+    }
+
+    // Same start as PlayMode::reset_level() and submit()
+    for (Object* unit : battle.units()) {
+        unit->reset();
+    }
+    enemy_exe->setState(enemy_initial);
+    enemy_exe->current_line = 0;
+    player_compiler.rng.seed(seed);
+    enemy_compiler.rng.seed(seed + 1);
+    battle.max_game_time = max_game_time;
+    battle.start(player_exe, enemy_exe);
+
+    bool cancelled = false;
+    while (!battle.finished() && out->turns < max_turns) {
+        if (out->turns % CancelCheckInterval == 0 && generation != job) {
+            cancelled = true;
+            break;
+        }
+        battle.takeTurn();
+        out->turns++;
+    }
+
+    out->status = DONE;
+    out->ending = battle.finished() ? battle.ending : Battle::UNDECIDED;
+    out->game_time = battle.game_time;
+    for (Object* unit : levels.player_units) {
+        if (player_compiler.objects.count(unit->name) > 0) {
+            out->health += std::max(0, unit->property(PROPERTY_HEALTH));
+            out->health_max += unit->property(PROPERTY_HEALTH_MAX);
+        }
+    }
+    battle.player_exe = nullptr;
+    battle.player_statement = nullptr;
+    delete player_exe;
+    return !cancelled;
+}
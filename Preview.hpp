@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Levels.hpp"
+#include "Battle.hpp"
+
+#ifndef _PREVIEW_H_
+#define _PREVIEW_H_
+
+// Projects how the program being typed would do against a level. A worker thread keeps its own
+// headless copy of the units, so the game never waits for it and the scene is never touched.
+// Every new request() cancels the simulation in progress and starts over with the new draft.
+struct Preview {
+    enum Status : uint8_t {
+        IDLE, // nothing to preview, e.g. an empty draft
+        COMPILE_ERROR,
+        DONE
+    };
+
+    struct Result {
+        Status status = IDLE;
+        bool stale = false; // the draft has changed since; a new result is on its way
+        Battle::Ending ending = Battle::UNDECIDED; // also when both programs ran out or max_turns did
+        size_t turns = 0;
+        float game_time = 0.f;
+        int health = 0; // the player's units, summed
+        int health_max = 0;
+        std::string error;
+    };
+
+    float max_game_time = 600.f;
+    size_t max_turns = 100000;
+    uint32_t seed = 0; // the real battle rolls its own, so RANDOM_* targets may land differently
+
+    Preview();
+    ~Preview();
+    Preview(Preview const&) = delete;
+
+    // Simulate the program against the level; does nothing if neither has changed since the last call
+    void request(int level, std::vector<std::string> const& program);
+    // The result for the latest request that has finished
+    Result result();
+    // Whether the latest request is still being simulated
+    bool pending();
+
+    // Worker side
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<uint64_t> generation{0}; // bumped by request(); the worker gives up once it moves on
+    int requested_level = -1;
+    std::vector<std::string> requested_program;
+    Result latest;
+    uint64_t latest_generation = 0;
+    bool quit = false;
+
+    Levels levels;
+    Compiler player_compiler;
+    Compiler enemy_compiler;
+    Battle battle;
+    Compiler::Executable* enemy_exe = nullptr;
+    std::vector<Compiler::StatementState> enemy_initial;
+    int prepared_level = -1;
+
+    void work();
+    bool simulate(uint64_t job, int level, std::vector<std::string> const& program, Result* out);
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include "Replay.hpp"
+#include "read_write_chunk.hpp"
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+// Pack strings into a single '\0'-separated buffer for write_chunk
+static std::vector<char> joinStrings(std::vector<std::string> const& strings) {
+    std::vector<char> out;
+    for (auto const& str : strings) {
+        out.insert(out.end(), str.begin(), str.end());
+        out.push_back('\0');
+    }
+    return out;
+}
+
+// Inverse of joinStrings
+static std::vector<std::string> splitStrings(std::vector<char> const& chars) {
+    std::vector<std::string> out;
+    std::string current;
+    for (char c : chars) {
+        if (c == '\0') {
+            out.push_back(current);
+            current.clear();
+        } else {
+            current.push_back(c);
+        }
+    }
+    return out;
+}
+
+// FNV-1a over the program text, one '\n' per line
+uint32_t Replay::hashProgram(std::vector<std::string> const& lines) {
+    uint32_t hash = 2166136261u;
+    auto mix = [&](char c) {
+        hash ^= (uint8_t)c;
+        hash *= 16777619u;
+    };
+    for (auto const& line : lines) {
+        for (char c : line) {
+            mix(c);
+        }
+        mix('\n');
+    }
+    return hash;
+}
+
+// Start a new recording; every property each unit has right now becomes a slot
+void Replay::begin(int level, std::vector<std::string> const& program_, uint32_t seed, std::vector<Object*> const& units_) {
+    header = Header();
+    header.level = level;
+    header.seed = seed;
+    header.program_hash = hashProgram(program_);
+    program = program_;
+    units = units_;
+
+    unit_names.clear();
+    slot_units.clear();
+    slot_properties.clear();
+    for (size_t i = 0; i < units.size(); i++) {
+        unit_names.push_back(units[i]->name);
+        std::vector<std::string> names;
+        for (size_t p = 0; p < units[i]->propertyCount(); p++) {
+            names.push_back(units[i]->propertyNameAt(p));
+        }
+        if (std::find(names.begin(), names.end(), "FREEZE_COUNTDOWN") == names.end()) {
+            names.push_back("FREEZE_COUNTDOWN");
+        }
+        for (auto const& name : names) {
+            slot_units.push_back((uint8_t)i);
+            slot_properties.push_back(name);
+        }
+    }
+    header.slot_count = (uint32_t)slot_properties.size();
+
+    turns.clear();
+    deltas.clear();
+    events.clear();
+    keyframes.clear();
+    last_values.clear();
+    for (size_t s = 0; s < slot_properties.size(); s++) {
+        last_values.push_back(readSlot(s));
+    }
+    keyframes.insert(keyframes.end(), last_values.begin(), last_values.end());
+}
+
+// Append one executed turn, diffing unit properties against the previous turn
+void Replay::record(uint8_t side, int line, uint8_t result, float pace, CombatEventBuffer const& turn_events) {
+    Turn turn;
+    turn.side = side;
+    turn.result = result;
+    turn.line = (uint16_t)std::max(line, 0);
+    turn.pace = pace;
+    turn.first_delta = (uint32_t)deltas.size();
+    turn.first_event = (uint32_t)events.size();
+
+    for (size_t s = 0; s < last_values.size(); s++) {
+        int32_t value = readSlot(s);
+        int32_t change = value - last_values[s];
+        while (change != 0) {
+            int16_t step = (int16_t)std::max(-32768, std::min(32767, change));
+            deltas.push_back(Delta{(uint16_t)s, step});
+            change -= step;
+        }
+        last_values[s] = value;
+    }
+
+    for (size_t i = 0; i < turn_events.size(); i++) {
+        CombatEvent const& event = turn_events[i];
+        Event out;
+        out.type = event.type;
+        out.kind = event.kind;
+        out.lethal = event.lethal ? 1 : 0;
+        out.source = unitIndex(event.source);
+        out.target = unitIndex(event.target);
+        out.amount = event.amount;
+        out.duration = event.duration;
+        events.push_back(out);
+    }
+
+    turn.delta_count = (uint16_t)(deltas.size() - turn.first_delta);
+    turn.event_count = (uint16_t)(events.size() - turn.first_event);
+    turns.push_back(turn);
+
+    if (turns.size() % header.keyframe_interval == 0) {
+        keyframes.insert(keyframes.end(), last_values.begin(), last_values.end());
+    }
+}
+
+// Attach the replay to live objects by name; returns false if any unit is missing
+bool Replay::bind(std::vector<Object*> const& candidates) {
+    units.clear();
+    for (auto const& name : unit_names) {
+        auto it = std::find_if(candidates.begin(), candidates.end(), [&](Object* obj) { return obj->name == name; });
+        if (it == candidates.end()) {
+            units.clear();
+            return false;
+        }
+        units.push_back(*it);
+    }
+    return true;
+}
+
+// Set every bound unit's properties to their values just before the given turn
+// (seek(turns.size()) gives the final state).
+void Replay::seek(size_t turn) {
+    turn = std::min(turn, turns.size());
+    size_t keyframe = std::min<size_t>(turn / header.keyframe_interval, keyframes.size() / std::max<size_t>(header.slot_count, 1) - 1);
+    std::vector<int32_t> values(keyframes.begin() + keyframe * header.slot_count, keyframes.begin() + (keyframe + 1) * header.slot_count);
+    for (size_t t = keyframe * header.keyframe_interval; t < turn; t++) {
+        for (size_t d = turns[t].first_delta; d < turns[t].first_delta + turns[t].delta_count; d++) {
+            values[deltas[d].slot] += deltas[d].change;
+        }
+    }
+    for (size_t s = 0; s < values.size(); s++) {
+        writeSlot(s, values[s]);
+    }
+}
+
+// Push the combat events recorded for the given turn, resolved against the bound units
+void Replay::turnEvents(size_t turn, CombatEventBuffer* out) const {
+    if (turn >= turns.size()) {
+        return;
+    }
+    auto unit = [&](uint8_t index) -> Object* {
+        return index < units.size() ? units[index] : nullptr;
+    };
+    for (size_t e = turns[turn].first_event; e < turns[turn].first_event + turns[turn].event_count; e++) {
+        Event const& event = events[e];
+        out->push({(CombatEventType)event.type, event.kind, event.lethal != 0, unit(event.source), unit(event.target), event.amount, event.duration});
+    }
+}
+
+// Throws std::runtime_error if the file cannot be written
+void Replay::save(std::string const& filename) const {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        throw std::runtime_error("Failed to open replay '" + filename + "' for writing");
+    }
+    write_chunk("rply", std::vector<Header>{header}, &out);
+    write_chunk("prog", joinStrings(program), &out);
+    write_chunk("unit", joinStrings(unit_names), &out);
+    write_chunk("slot", slot_units, &out);
+    write_chunk("prop", joinStrings(slot_properties), &out);
+    write_chunk("turn", turns, &out);
+    write_chunk("dlta", deltas, &out);
+    write_chunk("evnt", events, &out);
+    write_chunk("keyf", keyframes, &out);
+    if (!out) {
+        throw std::runtime_error("Failed to write replay '" + filename + "'");
+    }
+}
+
+// Throws std::runtime_error if the file is missing or malformed
+void Replay::load(std::string const& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open replay '" + filename + "'");
+    }
+
+    std::vector<Header> headers;
+    read_chunk(in, "rply", &headers);
+    if (headers.size() != 1 || headers[0].version != VERSION) {
+        throw std::runtime_error("Unsupported replay version in '" + filename + "'");
+    }
+    header = headers[0];
+
+    std::vector<char> chars;
+    read_chunk(in, "prog", &chars);
+    program = splitStrings(chars);
+    read_chunk(in, "unit", &chars);
+    unit_names = splitStrings(chars);
+    read_chunk(in, "slot", &slot_units);
+    read_chunk(in, "prop", &chars);
+    slot_properties = splitStrings(chars);
+    read_chunk(in, "turn", &turns);
+    read_chunk(in, "dlta", &deltas);
+    read_chunk(in, "evnt", &events);
+    read_chunk(in, "keyf", &keyframes);
+
+    // Everything seek, turnEvents and the slot accessors index must be in range
+    auto inconsistent = [&]() {
+        return std::runtime_error("Inconsistent replay data in '" + filename + "'");
+    };
+    if (slot_units.size() != header.slot_count || slot_properties.size() != header.slot_count
+     || header.keyframe_interval == 0 || keyframes.size() < header.slot_count
+     || (header.slot_count != 0 && keyframes.size() % header.slot_count != 0)) {
+        throw inconsistent();
+    }
+    std::vector<size_t> unit_slots(unit_names.size(), 0);
+    for (size_t s = 0; s < header.slot_count; s++) {
+        if (slot_units[s] >= unit_names.size() || slot_properties[s].empty()
+         || ++unit_slots[slot_units[s]] > Archetype::MAX_PROPERTIES) {
+            throw inconsistent();
+        }
+    }
+    for (Turn const& turn : turns) {
+        if ((size_t)turn.first_delta + turn.delta_count > deltas.size()
+         || (size_t)turn.first_event + turn.event_count > events.size()) {
+            throw inconsistent();
+        }
+    }
+    for (Delta const& delta : deltas) {
+        if (delta.slot >= header.slot_count) {
+            throw inconsistent();
+        }
+    }
+    units.clear();
+}
+
+int32_t Replay::readSlot(size_t slot) const {
+    Object* unit = units[slot_units[slot]];
+    int* prop = unit->findProperty(slot_properties[slot]);
+    return prop != nullptr ? *prop : 0;
+}
+
+// Properties that the unit does not have yet are only created when they become non-zero
+void Replay::writeSlot(size_t slot, int32_t value) {
+    Object* unit = units[slot_units[slot]];
+    int* prop = unit->findProperty(slot_properties[slot]);
+    if (prop != nullptr) {
+        *prop = value;
+    } else if (value != 0) {
+        unit->property(slot_properties[slot]) = value;
+    }
+}
+
+uint8_t Replay::unitIndex(Object* obj) const {
+    auto it = std::find(units.begin(), units.end(), obj);
+    return it != units.end() ? (uint8_t)(it - units.begin()) : NO_UNIT;
+}
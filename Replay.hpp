@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Object.hpp"
+#include "CombatEvent.hpp"
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+// A recorded battle: the submitted program, the seed, and for every executed turn
+// the statement that ran, what it did (combat events), and how unit properties changed.
+// Property changes are delta-encoded; full keyframes every KEYFRAME_INTERVAL turns make seeking instant.
+// Saved in the read_write_chunk.hpp chunk format.
+struct Replay {
+    static const uint32_t VERSION = 1;
+    static const uint32_t KEYFRAME_INTERVAL = 32;
+    static const uint8_t NO_UNIT = 0xff;
+
+    struct Header {
+        uint32_t version = VERSION;
+        int32_t level = 0;
+        uint32_t program_hash = 0;
+        uint32_t seed = 0;
+        uint32_t keyframe_interval = KEYFRAME_INTERVAL;
+        uint32_t slot_count = 0;
+    };
+    static_assert(sizeof(Header) == 24, "Replay header is packed");
+
+    // One call to take_turn
+    struct Turn {
+        uint8_t side;
+        uint8_t result;
+        uint16_t line;
+        float pace;
+        uint32_t first_delta;
+        uint32_t first_event;
+        uint16_t delta_count;
+        uint16_t event_count;
+    };
+    static_assert(sizeof(Turn) == 20, "Replay turn is packed");
+
+    // Change of one property slot; large changes are split across several deltas
+    struct Delta {
+        uint16_t slot;
+        int16_t change;
+    };
+    static_assert(sizeof(Delta) == 4, "Replay delta is packed");
+
+    // A CombatEvent with objects replaced by unit indices
+    struct Event {
+        uint8_t type;
+        uint8_t kind;
+        uint8_t lethal;
+        uint8_t source;
+        uint8_t target;
+        uint8_t padding[3] = {0, 0, 0};
+        int32_t amount;
+        float duration;
+    };
+    static_assert(sizeof(Event) == 16, "Replay event is packed");
+
+    Header header;
+    std::vector<std::string> program;
+    std::vector<std::string> unit_names;
+    std::vector<uint8_t> slot_units;
+    std::vector<std::string> slot_properties;
+    std::vector<Turn> turns;
+    std::vector<Delta> deltas;
+    std::vector<Event> events;
+    std::vector<int32_t> keyframes;
+
+    // Objects the slots refer to, in unit_names order
+    std::vector<Object*> units;
+
+    // Recording
+    void begin(int level, std::vector<std::string> const& program, uint32_t seed, std::vector<Object*> const& units);
+    void record(uint8_t side, int line, uint8_t result, float pace, CombatEventBuffer const& turn_events);
+
+    // Playback
+    bool bind(std::vector<Object*> const& candidates);
+    void seek(size_t turn);
+    void turnEvents(size_t turn, CombatEventBuffer* out) const;
+
+    void save(std::string const& filename) const;
+    void load(std::string const& filename);
+
+    static uint32_t hashProgram(std::vector<std::string> const& lines);
+
+    // Slot values as of the last recorded turn
+    std::vector<int32_t> last_values;
+    int32_t readSlot(size_t slot) const;
+    void writeSlot(size_t slot, int32_t value);
+    uint8_t unitIndex(Object* obj) const;
+};
+
+#endif
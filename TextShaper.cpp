@@ -0,0 +1,88 @@
+#include "TextShaper.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <string_view>
+
+TextShaper::TextShaper(hb_font_t *font_, int font_size_) : font(font_), font_size(font_size_) {
+	//measure printable ASCII in one run; the table is only used if it is truly monospace:
+	std::string printable;
+	for (char c = MinChar; c <= MaxChar; ++c) {
+		printable += c;
+	}
+	std::vector< hb_glyph_position_t > positions;
+	shape_with_harfbuzz(printable.c_str(), printable.size(), &positions);
+	if (positions.size() != printable.size()) return;
+
+	monospace = true;
+	for (size_t i = 0; i < positions.size(); ++i) {
+		hb_glyph_position_t const &pos = positions[i];
+		if (pos.x_advance != positions[0].x_advance || pos.y_advance != 0 || pos.x_offset != 0 || pos.y_offset != 0) {
+			monospace = false;
+		}
+		ascii[i] = pos;
+	}
+}
+
+std::vector< hb_glyph_position_t > const &TextShaper::shape(std::string const &text, size_t offset) {
+	std::string_view rest = std::string_view(text).substr(std::min(offset, text.size()));
+	size_t key = std::hash< std::string_view >()(rest) ^ (std::hash< int >()(font_size) * 0x9e3779b97f4a7c15ULL);
+
+	auto f = run_of.find(key);
+	if (f != run_of.end()) {
+		runs.splice(runs.begin(), runs, f->second);
+		Run &run = runs.front();
+		if (run.text == rest) return run.positions;
+		//a different text with the same hash; shape it into this run instead
+		run.text = rest;
+	} else {
+		if (runs.size() == MaxRuns) {
+			run_of.erase(runs.back().key);
+			runs.splice(runs.begin(), runs, std::prev(runs.end()));
+		} else {
+			runs.emplace_front();
+		}
+		Run &run = runs.front();
+		run.key = key;
+		run.text = rest;
+		run_of.emplace(key, runs.begin());
+	}
+
+	Run &run = runs.front();
+	run.positions.clear();
+	bool ascii_only = monospace;
+	for (char c : rest) {
+		if (c < MinChar || c > MaxChar) {
+			ascii_only = false;
+			break;
+		}
+	}
+	if (ascii_only) {
+		run.positions.reserve(rest.size());
+		for (char c : rest) {
+			run.positions.emplace_back(ascii[c - MinChar]);
+		}
+	} else {
+		shape_with_harfbuzz(rest.data(), rest.size(), &run.positions);
+	}
+	return run.positions;
+}
+
+void TextShaper::shape_with_harfbuzz(char const *text, size_t length, std::vector< hb_glyph_position_t > *positions) {
+	// Create hb-buffer and populate.
+	hb_buffer_t *hb_buffer = hb_buffer_create();
+	hb_buffer_add_utf8(hb_buffer, text, (int)length, 0, (int)length);
+	hb_buffer_guess_segment_properties(hb_buffer);
+
+	// Shape it!
+	hb_feature_t feature;
+	hb_feature_from_string("-liga", -1, &feature);
+	hb_shape(font, hb_buffer, &feature, 1);
+
+	// Copy the glyph positions out of the buffer.
+	unsigned int len = hb_buffer_get_length(hb_buffer);
+	hb_glyph_position_t *pos = hb_buffer_get_glyph_positions(hb_buffer, NULL);
+	positions->assign(pos, pos + len);
+
+	hb_buffer_destroy(hb_buffer);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+/*
+ * "TextShaper" remembers the glyph positions of recently drawn text, so the
+ *  guidance, code and labels drawn every frame are only shaped when they change.
+ * Text that is all printable ASCII skips HarfBuzz entirely when the font is
+ *  monospace (as Roboto Mono is), using positions measured once at startup.
+ *
+ */
+
+#include <hb.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct TextShaper {
+	//the font must outlive this; font_size is the size it was set to:
+	TextShaper(hb_font_t *font, int font_size);
+	TextShaper(TextShaper const &) = delete;
+
+	//positions of the glyphs of text from offset on, as hb_shape gives them (with ligatures off);
+	// the reference stays valid until MaxRuns other runs have been shaped:
+	std::vector< hb_glyph_position_t > const &shape(std::string const &text, size_t offset = 0);
+
+	hb_font_t *font;
+	int font_size;
+
+	//printable ASCII, when every character shapes to the same advance and no offset:
+	enum : char { MinChar = ' ', MaxChar = '~' };
+	bool monospace = false;
+	hb_glyph_position_t ascii[MaxChar - MinChar + 1];
+
+	//recently shaped runs, most recently used first, found by hash of (text from offset, font size):
+	enum : size_t { MaxRuns = 256 };
+	struct Run {
+		size_t key = 0;
+		std::string text; //to tell apart texts whose hashes collide
+		std::vector< hb_glyph_position_t > positions;
+	};
+	std::list< Run > runs;
+	std::unordered_map< size_t, std::list< Run >::iterator > run_of;
+
+	void shape_with_harfbuzz(char const *text, size_t length, std::vector< hb_glyph_position_t > *positions);
+};
@@ -0,0 +1,101 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+// count == 0 uses one thread per hardware thread
+ThreadPool::ThreadPool(size_t count) {
+    if (count == 0) {
+        count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 1; i < count; i++) {
+        threads.emplace_back(&ThreadPool::work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::run(size_t count, Job const& job) {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = &job;
+        job_count = count;
+        next_job = 0;
+        busy = threads.size();
+        generation++;
+    }
+    wake.notify_all();
+    drain(0);
+    wait();
+}
+
+void ThreadPool::start(size_t count, Job const& job) {
+    wait();
+    if (threads.empty()) {
+        for (size_t i = 0; i < count; i++) {
+            job(i, 0);
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        started = job;
+        current = &started;
+        job_count = count;
+        next_job = 0;
+        busy = threads.size();
+        generation++;
+    }
+    wake.notify_all();
+}
+
+bool ThreadPool::done() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return busy == 0;
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&]() { return busy == 0; });
+    current = nullptr;
+    started = nullptr;
+}
+
+// Take jobs until there are none left
+void ThreadPool::drain(size_t worker) {
+    while (true) {
+        size_t job = next_job++;
+        if (job >= job_count) {
+            break;
+        }
+        (*current)(job, worker);
+    }
+}
+
+void ThreadPool::work(size_t worker) {
+    size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return quit || generation != seen; });
+            if (quit) {
+                return;
+            }
+            seen = generation;
+        }
+        drain(worker);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy--;
+        }
+        finished.notify_one();
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+// Fixed set of worker threads for running independent jobs in parallel.
+// run() hands out job indices to the workers and returns once every job is done;
+// start() hands them out and returns at once, for the caller to carry on and check done() later.
+struct ThreadPool {
+    typedef std::function<void(size_t job, size_t worker)> Job;
+
+    ThreadPool(size_t count = 0);
+    ~ThreadPool();
+    ThreadPool(ThreadPool const&) = delete;
+
+    // Call job(i, worker) for every i in [0, count); the calling thread helps as worker 0
+    void run(size_t count, Job const& job);
+    // Call job(i, worker) for every i in [0, count) on the worker threads alone, returning at once
+    // (or, with no worker threads, once every job is done); one batch of jobs runs at a time
+    void start(size_t count, Job const& job);
+    // Whether the jobs handed out last have all finished
+    bool done();
+    // Block until they have
+    void wait();
+    // Workers plus the calling thread
+    size_t size() const { return threads.size() + 1; }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    Job const* current = nullptr;
+    Job started; // the jobs of start(), kept until they are done
+    size_t job_count = 0;
+    std::atomic<size_t> next_job{0};
+    size_t generation = 0;
+    size_t busy = 0;
+    bool quit = false;
+
+    void work(size_t worker);
+    void drain(size_t worker);
+};
+
+#endif
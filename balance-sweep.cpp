@@ -0,0 +1,398 @@
+#include "Levels.hpp"
+#include "Battle.hpp"
+#include "ThreadPool.hpp"
+#include "data_path.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Runs a corpus of reference programs against every combination of the given unit stats
+// and writes win rates and times to win as CSV.
+// Each parameter is UNIT.NAME=MIN:MAX[:STEP]; NAME is a property (integer values) or an
+// action, whose duration is given in turns. Setting HEALTH_MAX also sets the starting HEALTH.
+
+typedef std::chrono::steady_clock Clock;
+
+struct Parameter {
+    std::string text;
+    std::string unit;
+    std::string name;
+    std::vector<float> values;
+};
+
+// One reference program from the corpus file
+struct Script {
+    std::string name;
+    int level = 0; // 0-based
+    std::vector<std::string> lines;
+};
+
+struct Options {
+    std::vector<Parameter> parameters;
+    std::string corpus = "reference-scripts.txt";
+    std::string out = "balance";
+    size_t seeds = 1;
+    float max_game_time = 600.f;
+    size_t threads = 0;
+};
+
+// The corpus is a list of programs, each starting with a "LEVEL <number> <name>" line.
+// Blank lines and lines starting with '#' are skipped.
+// Throws std::runtime_error if the file is missing or malformed.
+static std::vector<Script> readCorpus(std::string const& filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        throw std::runtime_error("Failed to open corpus '" + filename + "'");
+    }
+    std::vector<Script> scripts;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.find_first_not_of(" \t") == std::string::npos || line[0] == '#') {
+            continue;
+        }
+        if (line.compare(0, 6, "LEVEL ") == 0) {
+            std::istringstream header(line.substr(6));
+            Script script;
+            header >> script.level >> script.name;
+            if (!header || script.level < 1) {
+                throw std::runtime_error("Bad program header '" + line + "' in '" + filename + "'");
+            }
+            script.level--;
+            scripts.push_back(script);
+        } else if (scripts.empty()) {
+            throw std::runtime_error("'" + filename + "' must start with a LEVEL line");
+        } else {
+            scripts.back().lines.push_back(line);
+        }
+    }
+    return scripts;
+}
+
+// Throws std::runtime_error if the text is not UNIT.NAME=MIN:MAX[:STEP]
+static Parameter parseParameter(std::string const& text) {
+    Parameter parameter;
+    parameter.text = text;
+    size_t dot = text.find('.');
+    size_t equals = text.find('=');
+    if (dot == std::string::npos || equals == std::string::npos || equals < dot) {
+        throw std::runtime_error("Expected UNIT.NAME=MIN:MAX[:STEP], got '" + text + "'");
+    }
+    parameter.unit = text.substr(0, dot);
+    parameter.name = text.substr(dot + 1, equals - dot - 1);
+    std::transform(parameter.unit.begin(), parameter.unit.end(), parameter.unit.begin(), ::toupper);
+    std::transform(parameter.name.begin(), parameter.name.end(), parameter.name.begin(), ::toupper);
+
+    std::vector<float> range;
+    std::istringstream numbers(text.substr(equals + 1));
+    std::string number;
+    while (std::getline(numbers, number, ':')) {
+        range.push_back(std::stof(number));
+    }
+    if (range.size() == 1) {
+        range.push_back(range[0]);
+    }
+    if (range.size() == 2) {
+        range.push_back(1.f);
+    }
+    if (range.size() != 3 || range[2] <= 0.f || range[1] < range[0]) {
+        throw std::runtime_error("Bad range in '" + text + "'");
+    }
+    for (float value = range[0]; value <= range[1] + range[2] * 0.001f; value += range[2]) {
+        parameter.values.push_back(value);
+    }
+    return parameter;
+}
+
+// One reference program set up on a private copy of its level
+struct Arena {
+    // Where a parameter lands in this arena; unused parameters have neither
+    struct Target {
+        Object* unit = nullptr;
+        int* value = nullptr;
+        int setting = 0;
+        Action* action = nullptr;
+        std::vector<Compiler::ActionStatement*> statements;
+    };
+
+    Levels levels;
+    Compiler player_compiler;
+    Compiler enemy_compiler;
+    Battle battle;
+    std::vector<Object*> units;
+    Compiler::Executable* player_exe;
+    Compiler::Executable* enemy_exe;
+    std::vector<Compiler::StatementState> player_initial;
+    std::vector<Compiler::StatementState> enemy_initial;
+    std::vector<Target> targets;
+
+    Arena(Script const& script, std::vector<Parameter> const& parameters) {
+        levels.createHeadless();
+        levels.setup(script.level, &player_compiler, &enemy_compiler);
+        battle.player_units = levels.player_units;
+        battle.enemy_units = levels.enemy_units[script.level];
+        for (Object* unit : battle.units()) {
+            if (player_compiler.objects.count(unit->name) > 0) {
+                units.push_back(unit);
+            }
+            // Programs may refer to properties reset() creates, like BURNED
+            unit->reset();
+        }
+        player_exe = player_compiler.compile(script.lines);
+        if (player_exe == nullptr) {
+            throw std::runtime_error("Program '" + script.name + "' does not compile: " + player_compiler.error_message);
+        }
+        enemy_exe = enemy_compiler.compile(levels.script(script.level));
+        if (enemy_exe == nullptr) {
+            throw std::runtime_error("Failed to compile the enemy script of level " + std::to_string(script.level + 1) + ": " + enemy_compiler.error_message);
+        }
+        player_exe->getState(&player_initial);
+        enemy_exe->getState(&enemy_initial);
+
+        std::vector<Compiler::ActionStatement*> actions;
+        for (Compiler::Executable* exe : {player_exe, enemy_exe}) {
+            for (Compiler::Statement* statement : exe->flatten()) {
+                if (statement->type == Compiler::ACTION_STATEMENT) {
+                    actions.push_back(dynamic_cast<Compiler::ActionStatement*>(statement));
+                }
+            }
+        }
+        for (auto const& parameter : parameters) {
+            Target target;
+            auto unit = std::find_if(units.begin(), units.end(), [&](Object* obj) { return obj->name == parameter.unit; });
+            if (unit != units.end()) {
+                Action* action = (*unit)->editAction(parameter.name);
+                if (action != nullptr) {
+                    target.action = action;
+                    for (Compiler::ActionStatement* statement : actions) {
+                        if (statement->object == *unit && statement->action_name == parameter.name) {
+                            target.statements.push_back(statement);
+                        }
+                    }
+                } else {
+                    if ((*unit)->findProperty(parameter.name) == nullptr) {
+                        throw std::runtime_error(parameter.unit + " has no property or action " + parameter.name);
+                    }
+                    target.unit = *unit;
+                    target.value = &(*unit)->property(parameter.name);
+                    target.setting = *target.value;
+                }
+            }
+            targets.push_back(target);
+        }
+    }
+
+    void apply(size_t parameter, float value) {
+        Target& target = targets[parameter];
+        if (target.value != nullptr) {
+            target.setting = (int)std::round(value);
+        } else if (target.action != nullptr) {
+            target.action->duration = value * turn_duration();
+            for (Compiler::ActionStatement* statement : target.statements) {
+                statement->base_duration = target.action->duration;
+            }
+        }
+    }
+
+    // Play the program from the start; returns true on a win, with the game time it took
+    bool play(uint32_t seed, float max_game_time, float* time) {
+        for (Object* unit : units) {
+            unit->reset();
+        }
+        // After reset(), which refills HEALTH and ARROWS
+        for (Target const& target : targets) {
+            if (target.value != nullptr) {
+                *target.value = target.setting;
+                if (target.value == &target.unit->property(PROPERTY_HEALTH_MAX)) {
+                    target.unit->property(PROPERTY_HEALTH) = target.setting;
+                }
+            }
+        }
+        player_exe->setState(player_initial);
+        player_exe->current_line = 0;
+        enemy_exe->setState(enemy_initial);
+        enemy_exe->current_line = 0;
+        player_compiler.rng.seed(seed);
+        enemy_compiler.rng.seed(seed);
+        battle.max_game_time = max_game_time;
+        battle.start(player_exe, enemy_exe);
+        while (!battle.finished()) {
+            battle.takeTurn();
+        }
+        *time = battle.game_time;
+        return battle.won;
+    }
+};
+
+struct Result {
+    uint32_t wins = 0;
+    float time_to_win = 0.f; // summed over wins
+};
+
+static void usage(char const* name) {
+    std::cerr << "Usage: " << name << " [options] UNIT.NAME=MIN:MAX[:STEP]...\n"
+              << "  NAME is a property, or an action whose duration is given in turns\n"
+              << "  --corpus FILE        reference programs (default dist/reference-scripts.txt)\n"
+              << "  --out PREFIX         writes PREFIX-summary.csv and PREFIX-scripts.csv (default balance)\n"
+              << "  --seeds N            runs per program, with different random seeds (default 1)\n"
+              << "  --max-game-time S    battles longer than this count as losses (default 600)\n"
+              << "  --threads N          worker threads (default: one per core)\n"
+              << "Example: " << name << " BRAWLER.POWER=10:20:5 YORMUN.HEALTH_MAX=200:300:50 GRUM.ATTACK=0.25:1:0.25\n";
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    bool corpus_given = false;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("Missing value for " + arg);
+                }
+                return argv[++i];
+            };
+            if (arg == "--corpus") {
+                options.corpus = value();
+                corpus_given = true;
+            } else if (arg == "--out") {
+                options.out = value();
+            } else if (arg == "--seeds") {
+                options.seeds = std::max<size_t>(1, std::stoul(value()));
+            } else if (arg == "--max-game-time") {
+                options.max_game_time = std::stof(value());
+            } else if (arg == "--threads") {
+                options.threads = std::stoul(value());
+            } else if (!arg.empty() && arg[0] != '-') {
+                options.parameters.push_back(parseParameter(arg));
+            } else {
+                throw std::runtime_error("Unknown option " + arg);
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Script> scripts;
+    try {
+        scripts = readCorpus(corpus_given ? options.corpus : data_path(options.corpus));
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    size_t combinations = 1;
+    for (auto const& parameter : options.parameters) {
+        combinations *= parameter.values.size();
+    }
+    // Value index of each parameter in a combination, first parameter varying slowest
+    auto decode = [&](size_t combination, size_t parameter) {
+        for (size_t p = options.parameters.size() - 1; p > parameter; p--) {
+            combination /= options.parameters[p].values.size();
+        }
+        return combination % options.parameters[parameter].values.size();
+    };
+
+    ThreadPool pool(options.threads);
+    std::vector<std::vector<Arena*>> arenas(pool.size());
+    try {
+        for (auto& worker : arenas) {
+            for (auto const& script : scripts) {
+                worker.push_back(new Arena(script, options.parameters));
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    for (size_t p = 0; p < options.parameters.size(); p++) {
+        bool used = false;
+        for (Arena* arena : arenas[0]) {
+            used = used || arena->targets[p].value != nullptr || arena->targets[p].action != nullptr;
+        }
+        if (!used) {
+            std::cout << "Warning: " << options.parameters[p].text << " does not affect any program in the corpus" << std::endl;
+        }
+    }
+
+    std::cout << "Running " << combinations * scripts.size() * options.seeds << " battles (" << combinations << " parameter settings x "
+              << scripts.size() << " programs";
+    if (options.seeds > 1) {
+        std::cout << " x " << options.seeds << " seeds";
+    }
+    std::cout << ") on " << pool.size() << " threads" << std::endl;
+
+    auto start = Clock::now();
+    std::vector<Result> results(combinations * scripts.size());
+    pool.run(combinations, [&](size_t combination, size_t worker) {
+        for (size_t s = 0; s < scripts.size(); s++) {
+            Arena& arena = *arenas[worker][s];
+            for (size_t p = 0; p < options.parameters.size(); p++) {
+                arena.apply(p, options.parameters[p].values[decode(combination, p)]);
+            }
+            Result& result = results[combination * scripts.size() + s];
+            for (uint32_t seed = 0; seed < options.seeds; seed++) {
+                float time;
+                if (arena.play(seed, options.max_game_time, &time)) {
+                    result.wins++;
+                    result.time_to_win += time;
+                }
+            }
+        }
+    });
+    float seconds = std::chrono::duration<float>(Clock::now() - start).count();
+    std::cout << std::fixed << std::setprecision(2) << seconds << "s, "
+              << (size_t)(combinations * scripts.size() * options.seeds / std::max(seconds, 0.001f)) << " battles/s" << std::endl;
+
+    std::ofstream summary(options.out + "-summary.csv");
+    std::ofstream per_script(options.out + "-scripts.csv");
+    if (!summary || !per_script) {
+        std::cerr << "Failed to open '" << options.out << "-*.csv' for writing" << std::endl;
+        return 1;
+    }
+    std::string header;
+    for (auto const& parameter : options.parameters) {
+        header += parameter.unit + "." + parameter.name + ",";
+    }
+    summary << header << "battles,wins,win_rate,mean_time_to_win\n";
+    per_script << header << "program,level,runs,wins,win_rate,mean_time_to_win\n";
+    for (size_t combination = 0; combination < combinations; combination++) {
+        std::ostringstream values;
+        for (size_t p = 0; p < options.parameters.size(); p++) {
+            values << options.parameters[p].values[decode(combination, p)] << ",";
+        }
+        uint32_t wins = 0;
+        float time_to_win = 0.f;
+        for (size_t s = 0; s < scripts.size(); s++) {
+            Result const& result = results[combination * scripts.size() + s];
+            wins += result.wins;
+            time_to_win += result.time_to_win;
+            per_script << values.str() << scripts[s].name << "," << scripts[s].level + 1 << "," << options.seeds << "," << result.wins << ","
+                       << (float)result.wins / options.seeds << ",";
+            if (result.wins > 0) {
+                per_script << result.time_to_win / result.wins;
+            }
+            per_script << "\n";
+        }
+        size_t battles = scripts.size() * options.seeds;
+        summary << values.str() << battles << "," << wins << "," << (float)wins / std::max<size_t>(battles, 1) << ",";
+        if (wins > 0) {
+            summary << time_to_win / wins;
+        }
+        summary << "\n";
+    }
+    std::cout << "Wrote " << options.out << "-summary.csv and " << options.out << "-scripts.csv" << std::endl;
+    return 0;
+}
@@ -0,0 +1,300 @@
+#include "clockwork.h"
+#include "Levels.hpp"
+#include "Battle.hpp"
+#include "ThreadPool.hpp"
+#include "data_path.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Battles longer than this much game time are draws, as in the tools
+static float const MaxGameTime = 600.f;
+
+static std::string last_error;
+
+// Plays the action cw_step() chose for the player's side
+struct Agent : Battle::Controller {
+    bool has_action = false;
+    Battle::Decision action;
+    bool ending = false; // the player has no more moves
+
+    Agent(Compiler* compiler) : Controller(compiler) {}
+
+    bool decide(Battle& battle, Battle::Decision* out) override {
+        if (!has_action) {
+            return false;
+        }
+        *out = action;
+        has_action = false;
+        return true;
+    }
+};
+
+// One battle with its own copy of the units
+struct Environment {
+    Levels levels;
+    Compiler player_compiler;
+    Compiler enemy_compiler;
+    Battle battle;
+    Agent agent;
+    Compiler::Executable* enemy_exe = nullptr;
+    std::vector<Compiler::StatementState> enemy_initial;
+    std::vector<Object*> units;
+    std::vector<bool> present; // in this level
+    uint32_t seed;
+    uint32_t episode = 0;
+
+    Environment(LevelPack const& pack, int level, std::vector<std::string> const& enemy_program, uint32_t seed) : agent(&player_compiler), seed(seed) {
+        levels.createHeadless(pack);
+        levels.setup(level, &player_compiler, &enemy_compiler);
+        battle.player_units = levels.player_units;
+        battle.enemy_units = levels.enemy_units[level];
+        battle.player_controller = &agent;
+        battle.max_game_time = MaxGameTime;
+        units = battle.units();
+        for (Object* unit : units) {
+            present.push_back(player_compiler.objects.count(unit->name) > 0);
+            // Programs may refer to properties reset() creates, like BURNED
+            unit->reset();
+        }
+        enemy_exe = enemy_compiler.compile(enemy_program);
+        if (enemy_exe != nullptr) {
+            enemy_exe->getState(&enemy_initial);
+        }
+    }
+
+    ~Environment() {
+        delete enemy_exe;
+    }
+
+    void reset() {
+        for (Object* unit : units) {
+            unit->reset();
+        }
+        enemy_exe->setState(enemy_initial);
+        enemy_exe->current_line = 0;
+        player_compiler.rng.seed(seed + episode * 2);
+        enemy_compiler.rng.seed(seed + episode * 2 + 1);
+        episode++;
+        agent.has_action = false;
+        agent.ending = false;
+        battle.start(nullptr, enemy_exe);
+        advance();
+    }
+
+    // Play until the player has to move or the battle is over
+    void advance() {
+        while (!battle.finished()) {
+            if (battle.turn == Battle::PLAYER && battle.player_statement == nullptr && !battle.player_done
+                && !agent.has_action && !agent.ending) {
+                return;
+            }
+            battle.takeTurn();
+        }
+    }
+
+    bool valid(int32_t const* action) const {
+        int32_t unit = action[0];
+        if (unit == -1) {
+            return true;
+        }
+        if (unit < 0 || unit >= (int32_t)battle.player_units.size() || !present[unit]) {
+            return false;
+        }
+        Object* object = units[unit];
+        if (action[1] < 0 || action[1] >= (int32_t)object->actionNames().size()) {
+            return false;
+        }
+        if (!object->actions().at(object->actionNames()[action[1]]).has_target) {
+            return true;
+        }
+        return action[2] >= 0 && action[2] < (int32_t)units.size() && present[action[2]];
+    }
+
+    // Returns false, without moving, if the action is invalid
+    bool step(int32_t const* action, float* reward, uint8_t* done) {
+        *reward = 0.f;
+        *done = 0;
+        if (!valid(action)) {
+            return false;
+        }
+        if (action[0] == -1) {
+            agent.ending = true;
+        } else {
+            agent.action.object = units[action[0]];
+            agent.action.action = (size_t)action[1];
+            agent.action.target = action[2] >= 0 && action[2] < (int32_t)units.size() ? units[action[2]] : nullptr;
+            agent.has_action = true;
+        }
+        advance();
+        if (battle.finished()) {
+            *reward = battle.won ? 1.f : battle.lost ? -1.f : 0.f;
+            *done = 1;
+            reset();
+        }
+        return true;
+    }
+
+    void observe(int32_t* out) const {
+        for (size_t u = 0; u < units.size(); u++) {
+            for (int p = 0; p < PROPERTY_COUNT; p++) {
+                int* slot = units[u]->findProperty((PropertyId)p);
+                *out++ = present[u] && slot != nullptr ? *slot : 0;
+            }
+        }
+    }
+};
+
+struct cw_batch {
+    std::vector<Environment*> environments;
+    ThreadPool pool;
+    size_t units = 0;
+    std::vector<int32_t> observations;
+    std::vector<float> rewards;
+    std::vector<uint8_t> dones;
+    std::vector<uint8_t> invalid;
+
+    cw_batch(size_t threads) : pool(threads) {}
+    ~cw_batch() {
+        for (Environment* environment : environments) {
+            delete environment;
+        }
+    }
+
+    // Call work(first, last) on even slices of the environments across the pool
+    template<typename Work>
+    void forEach(Work const& work) {
+        size_t count = environments.size();
+        size_t slices = std::min(count, pool.size() * 4);
+        pool.run(slices, [&](size_t slice, size_t worker) {
+            work(count * slice / slices, count * (slice + 1) / slices);
+        });
+    }
+};
+
+extern "C" {
+
+cw_batch* cw_create(int level, int count, uint32_t seed, int threads, char const* data_dir) {
+    LevelPack pack;
+    std::vector<std::string> enemy_program;
+    try {
+        pack.load(data_dir != nullptr ? std::string(data_dir) + "/levels.pack" : data_path("levels.pack"));
+        if (level < 0 || level >= (int)pack.levels.size()) {
+            last_error = "There is no level " + std::to_string(level);
+            return nullptr;
+        }
+        enemy_program = pack.script((size_t)level);
+        // Fail here rather than in the pool if the pack names an unknown action
+        Levels levels;
+        levels.createHeadless(pack);
+    } catch (std::exception& e) {
+        last_error = e.what();
+        return nullptr;
+    }
+    if (count <= 0) {
+        last_error = "Need at least one environment";
+        return nullptr;
+    }
+
+    cw_batch* batch = new cw_batch((size_t)std::max(threads, 0));
+    batch->environments.resize((size_t)count, nullptr);
+    // Built in parallel, since every environment creates the units of all levels
+    batch->forEach([&](size_t first, size_t last) {
+        for (size_t e = first; e < last; e++) {
+            batch->environments[e] = new Environment(pack, level, enemy_program, seed + (uint32_t)e * 0x9e3779b9u);
+        }
+    });
+    if (batch->environments[0]->enemy_exe == nullptr) {
+        last_error = "The enemy program of level " + std::to_string(level) + " does not compile: " + batch->environments[0]->enemy_compiler.error_message;
+        delete batch;
+        return nullptr;
+    }
+    batch->units = batch->environments[0]->units.size();
+    batch->observations.resize((size_t)count * batch->units * PROPERTY_COUNT);
+    batch->rewards.resize((size_t)count);
+    batch->dones.resize((size_t)count);
+    batch->invalid.resize((size_t)count);
+    cw_reset(batch);
+    return batch;
+}
+
+void cw_destroy(cw_batch* batch) {
+    delete batch;
+}
+
+char const* cw_error(void) {
+    return last_error.c_str();
+}
+
+int cw_count(cw_batch const* batch) {
+    return (int)batch->environments.size();
+}
+
+int cw_units(cw_batch const* batch) {
+    return (int)batch->units;
+}
+
+int cw_features(void) {
+    return PROPERTY_COUNT;
+}
+
+char const* cw_feature_name(int feature) {
+    return feature >= 0 && feature < PROPERTY_COUNT ? Object::propertyName((PropertyId)feature) : "";
+}
+
+char const* cw_unit_name(cw_batch const* batch, int unit) {
+    auto const& units = batch->environments[0]->units;
+    return unit >= 0 && unit < (int)units.size() ? units[unit]->name.c_str() : "";
+}
+
+int cw_actions(cw_batch const* batch, int unit) {
+    auto const& units = batch->environments[0]->units;
+    return unit >= 0 && unit < (int)units.size() ? (int)units[unit]->actionNames().size() : 0;
+}
+
+char const* cw_action_name(cw_batch const* batch, int unit, int action) {
+    if (action < 0 || action >= cw_actions(batch, unit)) {
+        return "";
+    }
+    return batch->environments[0]->units[unit]->actionNames()[action].c_str();
+}
+
+int32_t const* cw_observations(cw_batch const* batch) {
+    return batch->observations.data();
+}
+
+float const* cw_rewards(cw_batch const* batch) {
+    return batch->rewards.data();
+}
+
+uint8_t const* cw_dones(cw_batch const* batch) {
+    return batch->dones.data();
+}
+
+void cw_reset(cw_batch* batch) {
+    size_t stride = batch->units * PROPERTY_COUNT;
+    batch->forEach([&](size_t first, size_t last) {
+        for (size_t e = first; e < last; e++) {
+            Environment* environment = batch->environments[e];
+            environment->reset();
+            environment->observe(batch->observations.data() + e * stride);
+            batch->rewards[e] = 0.f;
+            batch->dones[e] = 0;
+        }
+    });
+}
+
+int cw_step(cw_batch* batch, int32_t const* actions) {
+    size_t stride = batch->units * PROPERTY_COUNT;
+    batch->forEach([&](size_t first, size_t last) {
+        for (size_t e = first; e < last; e++) {
+            Environment* environment = batch->environments[e];
+            batch->invalid[e] = !environment->step(actions + e * 3, &batch->rewards[e], &batch->dones[e]);
+            environment->observe(batch->observations.data() + e * stride);
+        }
+    });
+    return (int)std::count(batch->invalid.begin(), batch->invalid.end(), (uint8_t)1);
+}
+
+}
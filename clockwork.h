@@ -0,0 +1,60 @@
+#pragma once
+
+#ifndef _CLOCKWORK_H_
+#define _CLOCKWORK_H_
+
+/* Plain C interface to the battle simulation, for driving many headless battles from other
+ * languages (e.g. to train agents). Built as a static library by Maekfile.js; link with -lpthread.
+ *
+ * A batch holds count environments of one level. In each, the step actions choose the player's
+ * moves one at a time and the level's enemy script plays the other side, exactly as in the game.
+ * Observations, rewards and dones live in arrays owned by the batch, which cw_reset() and cw_step()
+ * rewrite in place, so callers can wrap the pointers once (e.g. as numpy arrays) and never copy. */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cw_batch cw_batch;
+
+/* level is 0-based. data_dir is the game's dist/ directory, where levels.pack lives;
+ * NULL looks next to the running executable. threads == 0 uses one per core.
+ * Returns NULL, with the reason in cw_error(), on failure. Environments start reset. */
+cw_batch* cw_create(int level, int count, uint32_t seed, int threads, char const* data_dir);
+void cw_destroy(cw_batch* batch);
+/* Why the last cw_create() failed */
+char const* cw_error(void);
+
+int cw_count(cw_batch const* batch);
+/* Per environment: the player's four units, then the level's enemies. Units not in this level
+ * observe as all zeros. */
+int cw_units(cw_batch const* batch);
+/* Per unit: ALIVE, HEALTH, HEALTH_MAX, DEFENSE, POWER, ARROWS, BURNED, FROZEN, FREEZE_COUNTDOWN */
+int cw_features(void);
+char const* cw_feature_name(int feature);
+char const* cw_unit_name(cw_batch const* batch, int unit);
+int cw_actions(cw_batch const* batch, int unit);
+char const* cw_action_name(cw_batch const* batch, int unit, int action);
+
+/* [count][units][features] */
+int32_t const* cw_observations(cw_batch const* batch);
+/* [count]: 1 for a win, -1 for a loss, 0 otherwise, for the last step */
+float const* cw_rewards(cw_batch const* batch);
+/* [count]: 1 if the last step ended the battle; the environment has already started over */
+uint8_t const* cw_dones(cw_batch const* batch);
+
+/* Start every battle over */
+void cw_reset(cw_batch* batch);
+/* actions is [count][3]: acting unit, action index, target unit (ignored by actions without one).
+ * A unit of -1 ends the player's program; the enemies then play on alone. Each environment runs
+ * until the player has to move again or the battle ends. Environments given an invalid action
+ * stay where they are; returns how many there were. */
+int cw_step(cw_batch* batch, int32_t const* actions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -135,6 +135,13 @@ int main(int argc, char **argv) {
 	};
 	on_resize();
 
+	//While the current mode has nothing new to show, the loop sleeps on events instead of drawing,
+	// waking this often (in milliseconds) to update anyway:
+	const Uint32 IdleWakeInterval = 500;
+	bool redraw = true; //something happened since the last frame was drawn
+	Mode *drawn_mode = nullptr; //the mode that drew the last frame
+	auto previous_time = std::chrono::high_resolution_clock::now();
+
 	//This will loop until the current mode is set to null:
 	while (Mode::current) {
 		//every pass through the game loop creates one frame of output
@@ -147,9 +154,14 @@ int main(int argc, char **argv) {
 				if (evt.type == SDL_WINDOWEVENT && evt.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
 					on_resize();
 				}
+				//anything but the mouse moving over the window may change what is shown:
+				if (evt.type != SDL_MOUSEMOTION) {
+					redraw = true;
+				}
 				//handle input:
 				if (Mode::current && Mode::current->handle_event(evt, window_size)) {
 					// mode handled it; great
+					redraw = true;
 				} else if (evt.type == SDL_QUIT) {
 					Mode::set_current(nullptr);
 					break;
@@ -174,7 +186,6 @@ int main(int argc, char **argv) {
 
 		{ //(2) call the current mode's "update" function to deal with elapsed time:
 			auto current_time = std::chrono::high_resolution_clock::now();
-			static auto previous_time = current_time;
 			float elapsed = std::chrono::duration< float >(current_time - previous_time).count();
 			previous_time = current_time;
 
@@ -186,9 +197,19 @@ int main(int argc, char **argv) {
 			if (!Mode::current) break;
 		}
 
+		if (!redraw && Mode::current.get() == drawn_mode && !Mode::current->needs_redraw()) {
+			//nothing new to show, so wait for an event (leaving it queued for step (1)) instead of drawing:
+			SDL_WaitEventTimeout(nullptr, IdleWakeInterval);
+			//time spent asleep passes for nothing:
+			previous_time = std::chrono::high_resolution_clock::now();
+			continue;
+		}
+
 		{ //(3) call the current mode's "draw" function to produce output:
 		
 			Mode::current->draw(drawable_size);
+			redraw = false;
+			drawn_mode = Mode::current.get();
 		}
 
 		//Wait until the recently-drawn frame is shown before doing it all again:
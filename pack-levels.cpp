@@ -0,0 +1,202 @@
+#include "LevelPack.hpp"
+#include "Levels.hpp"
+#include "Actions.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Builds the level pack from its text description (see levels.txt for the format) and the enemy scripts it names.
+// Every script is compiled against its level, so a broken level fails the build instead of the game.
+
+static void usage(char const* name) {
+    std::cerr << "Usage: " << name << " levels.txt levels.pack" << std::endl;
+}
+
+static std::vector<std::string> readLines(std::string const& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open '" + filename + "'");
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+static LevelPack parse(std::string const& filename) {
+    std::string directory;
+    size_t slash = filename.find_last_of("/\\");
+    if (slash != std::string::npos) {
+        directory = filename.substr(0, slash + 1);
+    }
+
+    LevelPack pack;
+    std::unordered_map<std::string, uint32_t> unit_index;
+    std::vector<std::string> lines = readLines(filename);
+    for (size_t l = 0; l < lines.size(); l++) {
+        std::string where = filename + ":" + std::to_string(l + 1) + ": ";
+        std::istringstream in(lines[l]);
+        std::string keyword;
+        if (!(in >> keyword) || keyword[0] == '#') {
+            continue;
+        }
+
+        auto fail = [&](std::string const& message) {
+            throw std::runtime_error(where + message);
+        };
+        auto word = [&](char const* what) {
+            std::string out;
+            if (!(in >> out)) {
+                fail(std::string("expected ") + what);
+            }
+            return out;
+        };
+        auto number = [&](char const* what) {
+            std::string text = word(what);
+            try {
+                size_t used = 0;
+                float value = std::stof(text, &used);
+                if (used == text.size()) {
+                    return value;
+                }
+            } catch (std::exception&) {
+            }
+            fail(std::string("expected ") + what + ", not '" + text + "'");
+            return 0.f;
+        };
+        auto unit = [&]() -> LevelPack::Unit& {
+            if (pack.units.empty()) {
+                fail(keyword + " before any unit");
+            }
+            return pack.units.back();
+        };
+        auto level = [&]() -> LevelPack::Level& {
+            if (pack.levels.empty()) {
+                fail(keyword + " before any level");
+            }
+            return pack.levels.back();
+        };
+
+        if (keyword == "unit") {
+            LevelPack::Unit added;
+            added.name = word("a unit name");
+            added.model = word("a model");
+            std::string team = word("player or enemy");
+            if (team == "player") {
+                added.team = TEAM_PLAYER;
+            } else if (team == "enemy") {
+                added.team = TEAM_ENEMY;
+            } else {
+                fail("expected player or enemy, not '" + team + "'");
+            }
+            added.start_position.x = number("a start position");
+            added.start_position.y = number("a start position");
+            if (added.team == TEAM_PLAYER) {
+                added.first_level = (int)number("the level the unit joins at") - 1;
+            }
+            if (!unit_index.emplace(added.name, (uint32_t)pack.units.size()).second) {
+                fail("there already is a unit " + added.name);
+            }
+            pack.units.push_back(added);
+        } else if (keyword == "action") {
+            LevelPack::ActionInfo action;
+            action.name = word("an action name");
+            action.function = word("an action function");
+            if (action_function_named(action.function) == nullptr) {
+                fail("unknown action function '" + action.function + "'");
+            }
+            action.turns = number("a duration in turns");
+            std::string flag;
+            if (in >> flag) {
+                if (flag != "untargeted") {
+                    fail("expected untargeted, not '" + flag + "'");
+                }
+                action.has_target = false;
+            }
+            unit().actions.push_back(action);
+        } else if (keyword == "property") {
+            LevelPack::Property property;
+            property.name = word("a property name");
+            property.value = (int)number("a value");
+            unit().properties.push_back(property);
+        } else if (keyword == "level") {
+            LevelPack::Level added;
+            added.scene = word("a scene");
+            added.script = readLines(directory + word("an enemy script"));
+            std::string name;
+            while (in >> name) {
+                auto found = unit_index.find(name);
+                if (found == unit_index.end() || pack.units[found->second].team != TEAM_ENEMY) {
+                    fail("there is no enemy " + name);
+                }
+                added.enemies.push_back(found->second);
+            }
+            if (added.enemies.empty()) {
+                fail("a level needs at least one enemy");
+            }
+            pack.levels.push_back(added);
+        } else if (keyword == "guidance") {
+            std::string text;
+            std::getline(in >> std::ws, text);
+            level().guidance = text;
+        } else {
+            fail("unknown keyword '" + keyword + "'");
+        }
+    }
+    if (pack.levels.empty()) {
+        throw std::runtime_error(filename + " has no levels");
+    }
+    return pack;
+}
+
+// Compile each level's enemy script the way the game does
+static void check(LevelPack const& pack) {
+    Levels levels;
+    levels.createHeadless(pack);
+    // Scripts may refer to properties reset() creates, like BURNED
+    for (Object* unit : levels.player_units) {
+        unit->reset();
+    }
+    for (auto const& units : levels.enemy_units) {
+        for (Object* unit : units) {
+            unit->reset();
+        }
+    }
+    Compiler player_compiler;
+    Compiler enemy_compiler;
+    for (size_t level = 0; level < levels.size(); level++) {
+        levels.setup((int)level, &player_compiler, &enemy_compiler);
+        Compiler::Executable* exe = enemy_compiler.compile(pack.levels[level].script);
+        if (exe == nullptr) {
+            throw std::runtime_error("The enemy script of level " + std::to_string(level + 1) + " does not compile: " + enemy_compiler.error_message);
+        }
+        delete exe;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    try {
+        LevelPack pack = parse(argv[1]);
+        check(pack);
+        pack.save(argv[2]);
+        std::cout << "Packed " << pack.units.size() << " units and " << pack.levels.size() << " levels into " << argv[2] << std::endl;
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "Lockstep.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Plays this side's player program against another instance's over TCP (see Lockstep.hpp).
+// Try it over loopback with two terminals:
+//   pvp --host 15466 mine.txt
+//   pvp --join localhost 15466 theirs.txt
+
+typedef std::chrono::steady_clock Clock;
+
+static void usage(char const* name) {
+    std::cerr << "Usage: " << name << " --host PORT PROGRAM\n"
+              << "       " << name << " --join HOST PORT PROGRAM\n"
+              << "  Your units are BRAWLER, CASTER, HEALER and RANGER, the other side's FOE_BRAWLER etc.\n"
+              << "  --max-game-time S    games longer than this are draws (default 600; both sides must agree)\n"
+              << "  --timeout S          give up after this many seconds without finishing (default 60)\n";
+}
+
+int main(int argc, char** argv) {
+    bool host = false;
+    std::string address;
+    std::string port;
+    std::string file;
+    float max_game_time = 600.f;
+    float timeout = 60.f;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("Missing value for " + arg);
+                }
+                return argv[++i];
+            };
+            if (arg == "--host") {
+                host = true;
+                port = value();
+            } else if (arg == "--join") {
+                host = false;
+                address = value();
+                port = value();
+            } else if (arg == "--max-game-time") {
+                max_game_time = std::stof(value());
+            } else if (arg == "--timeout") {
+                timeout = std::stof(value());
+            } else if (!arg.empty() && arg[0] != '-' && file.empty()) {
+                file = arg;
+            } else {
+                throw std::runtime_error("Unexpected argument " + arg);
+            }
+        }
+        if (port.empty() || file.empty()) {
+            throw std::runtime_error("Need --host or --join, and a program");
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> program;
+    {
+        std::ifstream in(file);
+        if (!in) {
+            std::cerr << "Failed to open '" << file << "'" << std::endl;
+            return 1;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            program.push_back(line);
+        }
+    }
+
+    auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(timeout));
+    std::unique_ptr<Connection> connection;
+    if (host) {
+        std::unique_ptr<Server> server;
+        try {
+            server.reset(new Server(port));
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Waiting for the other side on port " << port << "..." << std::endl;
+        while (!connection && Clock::now() < deadline) {
+            connection.reset(server->accept(0.25));
+        }
+    } else {
+        connection.reset(Connection::connect(address, port));
+    }
+    if (!connection) {
+        std::cerr << "No connection" << std::endl;
+        return 1;
+    }
+
+    Lockstep match(connection.get(), host, program, max_game_time);
+    while (match.state == Lockstep::WAITING && Clock::now() < deadline) {
+        match.update(0.05);
+    }
+    // Let the checksums reach the other side before hanging up
+    while (!connection->send_buffer.empty() && *connection && Clock::now() < deadline) {
+        connection->poll(0.05);
+    }
+
+    if (match.state == Lockstep::WAITING) {
+        std::cerr << "Timed out" << std::endl;
+        return 1;
+    } else if (match.state == Lockstep::FAILED) {
+        std::cerr << match.error << std::endl;
+        return 1;
+    }
+    int score = 0;
+    for (size_t game = 0; game < 2; game++) {
+        int result = match.result(game);
+        std::cout << "Game " << game + 1 << " (" << ((game == 0) == host ? "you" : "they") << " moved first): "
+                  << (result == 1 ? "won" : result == 0 ? "lost" : "draw") << std::endl;
+        score += result == 1 ? 2 : result == -1 ? 1 : 0;
+    }
+    std::cout << "Match: " << (score > 2 ? "you win" : score < 2 ? "you lose" : "even") << "; states agreed at "
+              << match.checks.size() << " checkpoints; " << connection->bytes_sent << " bytes sent, "
+              << connection->bytes_received << " received" << std::endl;
+    return 0;
+}
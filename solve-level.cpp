@@ -0,0 +1,632 @@
+#include "Levels.hpp"
+#include "Battle.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Searches for the shortest (or, with --fastest, the quickest) winning program for a level.
+// Programs are built from moves: one action line, or a WHILE loop over a few action lines.
+// The search deepens one line at a time; every move continues the battle from the snapshot
+// taken where the previous move left off, so a program is never replayed from the start.
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    std::vector<int> levels; // 0-based
+    size_t max_lines = 5;
+    size_t loop_body = 1;
+    bool guards = false;
+    bool fastest = false;
+    float max_game_time = 300.f;
+    float time_limit = 60.f;
+    size_t threads = 0;
+};
+
+enum Outcome {
+    DECIDE, // the player needs its next line
+    WON,
+    LOST,
+    TIMEOUT
+};
+
+// One line, or a whole WHILE loop
+struct Move {
+    std::vector<std::string> lines;
+    int unit = -1; // acting unit for a single action, -1 for a loop
+    size_t action = 0;
+    int target = -1;
+};
+
+struct Node {
+    Battle::Snapshot snapshot;
+    float time = 0.f; // game time so far, as the game would show it
+    uint64_t hash = 0;
+};
+
+static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static uint64_t floatBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Plays the moves the search picks: single actions through decide(), loops statement by statement
+struct Script : Battle::Controller {
+    bool has_action = false;
+    Battle::Decision action;
+    Compiler::Executable* loop = nullptr;
+    Compiler::Statement* loop_next = nullptr;
+    bool ending = false; // the program has no more lines
+
+    Script(Compiler* compiler) : Controller(compiler) {}
+
+    bool decide(Battle& battle, Battle::Decision* out) override {
+        if (!has_action) {
+            return false;
+        }
+        *out = action;
+        has_action = false;
+        return true;
+    }
+
+    Compiler::Statement* next(Battle& battle) override {
+        if (loop_next != nullptr) {
+            Compiler::Statement* statement = loop_next;
+            loop_next = nullptr;
+            return statement;
+        }
+        return Controller::next(battle);
+    }
+};
+
+// A private copy of the level for one thread
+struct Worker {
+    struct Loop {
+        Compiler::Executable* exe;
+        std::vector<Compiler::StatementState> initial;
+    };
+
+    Levels levels;
+    Compiler player_compiler;
+    Compiler enemy_compiler;
+    Battle battle;
+    Script script;
+    std::vector<Object*> units;
+    std::vector<bool> present;
+    std::unordered_map<std::string, Loop> loops;
+    std::vector<std::string> path; // lines of the program being tried
+    Node root;
+
+    // Without a program, the search chooses the player's lines through the script
+    Worker(int level, std::vector<std::string> const* program = nullptr) : script(&player_compiler) {
+        levels.createHeadless();
+        levels.setup(level, &player_compiler, &enemy_compiler);
+        for (Object* unit : levels.player_units) {
+            unit->reset();
+        }
+        for (Object* unit : levels.enemy_units[level]) {
+            unit->reset();
+        }
+        battle.player_units = levels.player_units;
+        battle.enemy_units = levels.enemy_units[level];
+        Compiler::Executable* player_exe = nullptr;
+        if (program != nullptr) {
+            player_exe = player_compiler.compile(*program);
+            if (player_exe == nullptr) {
+                throw std::runtime_error("Program does not compile: " + player_compiler.error_message);
+            }
+        } else {
+            battle.player_controller = &script;
+        }
+        Compiler::Executable* enemy_exe = enemy_compiler.compile(levels.script(level));
+        if (enemy_exe == nullptr) {
+            throw std::runtime_error("Failed to compile the enemy script of level " + std::to_string(level + 1) + ": " + enemy_compiler.error_message);
+        }
+        battle.start(player_exe, enemy_exe);
+
+        units = battle.units();
+        for (Object* unit : units) {
+            present.push_back(player_compiler.objects.count(unit->name) > 0);
+        }
+        battle.save(&root.snapshot);
+        root.hash = hash();
+    }
+
+    bool alive(size_t unit) {
+        return present[unit] && units[unit]->property(PROPERTY_ALIVE) != 0;
+    }
+
+    void load(Node const& node) {
+        script.has_action = false;
+        script.loop = nullptr;
+        script.loop_next = nullptr;
+        script.ending = false;
+        battle.load(node.snapshot);
+    }
+
+    // Run until the player needs another line or the battle is decided
+    Outcome advance(float* time, float bound) {
+        while (!battle.finished()) {
+            if (battle.turn == Battle::PLAYER && battle.player_statement == nullptr && !battle.player_done) {
+                if (script.loop != nullptr && script.loop_next == nullptr) {
+                    script.loop_next = script.loop->next();
+                    if (script.loop_next == nullptr) {
+                        script.loop = nullptr;
+                    }
+                }
+                if (script.loop == nullptr && !script.has_action && !script.ending) {
+                    return DECIDE;
+                }
+            }
+            *time += battle.pace();
+            battle.takeTurn();
+            if (*time >= bound) {
+                return TIMEOUT;
+            }
+        }
+        return battle.won ? WON : LOST;
+    }
+
+    Outcome apply(Move const& move, float* time, float bound) {
+        if (move.unit >= 0) {
+            script.action.object = units[move.unit];
+            script.action.action = move.action;
+            script.action.target = move.target >= 0 ? units[move.target] : nullptr;
+            script.has_action = true;
+        } else {
+            Loop& loop = compileLoop(move.lines);
+            loop.exe->setState(loop.initial);
+            loop.exe->current_line = 0;
+            script.loop = loop.exe;
+        }
+        return advance(time, bound);
+    }
+
+    // Let the battle play out with no more lines
+    Outcome finish(float* time, float bound) {
+        script.ending = true;
+        return advance(time, bound);
+    }
+
+    Loop& compileLoop(std::vector<std::string> const& lines) {
+        std::string key;
+        for (auto const& line : lines) {
+            key += line + "\n";
+        }
+        auto found = loops.find(key);
+        if (found != loops.end()) {
+            return found->second;
+        }
+        Loop loop;
+        loop.exe = player_compiler.compile(lines);
+        if (loop.exe == nullptr) {
+            throw std::runtime_error("Generated loop does not compile: " + player_compiler.error_message);
+        }
+        loop.exe->getState(&loop.initial);
+        return loops.emplace(key, loop).first->second;
+    }
+
+    // Every move that fits in the given number of lines from the current state
+    void moves(size_t max_lines, Options const& options, std::vector<Move>* out) {
+        out->clear();
+        if (max_lines == 0) {
+            return;
+        }
+        std::vector<Move> actions;
+        for (size_t u = 0; u < battle.player_units.size(); u++) {
+            if (!alive(u)) {
+                continue;
+            }
+            Object* unit = units[u];
+            for (size_t a = 0; a < unit->actionNames().size(); a++) {
+                std::string call = unit->name + "." + unit->actionNames()[a] + "(";
+                Move move;
+                move.unit = (int)u;
+                move.action = a;
+                if (unit->actions().at(unit->actionNames()[a]).has_target) {
+                    for (size_t t = 0; t < units.size(); t++) {
+                        if (alive(t)) {
+                            move.target = (int)t;
+                            move.lines = {call + units[t]->name + ")"};
+                            actions.push_back(move);
+                        }
+                    }
+                } else {
+                    move.lines = {call + ")"};
+                    actions.push_back(move);
+                }
+            }
+        }
+        *out = actions;
+        if (max_lines < 3 || options.loop_body == 0) {
+            return;
+        }
+
+        // Loop while TRUE, or while some property of a player unit is still positive
+        std::vector<std::string> conditions = {"TRUE"};
+        std::vector<std::string> guards;
+        for (size_t u = 0; u < units.size(); u++) {
+            if (!alive(u)) {
+                continue;
+            }
+            for (size_t p = 0; p < units[u]->propertyCount(); p++) {
+                std::string const& name = units[u]->propertyNameAt(p);
+                std::string property = units[u]->name + "." + name;
+                bool is_max = name.size() > 4 && name.compare(name.size() - 4, 4, "_MAX") == 0;
+                if (u < battle.player_units.size() && !is_max && units[u]->property(name) > 0) {
+                    conditions.push_back(property + " > 0");
+                }
+                if (units[u]->findProperty(name + "_MAX") != nullptr) {
+                    guards.push_back(property + " < " + property + "_MAX");
+                }
+            }
+        }
+
+        // Loop bodies: actions, optionally each behind an IF
+        std::vector<std::vector<std::string>> elements;
+        for (auto const& action : actions) {
+            elements.push_back({"  " + action.lines[0]});
+        }
+        if (options.guards) {
+            for (auto const& guard : guards) {
+                for (auto const& action : actions) {
+                    elements.push_back({"  IF (" + guard + ")", "    " + action.lines[0], "  END"});
+                }
+            }
+        }
+        std::vector<std::vector<std::string>> bodies;
+        std::vector<std::string> body;
+        std::function<void(size_t)> extend = [&](size_t count) {
+            if (count > 0) {
+                bodies.push_back(body);
+            }
+            if (count == options.loop_body) {
+                return;
+            }
+            for (auto const& element : elements) {
+                if (body.size() + element.size() + 2 > max_lines) {
+                    continue;
+                }
+                body.insert(body.end(), element.begin(), element.end());
+                extend(count + 1);
+                body.resize(body.size() - element.size());
+            }
+        };
+        extend(0);
+
+        for (auto const& condition : conditions) {
+            for (auto const& loop_body : bodies) {
+                Move move;
+                move.lines.push_back("WHILE (" + condition + ")");
+                move.lines.insert(move.lines.end(), loop_body.begin(), loop_body.end());
+                move.lines.push_back("END");
+                out->push_back(move);
+            }
+        }
+    }
+
+    // Identifies the battle state: unit properties, the enemy program's position, and the scheduler.
+    // Properties are summed so their order does not matter, and 0 counts the same as missing.
+    uint64_t hash() {
+        uint64_t hash = 0;
+        std::hash<std::string> hash_string;
+        for (size_t u = 0; u < units.size(); u++) {
+            for (size_t p = 0; p < units[u]->propertyCount(); p++) {
+                int value = units[u]->propertyAt(p);
+                if (value != 0) {
+                    hash += mix(mix(hash_string(units[u]->propertyNameAt(p)) + u) + (uint32_t)value);
+                }
+            }
+        }
+        auto add = [&](uint64_t value) {
+            hash = mix(hash ^ value);
+        };
+        add(battle.turn);
+        add(floatBits(battle.player_time));
+        add(floatBits(battle.enemy_time));
+        add(battle.player_done);
+        add(battle.enemy_done);
+        if (battle.enemy_exe != nullptr) {
+            std::vector<Compiler::StatementState> state;
+            battle.enemy_exe->getState(&state);
+            add(battle.enemy_exe->current_line);
+            for (auto const& statement : state) {
+                add(statement.current_line);
+                add(floatBits(statement.duration));
+                add(statement.truth);
+            }
+            std::vector<Compiler::Statement*> flat = battle.enemy_exe->flatten();
+            add(std::find(flat.begin(), flat.end(), battle.enemy_statement) - flat.begin());
+        }
+        return hash;
+    }
+};
+
+// States already searched, with the fewest lines and least game time they were reached in
+struct TranspositionTable {
+    struct Entry {
+        size_t lines;
+        float time;
+    };
+    static const size_t SHARDS = 64;
+    std::unordered_map<uint64_t, Entry> shards[SHARDS];
+    std::mutex mutexes[SHARDS];
+
+    // Returns false if the state was already reached at least as early
+    bool visit(uint64_t hash, size_t lines, float time) {
+        size_t shard = hash % SHARDS;
+        std::lock_guard<std::mutex> lock(mutexes[shard]);
+        auto found = shards[shard].find(hash);
+        if (found != shards[shard].end()) {
+            if (found->second.lines <= lines && found->second.time <= time) {
+                return false;
+            }
+            found->second.lines = std::min(found->second.lines, lines);
+            found->second.time = std::min(found->second.time, time);
+            return true;
+        }
+        shards[shard].emplace(hash, Entry{lines, time});
+        return true;
+    }
+
+    void clear() {
+        for (size_t s = 0; s < SHARDS; s++) {
+            shards[s].clear();
+        }
+    }
+};
+
+struct Solver {
+    Options const& options;
+    ThreadPool& pool;
+    std::vector<Worker*> workers;
+    TranspositionTable table;
+
+    std::mutex best_mutex;
+    bool found = false;
+    std::vector<std::string> best_lines;
+    float best_time = 0.f;
+    std::atomic<float> bound;
+
+    Clock::time_point deadline;
+    std::atomic<bool> timed_out{false};
+    std::atomic<size_t> nodes{0};
+
+    Solver(int level, Options const& options, ThreadPool& pool) : options(options), pool(pool), bound(options.max_game_time) {
+        for (size_t w = 0; w < pool.size(); w++) {
+            workers.push_back(new Worker(level));
+        }
+    }
+
+    ~Solver() {
+        for (Worker* worker : workers) {
+            delete worker;
+        }
+    }
+
+    void report(std::vector<std::string> const& lines, float time) {
+        std::lock_guard<std::mutex> lock(best_mutex);
+        bool better;
+        if (!found) {
+            better = true;
+        } else if (options.fastest) {
+            better = time < best_time || (time == best_time && lines.size() < best_lines.size());
+        } else {
+            better = lines.size() < best_lines.size() || (lines.size() == best_lines.size() && time < best_time);
+        }
+        if (better) {
+            found = true;
+            best_lines = lines;
+            best_time = time;
+            bound = time;
+        }
+    }
+
+    bool stopped() {
+        if (!timed_out && Clock::now() > deadline) {
+            timed_out = true;
+        }
+        return timed_out;
+    }
+
+    // Follow one move from a loaded node, then search on from where it leaves the battle
+    void step(Worker& worker, Node const& node, Move const& move, size_t lines, size_t max_lines) {
+        Node child;
+        child.time = node.time;
+        Outcome outcome = worker.apply(move, &child.time, bound);
+        worker.path.insert(worker.path.end(), move.lines.begin(), move.lines.end());
+        if (outcome == WON) {
+            report(worker.path, child.time);
+        } else if (outcome == DECIDE) {
+            worker.battle.save(&child.snapshot);
+            child.hash = worker.hash();
+            search(worker, child, lines + move.lines.size(), max_lines);
+        }
+        worker.path.resize(worker.path.size() - move.lines.size());
+    }
+
+    void search(Worker& worker, Node const& node, size_t lines, size_t max_lines) {
+        nodes++;
+        if (stopped() || node.time >= bound || !table.visit(node.hash, lines, node.time)) {
+            return;
+        }
+        // When deepening, shorter programs were already tried in earlier passes
+        if (lines > 0 && (options.fastest || lines == max_lines)) {
+            worker.load(node);
+            float time = node.time;
+            if (worker.finish(&time, bound) == WON) {
+                report(worker.path, time);
+            }
+        }
+        if (lines == max_lines) {
+            return;
+        }
+        worker.load(node);
+        std::vector<Move> moves;
+        worker.moves(max_lines - lines, options, &moves);
+        for (auto const& move : moves) {
+            worker.load(node);
+            step(worker, node, move, lines, max_lines);
+        }
+    }
+
+    // The first moves are split between the threads
+    void searchRoot(size_t max_lines) {
+        table.clear();
+        Worker& first = *workers[0];
+        first.load(first.root);
+        std::vector<Move> moves;
+        first.moves(max_lines, options, &moves);
+        pool.run(moves.size(), [&](size_t job, size_t w) {
+            Worker& worker = *workers[w];
+            if (stopped()) {
+                return;
+            }
+            worker.load(worker.root);
+            step(worker, worker.root, moves[job], 0, max_lines);
+        });
+    }
+
+    // Run the best program the way the game would, as a check on the search
+    bool verify(int level) {
+        Worker check(level, &best_lines);
+        float time = 0.f;
+        return check.finish(&time, options.max_game_time) == WON && std::abs(time - best_time) < 0.001f;
+    }
+
+    void solve() {
+        deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(options.time_limit));
+        if (options.fastest) {
+            searchRoot(options.max_lines);
+            return;
+        }
+        for (size_t max_lines = 1; max_lines <= options.max_lines && !timed_out; max_lines++) {
+            searchRoot(max_lines);
+            if (found) {
+                break;
+            }
+        }
+    }
+};
+
+static void usage(char const* name) {
+    std::cerr << "Usage: " << name << " (LEVEL | --all) [options]\n"
+              << "  --max-lines N       longest program to try (default 5)\n"
+              << "  --loop-body N       most actions inside a WHILE loop (default 1, 0 for no loops)\n"
+              << "  --guards            also put actions behind IF (X.P < X.P_MAX) inside loops\n"
+              << "  --fastest           minimize game time instead of program length\n"
+              << "  --max-game-time S   give up on battles longer than this (default 300)\n"
+              << "  --time-limit S      search time per level in seconds (default 60)\n"
+              << "  --threads N         worker threads (default: one per core)\n";
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    bool all = false;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("Missing value for " + arg);
+                }
+                return argv[++i];
+            };
+            if (arg == "--all") {
+                all = true;
+            } else if (arg == "--max-lines") {
+                options.max_lines = std::stoul(value());
+            } else if (arg == "--loop-body") {
+                options.loop_body = std::stoul(value());
+            } else if (arg == "--guards") {
+                options.guards = true;
+            } else if (arg == "--fastest") {
+                options.fastest = true;
+            } else if (arg == "--max-game-time") {
+                options.max_game_time = std::stof(value());
+            } else if (arg == "--time-limit") {
+                options.time_limit = std::stof(value());
+            } else if (arg == "--threads") {
+                options.threads = std::stoul(value());
+            } else if (!arg.empty() && arg[0] != '-') {
+                options.levels.push_back(std::stoi(arg) - 1);
+            } else {
+                throw std::runtime_error("Unknown option " + arg);
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+
+    Levels levels;
+    levels.createHeadless();
+    if (all) {
+        options.levels.clear();
+        for (size_t level = 0; level < levels.size(); level++) {
+            options.levels.push_back((int)level);
+        }
+    }
+    if (options.levels.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (int level : options.levels) {
+        if (level < 0 || level >= (int)levels.size()) {
+            std::cerr << "There is no level " << level + 1 << " (levels are 1 to " << levels.size() << ")" << std::endl;
+            return 1;
+        }
+    }
+
+    ThreadPool pool(options.threads);
+    size_t unsolved = 0;
+    for (int level : options.levels) {
+        auto start = Clock::now();
+        Solver solver(level, options, pool);
+        solver.solve();
+        float seconds = std::chrono::duration<float>(Clock::now() - start).count();
+
+        std::cout << "Level " << level + 1 << ": ";
+        if (!solver.found) {
+            unsolved++;
+            if (solver.timed_out) {
+                std::cout << "no winning program found within the time limit";
+            } else {
+                std::cout << "no winning program within " << options.max_lines << " lines";
+            }
+        } else {
+            std::cout << solver.best_lines.size() << " lines, " << std::fixed << std::setprecision(2) << solver.best_time << "s of game time";
+            if (solver.timed_out) {
+                std::cout << " (search cut short, may not be the best)";
+            }
+            if (!solver.verify(level)) {
+                unsolved++;
+                std::cout << " (Warning: the compiled program does not reproduce this win)";
+            }
+        }
+        std::cout << std::fixed << std::setprecision(2) << " [" << solver.nodes << " states, " << seconds << "s]" << std::endl;
+        for (auto const& line : solver.best_lines) {
+            std::cout << "    " << line << std::endl;
+        }
+    }
+    return unsolved == 0 ? 0 : 2;
+}
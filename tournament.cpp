@@ -0,0 +1,569 @@
+#include "Mirror.hpp"
+#include "Replay.hpp"
+#include "ThreadPool.hpp"
+#include "read_write_chunk.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Plays player programs against each other and keeps Elo ratings.
+// In each game one program controls the player's units and the other a mirrored copy of them
+// on the enemy side (see Mirror.hpp). A match is two games, so both programs get to move first once.
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    std::vector<std::string> files;
+    size_t swiss_rounds = 0; // 0 for round-robin
+    std::string checkpoint;
+    float checkpoint_interval = 10.f;
+    std::string out = "ladder.csv";
+    float k = 16.f;
+    float max_game_time = 600.f;
+    uint32_t seed = 0;
+    size_t threads = 0;
+};
+
+struct Entrant {
+    std::string name;
+    std::vector<std::string> lines;
+    uint32_t hash = 0;
+};
+
+// Fixed-size so the checkpoint can store it as a chunk
+struct Standing {
+    float rating = 1500.f;
+    float score = 0.f; // 1 per game won, 0.5 per game drawn, 2 per bye
+    uint32_t wins = 0;
+    uint32_t draws = 0;
+    uint32_t losses = 0;
+    uint32_t byes = 0;
+};
+static_assert(sizeof(Standing) == 24, "Standing is packed");
+
+struct Pairing {
+    uint32_t a = 0;
+    uint32_t b = 0;
+};
+static_assert(sizeof(Pairing) == 8, "Pairing is packed");
+
+// Both games of one pairing: a with the party, then b with the party
+struct MatchResult {
+    Mirror::Outcome first = Mirror::DRAW;
+    Mirror::Outcome second = Mirror::DRAW;
+};
+
+// Everything needed to carry on an interrupted tournament
+struct Checkpoint {
+    enum : uint32_t { VERSION = 1 };
+    struct Header {
+        uint32_t version = VERSION;
+        uint32_t swiss_rounds = 0;
+        uint32_t next_round = 0;
+        uint32_t entrant_count = 0;
+        uint32_t seed = 0;
+        float k = 0.f;
+        float max_game_time = 0.f;
+    };
+    static_assert(sizeof(Header) == 28, "Header is packed");
+
+    Header header;
+    std::vector<std::string> names;
+    std::vector<uint32_t> hashes;
+    std::vector<Standing> standings;
+    std::vector<Pairing> played; // Swiss only
+
+    void save(std::string const& filename) const;
+    void load(std::string const& filename);
+};
+
+// Pack strings into a single '\0'-separated buffer for write_chunk
+static std::vector<char> joinStrings(std::vector<std::string> const& strings) {
+    std::vector<char> out;
+    for (auto const& str : strings) {
+        out.insert(out.end(), str.begin(), str.end());
+        out.push_back('\0');
+    }
+    return out;
+}
+
+// Inverse of joinStrings
+static std::vector<std::string> splitStrings(std::vector<char> const& chars) {
+    std::vector<std::string> out;
+    std::string current;
+    for (char c : chars) {
+        if (c == '\0') {
+            out.push_back(current);
+            current.clear();
+        } else {
+            current.push_back(c);
+        }
+    }
+    return out;
+}
+
+// Written to a temporary file first, so an interrupted save leaves the previous checkpoint intact.
+// Throws std::runtime_error if the file cannot be written.
+void Checkpoint::save(std::string const& filename) const {
+    std::string temporary = filename + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Failed to open checkpoint '" + temporary + "' for writing");
+        }
+        write_chunk("tour", std::vector<Header>{header}, &out);
+        write_chunk("name", joinStrings(names), &out);
+        write_chunk("hash", hashes, &out);
+        write_chunk("rank", standings, &out);
+        write_chunk("pair", played, &out);
+        if (!out) {
+            throw std::runtime_error("Failed to write checkpoint '" + temporary + "'");
+        }
+    }
+    if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        throw std::runtime_error("Failed to replace checkpoint '" + filename + "'");
+    }
+}
+
+// Throws std::runtime_error if the file is malformed
+void Checkpoint::load(std::string const& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open checkpoint '" + filename + "'");
+    }
+    std::vector<Header> headers;
+    read_chunk(in, "tour", &headers);
+    if (headers.size() != 1 || headers[0].version != VERSION) {
+        throw std::runtime_error("Unsupported checkpoint version in '" + filename + "'");
+    }
+    header = headers[0];
+    std::vector<char> chars;
+    read_chunk(in, "name", &chars);
+    names = splitStrings(chars);
+    read_chunk(in, "hash", &hashes);
+    read_chunk(in, "rank", &standings);
+    read_chunk(in, "pair", &played);
+    if (names.size() != header.entrant_count || hashes.size() != header.entrant_count || standings.size() != header.entrant_count) {
+        throw std::runtime_error("Inconsistent checkpoint data in '" + filename + "'");
+    }
+}
+
+// A mirrored battle with every entrant compiled for both sides on first use.
+// Between games, units and programs are reset in place.
+struct Arena {
+    Mirror mirror;
+    std::vector<Compiler::Executable*> as_party;
+    std::vector<Compiler::Executable*> as_foe;
+    std::vector<std::vector<Compiler::StatementState>> party_initial;
+    std::vector<std::vector<Compiler::StatementState>> foe_initial;
+
+    Arena(size_t entrant_count, float max_game_time) : as_party(entrant_count, nullptr), as_foe(entrant_count, nullptr),
+                                                       party_initial(entrant_count), foe_initial(entrant_count) {
+        mirror.battle.max_game_time = max_game_time;
+    }
+
+    // Returns nullptr with the compiler's error message if the program does not compile
+    Compiler::Executable* program(std::vector<Entrant> const& entrants, size_t entrant, bool foe) {
+        auto& exes = foe ? as_foe : as_party;
+        if (exes[entrant] == nullptr) {
+            Compiler& compiler = foe ? mirror.foe_compiler : mirror.party_compiler;
+            exes[entrant] = compiler.compile(entrants[entrant].lines);
+            if (exes[entrant] != nullptr) {
+                exes[entrant]->getState(foe ? &foe_initial[entrant] : &party_initial[entrant]);
+            }
+        }
+        return exes[entrant];
+    }
+
+    Mirror::Outcome play(std::vector<Entrant> const& entrants, size_t a, size_t b, uint32_t seed) {
+        Compiler::Executable* party_exe = program(entrants, a, false);
+        Compiler::Executable* foe_exe = program(entrants, b, true);
+        party_exe->setState(party_initial[a]);
+        party_exe->current_line = 0;
+        foe_exe->setState(foe_initial[b]);
+        foe_exe->current_line = 0;
+        mirror.start(party_exe, foe_exe, seed);
+        return mirror.finish();
+    }
+};
+
+static std::vector<std::string> readLines(std::string const& filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        throw std::runtime_error("Failed to open '" + filename + "'");
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// File name without directory or extension
+static std::string entrantName(std::string const& filename) {
+    size_t slash = filename.find_last_of("/\\");
+    std::string name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+static uint64_t pairKey(uint32_t a, uint32_t b) {
+    return ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+}
+
+// Circle method: with an even count m, round r pairs position i with position m-1-i,
+// position 0 staying put while the rest rotate. An odd field gets a sitting-out slot.
+static std::vector<Pairing> roundRobinRound(size_t count, size_t round) {
+    size_t m = count + (count % 2);
+    auto position = [&](size_t i) {
+        return i == 0 ? 0 : 1 + (i - 1 + round) % (m - 1);
+    };
+    std::vector<Pairing> pairings;
+    for (size_t i = 0; i < m / 2; i++) {
+        size_t a = position(i);
+        size_t b = position(m - 1 - i);
+        if (a < count && b < count) {
+            // Alternate who moves first in the first game of the pair
+            if (round % 2) {
+                std::swap(a, b);
+            }
+            pairings.push_back(Pairing{(uint32_t)a, (uint32_t)b});
+        }
+    }
+    return pairings;
+}
+
+// Pair neighbours in the standings, avoiding rematches where possible.
+// With an odd field the lowest-placed entrant without a bye so far sits out and scores a bye.
+static std::vector<Pairing> swissRound(std::vector<Standing>& standings, std::unordered_set<uint64_t> const& played) {
+    std::vector<uint32_t> order(standings.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = (uint32_t)i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        if (standings[a].score != standings[b].score) {
+            return standings[a].score > standings[b].score;
+        }
+        return standings[a].rating > standings[b].rating;
+    });
+
+    std::vector<bool> paired(standings.size(), false);
+    if (order.size() % 2) {
+        uint32_t bye = order.back();
+        uint32_t fewest = standings[bye].byes;
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            if (standings[*it].byes < fewest) {
+                bye = *it;
+                fewest = standings[*it].byes;
+            }
+        }
+        paired[bye] = true;
+        standings[bye].byes++;
+        standings[bye].score += 2.f;
+    }
+
+    std::vector<Pairing> pairings;
+    for (size_t i = 0; i < order.size(); i++) {
+        uint32_t a = order[i];
+        if (paired[a]) {
+            continue;
+        }
+        size_t fallback = order.size();
+        size_t chosen = order.size();
+        for (size_t j = i + 1; j < order.size(); j++) {
+            if (paired[order[j]]) {
+                continue;
+            }
+            if (fallback == order.size()) {
+                fallback = j;
+            }
+            if (played.count(pairKey(a, order[j])) == 0) {
+                chosen = j;
+                break;
+            }
+        }
+        if (chosen == order.size()) {
+            chosen = fallback;
+        }
+        if (chosen == order.size()) {
+            break;
+        }
+        paired[a] = true;
+        paired[order[chosen]] = true;
+        pairings.push_back(Pairing{a, order[chosen]});
+    }
+    return pairings;
+}
+
+static void updateElo(Standing& a, Standing& b, float score_a, float k) {
+    float expected = 1.f / (1.f + std::pow(10.f, (b.rating - a.rating) / 400.f));
+    a.rating += k * (score_a - expected);
+    b.rating -= k * (score_a - expected);
+}
+
+static void record(Standing& party, Standing& foe, Mirror::Outcome result, float k) {
+    if (result == Mirror::PARTY_WON) {
+        party.wins++;
+        party.score += 1.f;
+        foe.losses++;
+        updateElo(party, foe, 1.f, k);
+    } else if (result == Mirror::FOE_WON) {
+        foe.wins++;
+        foe.score += 1.f;
+        party.losses++;
+        updateElo(party, foe, 0.f, k);
+    } else {
+        party.draws++;
+        foe.draws++;
+        party.score += 0.5f;
+        foe.score += 0.5f;
+        updateElo(party, foe, 0.5f, k);
+    }
+}
+
+// Depends only on the tournament seed and who plays whom, so results do not depend on scheduling
+static uint32_t gameSeed(uint32_t seed, uint32_t party, uint32_t foe) {
+    uint32_t hash = seed ^ 2166136261u;
+    for (uint32_t value : {party, foe}) {
+        hash = (hash ^ value) * 16777619u;
+        hash ^= hash >> 15;
+    }
+    return hash;
+}
+
+static void usage(char const* name) {
+    std::cerr << "Usage: " << name << " [options] PROGRAM...\n"
+              << "  Each PROGRAM is a file holding one player program; its name is the file name without extension.\n"
+              << "  A program's own units are BRAWLER, CASTER, HEALER and RANGER, its opponent's FOE_BRAWLER etc.\n"
+              << "  --swiss ROUNDS            Swiss pairings for this many rounds (default: round-robin)\n"
+              << "  --checkpoint FILE         save progress here, and resume from it if it exists\n"
+              << "  --checkpoint-interval S   seconds between checkpoints (default 10)\n"
+              << "  --out FILE                final ratings as CSV (default ladder.csv)\n"
+              << "  --k K                     Elo K-factor per game (default 16)\n"
+              << "  --max-game-time S         games longer than this are draws (default 600)\n"
+              << "  --seed N                  seed for RANDOM_PLAYER/RANDOM_ENEMY targets (default 0)\n"
+              << "  --threads N               worker threads (default: one per core)\n";
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error("Missing value for " + arg);
+                }
+                return argv[++i];
+            };
+            if (arg == "--swiss") {
+                options.swiss_rounds = std::max<size_t>(1, std::stoul(value()));
+            } else if (arg == "--checkpoint") {
+                options.checkpoint = value();
+            } else if (arg == "--checkpoint-interval") {
+                options.checkpoint_interval = std::stof(value());
+            } else if (arg == "--out") {
+                options.out = value();
+            } else if (arg == "--k") {
+                options.k = std::stof(value());
+            } else if (arg == "--max-game-time") {
+                options.max_game_time = std::stof(value());
+            } else if (arg == "--seed") {
+                options.seed = (uint32_t)std::stoul(value());
+            } else if (arg == "--threads") {
+                options.threads = std::stoul(value());
+            } else if (!arg.empty() && arg[0] != '-') {
+                options.files.push_back(arg);
+            } else {
+                throw std::runtime_error("Unknown option " + arg);
+            }
+        }
+        if (options.files.size() < 2) {
+            throw std::runtime_error("Need at least two programs");
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Programs that do not compile are left out before anything is scheduled
+    std::vector<Entrant> entrants;
+    {
+        std::vector<Entrant> candidates;
+        try {
+            for (auto const& file : options.files) {
+                Entrant entrant;
+                entrant.name = entrantName(file);
+                entrant.lines = readLines(file);
+                entrant.hash = Replay::hashProgram(entrant.lines);
+                for (auto const& other : candidates) {
+                    if (other.name == entrant.name) {
+                        throw std::runtime_error("Two programs are named '" + entrant.name + "'");
+                    }
+                }
+                candidates.push_back(entrant);
+            }
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        Arena check(candidates.size(), options.max_game_time);
+        for (size_t e = 0; e < candidates.size(); e++) {
+            if (check.program(candidates, e, false) == nullptr) {
+                std::cout << "Warning: leaving out " << candidates[e].name << ", which does not compile: " << check.mirror.party_compiler.error_message << std::endl;
+            } else {
+                entrants.push_back(candidates[e]);
+            }
+        }
+    }
+    if (entrants.size() < 2) {
+        std::cerr << "Fewer than two programs compile" << std::endl;
+        return 1;
+    }
+
+    Checkpoint state;
+    state.header.swiss_rounds = (uint32_t)options.swiss_rounds;
+    state.header.entrant_count = (uint32_t)entrants.size();
+    state.header.seed = options.seed;
+    state.header.k = options.k;
+    state.header.max_game_time = options.max_game_time;
+    for (auto const& entrant : entrants) {
+        state.names.push_back(entrant.name);
+        state.hashes.push_back(entrant.hash);
+    }
+    state.standings.resize(entrants.size());
+
+    if (!options.checkpoint.empty() && std::ifstream(options.checkpoint)) {
+        Checkpoint saved;
+        try {
+            saved.load(options.checkpoint);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        Checkpoint::Header expected = state.header;
+        if (saved.header.swiss_rounds != expected.swiss_rounds || saved.header.entrant_count != expected.entrant_count
+         || saved.header.seed != expected.seed || saved.header.k != expected.k || saved.header.max_game_time != expected.max_game_time
+         || saved.names != state.names || saved.hashes != state.hashes) {
+            std::cerr << "Checkpoint '" << options.checkpoint << "' is from a different tournament; remove it to start over" << std::endl;
+            return 1;
+        }
+        state = saved;
+        std::cout << "Resuming after round " << state.header.next_round << std::endl;
+    }
+
+    size_t rounds = options.swiss_rounds > 0 ? options.swiss_rounds : entrants.size() - 1 + (entrants.size() % 2);
+    std::unordered_set<uint64_t> played;
+    for (Pairing const& pairing : state.played) {
+        played.insert(pairKey(pairing.a, pairing.b));
+    }
+
+    ThreadPool pool(options.threads);
+    std::vector<Arena*> arenas;
+    for (size_t w = 0; w < pool.size(); w++) {
+        arenas.push_back(new Arena(entrants.size(), options.max_game_time));
+    }
+
+    std::cout << entrants.size() << " programs, " << rounds << (options.swiss_rounds > 0 ? " Swiss" : " round-robin")
+              << " rounds on " << pool.size() << " threads" << std::endl;
+
+    auto save = [&]() {
+        if (options.checkpoint.empty()) {
+            return true;
+        }
+        try {
+            state.save(options.checkpoint);
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return false;
+        }
+        return true;
+    };
+
+    auto start = Clock::now();
+    auto last_save = start;
+    size_t games = 0;
+    std::vector<MatchResult> results;
+    for (size_t round = state.header.next_round; round < rounds; round++) {
+        std::vector<Pairing> pairings = options.swiss_rounds > 0 ? swissRound(state.standings, played) : roundRobinRound(entrants.size(), round);
+        results.assign(pairings.size(), MatchResult());
+        pool.run(pairings.size(), [&](size_t job, size_t worker) {
+            Arena& arena = *arenas[worker];
+            Pairing const& pairing = pairings[job];
+            results[job].first = arena.play(entrants, pairing.a, pairing.b, gameSeed(options.seed, pairing.a, pairing.b));
+            results[job].second = arena.play(entrants, pairing.b, pairing.a, gameSeed(options.seed, pairing.b, pairing.a));
+        });
+
+        // Ratings are updated in pairing order, so they do not depend on the thread count
+        for (size_t p = 0; p < pairings.size(); p++) {
+            Standing& a = state.standings[pairings[p].a];
+            Standing& b = state.standings[pairings[p].b];
+            record(a, b, results[p].first, options.k);
+            record(b, a, results[p].second, options.k);
+            if (options.swiss_rounds > 0) {
+                played.insert(pairKey(pairings[p].a, pairings[p].b));
+                state.played.push_back(pairings[p]);
+            }
+        }
+        games += pairings.size() * 2;
+        state.header.next_round = (uint32_t)round + 1;
+
+        auto now = Clock::now();
+        if (std::chrono::duration<float>(now - last_save).count() >= options.checkpoint_interval) {
+            if (!save()) {
+                return 1;
+            }
+            last_save = now;
+            std::cout << "Round " << round + 1 << "/" << rounds << std::endl;
+        }
+    }
+    if (!save()) {
+        return 1;
+    }
+    float seconds = std::chrono::duration<float>(Clock::now() - start).count();
+    std::cout << std::fixed << std::setprecision(2) << games << " games in " << seconds << "s, "
+              << (size_t)(games / std::max(seconds, 0.001f)) << " games/s" << std::endl;
+
+    std::vector<size_t> order(entrants.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return state.standings[a].rating > state.standings[b].rating;
+    });
+    std::ofstream out(options.out);
+    if (!out) {
+        std::cerr << "Failed to open '" << options.out << "' for writing" << std::endl;
+        return 1;
+    }
+    out << std::fixed << "rank,program,rating,score,wins,draws,losses,byes\n";
+    for (size_t r = 0; r < order.size(); r++) {
+        Standing const& standing = state.standings[order[r]];
+        out << r + 1 << "," << entrants[order[r]].name << "," << std::setprecision(1) << standing.rating << "," << standing.score << ","
+            << standing.wins << "," << standing.draws << "," << standing.losses << "," << standing.byes << "\n";
+        if (r < 10) {
+            std::cout << std::setw(4) << r + 1 << "  " << std::setw(7) << standing.rating << "  " << entrants[order[r]].name << std::endl;
+        }
+    }
+    std::cout << "Wrote " << options.out << std::endl;
+
+    for (Arena* arena : arenas) {
+        delete arena;
+    }
+    return 0;
+}